@@ -32,6 +32,34 @@ freely, subject to the following restrictions:
 
 #include "SDL_bgi.h"
 
+#include <sys/stat.h>  // for stat()
+#include <stdarg.h>    // for record_call()
+
+#if defined (__unix__) || defined (__APPLE__)
+#include <fcntl.h>     // for open()
+#include <unistd.h>    // for close()
+#include <sys/mman.h>  // for mmap(), shm_open()
+#include <errno.h>     // for errno
+#include <poll.h>      // for poll()
+#include <sys/socket.h>
+#include <sys/un.h>    // for sockaddr_un
+#include <netinet/in.h>
+#include <arpa/inet.h> // for inet_addr()
+#define BGI_HAVE_MMAP
+#define BGI_HAVE_SOCKETS
+#endif
+
+#if defined (__SSE2__) || defined (_M_X64) || \
+  (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h> // for the SSE2 kernels
+#define BGI_HAVE_SSE2
+#endif
+
+#if defined (__AVX2__)
+#include <immintrin.h> // for the AVX2 kernels
+#define BGI_HAVE_AVX2
+#endif
+
 // stuff gets drawn here; these variables are available to the programmer.
 // All the rest is hidden.
 
@@ -45,6 +73,25 @@ static SDL_Window   *bgi_win[NUM_BGI_WIN];
 static SDL_Renderer *bgi_rnd[NUM_BGI_WIN];
 static SDL_Texture  *bgi_txt[NUM_BGI_WIN];
 
+// how pages are presented: renderer and streaming texture, or
+// window surface. With the latter, page 0 may be the window surface
+// itself ('aliased'), so that nothing needs to be copied.
+
+static int
+  bgi_backend = RENDERER_BACKEND, // backend for new windows
+  bgi_win_backend[NUM_BGI_WIN];   // backend of each window
+
+static Uint32
+  *bgi_win_alias[NUM_BGI_WIN];    // window surface pixels used as page 0
+
+// pages are stored in rows, or in tiles of PAGE_TILE x PAGE_TILE
+// pixels, see setpagelayout ()
+
+#define PAGE_TILE 32
+
+static int
+  bgi_win_layout[NUM_BGI_WIN];    // LAYOUT_ROWS or LAYOUT_TILES
+
 static short int
   current_window = -1, // id of current window
   num_windows = 0;     // number of created windows
@@ -71,9 +118,10 @@ static Uint32
 
 // This is how we draw stuff on the screen. Pixels pointed to by
 // bgi_activepage (a pointer to pixel data in the active surface)
-// are modified by functions like putpixel_copy(); bgi_texture is
-// updated with the new bgi_activepage contents; bgi_texture is then
-// copied to bgi_renderer, and finally bgi_renderer is made present.
+// are modified, through the default context, by functions like
+// putpixel_copy(); bgi_texture is updated with the new
+// bgi_activepage contents; bgi_texture is then copied to
+// bgi_renderer, and finally bgi_renderer is made present.
 
 // The palette contains the BGI colors, entries 0:MAXCOLORS;
 // then three entries for temporary fg, bg, and fill ARGB colors
@@ -82,9 +130,6 @@ static Uint32
 #define BGI_COLORS  MAXCOLORS + 1
 #define TMP_COLORS  3
 
-static Uint32
-  palette[BGI_COLORS + TMP_COLORS + PALETTE_SIZE]; // all colors
-
 static Uint32
   bgi_palette[1 + MAXCOLORS] = { // 0 - 15
     // ARGB
@@ -107,15 +152,33 @@ static Uint32
   };
 
 static Uint16
-  line_patterns[1 + USERBIT_LINE] =
+  bgi_line_patterns[1 + USERBIT_LINE] =
   {0xffff,  // SOLID_LINE  = 1111111111111111
    0xcccc,  // DOTTED_LINE = 1100110011001100
    0xf1f8,  // CENTER_LINE = 1111000111111000
    0xf8f8,  // DASHED_LINE = 1111100011111000
    0xffff}; // USERBIT_LINE
 
+// These are setfillpattern-compatible arrays for the tiling patterns.
+// Taken from TurboC, http://www.sandroid.org/TurboC/
+
+static Uint8 bgi_fill_patterns[1 + USER_FILL][8] = {
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // EMPTY_FILL
+  {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, // SOLID_FILL
+  {0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00}, // LINE_FILL
+  {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80}, // LTSLASH_FILL
+  {0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x81}, // SLASH_FILL
+  {0xc0, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x81}, // BKSLASH_FILL
+  {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01}, // LTBKSLASH_FILL
+  {0x22, 0x22, 0xff, 0x22, 0x22, 0x22, 0xff, 0x22}, // HATCH_FILL
+  {0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81}, // XHATCH_FILL
+  {0x11, 0x44, 0x11, 0x44, 0x11, 0x44, 0x11, 0x44}, // INTERLEAVE_FILL
+  {0x10, 0x00, 0x01, 0x00, 0x10, 0x00, 0x01, 0x00}, // WIDE_DOT_FILL
+  {0x11, 0x00, 0x44, 0x00, 0x11, 0x00, 0x44, 0x00}, // CLOSE_DOT_FILL
+  {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}  // USER_FILL
+};
+
 static Uint32
-  bgi_tmp_color_argb,     // temporary color set up by COLOR()
   window_flags = 0;       // window flags
 
 static int
@@ -123,22 +186,15 @@ static int
     SDL_WINDOWPOS_CENTERED,
   window_y =
     SDL_WINDOWPOS_CENTERED,
-  bgi_fg_color = WHITE,   // index of BGI foreground color
-  bgi_bg_color = BLACK,   // index of BGI background color
-  bgi_fill_color = WHITE, // index of BGI fill color
   bgi_mouse_x,            // coordinates of last mouse click
   bgi_mouse_y,
   bgi_font_width = 8,     // default font width and height
   bgi_font_height = 8,
   bgi_fast_mode = 1,      // needs screen update?
   bgi_last_event = 0,     // mouse click, keyboard event, or QUIT
-  bgi_cp_x = 0,           // current position
-  bgi_cp_y = 0,
-  bgi_maxx,               // screen size
-  bgi_maxy,
+  bgi_win_maxx[NUM_BGI_WIN], // size of each window
+  bgi_win_maxy[NUM_BGI_WIN],
   bgi_gm,                 // graphics mode
-  bgi_argb_mode = NOPE,   // BGI or ARGB colors
-  bgi_writemode,          // plotting method (COPY_PUT, XOR_PUT...)
   bgi_blendmode =
     SDL_BLENDMODE_BLEND,  // blending mode
   bgi_ap,                 // active page number
@@ -151,6 +207,85 @@ static int
 static SDL_mutex
   *update_mutex = NULL;
 
+// present limiter for slow mode: damage accumulated since the
+// last present, flushed at most once per display refresh
+
+static int
+  bgi_present_limit = NOPE,   // limiter active?
+  bgi_damage_x1 = 0,          // pending damage; empty if x2 < 0
+  bgi_damage_y1 = 0,
+  bgi_damage_x2 = -1,
+  bgi_damage_y2 = -1;
+
+static Uint32
+  bgi_present_interval = 0,   // ms between presents
+  bgi_last_present = 0;       // ticks of the last present
+
+static SDL_TimerID
+  bgi_damage_timer = 0;       // pending flush, if any
+
+// page flipping
+
+static int
+  bgi_vsync = NOPE;           // swapbuffers() waits for vsync?
+
+static Uint32
+  bgi_last_flip = 0;          // ticks of the last swapbuffers()
+
+// pages exported to other processes, see setsharedpages ()
+
+static char
+  bgi_shm_name[256] = "";     // shared memory object, if any
+static bgi_shm_header
+  *bgi_shm = NULL;            // its mapping
+static size_t
+  bgi_shm_size = 0;
+static int
+  bgi_shm_window = -1;        // window whose pages are shared
+
+// frame server, see startframeserver ()
+
+#define SERVE_MAX_CLIENTS 8
+
+typedef struct {
+  int
+    fd,                       // -1 if the slot is free
+    keyframe,                 // next frame is sent whole?
+    x1, y1, x2, y2,           // damage not sent yet; empty if x2 < 0
+    in_len;
+  Uint32
+    *shadow;                  // frame as the client has it
+  Uint8
+    in[16],                   // partial input message
+    *out;                     // encoded data not sent yet
+  size_t
+    out_pos,
+    out_len,
+    out_size;
+} ServeClient;
+
+static SDL_SpinLock
+  bgi_serve_lock;             // protects the pending damage
+static SDL_Thread
+  *bgi_serve_thread = NULL;
+static int
+  bgi_serve_running = NOPE,
+  bgi_serve_fd = -1,          // listening socket
+  bgi_serve_wake[2] = {-1, -1}, // pipe that wakes up the thread
+  bgi_serve_window = -1,      // window being served
+  bgi_serve_w,
+  bgi_serve_h,
+  bgi_serve_x1, bgi_serve_y1,
+  bgi_serve_x2 = -1, bgi_serve_y2 = -1; // pending damage
+static Uint32
+  *bgi_serve_frame = NULL,    // the window as last presented
+  bgi_serve_window_id,
+  bgi_serve_seq = 0;
+static char
+  bgi_serve_path[256];
+static ServeClient
+  bgi_serve_clients[SERVE_MAX_CLIENTS];
+
 // BGI window title
 char
   bgi_win_title[BGI_WINTITLE_LEN] = "SDL_bgi";
@@ -161,10 +296,6 @@ static int
   key_pressed = NOPE,
   xkey_pressed = NOPE;
 
-static float
-  bgi_font_mag_x = 1.0,  // font magnification
-  bgi_font_mag_y = 1.0;
-
 // pointer to font array. Should I add more (ugly) bitmap fonts?
 
 // 8x8 font definition
@@ -436,12 +567,450 @@ static unsigned char gfxPrimitivesFontdata[GFX_FONTDATAMAX] = {
 
 static const Uint8 *fontptr = gfxPrimitivesFontdata;
 
-static struct arccoordstype bgi_last_arc;
-static struct fillsettingstype bgi_fill_style;
-static struct linesettingstype bgi_line_style;
-static struct textsettingstype bgi_txt_style;
-static struct viewporttype vp;
-static struct palettetype pal;
+// Filled horizontal segment of scanline y for xl<=x<=xr.
+// Parent segment was on line y-dy. dy=1 or -1
+
+typedef struct {
+  int y, xl, xr, dy;
+} Segment;
+
+// max depth of stack - was 10000
+
+#define STACKSIZE 2000
+
+// horizontal span of a stroke
+
+typedef struct {
+  int y, x1, x2;
+} Span;
+
+// A context holds everything that drawing functions read or modify:
+// the target pixels, colours, styles, viewport, current position,
+// and the scratch buffers of floodfill() and of the stroking code.
+// Each thread draws on its own current context, so two threads
+// can draw at the same time as long as they use different contexts.
+// The classic BGI API works on the default context, which is bound
+// to the active page of the current window.
+
+struct bgi_context {
+  Uint32
+    *pixels,              // pixel data being drawn on
+    *buffer,              // pixel data allocated by createcontext()
+    *staging,             // rows lent by lockframebuffer(), or NULL
+    palette[BGI_COLORS + TMP_COLORS + PALETTE_SIZE]; // all colors
+  Uint16
+    line_patterns[1 + USERBIT_LINE];
+  Uint8
+    fill_patterns[1 + USER_FILL][8];
+  int
+    fg_color,             // index of BGI foreground color
+    bg_color,             // index of BGI background color
+    fill_color,           // index of BGI fill color
+    cp_x,                 // current position
+    cp_y,
+    maxx,                 // size of the target
+    maxy,
+    argb_mode,            // BGI or ARGB colors
+    writemode,            // plotting method (COPY_PUT, XOR_PUT...)
+    image_filter,         // used by readimagefile () to resize
+    ring_mode,            // RING_OFF, RING_COLUMNS or RING_ROWS
+    ring_origin,          // stored column (row) of the first one
+    layout,               // LAYOUT_TILES for tiled window pages
+    follow_page,          // made by createcontext(0, 0): draws on
+    page_window;          // the active page of this window
+  float
+    font_mag_x,           // font magnification
+    font_mag_y;
+  struct arccoordstype last_arc;
+  struct fillsettingstype fill_style;
+  struct linesettingstype line_style;
+  struct textsettingstype txt_style;
+  struct viewporttype vp;
+  struct viewporttype ring; // area of the ring, absolute
+  struct bgi_context
+    *next_layer,          // layer above this one in the window
+    *next_bitmap;         // next context made by createbitmap()
+  char
+    *layer_name;          // name of a layer, NULL otherwise
+  int
+    layer_window,         // window a layer belongs to, or -1
+    layer_z,              // stacking order, higher on top
+    layer_visible,
+    layer_opacity,        // 0..255
+    layer_mode;           // LAYER_OVER or LAYER_KEY
+  Uint32
+    layer_key;            // transparent colour for LAYER_KEY
+  size_t
+    canvas_bytes;         // size of a canvas, 0 otherwise
+  int
+    canvas_window,        // window a canvas is shown in, or -1
+    canvas_x,             // canvas pixel at the top left corner
+    canvas_y;             // of the window
+  float
+    canvas_zoom;          // window pixels per canvas pixel
+  struct palettetype pal;
+  Segment
+    stack[STACKSIZE],     // stack of filled segments
+    *sp;
+  Span
+    *stroke_span;         // spans of the current stroke
+  int
+    stroke_nspans,        // # of spans in the current stroke
+    stroke_maxspans;      // # of allocated spans
+  struct bgi_snapshot
+    *snap;                // latest snapshot of the target, or NULL
+  const Uint32
+    *snap_pixels;         // pixels 'snap' was looked up for
+  int
+    snap_gen;             // bgi_snap_gen when it was looked up
+};
+
+// the current context is looked up on every pixel: with GCC and
+// clang, avoid the slow general-dynamic TLS model in shared objects
+
+#if defined (_MSC_VER)
+#define BGI_THREAD_LOCAL __declspec(thread)
+#elif defined (__GNUC__)
+#define BGI_THREAD_LOCAL \
+  __thread __attribute__ ((tls_model ("initial-exec")))
+#else
+#define BGI_THREAD_LOCAL _Thread_local
+#endif
+
+static struct bgi_context
+  bgi_default_ctx;        // used by the classic API
+
+static BGI_THREAD_LOCAL struct bgi_context
+  *bgi_ctx = &bgi_default_ctx; // current context of this thread
+
+static struct bgi_context
+  *bgi_layers[NUM_BGI_WIN],    // layers of each window, by z
+  *bgi_canvas[NUM_BGI_WIN];    // canvas shown in each window
+
+// offscreen bitmaps are contexts whose buffer starts with the
+// width and height words of a getimage () bitmap
+
+static SDL_SpinLock
+  bgi_bitmap_lock;             // protects the following
+static struct bgi_context
+  *bgi_bitmaps = NULL;
+
+// snapshots of a target are kept in tiles, shared between
+// snapshots while they do not change; see snapshotpage ()
+
+#define SNAP_TILE 64
+
+typedef struct SnapTile {
+  int refs;                     // snapshots sharing it
+  Uint32 pixels[];              // rows of the tile, in a row
+} SnapTile;
+
+struct bgi_snapshot {
+  const Uint32 *target;         // pixels it was taken from
+  int width, height;            // size of the target
+  int tiles_x, tiles_y;
+  SnapTile **tile;              // tiles_x * tiles_y, by rows
+  Uint8 *dirty;                 // tiles drawn on since; only in the
+                                // latest snapshot of the target
+  struct bgi_snapshot *next;    // older snapshot
+};
+
+static SDL_SpinLock
+  bgi_snap_lock;               // protects the following
+static struct bgi_snapshot
+  *bgi_snapshots = NULL;       // newest first
+static int
+  bgi_snap_gen = 1;            // changes when a 'dirty' map moves
+
+// sprites are bitmaps shown over a window, never drawn on a page
+
+typedef struct Sprite {
+  Uint32 *pixels;               // w x h ARGB
+  int w, h;
+  int x, y;                     // position in the window
+  int z;                        // stacking order, higher on top
+  int window;                   // window it is shown on, or -1
+  int visible;
+  int mode;                     // LAYER_OVER or LAYER_KEY
+  Uint32 key;                   // transparent colour for LAYER_KEY
+  struct Sprite *next;          // sprite above this one
+} Sprite;
+
+static Sprite
+  **bgi_sprites = NULL,        // all sprites, by id
+  *bgi_sprite_list[NUM_BGI_WIN]; // sprites of each window, by z
+static int
+  bgi_nsprites = 0;            // size of bgi_sprites
+
+// COLOR() is evaluated as an argument, so the temporary colour
+// it sets up belongs to the calling thread, not to a context
+
+static BGI_THREAD_LOCAL Uint32
+  bgi_tmp_color_argb;
+
+// runs 'call' on context 'c' instead of the current one
+
+#define CTX_CALL(c, call)                   \
+  do {                                      \
+    struct bgi_context *old_ctx = bgi_ctx;  \
+    bgi_ctx = (c);                          \
+    follow_active_page (bgi_ctx);           \
+    call;                                   \
+    bgi_ctx = old_ctx;                      \
+  } while (0)
+
+// readimagefile () keeps decoded bitmaps, converted to opaque
+// ARGB8888, in a cache shared by all threads. Entries are keyed by
+// path, modification time and size, and the least recently used
+// ones are evicted when the cache exceeds its budget. An entry that
+// is being drawn from ('refs' > 0) is never freed under the reader;
+// if it is dropped from the cache, the last reader frees it.
+
+#define IMAGE_CACHE_MB 32         // default budget, megabytes
+#define IMAGE_MMAP_MIN (1 << 20)  // map files at least this large
+
+typedef struct ImageEntry {
+  char *path;
+  time_t mtime;
+  long size;                    // file size
+  SDL_Surface *surface;         // decoded bitmap
+  size_t bytes;                 // memory used by the surface
+  Uint64 stamp;                 // last use
+  int refs;                     // readers drawing from it
+  int cached;                   // still in the cache?
+  struct ImageEntry *next;
+} ImageEntry;
+
+static SDL_SpinLock
+  bgi_image_lock;               // protects the following
+static ImageEntry
+  *bgi_image_cache = NULL;
+static size_t
+  bgi_image_bytes = 0,          // memory used by the cache
+  bgi_image_budget = (size_t) IMAGE_CACHE_MB << 20;
+static Uint64
+  bgi_image_clock = 0;
+
+// worker pool, see run_tasks ()
+
+#define MAX_WORKERS 64
+
+#define PROGRESS_MS 40
+
+typedef void (*bgi_task) (void *, int);
+typedef void (*bgi_progress) (void *);
+
+static SDL_SpinLock
+  bgi_pool_lock;                // protects pool startup
+static SDL_mutex
+  *bgi_pool_mutex = NULL;       // protects bgi_job
+static SDL_cond
+  *bgi_pool_cond = NULL;        // bgi_job has changed
+static SDL_Thread
+  *bgi_pool_thread[MAX_WORKERS];
+static int
+  bgi_pool_size = 0;            // number of worker threads
+
+static struct {
+  bgi_task fn;                  // NULL if no job is running
+  void *arg;
+  int ntasks;
+  int next;                     // next task to be started
+  int running;                  // tasks not finished yet
+  int quit;                     // workers must exit
+} bgi_job;
+
+// tracing: if SDL_BGI_TRACE names a file, begin/end events of the
+// hot paths are appended to per-thread buffers, which need no
+// locking, and closegraph () writes them out in Chrome trace
+// format (chrome://tracing, Perfetto). Building with
+// -DSDL_BGI_NO_TRACE compiles the hooks out.
+
+#define TRACE_CHUNK 4096          // events per buffer chunk
+
+typedef struct TraceEvent {
+  const char *name;             // string literal
+  Uint64 ticks;                 // performance counter
+  char phase;                   // 'B'egin or 'E'nd
+} TraceEvent;
+
+typedef struct TraceChunk {
+  TraceEvent event[TRACE_CHUNK];
+  int n;
+  struct TraceChunk *next;
+} TraceChunk;
+
+typedef struct TraceBuffer {
+  SDL_threadID tid;
+  TraceChunk *first, *last;
+  struct TraceBuffer *next;
+} TraceBuffer;
+
+static SDL_SpinLock
+  bgi_trace_lock;               // protects the buffer list
+static TraceBuffer
+  *bgi_trace_buffers = NULL;
+static BGI_THREAD_LOCAL TraceBuffer
+  *bgi_trace_buf = NULL;        // buffer of this thread
+static char
+  *bgi_trace_file = NULL;
+static int
+  bgi_trace_on = NOPE;
+static Uint64
+  bgi_trace_start;              // ticks at initwindow ()
+
+#ifdef SDL_BGI_NO_TRACE
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#else
+#define TRACE_BEGIN(name)                         \
+  do {                                            \
+    if (bgi_trace_on)                             \
+      trace_event (name, 'B');                    \
+  } while (0)
+#define TRACE_END(name)                           \
+  do {                                            \
+    if (bgi_trace_on)                             \
+      trace_event (name, 'E');                    \
+  } while (0)
+#endif
+
+// recording: if SDL_BGI_RECORD names a file, the calls that change
+// what is drawn on the default context are logged to it, and
+// replayfile () executes them again. Calls made by the library
+// itself are not logged: RECORD () runs the call once more with
+// 'bgi_rec_busy' set, so nested calls fall through.
+//
+// File format: the 8-byte magic "BGIREC1", a Uint32 0x01020304 in
+// native byte order, then one record per call: the opcode byte and
+// the arguments listed in bgi_rec_sig[], where 'i' is an int (zigzag
+// varint), 'd' a double (8 raw bytes), and 'b' a blob (varint
+// length, then the bytes); 's' is a blob holding a string and its
+// '\0'. Blobs are arrays in native format; an empty blob stands
+// for NULL.
+
+#define REC_MAGIC "BGIREC1"
+
+enum {
+  REC_INITWINDOW = 1, REC_CLOSEGRAPH, REC_TMPCOLOR, REC_BLIT,
+  REC_ARC, REC_BAR, REC_BAR3D, REC_CIRCLE, REC_CLEARDEVICE,
+  REC_CLEARVIEWPORT, REC_DRAWPOLY, REC_ELLIPSE, REC_FILLELLIPSE,
+  REC_FILLPOLY, REC_FLOODFILL, REC_GRAPHDEFAULTS, REC_LINE,
+  REC_LINEREL, REC_LINETO, REC_MOVEREL, REC_MOVETO, REC_OUTTEXT,
+  REC_OUTTEXTXY, REC_PIESLICE, REC_PUTIMAGE, REC_PUTPIXEL,
+  REC_READIMAGEFILE, REC_RECTANGLE, REC_SECTOR, REC_SETACTIVEPAGE,
+  REC_SETALLPALETTE, REC_SETBKCOLOR, REC_SETCOLOR, REC_SETFILLPATTERN,
+  REC_SETFILLSTYLE, REC_SETLINESTYLE, REC_SETPALETTE,
+  REC_SETTEXTJUSTIFY, REC_SETTEXTSTYLE, REC_SETUSERCHARSIZE,
+  REC_SETVIEWPORT, REC_SETVISUALPAGE, REC_SETWRITEMODE, REC_COPYPAGE,
+  REC_PUTCOLORMAP, REC_PUTCOLORMAPINT, REC__PUTPIXEL,
+  REC_PUTIMAGESCALED, REC_PUTPIXELS, REC_REFRESH, REC_SDLBGIAUTO,
+  REC_SDLBGIFAST, REC_SDLBGILIMIT, REC_SDLBGISLOW, REC_SETALPHA,
+  REC_SETBKRGBCOLOR, REC_SETBLENDMODE, REC_SETIMAGEFILTER,
+  REC_SETRGBCOLOR, REC_SETRGBPALETTE, REC_SWAPBUFFERS,
+  REC_SETCURRENTWINDOW, REC_CLOSEWINDOW, REC_COPYRECT,
+  REC_SCROLLVIEWPORT, REC_SCROLLRING, REC_SETRINGVIEWPORT,
+  REC_SETPAGELAYOUT,
+  REC_LAST
+};
+
+static const char
+  *bgi_rec_sig[REC_LAST] = {
+  [REC_INITWINDOW] = "iii",     // width, height, fast mode
+  [REC_CLOSEGRAPH] = "",
+  [REC_TMPCOLOR] = "i",         // colour set up by COLOR ()
+  [REC_BLIT] = "iiiib",         // pixels written directly
+  [REC_ARC] = "iiiii",
+  [REC_BAR] = "iiii",
+  [REC_BAR3D] = "iiiiii",
+  [REC_CIRCLE] = "iii",
+  [REC_CLEARDEVICE] = "",
+  [REC_CLEARVIEWPORT] = "",
+  [REC_DRAWPOLY] = "ib",
+  [REC_ELLIPSE] = "iiiiii",
+  [REC_FILLELLIPSE] = "iiii",
+  [REC_FILLPOLY] = "ib",
+  [REC_FLOODFILL] = "iii",
+  [REC_GRAPHDEFAULTS] = "",
+  [REC_LINE] = "iiii",
+  [REC_LINEREL] = "ii",
+  [REC_LINETO] = "ii",
+  [REC_MOVEREL] = "ii",
+  [REC_MOVETO] = "ii",
+  [REC_OUTTEXT] = "s",
+  [REC_OUTTEXTXY] = "iis",
+  [REC_PIESLICE] = "iiiii",
+  [REC_PUTIMAGE] = "iibi",
+  [REC_PUTPIXEL] = "iii",
+  [REC_READIMAGEFILE] = "siiii",
+  [REC_RECTANGLE] = "iiii",
+  [REC_SECTOR] = "iiiiii",
+  [REC_SETACTIVEPAGE] = "i",
+  [REC_SETALLPALETTE] = "b",
+  [REC_SETBKCOLOR] = "i",
+  [REC_SETCOLOR] = "i",
+  [REC_SETFILLPATTERN] = "bi",
+  [REC_SETFILLSTYLE] = "ii",
+  [REC_SETLINESTYLE] = "iii",
+  [REC_SETPALETTE] = "ii",
+  [REC_SETTEXTJUSTIFY] = "ii",
+  [REC_SETTEXTSTYLE] = "iii",
+  [REC_SETUSERCHARSIZE] = "iiii",
+  [REC_SETVIEWPORT] = "iiiii",
+  [REC_SETVISUALPAGE] = "i",
+  [REC_SETWRITEMODE] = "i",
+  [REC_COPYPAGE] = "ii",
+  [REC_PUTCOLORMAP] = "iiiibddbi",
+  [REC_PUTCOLORMAPINT] = "iiiibbi",
+  [REC__PUTPIXEL] = "ii",
+  [REC_PUTIMAGESCALED] = "iiiibii",
+  [REC_PUTPIXELS] = "ibbb",
+  [REC_REFRESH] = "",
+  [REC_SDLBGIAUTO] = "",
+  [REC_SDLBGIFAST] = "",
+  [REC_SDLBGILIMIT] = "",
+  [REC_SDLBGISLOW] = "",
+  [REC_SETALPHA] = "ii",
+  [REC_SETBKRGBCOLOR] = "i",
+  [REC_SETBLENDMODE] = "i",
+  [REC_SETIMAGEFILTER] = "i",
+  [REC_SETRGBCOLOR] = "i",
+  [REC_SETRGBPALETTE] = "iiii",
+  [REC_SWAPBUFFERS] = "",
+  [REC_SETCURRENTWINDOW] = "i",
+  [REC_CLOSEWINDOW] = "i",
+  [REC_COPYRECT] = "iiiiiii",
+  [REC_SCROLLVIEWPORT] = "iii",
+  [REC_SCROLLRING] = "ii",
+  [REC_SETRINGVIEWPORT] = "i",
+  [REC_SETPAGELAYOUT] = "i"
+};
+
+#define REC_MAXARGS 9
+
+static SDL_SpinLock
+  bgi_rec_lock;                 // protects the record file
+static FILE
+  *bgi_rec_file = NULL;
+static Uint32
+  bgi_rec_tmp_color = 0;        // last REC_TMPCOLOR written
+static BGI_THREAD_LOCAL int
+  bgi_rec_busy = NOPE;          // inside a recorded call?
+
+// logs 'call', then runs it with logging off. Must be the first
+// statement of a void function, and 'call' the function itself
+
+#define RECORD(call, ...)                             \
+  do {                                                \
+    if (bgi_rec_file && NOPE == bgi_rec_busy &&       \
+        &bgi_default_ctx == bgi_ctx) {                \
+      record_call (__VA_ARGS__);                      \
+      bgi_rec_busy = YEAH;                            \
+      call;                                           \
+      bgi_rec_busy = NOPE;                            \
+      return;                                         \
+    }                                                 \
+  } while (0)
 
 // utility functions
 
@@ -451,14 +1020,17 @@ static void putpixel_xor     (int, int, Uint32);
 static void putpixel_and     (int, int, Uint32);
 static void putpixel_or      (int, int, Uint32);
 static void putpixel_not     (int, int, Uint32);
+static void putpixel_alpha   (int, int, Uint32);
 static void ff_putpixel      (int x, int);
 static Uint32 getpixel_raw   (int, int);
+static Uint32 *pixel_address (int, int);
 
 static void line_copy        (int, int, int, int);
 static void line_xor         (int, int, int, int);
 static void line_and         (int, int, int, int);
 static void line_or          (int, int, int, int);
 static void line_not         (int, int, int, int);
+static void line_alpha       (int, int, int, int);
 static void line_fill        (int, int, int, int);
 static void _floodfill       (int, int, int);
 
@@ -466,13 +1038,111 @@ static void line_fast        (int, int, int, int);
 static void updaterect       (int, int, int, int);
 static void update	     (void);
 static void update_pixel     (int, int);
+static void update_area      (int, int, int, int);
 
 static void unimplemented    (char *);
 static int  is_in_range      (int, int, int);
 static void swap_if_greater  (int *, int *);
 static void circle_bresenham (int, int, int);
-static int  octant           (int, int);
 static void refresh_window   (void);
+static Uint32 *page_pixels   (int);
+static void present_damage   (int, int, int, int);
+static void flush_damage     (void);
+static int  display_refresh_rate (void);
+
+static int  clip_span        (int *, int *, int);
+static void draw_span        (int, int, int, Uint32);
+static void fill_span        (int, int, int);
+static void clip_bounds      (int *, int *, int *, int *);
+static int  move_rect        (const Uint32 *, int, int, int, int,
+                              int, int, SDL_Rect *);
+static void fill_rect        (int, int, int, int, Uint32);
+static void put_row          (Uint32 *, const Uint32 *, int, int);
+static void load_row         (const struct bgi_context *, const Uint32 *,
+                              Uint32 *, int, int, int);
+static void save_row         (const struct bgi_context *, const Uint32 *,
+                              int, int, int);
+static void store_row        (int, int, int, const Uint32 *, int);
+static size_t ring_offset    (const struct bgi_context *, int, int);
+static int  ring_run         (const struct bgi_context *, int, int, int,
+                              size_t *);
+static int  ring_pieces      (int, int, int, int, SDL_Rect *,
+                              SDL_Rect *);
+static void ring_unroll      (void);
+static void drop_page_ring   (void);
+static inline Uint32 lerp_pixel (Uint32, Uint32, int);
+static inline Uint32 alpha_pixel (Uint32, Uint32);
+static void alpha_span       (Uint32 *, Uint32, int);
+static void alpha_row        (Uint32 *, const Uint32 *, int);
+
+static void stroke_begin     (void);
+static void stroke_end       (void);
+static void stroke_ipolyline (int, const int *, int);
+static void stroke_thin_polyline (int, const int *);
+static void stroke_arc       (double, double, double, double,
+                              double, double);
+static void stroke_annulus   (int, int, int);
+
+static int  surface_is_argb      (SDL_Surface *);
+static void updaterect_surface   (int, int, int, int);
+static void alias_window_surface (void);
+
+static int  on_screen            (const struct bgi_context *);
+static void layer_link           (struct bgi_context *);
+static void layer_unlink         (struct bgi_context *);
+static void layer_update         (struct bgi_context *);
+static void blend_row            (Uint32 *, const Uint32 *, int,
+                                  int, int, Uint32);
+static Uint32 *compose_rect      (int, int, int, int);
+static Sprite *sprite_get        (int);
+static void sprite_link          (Sprite *);
+static void sprite_unlink        (Sprite *);
+static void sprite_update        (const Sprite *, int, int);
+static int  sprite_new           (int, int);
+static void canvas_row           (const struct bgi_context *, Uint32 *,
+                                  const int *, int, int);
+static int  canvas_to_window     (const struct bgi_context *, int *,
+                                  int *, int *, int *);
+static int  canvas_release       (void);
+
+static int  shm_pages_create     (int, int);
+static void shm_pages_present    (void);
+static void shm_pages_free       (void);
+
+static void serve_damage         (int, int, int, int);
+
+static ImageEntry *image_get     (const char *);
+static void image_release        (ImageEntry *);
+static void image_flush          (size_t);
+
+static int  pool_worker      (void *);
+static void pool_stop        (void);
+static void run_tasks        (bgi_task, void *, int, bgi_progress);
+
+static void trace_start      (const char *);
+static void trace_event      (const char *, char);
+static void trace_flush      (void);
+static int  lock_update      (void);
+static int  poll_event       (SDL_Event *);
+static int  wait_event       (SDL_Event *);
+static void record_start     (const char *);
+static void record_varint    (Uint64);
+static void record_int       (int);
+static void record_call      (int, ...);
+static void record_blit      (int, int, int, int);
+static void record_stop      (void);
+static int  bitmap_bytes     (const void *);
+
+static void context_init     (struct bgi_context *);
+static void snap_tile_rect   (const struct bgi_snapshot *, int, int *,
+                              int *, int *, int *);
+static int  snap_tile_equal  (const SnapTile *, int, int, int, int);
+static void snap_tile_drop   (SnapTile *);
+static void snap_find        (struct bgi_context *);
+static void snap_touch       (struct bgi_context *, int, int, int, int);
+static void snap_forget      (const Uint32 *);
+static void bind_default_context (void);
+static void follow_active_page (struct bgi_context *);
 
 // -----
 
@@ -485,233 +1155,693 @@ static void unimplemented (char *msg)
 
 // -----
 
-void _graphfreemem (void *ptr, unsigned int size)
+static void trace_start (const char *path)
 {
+  // Starts tracing to file 'path', if any.
 
-  unimplemented ("_graphfreemem");
+  if (NULL == path || YEAH == bgi_trace_on)
+    return;
 
-} // _graphfreemem ()
+  bgi_trace_file = malloc (strlen (path) + 1);
+  if (NULL == bgi_trace_file) {
+    fprintf (stderr, "Can't allocate trace file name.\n");
+    return;
+  }
+  strcpy (bgi_trace_file, path);
+  bgi_trace_start = SDL_GetPerformanceCounter ();
+  bgi_trace_on = YEAH;
+
+} // trace_start ()
 
 // -----
 
-void _graphgetmem (unsigned int size)
+static void trace_event (const char *name, char phase)
 {
+  // Appends an event to the buffer of the calling thread.
 
-  unimplemented ("_graphgetmem");
+  TraceBuffer
+    *buf = bgi_trace_buf;
+  TraceChunk
+    *chunk;
+  TraceEvent
+    *event;
 
-} // _graphgetmem ()
+  if (NULL == buf) {
+    // first event of this thread
+    buf = calloc (1, sizeof (TraceBuffer));
+    if (NULL == buf)
+      return;
+    buf->tid = SDL_ThreadID ();
+    SDL_AtomicLock (&bgi_trace_lock);
+    buf->next = bgi_trace_buffers;
+    bgi_trace_buffers = buf;
+    SDL_AtomicUnlock (&bgi_trace_lock);
+    bgi_trace_buf = buf;
+  }
+
+  chunk = buf->last;
+  if (NULL == chunk || TRACE_CHUNK == chunk->n) {
+    chunk = calloc (1, sizeof (TraceChunk));
+    if (NULL == chunk)
+      return;
+    if (buf->last)
+      buf->last->next = chunk;
+    else
+      buf->first = chunk;
+    buf->last = chunk;
+  }
+
+  event = &chunk->event[chunk->n];
+  event->name = name;
+  event->ticks = SDL_GetPerformanceCounter ();
+  event->phase = phase;
+  chunk->n++;
+
+} // trace_event ()
 
 // -----
 
-int installuserdriver (char *name, int (*detect)(void))
+static void trace_flush (void)
 {
+  // Writes all buffered events to the trace file and stops
+  // tracing. Other threads must not be drawing any more.
 
-  unimplemented ("installuserdriver");
-  return 0;
+  FILE
+    *f;
+  TraceBuffer
+    *buf;
+  TraceChunk
+    *chunk,
+    *next;
+  TraceEvent
+    *event;
+  double
+    us = SDL_GetPerformanceFrequency () / 1e6;
+  int
+    i,
+    first = YEAH;
 
-} // installuserdriver ()
+  if (NOPE == bgi_trace_on)
+    return;
+  bgi_trace_on = NOPE;
 
-// -----
+  f = fopen (bgi_trace_file, "w");
+  if (NULL == f)
+    fprintf (stderr, "Can't write trace file %s.\n", bgi_trace_file);
+  else
+    fprintf (f, "{\"traceEvents\":[\n");
+
+  // buffers are kept, since threads still point to them
+  SDL_AtomicLock (&bgi_trace_lock);
+  for (buf = bgi_trace_buffers; buf; buf = buf->next) {
+    for (chunk = buf->first; chunk; chunk = next) {
+      for (i = 0; f && i < chunk->n; i++) {
+        event = &chunk->event[i];
+        fprintf (f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                 "\"pid\":1,\"tid\":%lu}",
+                 first ? "" : ",\n", event->name, event->phase,
+                 (event->ticks - bgi_trace_start) / us,
+                 (unsigned long) buf->tid);
+        first = NOPE;
+      }
+      next = chunk->next;
+      free (chunk);
+    }
+    buf->first = buf->last = NULL;
+  }
+  SDL_AtomicUnlock (&bgi_trace_lock);
 
-int installuserfont (char *name)
-{
+  if (f) {
+    fprintf (f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose (f);
+  }
 
-  unimplemented ("installuserfont");
-  return 0;
+  free (bgi_trace_file);
+  bgi_trace_file = NULL;
 
-} // installuserfont ()
+} // trace_flush ()
 
 // -----
 
-int registerbgidriver (void (*driver)(void))
+static int lock_update (void)
 {
+  // Locks update_mutex, tracing the wait.
 
-  unimplemented ("registerbgidriver");
-  return 0;
+  int
+    result;
 
-} // registerbgidriver ()
+  TRACE_BEGIN ("mutex wait");
+  result = SDL_LockMutex (update_mutex);
+  TRACE_END ("mutex wait");
+
+  return result;
+
+} // lock_update ()
 
 // -----
 
-int registerbgifont (void (*font)(void))
+static int poll_event (SDL_Event *event)
 {
+  // SDL_PollEvent (), traced.
 
-  unimplemented ("registerbgifont");
-  return 0;
+  int
+    result;
 
-} // registerbgifont ()
+  TRACE_BEGIN ("SDL_PollEvent");
+  result = SDL_PollEvent (event);
+  TRACE_END ("SDL_PollEvent");
+
+  return result;
+
+} // poll_event ()
 
 // -----
 
-unsigned int setgraphbufsize (unsigned bufsize)
+static int wait_event (SDL_Event *event)
 {
+  // SDL_WaitEvent (), traced.
 
-  unimplemented ("setgraphbufsize");
-  return 0;
+  int
+    result;
 
-} // setgraphbufsize ()
+  TRACE_BEGIN ("SDL_WaitEvent");
+  result = SDL_WaitEvent (event);
+  TRACE_END ("SDL_WaitEvent");
 
-// -----
+  return result;
 
-// ----- implemented stuff starts here -----
+} // wait_event ()
 
-#define PI_CONV (3.1415926 / 180.0)
+// -----
 
-void arc (int x, int y, int stangle, int endangle, int radius)
+static void record_start (const char *path)
 {
-  // Draws a circular arc centered at (x, y), with a radius
-  // given by radius, traveling from stangle to endangle.
+  // Starts recording calls to file 'path', if any.
 
-  // Quick and dirty for now, Bresenham-based later (maybe)
+  Uint32
+    order = 0x01020304;
 
-  int angle;
+  if (NULL == path || NULL != bgi_rec_file)
+    return;
 
-  if (0 == radius)
+  bgi_rec_file = fopen (path, "wb");
+  if (NULL == bgi_rec_file) {
+    fprintf (stderr, "Can't write record file %s.\n", path);
     return;
+  }
 
-  if (endangle < stangle)
-    endangle += 360;
+  fwrite (REC_MAGIC, 1, sizeof (REC_MAGIC), bgi_rec_file);
+  fwrite (&order, sizeof (order), 1, bgi_rec_file);
+  bgi_rec_tmp_color = 0;
 
-  bgi_last_arc.x = x;
-  bgi_last_arc.y = y;
-  bgi_last_arc.xstart = x + (radius * cos (stangle * PI_CONV));
-  bgi_last_arc.ystart = y - (radius * sin (stangle * PI_CONV));
-  bgi_last_arc.xend = x + (radius * cos (endangle * PI_CONV));
-  bgi_last_arc.yend = y - (radius * sin (endangle * PI_CONV));
+} // record_start ()
 
-  for (angle = stangle; angle < endangle; angle++)
-    line_fast (x + floor (0.5 + (radius * cos (angle * PI_CONV))),
-               y - floor (0.5 + (radius * sin (angle * PI_CONV))),
-               x + floor (0.5 + (radius * cos ((angle+1) * PI_CONV))),
-               y - floor (0.5 + (radius * sin ((angle+1) * PI_CONV))));
+// -----
 
-  update ();
+static void record_varint (Uint64 n)
+{
+  // Writes n, 7 bits per byte, low bits first.
 
-} // arc ()
+  while (n > 0x7f) {
+    putc ((int) (n & 0x7f) | 0x80, bgi_rec_file);
+    n >>= 7;
+  }
+  putc ((int) n, bgi_rec_file);
+
+} // record_varint ()
 
 // -----
 
-void bar3d (int left, int top, int right, int bottom, int depth, int topflag)
+static void record_int (int i)
 {
-  // Draws a three-dimensional, filled-in rectangle (bar), using
-  // the current fill colour and fill pattern.
+  // Writes i zigzag-encoded, so that small negative numbers
+  // stay short.
 
-  Uint32 tmp, tmpcolor;
+  record_varint (((Uint32) i << 1) ^ (Uint32) (i >> 31));
 
-  swap_if_greater (&left, &right);
-  swap_if_greater (&top, &bottom);
+} // record_int ()
 
-  tmp = bgi_fg_color;
+// -----
 
-  if (EMPTY_FILL == bgi_fill_style.pattern)
-    tmpcolor = bgi_bg_color;
-  else // all other styles
-    tmpcolor = bgi_fill_style.color;
+static void record_blob (const void *data, int len)
+{
+  // Writes a length-prefixed array; NULL is written as empty.
 
-  setcolor (tmpcolor); // fill
-  bar (left, top, right, bottom);
-  setcolor (tmp); // outline
-  if (depth > 0) {
-    if (topflag) {
-      line_fast (left, top, left + depth, top - depth);
-      line_fast (left + depth, top - depth, right + depth, top - depth);
-    }
-    line_fast (right, top, right + depth, top - depth);
-    line_fast (right, bottom, right + depth, bottom - depth);
-    line_fast (right + depth, bottom - depth, right + depth, top - depth);
-  }
-  rectangle (left, top, right, bottom);
+  if (NULL == data || len < 0)
+    len = 0;
 
-  update ();
+  record_varint (len);
+  if (len)
+    fwrite (data, 1, len, bgi_rec_file);
 
-} // bar3d ()
+} // record_blob ()
 
 // -----
 
-void bar (int left, int top, int right, int bottom)
+static void record_args (int op, va_list ap)
 {
-  // Draws a filled-in rectangle (bar), using the current fill colour
-  // and fill pattern.
+  // Writes an opcode and its arguments, see bgi_rec_sig[].
 
+  const char
+    *sig;
+  const void
+    *data;
+  double
+    d;
   int
-    y,
-    tmp, tmpcolor, tmpthickness;
+    len;
 
-  tmp = bgi_fg_color;
+  putc (op, bgi_rec_file);
 
-  if (EMPTY_FILL == bgi_fill_style.pattern)
-    tmpcolor = bgi_bg_color;
-  else // all other styles
-    tmpcolor = bgi_fill_style.color;
+  for (sig = bgi_rec_sig[op]; *sig; sig++)
+    switch (*sig) {
 
-  setcolor (tmpcolor);
-  tmpthickness = bgi_line_style.thickness;
-  bgi_line_style.thickness = NORM_WIDTH;
+    case 'i':
+      record_int (va_arg (ap, int));
+      break;
 
-  if (SOLID_FILL == bgi_fill_style.pattern)
-    for (y = top; y <= bottom; y++)
-      line_fast (left, y, right, y);
-  else
-    for (y = top; y <= bottom; y++)
-      line_fill (left, y, right, y);
+    case 'd':
+      d = va_arg (ap, double);
+      fwrite (&d, sizeof (d), 1, bgi_rec_file);
+      break;
 
-  setcolor (tmp);
-  bgi_line_style.thickness = tmpthickness;
+    case 's': // with the final '\0'
+      data = va_arg (ap, const char *);
+      record_blob (data, data ? (int) strlen (data) + 1 : 0);
+      break;
 
-  update ();
+    case 'b':
+      data = va_arg (ap, const void *);
+      len = va_arg (ap, int);
+      record_blob (data, len);
+      break;
 
-} // bar ()
+    } // switch
+
+} // record_args ()
 
 // -----
 
-int ALPHA_VALUE (int color)
+static void record_op (int op, ...)
 {
-  // Returns the alpha (transparency) component of an ARGB color.
+  // record_args () with a variable argument list.
 
-  return ((palette[BGI_COLORS + TMP_COLORS + color] >> 24) & 0xFF);
+  va_list
+    ap;
 
-} // ALPHA_VALUE ()
+  va_start (ap, op);
+  record_args (op, ap);
+  va_end (ap);
+
+} // record_op ()
 
 // -----
 
-int RED_VALUE (int color)
+static void record_call (int op, ...)
 {
-  // Returns the red component of 'color' in the extended palette
+  // Logs a call: opcode 'op' and its arguments.
 
-  return ((palette[BGI_COLORS + TMP_COLORS + color] >> 16) & 0xFF);
+  va_list
+    ap;
 
-} // RED_VALUE ()
+  SDL_AtomicLock (&bgi_rec_lock);
+
+  if (NULL == bgi_rec_file) {
+    SDL_AtomicUnlock (&bgi_rec_lock);
+    return;
+  }
+
+  // a COLOR () argument lives outside the context
+  if (bgi_tmp_color_argb != bgi_rec_tmp_color) {
+    bgi_rec_tmp_color = bgi_tmp_color_argb;
+    record_op (REC_TMPCOLOR, (int) bgi_rec_tmp_color);
+  }
+
+  va_start (ap, op);
+  record_args (op, ap);
+  va_end (ap);
+
+  SDL_AtomicUnlock (&bgi_rec_lock);
+
+} // record_call ()
 
 // -----
 
-int GREEN_VALUE (int color)
+static void record_blit (int x1, int y1, int x2, int y2)
 {
-  // Returns the green component of 'color' in the extended palette
+  // Logs the pixels of a rectangle of the active page, absolute
+  // coordinates, when they were written without a drawing call.
 
-  return ((palette[BGI_COLORS + TMP_COLORS + color] >> 8) & 0xFF);
+  int
+    y, x, n;
+  size_t
+    offset;
 
-} // GREEN_VALUE ()
+  if (NULL == bgi_rec_file || YEAH == bgi_rec_busy ||
+      &bgi_default_ctx != bgi_ctx)
+    return;
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 > bgi_default_ctx.maxx)
+    x2 = bgi_default_ctx.maxx;
+  if (y2 > bgi_default_ctx.maxy)
+    y2 = bgi_default_ctx.maxy;
+  if (x1 > x2 || y1 > y2)
+    return;
+
+  SDL_AtomicLock (&bgi_rec_lock);
+
+  if (bgi_rec_file) {
+    putc (REC_BLIT, bgi_rec_file);
+    record_int (x1);
+    record_int (y1);
+    record_int (x2 - x1 + 1);
+    record_int (y2 - y1 + 1);
+    record_varint ((Uint64) (x2 - x1 + 1) * (y2 - y1 + 1) *
+                   sizeof (Uint32));
+    for (y = y1; y <= y2; y++)
+      for (x = x1; x <= x2; x += n) {
+        n = ring_run (&bgi_default_ctx, x, x2, y, &offset);
+        fwrite (bgi_default_ctx.pixels + offset,
+                sizeof (Uint32), n, bgi_rec_file);
+      }
+  }
+
+  SDL_AtomicUnlock (&bgi_rec_lock);
+
+} // record_blit ()
 
 // -----
 
-int BLUE_VALUE (int color)
+static void record_stop (void)
 {
-  // Returns the blue component 'color' in the extended palette
+  // Ends the record file.
 
-  return (palette[BGI_COLORS + TMP_COLORS + color] & 0xFF);
+  SDL_AtomicLock (&bgi_rec_lock);
 
-} // BLUE_VALUE ()
+  if (bgi_rec_file) {
+    putc (REC_CLOSEGRAPH, bgi_rec_file);
+    fclose (bgi_rec_file);
+    bgi_rec_file = NULL;
+  }
+
+  SDL_AtomicUnlock (&bgi_rec_lock);
+
+} // record_stop ()
 
 // -----
 
-static void circle_bresenham (int x, int y, int radius)
+static int bitmap_bytes (const void *bitmap)
 {
-  // Draws a circle of the given radius at (x, y).
-  // Adapted from:
-  // http://members.chello.at/easyfilter/bresenham.html
+  // Returns the size of a getimage () bitmap.
 
-  int
-    xx = -radius,
+  Uint32
+    w, h;
+
+  if (NULL == bitmap)
+    return 0;
+
+  memcpy (&w, bitmap, sizeof (Uint32));
+  memcpy (&h, (const Uint32 *) bitmap + 1, sizeof (Uint32));
+
+  return (2 + w * h) * sizeof (Uint32);
+
+} // bitmap_bytes ()
+
+// -----
+
+void _graphfreemem (void *ptr, unsigned int size)
+{
+
+  unimplemented ("_graphfreemem");
+
+} // _graphfreemem ()
+
+// -----
+
+void _graphgetmem (unsigned int size)
+{
+
+  unimplemented ("_graphgetmem");
+
+} // _graphgetmem ()
+
+// -----
+
+int installuserdriver (char *name, int (*detect)(void))
+{
+
+  unimplemented ("installuserdriver");
+  return 0;
+
+} // installuserdriver ()
+
+// -----
+
+int installuserfont (char *name)
+{
+
+  unimplemented ("installuserfont");
+  return 0;
+
+} // installuserfont ()
+
+// -----
+
+int registerbgidriver (void (*driver)(void))
+{
+
+  unimplemented ("registerbgidriver");
+  return 0;
+
+} // registerbgidriver ()
+
+// -----
+
+int registerbgifont (void (*font)(void))
+{
+
+  unimplemented ("registerbgifont");
+  return 0;
+
+} // registerbgifont ()
+
+// -----
+
+unsigned int setgraphbufsize (unsigned bufsize)
+{
+
+  unimplemented ("setgraphbufsize");
+  return 0;
+
+} // setgraphbufsize ()
+
+// -----
+
+// ----- implemented stuff starts here -----
+
+#define PI_CONV (3.1415926 / 180.0)
+
+void arc (int x, int y, int stangle, int endangle, int radius)
+{
+  // Draws a circular arc centered at (x, y), with a radius
+  // given by radius, traveling from stangle to endangle.
+
+  // Quick and dirty for now, Bresenham-based later (maybe).
+  // Thick arcs are stroked as a whole.
+
+  int angle;
+
+  RECORD (arc (x, y, stangle, endangle, radius),
+          REC_ARC, x, y, stangle, endangle, radius);
+
+  if (0 == radius)
+    return;
+
+  if (endangle < stangle)
+    endangle += 360;
+
+  bgi_ctx->last_arc.x = x;
+  bgi_ctx->last_arc.y = y;
+  bgi_ctx->last_arc.xstart = x + (radius * cos (stangle * PI_CONV));
+  bgi_ctx->last_arc.ystart = y - (radius * sin (stangle * PI_CONV));
+  bgi_ctx->last_arc.xend = x + (radius * cos (endangle * PI_CONV));
+  bgi_ctx->last_arc.yend = y - (radius * sin (endangle * PI_CONV));
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    stroke_begin ();
+    stroke_arc (x + bgi_ctx->vp.left, y + bgi_ctx->vp.top, stangle, endangle,
+                radius, radius);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  for (angle = stangle; angle < endangle; angle++)
+    line_fast (x + floor (0.5 + (radius * cos (angle * PI_CONV))),
+               y - floor (0.5 + (radius * sin (angle * PI_CONV))),
+               x + floor (0.5 + (radius * cos ((angle+1) * PI_CONV))),
+               y - floor (0.5 + (radius * sin ((angle+1) * PI_CONV))));
+
+  update ();
+
+} // arc ()
+
+// -----
+
+void bar3d (int left, int top, int right, int bottom, int depth, int topflag)
+{
+  // Draws a three-dimensional, filled-in rectangle (bar), using
+  // the current fill colour and fill pattern.
+
+  Uint32 tmp, tmpcolor;
+
+  RECORD (bar3d (left, top, right, bottom, depth, topflag),
+          REC_BAR3D, left, top, right, bottom, depth, topflag);
+
+  swap_if_greater (&left, &right);
+  swap_if_greater (&top, &bottom);
+
+  tmp = bgi_ctx->fg_color;
+
+  if (EMPTY_FILL == bgi_ctx->fill_style.pattern)
+    tmpcolor = bgi_ctx->bg_color;
+  else // all other styles
+    tmpcolor = bgi_ctx->fill_style.color;
+
+  setcolor (tmpcolor); // fill
+  bar (left, top, right, bottom);
+  setcolor (tmp); // outline
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    // outline and depth lines make up a single stroke
+    int
+      front[8] = { left, top, right, top, right, bottom, left, bottom },
+      side[10] = { left, top, left + depth, top - depth,
+                   right + depth, top - depth,
+                   right + depth, bottom - depth, right, bottom },
+      edge[4] = { right, top, right + depth, top - depth };
+    stroke_begin ();
+    stroke_ipolyline (4, front, YEAH);
+    if (depth > 0) {
+      if (topflag)
+        stroke_ipolyline (5, side, NOPE);
+      else
+        stroke_ipolyline (3, side + 4, NOPE);
+      stroke_ipolyline (2, edge, NOPE);
+    }
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  if (depth > 0) {
+    if (topflag) {
+      line_fast (left, top, left + depth, top - depth);
+      line_fast (left + depth, top - depth, right + depth, top - depth);
+    }
+    line_fast (right, top, right + depth, top - depth);
+    line_fast (right, bottom, right + depth, bottom - depth);
+    line_fast (right + depth, bottom - depth, right + depth, top - depth);
+  }
+  rectangle (left, top, right, bottom);
+
+  update ();
+
+} // bar3d ()
+
+// -----
+
+void bar (int left, int top, int right, int bottom)
+{
+  // Draws a filled-in rectangle (bar), using the current fill colour
+  // and fill pattern.
+
+  int
+    y,
+    tmp, tmpcolor, tmpthickness;
+
+  RECORD (bar (left, top, right, bottom),
+          REC_BAR, left, top, right, bottom);
+
+  tmp = bgi_ctx->fg_color;
+
+  if (EMPTY_FILL == bgi_ctx->fill_style.pattern)
+    tmpcolor = bgi_ctx->bg_color;
+  else // all other styles
+    tmpcolor = bgi_ctx->fill_style.color;
+
+  setcolor (tmpcolor);
+  tmpthickness = bgi_ctx->line_style.thickness;
+  bgi_ctx->line_style.thickness = NORM_WIDTH;
+
+  if (SOLID_FILL == bgi_ctx->fill_style.pattern)
+    for (y = top; y <= bottom; y++)
+      line_fast (left, y, right, y);
+  else
+    for (y = top; y <= bottom; y++)
+      line_fill (left, y, right, y);
+
+  setcolor (tmp);
+  bgi_ctx->line_style.thickness = tmpthickness;
+
+  update ();
+
+} // bar ()
+
+// -----
+
+int ALPHA_VALUE (int color)
+{
+  // Returns the alpha (transparency) component of an ARGB color.
+
+  return ((bgi_ctx->palette[BGI_COLORS + TMP_COLORS + color] >> 24) & 0xFF);
+
+} // ALPHA_VALUE ()
+
+// -----
+
+int RED_VALUE (int color)
+{
+  // Returns the red component of 'color' in the extended palette
+
+  return ((bgi_ctx->palette[BGI_COLORS + TMP_COLORS + color] >> 16) & 0xFF);
+
+} // RED_VALUE ()
+
+// -----
+
+int GREEN_VALUE (int color)
+{
+  // Returns the green component of 'color' in the extended palette
+
+  return ((bgi_ctx->palette[BGI_COLORS + TMP_COLORS + color] >> 8) & 0xFF);
+
+} // GREEN_VALUE ()
+
+// -----
+
+int BLUE_VALUE (int color)
+{
+  // Returns the blue component 'color' in the extended palette
+
+  return (bgi_ctx->palette[BGI_COLORS + TMP_COLORS + color] & 0xFF);
+
+} // BLUE_VALUE ()
+
+// -----
+
+static void circle_bresenham (int x, int y, int radius)
+{
+  // Draws a circle of the given radius at (x, y).
+  // Adapted from:
+  // http://members.chello.at/easyfilter/bresenham.html
+
+  int
+    xx = -radius,
     yy = 0,
     err = 2 - 2*radius;
 
@@ -740,12 +1870,21 @@ void circle (int x, int y, int radius)
 {
   // Draws a circle of the given radius at (x, y).
 
-  // the Bresenham algorithm draws a better-looking circle
+  RECORD (circle (x, y, radius), REC_CIRCLE, x, y, radius);
+
+  // the Bresenham algorithm draws a better-looking circle;
+  // thick circles are computed as rings
 
-  if (NORM_WIDTH == bgi_line_style.thickness)
+  if (bgi_ctx->line_style.thickness <= NORM_WIDTH)
     circle_bresenham (x, y, radius);
-  else
-    arc (x, y, 0, 360, radius);
+  else {
+    bgi_ctx->last_arc.x = x;
+    bgi_ctx->last_arc.y = y;
+    stroke_begin ();
+    stroke_annulus (x + bgi_ctx->vp.left, y + bgi_ctx->vp.top, radius);
+    stroke_end ();
+    update ();
+  }
 
 } // circle ();
 
@@ -756,14 +1895,15 @@ void cleardevice (void)
   // Clears the graphics screen, filling it with the current
   // background color.
 
-  int x, y;
+  RECORD (cleardevice (), REC_CLEARDEVICE);
+
+  bgi_ctx->cp_x = bgi_ctx->cp_y = 0;
 
-  bgi_cp_x = bgi_cp_y = 0;
+  if (canvas_release ())
+    return;
 
-  for (x = 0; x < bgi_maxx + 1; x++)
-    for (y = 0; y < bgi_maxy + 1; y++)
-      bgi_activepage[current_window][y * (bgi_maxx + 1) + x] =
-        palette[bgi_bg_color];
+  fill_rect (0, 0, bgi_ctx->maxx, bgi_ctx->maxy,
+             bgi_ctx->palette[bgi_ctx->bg_color]);
 
   update ();
 
@@ -776,14 +1916,26 @@ void clearviewport (void)
   // Clears the viewport, filling it with the current
   // background color.
 
-  int x, y;
+  int
+    right = bgi_ctx->vp.right,
+    bottom = bgi_ctx->vp.bottom;
+
+  RECORD (clearviewport (), REC_CLEARVIEWPORT);
+
+  bgi_ctx->cp_x = bgi_ctx->cp_y = 0;
 
-  bgi_cp_x = bgi_cp_y = 0;
+  if (0 == bgi_ctx->vp.left && 0 == bgi_ctx->vp.top &&
+      bgi_ctx->maxx == right &&
+      bgi_ctx->maxy == bottom && canvas_release ())
+    return;
 
-  for (x = vp.left; x < vp.right + 1; x++)
-    for (y = vp.top; y < vp.bottom + 1; y++)
-      bgi_activepage[current_window][y * (bgi_maxx + 1) + x] =
-        palette[bgi_bg_color];
+  // the viewport may extend past the page
+  if (right > bgi_ctx->maxx)
+    right = bgi_ctx->maxx;
+  if (bottom > bgi_ctx->maxy)
+    bottom = bgi_ctx->maxy;
+  fill_rect (bgi_ctx->vp.left, bgi_ctx->vp.top, right, bottom,
+             bgi_ctx->palette[bgi_ctx->bg_color]);
 
   update ();
 
@@ -795,16 +1947,49 @@ void closegraph (void)
 {
   // Closes the graphics system.
 
+  record_stop ();
+  stopframeserver ();
+
   // waits for update callback to finish
 
   refresh_needed = NOPE;
+  if (bgi_damage_timer)
+    SDL_RemoveTimer (bgi_damage_timer);
+  bgi_damage_timer = 0;
+  bgi_damage_x2 = bgi_damage_y2 = -1;
   SDL_Delay (500);
 
   for (int i = 0; i < num_windows; i++)
     if (YEAH == active_windows[i]) {
-      SDL_DestroyTexture (bgi_txt[i]);
-      SDL_DestroyRenderer (bgi_rnd[i]);
+      if (bgi_txt[i])
+        SDL_DestroyTexture (bgi_txt[i]);
+      if (bgi_rnd[i])
+        SDL_DestroyRenderer (bgi_rnd[i]);
       SDL_DestroyWindow (bgi_win[i]);
+      bgi_win_alias[i] = NULL;
+    }
+
+  // free cached bitmaps, stop worker threads
+  image_flush (0);
+  pool_stop ();
+  trace_flush ();
+  shm_pages_free ();
+
+  for (int i = 0; i < bgi_nsprites; i++)
+    if (bgi_sprites[i]) {
+      free (bgi_sprites[i]->pixels);
+      free (bgi_sprites[i]);
+    }
+  free (bgi_sprites);
+  bgi_sprites = NULL;
+  bgi_nsprites = 0;
+  memset (bgi_sprite_list, 0, sizeof (bgi_sprite_list));
+
+  // canvases belong to the program, but are not shown any more
+  for (int i = 0; i < NUM_BGI_WIN; i++)
+    if (bgi_canvas[i]) {
+      bgi_canvas[i]->canvas_window = -1;
+      bgi_canvas[i] = NULL;
     }
 
   // free visual pages - causes segmentation fault!
@@ -823,17 +2008,61 @@ void closewindow (int id)
 {
   // Closes a window.
 
+  struct bgi_context
+    *layer;
+  Sprite
+    *sprite;
+
+  RECORD (closewindow (id), REC_CLOSEWINDOW, id);
+
   if (NOPE == active_windows[id]) {
     fprintf (stderr, "Window %d does not exist\n", id);
     return;
   }
 
-  SDL_DestroyTexture (bgi_txt[id]);
-  SDL_DestroyRenderer (bgi_rnd[id]);
+  // the server reads the window's pages
+  if (id == bgi_serve_window)
+    stopframeserver ();
+
+  // pending damage belongs to the current window
+  if (id == current_window) {
+    if (update_mutex)
+      lock_update ();
+    if (bgi_damage_timer)
+      SDL_RemoveTimer (bgi_damage_timer);
+    bgi_damage_timer = 0;
+    bgi_damage_x2 = bgi_damage_y2 = -1;
+    if (update_mutex)
+      SDL_UnlockMutex (update_mutex);
+  }
+
+  if (bgi_txt[id])
+    SDL_DestroyTexture (bgi_txt[id]);
+  if (bgi_rnd[id])
+    SDL_DestroyRenderer (bgi_rnd[id]);
   SDL_DestroyWindow (bgi_win[id]);
+  bgi_win_alias[id] = NULL;
   active_windows[id] = NOPE;
   num_windows--;
 
+  // layers outlive their window, but are not shown any more
+  while (bgi_layers[id]) {
+    layer = bgi_layers[id];
+    bgi_layers[id] = layer->next_layer;
+    layer->layer_window = -1;
+    layer->next_layer = NULL;
+  }
+  while (bgi_sprite_list[id]) {
+    sprite = bgi_sprite_list[id];
+    bgi_sprite_list[id] = sprite->next;
+    sprite->window = -1;
+    sprite->next = NULL;
+  }
+  if (bgi_canvas[id]) {
+    bgi_canvas[id]->canvas_window = -1;
+    bgi_canvas[id] = NULL;
+  }
+
 } // closegraph ()
 
 // -----
@@ -851,2847 +2080,9138 @@ int COLOR (int r, int g, int b)
 
 // -----
 
-void delay (int msec)
+static Uint32 *page_pixels (int page)
 {
-  // Waits for msec milliseconds. Implemented as a loop,
-  // because apparently SDL_Delay() ignores pending events.
+  // Returns the pixel data of a page of the current window.
 
-  Uint32
-    stop;
+  if (0 == page && bgi_win_alias[current_window])
+    return bgi_win_alias[current_window];
 
-  update ();
+  return bgi_vpage[page]->pixels;
 
-  stop = SDL_GetTicks () + msec;
+} // page_pixels ()
 
-  do {
+// -----
 
-    if (kbhit ()) // take care of keypresses
-      key_pressed = YEAH;
-    if (xkbhit ())
-      xkey_pressed = YEAH;
+void copypage (int src, int dest)
+{
+  // Copies the contents of page 'src' to page 'dest'.
 
-  } while (SDL_GetTicks () < stop);
+  RECORD (copypage (src, dest), REC_COPYPAGE, src, dest);
 
-} // delay ()
+  if (src < 0 || src > bgi_np - 1 || dest < 0 || dest > bgi_np - 1) {
+    fprintf (stderr, "Invalid page in copypage().\n");
+    return;
+  }
 
-// -----
+  if (src == dest)
+    return;
 
-void detectgraph (int *graphdriver, int *graphmode)
-{
-  // Detects the graphics driver and graphics mode to use.
+  if (update_mutex)
+    lock_update ();
 
-  *graphdriver = SDL;
-  *graphmode = SDL_FULLSCREEN;
+  memcpy (page_pixels (dest), page_pixels (src),
+          (bgi_win_maxx[current_window] + 1) *
+          (bgi_win_maxy[current_window] + 1) * sizeof (Uint32));
+  snap_forget (page_pixels (dest));
 
-} // detectgraph ()
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  if (dest == bgi_vp)
+    update ();
+
+} // copypage ()
 
 // -----
 
-void drawpoly (int numpoints, int *polypoints)
+static int move_rect (const Uint32 *src, int x1, int y1, int x2, int y2,
+                      int x, int y, SDL_Rect *moved)
 {
-  // Draws a polygon of numpoints vertices.
+  // Moves the absolute rectangle (x1, y1, x2, y2) of 'src', which
+  // has the size of the current context, to (x, y) of the context.
+  // 'src' may be the context's own pixels, and the two areas may
+  // overlap. Returns NOPE if nothing was moved, otherwise YEAH and
+  // the clipped destination in 'moved'.
 
-  int n;
+  int
+    stride = bgi_ctx->maxx + 1,
+    left, top, right, bottom,
+    width, height, row;
+  Uint32
+    *line;
 
-  for (n = 0; n < numpoints - 1; n++)
-    line_fast (polypoints[2*n], polypoints[2*n + 1],
-               polypoints[2*n + 2], polypoints[2*n + 3]);
-  // close the polygon
-  line_fast (polypoints[2*n], polypoints[2*n + 1],
-             polypoints[0], polypoints[1]);
+  // clip the source to the page...
+  if (x1 < 0) {
+    x -= x1;
+    x1 = 0;
+  }
+  if (y1 < 0) {
+    y -= y1;
+    y1 = 0;
+  }
+  if (x2 > bgi_ctx->maxx)
+    x2 = bgi_ctx->maxx;
+  if (y2 > bgi_ctx->maxy)
+    y2 = bgi_ctx->maxy;
+
+  // ...and the destination to the viewport
+  clip_bounds (&left, &top, &right, &bottom);
+  if (x < left) {
+    x1 += left - x;
+    x = left;
+  }
+  if (y < top) {
+    y1 += top - y;
+    y = top;
+  }
+  if (x + x2 - x1 > right)
+    x2 = x1 + right - x;
+  if (y + y2 - y1 > bottom)
+    y2 = y1 + bottom - y;
+
+  if (x1 > x2 || y1 > y2)
+    return NOPE;
+
+  width = x2 - x1 + 1;
+  height = y2 - y1 + 1;
+
+  // a ring or a tiled page is not stored in rows: each row is read
+  // whole, then written, bottom up when moving down
+  if (RING_OFF != bgi_ctx->ring_mode || LAYOUT_TILES == bgi_ctx->layout) {
+    line = malloc (width * sizeof (Uint32));
+    if (NULL == line) {
+      fprintf (stderr, "Can't allocate memory to move pixels.\n");
+      return NOPE;
+    }
+    for (int i = 0; i < height; i++) {
+      row = (src == bgi_ctx->pixels && y > y1) ? height - 1 - i : i;
+      load_row (bgi_ctx, src, line, x1, x2, y1 + row);
+      store_row (x, x + width - 1, y + row, line, COPY_PUT);
+    }
+    free (line);
+  }
+  // moving down within a page: go bottom up, so that
+  // rows are not overwritten before they are read
+  else if (src == bgi_ctx->pixels && y > y1)
+    for (row = height - 1; row >= 0; row--)
+      memmove (bgi_ctx->pixels + (y + row) * stride + x,
+               src + (y1 + row) * stride + x1, width * sizeof (Uint32));
+  else
+    for (row = 0; row < height; row++)
+      memmove (bgi_ctx->pixels + (y + row) * stride + x,
+               src + (y1 + row) * stride + x1, width * sizeof (Uint32));
+  snap_touch (bgi_ctx, x, y, x + width - 1, y + height - 1);
 
-  update ();
+  moved->x = x;
+  moved->y = y;
+  moved->w = width;
+  moved->h = height;
 
-} // drawpoly ()
+  return YEAH;
+
+} // move_rect ()
 
 // -----
 
-static void swap_if_greater (int *x1, int *x2)
+void copyrect (int page, int left, int top, int right, int bottom,
+               int x, int y)
 {
-  int tmp;
+  // Copies the rectangle (left, top, right, bottom) of page 'page'
+  // to (x, y) of the active page. Coordinates are relative to the
+  // viewport, as in getimage() and putimage(); the rectangles may
+  // overlap.
 
-  if (*x1 > *x2) {
-    tmp = *x1;
-    *x1 = *x2;
-    *x2 = tmp;
+  const Uint32
+    *src;
+  SDL_Rect
+    moved;
+
+  RECORD (copyrect (page, left, top, right, bottom, x, y),
+          REC_COPYRECT, page, left, top, right, bottom, x, y);
+
+  // other contexts have a single page
+  if (&bgi_default_ctx != bgi_ctx)
+    src = bgi_ctx->pixels;
+  else {
+    if (page < 0 || page > bgi_np - 1) {
+      fprintf (stderr, "Invalid page in copyrect().\n");
+      return;
+    }
+    src = page_pixels (page);
   }
 
-} // swap_if_greater ()
+  if (move_rect (src,
+                 left + bgi_ctx->vp.left, top + bgi_ctx->vp.top,
+                 right + bgi_ctx->vp.left, bottom + bgi_ctx->vp.top,
+                 x + bgi_ctx->vp.left, y + bgi_ctx->vp.top, &moved))
+    update_area (moved.x, moved.y,
+                 moved.x + moved.w - 1, moved.y + moved.h - 1);
+
+} // copyrect ()
 
 // -----
 
-static void _ellipse (int, int, int, int);
+static void context_init (struct bgi_context *c)
+{
+  // Sets up the fields of a new context that graphdefaults()
+  // does not take care of.
 
-void ellipse (int x, int y, int stangle, int endangle,
-              int xradius, int yradius)
+  c->fg_color = WHITE;
+  c->bg_color = BLACK;
+  c->fill_color = WHITE;
+  c->argb_mode = NOPE;
+  c->font_mag_x = c->font_mag_y = 1.0;
+  memcpy (c->line_patterns, bgi_line_patterns, sizeof (bgi_line_patterns));
+  memcpy (c->fill_patterns, bgi_fill_patterns, sizeof (bgi_fill_patterns));
+  c->sp = c->stack;
+
+} // context_init ()
+
+// -----
+
+static void bind_default_context (void)
 {
-  // Draws an elliptical arc centered at (x, y), with axes given by
-  // xradius and yradius, traveling from stangle to endangle.
+  // Makes the default context draw on the active page
+  // of the current window.
 
-  // Bresenham-based if complete
-  int angle;
+  bgi_default_ctx.pixels = bgi_activepage[current_window];
+  bgi_default_ctx.maxx = bgi_win_maxx[current_window];
+  bgi_default_ctx.maxy = bgi_win_maxy[current_window];
+  bgi_default_ctx.layout = bgi_win_layout[current_window];
 
-  if (0 == xradius && 0 == yradius)
-    return;
+  // the page may have changed under the current context too
+  follow_active_page (bgi_ctx);
 
-  if (endangle < stangle)
-    endangle += 360;
+} // bind_default_context ()
 
-  // draw complete ellipse
-  if (0 == stangle && 360 == endangle) {
-    _ellipse (x, y, xradius, yradius);
-    return;
-  }
+// -----
 
-  // really needed?
-  bgi_last_arc.x = x;
-  bgi_last_arc.y = y;
+static void follow_active_page (struct bgi_context *c)
+{
+  // Points a context made by createcontext (0, 0) to the active
+  // page of its window, which setactivepage (), swapbuffers () and
+  // the window surface may have moved since.
 
-  for (angle = stangle; angle < endangle; angle++)
-    line_fast (x + (xradius * cos (angle * PI_CONV)),
-               y - (yradius * sin (angle * PI_CONV)),
-               x + (xradius * cos ((angle + 1) * PI_CONV)),
-               y - (yradius * sin ((angle + 1) * PI_CONV)));
+  int
+    w = c->page_window;
 
-  update ();
+  if (NOPE == c->follow_page || NOPE == active_windows[w])
+    return;
 
-} // ellipse ()
+  c->pixels = bgi_activepage[w];
+  c->maxx = bgi_win_maxx[w];
+  c->maxy = bgi_win_maxy[w];
+  c->layout = bgi_win_layout[w];
+
+} // follow_active_page ()
 
 // -----
 
-int event (void)
+static struct bgi_context *new_context (const char *caller,
+                                        int width, int height, int header,
+                                        Uint32 *pixels)
 {
-  // Returns YEAH if an event has occurred.
+  // Does the work of createcontext (); if the context has its own
+  // buffer, its pixels start after 'header' words. If 'pixels' is
+  // not NULL, the context draws on them instead, as they are.
 
-  SDL_Event event;
+  struct bgi_context
+    *c;
 
-  if (SDL_PollEvent (&event)) {
-    if ( (SDL_KEYDOWN == event.type)         ||
-         (SDL_MOUSEBUTTONDOWN == event.type) ||
-         (SDL_MOUSEWHEEL == event.type)      ||
-         (SDL_QUIT == event.type) ) {
-      SDL_PushEvent (&event); // don't disrupt the event
-      bgi_last_event = event.type;
-      return YEAH;
+  c = calloc (1, sizeof (struct bgi_context));
+  if (NULL == c) {
+    fprintf (stderr, "%s(): out of memory.\n", caller);
+    return NULL;
+  }
+
+  if (pixels) {
+    c->pixels = pixels;
+    c->maxx = width - 1;
+    c->maxy = height - 1;
+  }
+  else if (width > 0 && height > 0) {
+    c->buffer = malloc (((size_t) width * height + header) *
+                        sizeof (Uint32));
+    if (NULL == c->buffer) {
+      fprintf (stderr, "%s(): out of memory.\n", caller);
+      free (c);
+      return NULL;
     }
+    c->pixels = c->buffer + header;
+    for (int i = 0; i < width * height; i++)
+      c->pixels[i] = bgi_palette[BLACK];
+    c->maxx = width - 1;
+    c->maxy = height - 1;
+  }
+  else {
+    if (current_window < 0 || NOPE == active_windows[current_window]) {
+      fprintf (stderr, "%s(): no window to draw on.\n", caller);
+      free (c);
+      return NULL;
+    }
+    c->follow_page = YEAH;
+    c->page_window = current_window;
+    follow_active_page (c);
   }
-  return NOPE;
 
-} // event ()
+  memcpy (c->palette, bgi_ctx->palette, sizeof (c->palette));
+  context_init (c);
+  CTX_CALL (c, graphdefaults ());
+
+  return c;
+
+} // new_context ()
 
 // -----
 
-int eventtype (void)
+bgi_context *createcontext (int width, int height)
 {
-  // Returns the type of event occurred
+  // Creates a new context. If width and height are positive, the
+  // context draws on its own width x height ARGB buffer; otherwise,
+  // it draws on the active page of the current window, whichever
+  // page that is when the context is used.
+  // The new context inherits the ARGB palette of the current one.
 
-  return (bgi_last_event);
+  return new_context ("createcontext", width, height, 0, NULL);
 
-} // eventtype ()
+} // createcontext ()
 
 // -----
 
-// Yeah, duplicated code. The thing is, I can't catch the bug.
+// Context-taking variants of the classic functions: each one
+// does what the classic function does, but on context c, whatever
+// the current context of the calling thread is.
 
-void _ellipse (int cx, int cy, int xradius, int yradius)
+void ctx_arc (bgi_context *c, int x, int y, int stangle, int endangle,
+              int radius)
 {
-  // from "A Fast Bresenham Type Algorithm For Drawing Ellipses"
-  // by John Kennedy
-
-  int
-    x, y,
-    xchange, ychange,
-    ellipseerror,
-    TwoASquare, TwoBSquare,
-    StoppingX, StoppingY;
+  CTX_CALL (c, arc (x, y, stangle, endangle, radius));
 
-  if (0 == xradius && 0 == yradius)
-    return;
+} // ctx_arc ()
 
-  TwoASquare = 2*xradius*xradius;
-  TwoBSquare = 2*yradius*yradius;
-  x = xradius;
-  y = 0;
-  xchange = yradius*yradius*(1 - 2*xradius);
-  ychange = xradius*xradius;
-  ellipseerror = 0;
-  StoppingX = TwoBSquare*xradius;
-  StoppingY = 0;
+// -----
 
-  while (StoppingX >= StoppingY) {
+void ctx_bar3d (bgi_context *c, int left, int top, int right, int bottom,
+                int depth, int topflag)
+{
+  CTX_CALL (c, bar3d (left, top, right, bottom, depth, topflag));
 
-    // 1st set of points, y' > -1
+} // ctx_bar3d ()
 
-    // normally, I'd put the line_fill () code here; but
-    // the outline gets overdrawn, can't find out why.
-    _putpixel (cx + x, cy - y);
-    _putpixel (cx - x, cy - y);
-    _putpixel (cx - x, cy + y);
-    _putpixel (cx + x, cy + y);
-    y++;
-    StoppingY += TwoASquare;
-    ellipseerror += ychange;
-    ychange +=TwoASquare;
+// -----
 
-    if ((2*ellipseerror + xchange) > 0 ) {
-      x--;
-      StoppingX -= TwoBSquare;
-      ellipseerror +=xchange;
-      xchange += TwoBSquare;
-    }
-  } // while
+void ctx_bar (bgi_context *c, int left, int top, int right, int bottom)
+{
+  CTX_CALL (c, bar (left, top, right, bottom));
 
-  // 1st point set is done; start the 2nd set of points
+} // ctx_bar ()
 
-  x = 0;
-  y = yradius;
-  xchange = yradius*yradius;
-  ychange = xradius*xradius*(1 - 2*yradius);
-  ellipseerror = 0;
-  StoppingX = 0;
-  StoppingY = TwoASquare*yradius;
+// -----
 
-  while (StoppingX <= StoppingY ) {
+void ctx_circle (bgi_context *c, int x, int y, int radius)
+{
+  CTX_CALL (c, circle (x, y, radius));
 
-    // 2nd set of points, y' < -1
+} // ctx_circle ()
 
-    _putpixel (cx + x, cy - y);
-    _putpixel (cx - x, cy - y);
-    _putpixel (cx - x, cy + y);
-    _putpixel (cx + x, cy + y);
-    x++;
-    StoppingX += TwoBSquare;
-    ellipseerror += xchange;
-    xchange +=TwoBSquare;
-    if ((2*ellipseerror + ychange) > 0) {
-      y--,
-        StoppingY -= TwoASquare;
-      ellipseerror += ychange;
-      ychange +=TwoASquare;
-    }
-  }
+// -----
 
-  update ();
+void ctx_cleardevice (bgi_context *c)
+{
+  CTX_CALL (c, cleardevice ());
 
-} // _ellipse ()
+} // ctx_cleardevice ()
 
 // -----
 
-void fillellipse (int cx, int cy, int xradius, int yradius)
+void ctx_clearviewport (bgi_context *c)
 {
-  // Draws an ellipse centered at (x, y), with axes given by
-  // xradius and yradius, and fills it using the current fill color
-  // and fill pattern.
-
-  // from "A Fast Bresenham Type Algorithm For Drawing Ellipses"
-  // by John Kennedy
+  CTX_CALL (c, clearviewport ());
 
-  int
-    x, y,
-    xchange, ychange,
-    ellipseerror,
-    TwoASquare, TwoBSquare,
-    StoppingX, StoppingY;
+} // ctx_clearviewport ()
 
-  if (0 == xradius && 0 == yradius)
-    return;
+// -----
 
-  TwoASquare = 2*xradius*xradius;
-  TwoBSquare = 2*yradius*yradius;
-  x = xradius;
-  y = 0;
-  xchange = yradius*yradius*(1 - 2*xradius);
-  ychange = xradius*xradius;
-  ellipseerror = 0;
-  StoppingX = TwoBSquare*xradius;
-  StoppingY = 0;
+void ctx_copyrect (bgi_context *c, int left, int top, int right,
+                   int bottom, int x, int y)
+{
+  CTX_CALL (c, copyrect (0, left, top, right, bottom, x, y));
 
-  while (StoppingX >= StoppingY) {
+} // ctx_copyrect ()
 
-    // 1st set of points, y' > -1
+// -----
 
-    line_fill (cx + x, cy - y, cx - x, cy - y);
-    line_fill (cx - x, cy + y, cx + x, cy + y);
-    y++;
-    StoppingY += TwoASquare;
-    ellipseerror += ychange;
-    ychange +=TwoASquare;
+void ctx_drawpoly (bgi_context *c, int numpoints, int *polypoints)
+{
+  CTX_CALL (c, drawpoly (numpoints, polypoints));
 
-    if ((2*ellipseerror + xchange) > 0 ) {
-      x--;
-      StoppingX -= TwoBSquare;
-      ellipseerror +=xchange;
-      xchange += TwoBSquare;
-    }
-  } // while
+} // ctx_drawpoly ()
 
-  // 1st point set is done; start the 2nd set of points
+// -----
 
-  x = 0;
-  y = yradius;
-  xchange = yradius*yradius;
-  ychange = xradius*xradius*(1 - 2*yradius);
-  ellipseerror = 0;
-  StoppingX = 0;
-  StoppingY = TwoASquare*yradius;
+void ctx_ellipse (bgi_context *c, int x, int y, int stangle, int endangle,
+                  int xradius, int yradius)
+{
+  CTX_CALL (c, ellipse (x, y, stangle, endangle, xradius, yradius));
 
-  while (StoppingX <= StoppingY ) {
+} // ctx_ellipse ()
 
-    // 2nd set of points, y' < -1
+// -----
 
-    line_fill (cx + x, cy - y, cx - x, cy - y);
-    line_fill (cx - x, cy + y, cx + x, cy + y);
-    x++;
-    StoppingX += TwoBSquare;
-    ellipseerror += xchange;
-    xchange +=TwoBSquare;
-    if ((2*ellipseerror + ychange) > 0) {
-      y--,
-        StoppingY -= TwoASquare;
-      ellipseerror += ychange;
-      ychange +=TwoASquare;
-    }
-  }
+void ctx_fillellipse (bgi_context *c, int cx, int cy, int xradius, int yradius)
+{
+  CTX_CALL (c, fillellipse (cx, cy, xradius, yradius));
 
-  // outline
+} // ctx_fillellipse ()
 
-  _ellipse (cx, cy, xradius, yradius);
+// -----
 
-  update ();
+void ctx_fillpoly (bgi_context *c, int numpoints, int *polypoints)
+{
+  CTX_CALL (c, fillpoly (numpoints, polypoints));
 
-} // fillellipse ()
+} // ctx_fillpoly ()
 
 // -----
 
-static int intcmp (const void *n1, const void *n2)
+void ctx_floodfill (bgi_context *c, int x, int y, int border)
 {
-  // helper function for fillpoly ()
-
-  return (*(const int *) n1) - (*(const int *) n2);
+  CTX_CALL (c, floodfill (x, y, border));
 
-} // intcmp ()
+} // ctx_floodfill ()
 
 // -----
 
-// the following function was adapted from the public domain
-// code by Darel Rex Finley,
-// http://alienryderflex.com/polygon_fill/
-
-void fillpoly (int numpoints, int *polypoints)
+void ctx_getimage (bgi_context *c, int left, int top, int right, int bottom,
+                   void *bitmap)
 {
-  // Draws a polygon of numpoints vertices and fills it using the
-  // current fill color.
+  CTX_CALL (c, getimage (left, top, right, bottom, bitmap));
 
-  int
-    nodes,      // number of nodes
-    *nodeX,     // array of nodes
-    ymin, ymax,
-    pixelY,
-    i, j,
-    tmp, tmpcolor;
+} // ctx_getimage ()
 
-  if (NULL == (nodeX = calloc (sizeof (int), numpoints))) {
-    fprintf (stderr, "Can't allocate memory for fillpoly()\n");
-    return;
-  }
+// -----
 
-  tmp = bgi_fg_color;
-  if (EMPTY_FILL == bgi_fill_style.pattern)
-    tmpcolor = bgi_bg_color;
-  else // all other styles
-    tmpcolor = bgi_fill_style.color;
+unsigned int ctx_getpixel (bgi_context *c, int x, int y)
+{
+  unsigned int ret;
 
-  setcolor (tmpcolor);
+  CTX_CALL (c, ret = getpixel (x, y));
+  return ret;
 
-  // find Y maxima
+} // ctx_getpixel ()
 
-  ymin = ymax = polypoints[1];
-
-  for (i = 0; i < 2 * numpoints; i += 2) {
-    if (polypoints[i + 1] < ymin)
-      ymin = polypoints[i + 1];
-    if (polypoints[i + 1] > ymax)
-      ymax = polypoints[i + 1];
-  }
+// -----
 
-  //  Loop through the rows of the image.
-  for (pixelY = ymin; pixelY < ymax; pixelY++) {
+void ctx_getpixels (bgi_context *c, int n, const int *x, const int *y,
+                    Uint32 *colors)
+{
+  CTX_CALL (c, getpixels (n, x, y, colors));
 
-    //  Build a list of nodes.
-    nodes = 0;
-    j = 2 * numpoints - 2;
+} // ctx_getpixels ()
 
-    for (i = 0; i < 2 * numpoints; i += 2) {
+// -----
 
-      if (
-          ((float) polypoints[i + 1] < (float)  pixelY &&
-           (float) polypoints[j + 1] >= (float) pixelY) ||
-          ((float) polypoints[j + 1] < (float)  pixelY &&
-           (float) polypoints[i + 1] >= (float) pixelY))
-        nodeX[nodes++] =
-        (int) (polypoints[i] + (pixelY - (float) polypoints[i + 1]) /
-               ((float) polypoints[j + 1] - (float) polypoints[i + 1]) *
-               (polypoints[j] - polypoints[i]));
-      j = i;
-    }
+void ctx_graphdefaults (bgi_context *c)
+{
+  CTX_CALL (c, graphdefaults ());
 
-    // sort the nodes
-    qsort (nodeX, nodes, sizeof (int), intcmp);
+} // ctx_graphdefaults ()
 
-    // fill the pixels between node pairs.
-    for (i = 0; i < nodes; i += 2) {
-      if (SOLID_FILL == bgi_fill_style.pattern)
-        line_fast (nodeX[i], pixelY, nodeX[i + 1], pixelY);
-      else
-        line_fill (nodeX[i], pixelY, nodeX[i + 1], pixelY);
-    }
+// -----
 
-  } //   for pixelY
+void ctx_line (bgi_context *c, int x1, int y1, int x2, int y2)
+{
+  CTX_CALL (c, line (x1, y1, x2, y2));
 
-  setcolor (tmp);
-  drawpoly (numpoints, polypoints);
+} // ctx_line ()
 
-  update ();
+// -----
 
-} // fillpoly ()
+void ctx_linerel (bgi_context *c, int dx, int dy)
+{
+  CTX_CALL (c, linerel (dx, dy));
 
+} // ctx_linerel ()
 
 // -----
 
-// These are setfillpattern-compatible arrays for the tiling patterns.
-// Taken from TurboC, http://www.sandroid.org/TurboC/
+void ctx_lineto (bgi_context *c, int x, int y)
+{
+  CTX_CALL (c, lineto (x, y));
 
-static Uint8 fill_patterns[1 + USER_FILL][8] = {
-  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // EMPTY_FILL
-  {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, // SOLID_FILL
-  {0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00}, // LINE_FILL
-  {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80}, // LTSLASH_FILL
-  {0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x81}, // SLASH_FILL
-  {0xc0, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x81}, // BKSLASH_FILL
-  {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01}, // LTBKSLASH_FILL
-  {0x22, 0x22, 0xff, 0x22, 0x22, 0x22, 0xff, 0x22}, // HATCH_FILL
-  {0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81}, // XHATCH_FILL
-  {0x11, 0x44, 0x11, 0x44, 0x11, 0x44, 0x11, 0x44}, // INTERLEAVE_FILL
-  {0x10, 0x00, 0x01, 0x00, 0x10, 0x00, 0x01, 0x00}, // WIDE_DOT_FILL
-  {0x11, 0x00, 0x44, 0x00, 0x11, 0x00, 0x44, 0x00}, // CLOSE_DOT_FILL
-  {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}  // USER_FILL
-};
+} // ctx_lineto ()
 
-static void ff_putpixel (int x, int y)
+// -----
+
+void ctx_moverel (bgi_context *c, int dx, int dy)
 {
-  // similar to putpixel (), but uses fill patterns
+  CTX_CALL (c, moverel (dx, dy));
 
-  x += vp.left;
-  y += vp.top;
+} // ctx_moverel ()
 
-  // if the corresponding bit in the pattern is 1
-  if ( (fill_patterns[bgi_fill_style.pattern][y % 8] >> x % 8) & 1)
-    putpixel_copy (x, y, palette[bgi_fill_style.color]);
-  else
-    putpixel_copy (x, y, palette[bgi_bg_color]);
+// -----
 
-} // ff_putpixel ()
+void ctx_moveto (bgi_context *c, int x, int y)
+{
+  CTX_CALL (c, moveto (x, y));
 
-// -----
+} // ctx_moveto ()
 
-// the following code is adapted from "A Seed Fill Algorithm"
-// by Paul Heckbert, "Graphics Gems", Academic Press, 1990
+// -----
 
-// Filled horizontal segment of scanline y for xl<=x<=xr.
-// Parent segment was on line y-dy. dy=1 or -1
+void ctx_outtext (bgi_context *c, char *textstring)
+{
+  CTX_CALL (c, outtext (textstring));
 
-typedef struct {
-  int y, xl, xr, dy;
-} Segment;
+} // ctx_outtext ()
 
-// max depth of stack - was 10000
+// -----
 
-#define STACKSIZE 2000
+void ctx_outtextxy (bgi_context *c, int x, int y, char *textstring)
+{
+  CTX_CALL (c, outtextxy (x, y, textstring));
 
-Segment
-  stack[STACKSIZE],
-  *sp = stack; // stack of filled segments
+} // ctx_outtextxy ()
 
-// the following functions were implemented as unreadable macros
+// -----
 
-static inline void ff_push (int y, int xl, int xr, int dy)
+void ctx_pieslice (bgi_context *c, int x, int y, int stangle, int endangle,
+                   int radius)
 {
-  // push new segment on stack
-  if (sp < stack + STACKSIZE && y + dy >= 0 &&
-      y + dy <= vp.bottom - vp.top ) {
-    sp->y = y;
-    sp->xl = xl;
-    sp->xr = xr;
-    sp->dy = dy;
-    sp++;
-  }
-}
+  CTX_CALL (c, pieslice (x, y, stangle, endangle, radius));
+
+} // ctx_pieslice ()
 
 // -----
 
-static inline void ff_pop (int *y, int *xl, int *xr, int *dy)
+void ctx_putcolormap (bgi_context *c, int left, int top, int width,
+                      int height, const float *values, float vmin,
+                      float vmax, const Uint32 *lut, int lutsize)
 {
-  // pop segment off stack
-  sp--;
-  *dy = sp->dy;
-  *y = sp->y + *dy;
-  *xl = sp->xl;
-  *xr = sp->xr;
-}
+  CTX_CALL (c, putcolormap (left, top, width, height, values,
+                            vmin, vmax, lut, lutsize));
+
+} // ctx_putcolormap ()
 
 // -----
 
-// non-recursive implementation; adapted from Paul Heckbert'
-// Seed Fill algorithm, in "Graphics Gems", Academic Press, 1990
+void ctx_putcolormapint (bgi_context *c, int left, int top, int width,
+                         int height, const int *values,
+                         const Uint32 *lut, int lutsize)
+{
+  CTX_CALL (c, putcolormapint (left, top, width, height, values,
+                               lut, lutsize));
 
-// fill: set the pixel at (x,y) and all of its 4-connected neighbors
-// with the same pixel value to the new pixel value nv.
-// A 4-connected neighbor is a pixel above, below, left, or right
-// of a pixel.
+} // ctx_putcolormapint ()
 
-void _floodfill (int x, int y, int border)
+// -----
+
+void ctx_putimage (bgi_context *c, int left, int top, void *bitmap, int op)
 {
-  // Fills an enclosed area, containing the x and y points bounded by
-  // the border color. The area is filled using the current fill color.
+  CTX_CALL (c, putimage (left, top, bitmap, op));
 
-  int
-    start,
-    x1, x2,
-    dy = 0;
-  unsigned int
-    oldcol;
+} // ctx_putimage ()
 
-  oldcol = getpixel (x, y);
-  ff_push (y, x, x, 1);           // needed in some cases
-  ff_push (y + 1, x, x, -1);      // seed segment (popped 1st)
+// -----
 
-  while (sp > stack) {
+void ctx_putimagescaled (bgi_context *c, int left, int top, int right,
+                         int bottom, void *bitmap, int op, int filter)
+{
+  CTX_CALL (c, putimagescaled (left, top, right, bottom, bitmap, op,
+                               filter));
 
-    // pop segment off stack and fill a neighboring scan line
+} // ctx_putimagescaled ()
 
-    ff_pop (&y, &x1, &x2, &dy);
+// -----
 
-     // segment of scan line y-dy for x1<=x<=x2 was previously filled,
-     // now explore adjacent pixels in scan line y
+void ctx_putpixel (bgi_context *c, int x, int y, int color)
+{
+  CTX_CALL (c, putpixel (x, y, color));
 
-    for (x = x1; x >= 0 && getpixel (x, y) == oldcol; x--)
-      ff_putpixel (x, y);
+} // ctx_putpixel ()
 
-    if (x >= x1) {
-      for (x++; x <= x2 && getpixel (x, y) == border; x++)
-        ;
-      start = x;
-      if (x > x2)
-        continue;
-    }
-    else {
-      start = x + 1;
-      if (start < x1)
-        ff_push (y, start, x1 - 1, -dy);    // leak on left?
-      x = x1 + 1;
-    }
-    do {
-      for (x1 = x; x <= vp.right && getpixel (x, y) != border; x++)
-        ff_putpixel (x, y);
-      ff_push (y, start, x - 1, dy);
-      if (x > x2 + 1)
-        ff_push (y, x2 + 1, x - 1, -dy);    // leak on right?
-      for (x++; x <= x2 && getpixel (x, y) == border; x++)
-        ;
-      start = x;
-    } while (x <= x2);
+// -----
 
-  } // while
+void ctx_putpixels (bgi_context *c, int n, const int *x, const int *y,
+                    const Uint32 *colors)
+{
+  CTX_CALL (c, putpixels (n, x, y, colors));
 
-} // _floodfill ()
+} // ctx_putpixels ()
 
 // -----
 
-void floodfill (int x, int y, int border)
+void ctx_readimagefile (bgi_context *c, char *bitmapname, int x1, int y1,
+                        int x2, int y2)
 {
-  unsigned int
-    oldcol;
-  int
-    found,
-    tmp_pattern,
-    tmp_color;
+  CTX_CALL (c, readimagefile (bitmapname, x1, y1, x2, y2));
 
-  oldcol = getpixel (x, y);
+} // ctx_readimagefile ()
 
-  // the way the above implementation of floodfill works,
-  // the fill colour must be different than the border colour
-  // and the current shape's background color.
+// -----
 
-  if (oldcol == border || oldcol == bgi_fill_style.color ||
-      x < 0 || x > vp.right - vp.left || // out of viewport/window?
-      y < 0 || y > vp.bottom - vp.top)
-    return;
+void ctx_rectangle (bgi_context *c, int x1, int y1, int x2, int y2)
+{
+  CTX_CALL (c, rectangle (x1, y1, x2, y2));
 
-  // special case for fill patterns. The background colour can't be
-  // the same in the area to be filled and in the fill pattern.
+} // ctx_rectangle ()
 
-  if (SOLID_FILL == bgi_fill_style.pattern) {
-    _floodfill (x, y, border);
-    return;
-  }
-  else { // fill patterns
-    if (bgi_bg_color == oldcol) {
-      // solid fill first...
-      tmp_pattern = bgi_fill_style.pattern;
-      bgi_fill_style.pattern = SOLID_FILL;
-      tmp_color = bgi_fill_style.color;
-      // find a suitable temporary fill colour; it must be different
-      // than the border and the background
-      found = NOPE;
-      while (!found) {
-        bgi_fill_style.color = BLUE + random (WHITE);
-        if (oldcol != bgi_fill_style.color &&
-            border != bgi_fill_style.color)
-          found = YEAH;
-      }
-      _floodfill (x, y, border);
-      // ...then pattern fill
-      bgi_fill_style.pattern = tmp_pattern;
-      bgi_fill_style.color = tmp_color;
-      _floodfill (x, y, border);
-    }
-    else
-      _floodfill (x, y, border);
-  }
+// -----
 
-  update ();
+void ctx_scrollring (bgi_context *c, int n, int color)
+{
+  CTX_CALL (c, scrollring (n, color));
 
-} // floodfill ()
+} // ctx_scrollring ()
 
 // -----
 
-int getactivepage (void)
+void ctx_scrollviewport (bgi_context *c, int dx, int dy, int color)
 {
-  // Returns the active page number.
-
-  return (bgi_ap);
+  CTX_CALL (c, scrollviewport (dx, dy, color));
 
-} // getactivepage ()
+} // ctx_scrollviewport ()
 
 // -----
 
-void getarccoords (struct arccoordstype *arccoords)
+void ctx_sector (bgi_context *c, int x, int y, int stangle, int endangle,
+                 int xradius, int yradius)
 {
-  // Gets the coordinates of the last call to arc(), filling the
-  // arccoords structure.
-
-  arccoords->x = bgi_last_arc.x;
-  arccoords->y = bgi_last_arc.y;
-  arccoords->xstart = bgi_last_arc.xstart;
-  arccoords->ystart = bgi_last_arc.ystart;
-  arccoords->xend = bgi_last_arc.xend;
-  arccoords->yend = bgi_last_arc.yend;
+  CTX_CALL (c, sector (x, y, stangle, endangle, xradius, yradius));
 
-} // getarccoords ()
+} // ctx_sector ()
 
 // -----
 
-void getaspectratio (int *xasp, int *yasp)
+void ctx_setbkcolor (bgi_context *c, int col)
 {
-  // Retrieves the current graphics mode's aspect ratio.
-  // Irrelevant on modern hardware.
+  CTX_CALL (c, setbkcolor (col));
 
-  *xasp = 10000;
-  *yasp = 10000;
-
-} // getaspectratio ()
+} // ctx_setbkcolor ()
 
 // -----
 
-int getbkcolor (void)
+void ctx_setbkrgbcolor (bgi_context *c, int index)
 {
-  // Returns the current background color.
+  CTX_CALL (c, setbkrgbcolor (index));
 
-  return bgi_bg_color;
-
-} // getbkcolor ()
+} // ctx_setbkrgbcolor ()
 
 // -----
 
-// this function should be simply named "getch", but this name
-// causes a bug in MSYS2.
-// "getch" is defined as a macro in SDL_bgi.h
-
-int bgi_getch (void)
+void ctx_setcolor (bgi_context *c, int col)
 {
-  // Waits for a key and returns its ASCII value or code,
-  // or QUIT if the user asked to close the window
+  CTX_CALL (c, setcolor (col));
 
-  int
-    key, type;
+} // ctx_setcolor ()
 
-  if (window_is_hidden)
-    return (getchar ());
+// -----
 
-  do {
-    key = getevent ();
-    type = eventtype ();
+void ctx_setfillpattern (bgi_context *c, char *upattern, int color)
+{
+  CTX_CALL (c, setfillpattern (upattern, color));
 
-    if (QUIT == type)
-      return QUIT;
+} // ctx_setfillpattern ()
 
-    if (SDL_KEYDOWN == type &&
-        key != KEY_LEFT_CTRL &&
-        key != KEY_RIGHT_CTRL &&
-        key != KEY_LEFT_SHIFT &&
-        key != KEY_RIGHT_SHIFT &&
-        key != KEY_LEFT_ALT &&
-        key != KEY_RIGHT_ALT &&
-        key != KEY_CAPSLOCK &&
-        key != KEY_LGUI &&
-        key != KEY_RGUI &&
-        key != KEY_MENU &&
-        key != KEY_ALT_GR) // can't catch AltGr!
-      return (int) key;
-  } while (1);
+// -----
 
-  // we should never get here...
-  return 0;
+void ctx_setfillstyle (bgi_context *c, int pattern, int color)
+{
+  CTX_CALL (c, setfillstyle (pattern, color));
 
-} // bgi_getch ()
+} // ctx_setfillstyle ()
 
 // -----
 
-int getcolor (void)
+void ctx_setlinestyle (bgi_context *c, int linestyle, unsigned upattern,
+                       int thickness)
 {
-  // Returns the current drawing (foreground) color.
-
-  return bgi_fg_color;
+  CTX_CALL (c, setlinestyle (linestyle, upattern, thickness));
 
-} // getcolor ()
+} // ctx_setlinestyle ()
 
 // -----
 
-int getcurrentwindow (void)
+void ctx_setrgbcolor (bgi_context *c, int index)
 {
-  // Returns the ID of current window
+  CTX_CALL (c, setrgbcolor (index));
 
-  return current_window;
-
-} // getcurrentwindow ()
+} // ctx_setrgbcolor ()
 
 // -----
 
-struct palettetype *getdefaultpalette (void)
+void ctx_setrgbpalette (bgi_context *c, int colornum, int red, int green,
+                        int blue)
 {
-  // Returns the default palette
+  CTX_CALL (c, setrgbpalette (colornum, red, green, blue));
 
-  return &pal;
-
-} // getdefaultpalette ()
+} // ctx_setrgbpalette ()
 
 // -----
 
-char *getdrivername (void)
+void ctx_setringviewport (bgi_context *c, int mode)
 {
-  // Returns a pointer to a string containing the name
-  //  of the current graphics driver.
-
-  return ("SDL_bgi");
+  CTX_CALL (c, setringviewport (mode));
 
-} // getdrivername ()
+} // ctx_setringviewport ()
 
 // -----
 
-int getevent (void)
+void ctx_settextjustify (bgi_context *c, int horiz, int vert)
 {
-  // Waits for a keypress or mouse click, and returns the code of
-  // the mouse button or key that was pressed.
-
-  SDL_Event event;
-
-  // wait for an event
-  while (1) {
+  CTX_CALL (c, settextjustify (horiz, vert));
 
-    // while (SDL_PollEvent (&event))
-    while (SDL_WaitEvent (&event))
+} // ctx_settextjustify ()
 
-      switch (event.type) {
+// -----
 
-      case SDL_WINDOWEVENT:
+void ctx_settextstyle (bgi_context *c, int font, int direction, int charsize)
+{
+  CTX_CALL (c, settextstyle (font, direction, charsize));
 
-        switch (event.window.event) {
+} // ctx_settextstyle ()
 
-        case SDL_WINDOWEVENT_SHOWN:
-        case SDL_WINDOWEVENT_EXPOSED:
-          refresh_window ();
-          break;
+// -----
 
-        case SDL_WINDOWEVENT_CLOSE:
-          bgi_last_event = QUIT;
-          return QUIT;
-          break;
+void ctx_setusercharsize (bgi_context *c, int multx, int divx, int multy,
+                          int divy)
+{
+  CTX_CALL (c, setusercharsize (multx, divx, multy, divy));
 
-        default:
-          ;
+} // ctx_setusercharsize ()
 
-        } // switch (event.window.event)
+// -----
 
-        break;
+void ctx_setviewport (bgi_context *c, int left, int top, int right, int bottom,
+                      int clip)
+{
+  CTX_CALL (c, setviewport (left, top, right, bottom, clip));
 
-      case SDL_KEYDOWN:
-        bgi_last_event = SDL_KEYDOWN;
-        bgi_mouse_x = bgi_mouse_y = -1;
-        return event.key.keysym.sym;
-        break;
+} // ctx_setviewport ()
 
-      case SDL_MOUSEBUTTONDOWN:
-        bgi_last_event = SDL_MOUSEBUTTONDOWN;
-        bgi_mouse_x = event.button.x;
-        bgi_mouse_y = event.button.y;
-        return event.button.button;
-        break;
+// -----
 
-      case SDL_MOUSEWHEEL:
-        bgi_last_event = SDL_MOUSEWHEEL;
-        SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y);
-        if (1 == event.wheel.y) // up
-          return (WM_WHEELUP);
-        else
-          return (WM_WHEELDOWN);
-        break;
+void ctx_setwritemode (bgi_context *c, int mode)
+{
+  CTX_CALL (c, setwritemode (mode));
 
-      default:
-        ;
+} // ctx_setwritemode ()
 
-      } // switch (event.type)
+// -----
 
-  } // while (1)
+void ctx_shadeviewport (bgi_context *c, bgi_shader shader, void *userdata)
+{
+  CTX_CALL (c, shadeviewport (shader, userdata));
 
-} // getevent ()
+} // ctx_shadeviewport ()
 
 // -----
 
-void getfillpattern (char *pattern)
+void ctx_writeimagefile (bgi_context *c, char *filename, int left, int top,
+                         int right, int bottom)
 {
-  // Copies the user-defined fill pattern, as set by setfillpattern,
-  // into the 8-byte area pointed to by pattern.
+  CTX_CALL (c, writeimagefile (filename, left, top, right, bottom));
 
-  int i;
-
-  for (i = 0; i < 8; i++)
-    pattern[i] = (char) fill_patterns[USER_FILL][i];
-
-} // getfillpattern ()
+} // ctx_writeimagefile ()
 
 // -----
 
-void getfillsettings (struct fillsettingstype *fillinfo)
+void freecontext (bgi_context *c)
 {
-  // Fills the fillsettingstype structure pointed to by fillinfo
-  // with information about the current fill pattern and fill color.
+  // Frees a context created by createcontext(). If it is the
+  // current context, the default context becomes current.
 
-  fillinfo->pattern = bgi_fill_style.pattern;
-  fillinfo->color = bgi_fill_color;
+  if (NULL == c || &bgi_default_ctx == c)
+    return;
 
-} // getfillsettings ()
+  if (bgi_ctx == c)
+    bgi_ctx = &bgi_default_ctx;
+
+  if (c->layer_name) {
+    if (c->layer_window >= 0) {
+      if (update_mutex)
+        lock_update ();
+      layer_unlink (c);
+      if (update_mutex)
+        SDL_UnlockMutex (update_mutex);
+      layer_update (c);
+      if (current_window == c->layer_window)
+        alias_window_surface ();
+      bind_default_context ();
+    }
+    free (c->layer_name);
+  }
 
-// -----
+  if (c->canvas_bytes) {
+    if (c->canvas_window >= 0) {
+      bgi_canvas[c->canvas_window] = NULL;
+      if (current_window == c->canvas_window) {
+        alias_window_surface ();
+        bind_default_context ();
+        CTX_CALL (&bgi_default_ctx, update ());
+      }
+    }
+#if defined (BGI_HAVE_MMAP)
+    munmap (c->pixels, c->canvas_bytes);
+#else
+    free (c->pixels);
+#endif
+  }
 
-int getgraphmode (void)
-{
-  // Returns the current graphics mode.
+  SDL_AtomicLock (&bgi_bitmap_lock);
+  for (struct bgi_context **p = &bgi_bitmaps; *p; p = &(*p)->next_bitmap)
+    if (c == *p) {
+      *p = c->next_bitmap;
+      break;
+    }
+  SDL_AtomicUnlock (&bgi_bitmap_lock);
 
-  return bgi_gm;
+  // new pixels may be allocated at the same address
+  if (c->buffer || c->canvas_bytes)
+    snap_forget (c->pixels);
 
-} // getgraphmode ()
+  free (c->stroke_span);
+  free (c->buffer);
+  free (c->staging);
+  free (c);
+
+} // freecontext ()
 
 // -----
 
-void getimage (int left, int top, int right, int bottom, void *bitmap)
+Uint32 *getcontextpixels (bgi_context *c, int *width, int *height)
 {
-  // Copies a bit image of the specified region into the memory
-  // pointed by bitmap.
+  // Returns the ARGB pixels a context draws on; rows are
+  // *width pixels long, unless the context is tiled.
 
-  Uint32 bitmap_w, bitmap_h, *tmp;
-  int i = 2, x, y;
+  if (NULL == c)
+    c = &bgi_default_ctx;
+  follow_active_page (c);
 
-  // bitmap has already been malloc()'ed by the user.
-  tmp = bitmap;
-  bitmap_w = right - left + 1;
-  bitmap_h = bottom - top + 1;
+  if (width)
+    *width = c->maxx + 1;
+  if (height)
+    *height = c->maxy + 1;
 
-  // copy width and height to the beginning of bitmap
-  memcpy (tmp, &bitmap_w, sizeof (Uint32));
-  memcpy (tmp + 1, &bitmap_h, sizeof (Uint32));
+  // the pixels may be written behind the drawing functions' back
+  snap_forget (c->pixels);
 
-  // copy image to bitmap
-  for (y = top + vp.top; y <= bottom + vp.top; y++)
-    for (x = left + vp.left; x <= right + vp.left; x++)
-      tmp [i++] = getpixel_raw (x, y);
+  return c->pixels;
 
-} // getimage ()
+} // getcontextpixels ()
 
 // -----
 
-void getlinesettings (struct linesettingstype *lineinfo)
+bgi_context *getcurrentcontext (void)
 {
-  // Fills the linesettingstype structure pointed by lineinfo with
-  // information about the current line style, pattern, and thickness.
+  // Returns the current context of the calling thread.
 
-  lineinfo->linestyle = bgi_line_style.linestyle;
-  lineinfo->upattern = bgi_line_style.upattern;
-  lineinfo->thickness = bgi_line_style.thickness;
+  return bgi_ctx;
 
-} // getlinesettings ();
+} // getcurrentcontext ()
 
 // -----
 
-int getmaxcolor (void)
+void setcurrentcontext (bgi_context *c)
 {
-  // Returns the maximum color value available (MAXCOLORS).
+  // Makes c the current context of the calling thread; all
+  // subsequent drawing from this thread goes to c. NULL
+  // selects the default context.
 
-  if (! bgi_argb_mode)
-    return MAXCOLORS;
-  else
-    return PALETTE_SIZE;
+  bgi_ctx = (NULL == c) ? &bgi_default_ctx : c;
+  follow_active_page (bgi_ctx);
 
-} // getmaxcolor ()
+} // setcurrentcontext ()
 
 // -----
 
-int getmaxmode (void)
+static struct bgi_context *bitmap_context (const void *bitmap)
 {
-  // Returns the maximum mode number for the current driver.
+  // Returns the context of a bitmap made by createbitmap (),
+  // or NULL.
 
-  return SDL_FULLSCREEN;
+  struct bgi_context
+    *c;
 
-} // getmaxmode ()
+  SDL_AtomicLock (&bgi_bitmap_lock);
+  for (c = bgi_bitmaps; c; c = c->next_bitmap)
+    if (bitmap == c->buffer)
+      break;
+  SDL_AtomicUnlock (&bgi_bitmap_lock);
+
+  return c;
+
+} // bitmap_context ()
 
 // -----
 
-int getmaxx ()
+void *createbitmap (int width, int height)
 {
-  // Returns the maximum x screen coordinate.
+  // Creates a width x height offscreen bitmap, laid out like those
+  // saved by getimage (), and clears it to black. After settarget
+  // (), all drawing goes to the bitmap, in its own viewport.
 
-  return bgi_maxx;
+  struct bgi_context
+    *c;
+  Uint32
+    w = width,
+    h = height;
 
-} // getmaxx ()
+  if (width < 1 || height < 1) {
+    fprintf (stderr, "createbitmap(): invalid size %d x %d.\n",
+             width, height);
+    return NULL;
+  }
 
-// -----
+  c = new_context ("createbitmap", width, height, 2, NULL);
+  if (NULL == c)
+    return NULL;
 
-int getmaxy ()
-{
-  // Returns the maximum y screen coordinate.
+  memcpy (c->buffer, &w, sizeof (Uint32));
+  memcpy (c->buffer + 1, &h, sizeof (Uint32));
 
-  return bgi_maxy;
+  SDL_AtomicLock (&bgi_bitmap_lock);
+  c->next_bitmap = bgi_bitmaps;
+  bgi_bitmaps = c;
+  SDL_AtomicUnlock (&bgi_bitmap_lock);
 
-} // getmaxy ()
+  return c->buffer;
+
+} // createbitmap ()
 
 // -----
 
-char *getmodename (int mode_number)
+void freebitmap (void *bitmap)
 {
-  // Returns a pointer to a string containing
-  // the name of the specified graphics mode.
+  // Frees a bitmap made by createbitmap (). If it is the target
+  // of the calling thread, drawing goes back to the pages.
 
-  switch (mode_number) {
+  struct bgi_context
+    *c = bitmap_context (bitmap);
 
-  case SDL_CGALO:
-    return "SDL_CGALO";
-    break;
+  if (NULL == c) {
+    if (bitmap)
+      fprintf (stderr, "freebitmap(): not a bitmap.\n");
+    return;
+  }
 
-  case SDL_CGAHI:
-    return "SDL_CGAHI";
-    break;
+  freecontext (c);
 
-  case SDL_EGA:
-    return "SDL_EGA";
-    break;
+} // freebitmap ()
 
-  case SDL_VGA:
-    return "SDL_VGA";
-    break;
+// -----
 
-  case SDL_HERC:
-    return "SDL_HERC";
-    break;
+void settarget (void *bitmap)
+{
+  // Makes the calling thread draw on a bitmap made by
+  // createbitmap (); NULL goes back to the active page.
 
-  case SDL_PC3270:
-    return "SDL_PC3270";
-    break;
+  struct bgi_context
+    *c = NULL;
 
-  case SDL_1024x768:
-    return "SDL_1024x768";
-    break;
+  if (bitmap) {
+    c = bitmap_context (bitmap);
+    if (NULL == c) {
+      fprintf (stderr, "settarget(): not a bitmap.\n");
+      return;
+    }
+  }
 
-  case SDL_1152x900:
-    return "SDL_1152x900";
-    break;
+  setcurrentcontext (c);
 
-  case SDL_1280x1024:
-    return "SDL_1280x1024";
-    break;
+} // settarget ()
 
-  case SDL_1366x768:
-    return "SDL_1366x768";
-    break;
+// -----
 
-  case SDL_USER:
-    return "SDL_USER";
-    break;
+// Snapshots copy the target a tile at a time. A new snapshot starts
+// from the tiles of the latest snapshot of the same target and only
+// copies those whose pixels changed, so a long undo history costs
+// memory in proportion to what was drawn between snapshots. The
+// latest snapshot of a target keeps a map of the tiles drawn on
+// since it was taken: the functions that write pixels mark it
+// through snap_touch (), any context drawing on the target, and
+// only marked tiles are compared and copied by the next snapshot.
+// lockframebuffer () and getcontextpixels () mark the whole target.
 
-  case SDL_FULLSCREEN:
-    return "SDL_FULLSCREEN";
-    break;
+static void snap_find (struct bgi_context *c)
+{
+  // Looks up the latest snapshot of the pixels of c, whose map
+  // snap_touch () marks.
 
-  default:
-  case SDL_800x600:
-    return "SDL_800x600";
-    break;
+  struct bgi_snapshot
+    *s;
 
-  } // switch
+  SDL_AtomicLock (&bgi_snap_lock);
+  for (s = bgi_snapshots; s; s = s->next)
+    if (s->dirty && s->target == c->pixels &&
+        s->width == c->maxx + 1 && s->height == c->maxy + 1)
+      break;
+  c->snap = s;
+  c->snap_pixels = c->pixels;
+  c->snap_gen = bgi_snap_gen;
+  SDL_AtomicUnlock (&bgi_snap_lock);
 
-} // getmodename ()
+} // snap_find ()
 
 // -----
 
-void getmoderange (int graphdriver, int *lomode, int *himode)
+static void snap_touch (struct bgi_context *c,
+                        int x1, int y1, int x2, int y2)
 {
-  // Gets the range of valid graphics modes.
+  // Marks the tiles of the absolute rectangle (x1, y1, x2, y2) of
+  // c as drawn on, if the target has a snapshot. Worker threads
+  // don't call it: their caller marks the whole area first.
 
-  // return dummy values
-  *lomode = 0;
-  *himode = 0;
+  struct bgi_snapshot
+    *s;
 
-} // getmoderange ()
+  if (c->snap_gen != bgi_snap_gen || c->snap_pixels != c->pixels)
+    snap_find (c);
+  s = c->snap;
+  if (NULL == s)
+    return;
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 >= s->width)
+    x2 = s->width - 1;
+  if (y2 >= s->height)
+    y2 = s->height - 1;
+  if (x1 > x2 || y1 > y2)
+    return;
+
+  x1 /= SNAP_TILE;
+  x2 /= SNAP_TILE;
+  for (int ty = y1 / SNAP_TILE; ty <= y2 / SNAP_TILE; ty++)
+    memset (s->dirty + ty * s->tiles_x + x1, 1, x2 - x1 + 1);
+
+} // snap_touch ()
 
 // -----
 
-void getpalette (struct palettetype *palette)
+static void snap_forget (const Uint32 *target)
 {
-  // Fills the palettetype structure pointed by palette with
-  // information about the current palette's size and colors.
+  // Marks all tiles of 'target' as drawn on, when it was written
+  // as a whole or is about to be freed.
 
-  int i;
-
-  for (i = 0; i <= MAXCOLORS; i++)
-    palette->colors[i] = pal.colors[i];
+  SDL_AtomicLock (&bgi_snap_lock);
+  for (struct bgi_snapshot *s = bgi_snapshots; s; s = s->next)
+    if (s->dirty && s->target == target)
+      memset (s->dirty, 1, s->tiles_x * s->tiles_y);
+  SDL_AtomicUnlock (&bgi_snap_lock);
 
-} // getpalette ()
+} // snap_forget ()
 
 // -----
 
-int getpalettesize (struct palettetype *palette)
+static void snap_tile_rect (const struct bgi_snapshot *s, int i,
+                            int *x, int *y, int *w, int *h)
 {
-  // Returns the size of the palette.
+  // Returns the rectangle of tile i of snapshot s.
 
-  // !!! BUG - don't ignore the parameter
-  return BGI_COLORS + TMP_COLORS + PALETTE_SIZE;
+  *x = (i % s->tiles_x) * SNAP_TILE;
+  *y = (i / s->tiles_x) * SNAP_TILE;
+  *w = (*x + SNAP_TILE > s->width) ? s->width - *x : SNAP_TILE;
+  *h = (*y + SNAP_TILE > s->height) ? s->height - *y : SNAP_TILE;
 
-} // getpalettesize ()
+} // snap_tile_rect ()
 
 // -----
 
-static Uint32 getpixel_raw (int x, int y)
+static int snap_tile_equal (const SnapTile *t, int x, int y,
+                            int w, int h)
 {
-  // Returns a pixel as Uint32 value
+  // Returns YEAH if tile t holds the w x h pixels of the current
+  // target at (x, y).
+
+  int
+    n;
+  size_t
+    offset;
+
+  for (int row = 0; row < h; row++)
+    for (int i = 0; i < w; i += n) {
+      n = ring_run (bgi_ctx, x + i, x + w - 1, y + row, &offset);
+      if (memcmp (t->pixels + row * w + i, bgi_ctx->pixels + offset,
+                  n * sizeof (Uint32)))
+        return NOPE;
+    }
 
-  return bgi_activepage[current_window][y * (bgi_maxx + 1) + x];
+  return YEAH;
 
-} // getpixel_raw ()
+} // snap_tile_equal ()
 
 // -----
 
-static int is_in_range (int x, int x1, int x2)
+static void snap_tile_drop (SnapTile *t)
 {
-  // Utility function for getpixel ()
+  // Releases a reference to tile t, freeing it after the last one.
 
-  return (x >= x1 && x <= x2);
+  int
+    refs;
 
-} // is_in_range ()
+  if (NULL == t)
+    return;
 
-// -----
+  SDL_AtomicLock (&bgi_snap_lock);
+  refs = --t->refs;
+  SDL_AtomicUnlock (&bgi_snap_lock);
 
-unsigned int getpixel (int x, int y)
-{
-  // Returns the color of the pixel located at (x, y).
+  if (0 == refs)
+    free (t);
 
-  int col;
-  Uint32 tmp;
+} // snap_tile_drop ()
 
-  x += vp.left;
-  y += vp.top;
+// -----
 
-  // out of screen?
-  if (! is_in_range (x, 0, bgi_maxx) &&
-      ! is_in_range (y, 0, bgi_maxy))
-    return bgi_bg_color;
+bgi_snapshot *snapshotpage (void)
+{
+  // Returns a snapshot of the current target, usually the active
+  // page, for restorepage (); NULL on failure.
 
-  tmp = getpixel_raw (x, y);
+  struct bgi_snapshot
+    *s,
+    *last;
+  SnapTile
+    *t;
+  Uint8
+    *dirty;
+  int
+    i, x, y, w, h,
+    ntiles;
 
-  // now find the colour
+  s = calloc (1, sizeof (struct bgi_snapshot));
+  if (NULL == s) {
+    fprintf (stderr, "snapshotpage(): out of memory.\n");
+    return NULL;
+  }
+  s->target = bgi_ctx->pixels;
+  s->width = bgi_ctx->maxx + 1;
+  s->height = bgi_ctx->maxy + 1;
+  s->tiles_x = (s->width + SNAP_TILE - 1) / SNAP_TILE;
+  s->tiles_y = (s->height + SNAP_TILE - 1) / SNAP_TILE;
+  ntiles = s->tiles_x * s->tiles_y;
+  s->tile = calloc (ntiles, sizeof (SnapTile *));
+  dirty = malloc (ntiles);
+  if (NULL == s->tile || NULL == dirty) {
+    fprintf (stderr, "snapshotpage(): out of memory.\n");
+    free (s->tile);
+    free (dirty);
+    free (s);
+    return NULL;
+  }
 
-  for (col = BLACK; col < WHITE + 1; col++)
-    if (tmp == palette[col])
-      return col;
+  // share the tiles of the latest snapshot of this target, and take
+  // over its map of what was drawn since...
+  SDL_AtomicLock (&bgi_snap_lock);
+  for (last = bgi_snapshots; last; last = last->next)
+    if (last->dirty && last->target == s->target &&
+        last->width == s->width && last->height == s->height)
+      break;
+  if (last) {
+    for (i = 0; i < ntiles; i++) {
+      s->tile[i] = last->tile[i];
+      s->tile[i]->refs++;
+    }
+    s->dirty = last->dirty;
+    last->dirty = NULL;
+  }
+  else {
+    memset (dirty, 1, ntiles);
+    s->dirty = dirty;
+    dirty = NULL;
+  }
+  s->next = bgi_snapshots;
+  bgi_snapshots = s;
+  bgi_snap_gen++;
+  SDL_AtomicUnlock (&bgi_snap_lock);
+  free (dirty);
+
+  // ...and copy the tiles drawn on that changed
+  for (i = 0; i < ntiles; i++) {
+    if (0 == s->dirty[i])
+      continue;
+    s->dirty[i] = 0;
+    snap_tile_rect (s, i, &x, &y, &w, &h);
+    if (s->tile[i] && snap_tile_equal (s->tile[i], x, y, w, h))
+      continue;
+    t = malloc (sizeof (SnapTile) + w * h * sizeof (Uint32));
+    if (NULL == t) {
+      fprintf (stderr, "snapshotpage(): out of memory.\n");
+      s->dirty[i] = 1;
+      freesnapshot (s);
+      return NULL;
+    }
+    t->refs = 1;
+    for (int row = 0; row < h; row++)
+      load_row (bgi_ctx, bgi_ctx->pixels, t->pixels + row * w,
+                x, x + w - 1, y + row);
+    snap_tile_drop (s->tile[i]);
+    s->tile[i] = t;
+  }
 
-  // if it's not a BGI color, just return the 0xAARRGGBB value
-  return tmp;
+  return s;
 
-} // getpixel ()
+} // snapshotpage ()
 
 // -----
 
-void gettextsettings (struct textsettingstype *texttypeinfo)
+void restorepage (bgi_snapshot *s)
 {
-  // Fills the textsettingstype structure pointed to by texttypeinfo
-  // with information about the current text font, direction, size,
-  // and justification.
+  // Brings back the current target as it was when snapshot s was
+  // taken; only the tiles that differ are written and updated.
 
-  texttypeinfo->font = bgi_txt_style.font;
-  texttypeinfo->direction = bgi_txt_style.direction;
-  texttypeinfo->charsize = bgi_txt_style.charsize;
-  texttypeinfo->horiz = bgi_txt_style.horiz;
-  texttypeinfo->vert = bgi_txt_style.vert;
+  int
+    i, x, y, w, h,
+    stride = bgi_ctx->maxx + 1,
+    x1 = stride, y1 = bgi_ctx->maxy + 1, x2 = -1, y2 = -1;
 
-} // gettextsettings ()
+  if (NULL == s)
+    return;
+
+  if (s->width != bgi_ctx->maxx + 1 || s->height != bgi_ctx->maxy + 1) {
+    fprintf (stderr, "restorepage(): the snapshot has a different "
+             "size.\n");
+    return;
+  }
+
+  for (i = 0; i < s->tiles_x * s->tiles_y; i++) {
+    // tiles not drawn on since the latest snapshot still hold it
+    if (s->dirty && s->target == bgi_ctx->pixels && 0 == s->dirty[i])
+      continue;
+    snap_tile_rect (s, i, &x, &y, &w, &h);
+    if (snap_tile_equal (s->tile[i], x, y, w, h))
+      continue;
+    for (int row = 0; row < h; row++)
+      store_row (x, x + w - 1, y + row, s->tile[i]->pixels + row * w,
+                 COPY_PUT);
+    if (x < x1)
+      x1 = x;
+    if (y < y1)
+      y1 = y;
+    if (x + w - 1 > x2)
+      x2 = x + w - 1;
+    if (y + h - 1 > y2)
+      y2 = y + h - 1;
+  }
+
+  if (x2 >= 0) {
+    record_blit (x1, y1, x2, y2);
+    update_area (x1, y1, x2, y2);
+  }
+
+} // restorepage ()
 
 // -----
 
-void getviewsettings (struct viewporttype *viewport)
+void freesnapshot (bgi_snapshot *s)
 {
-  // Fills the viewporttype structure pointed to by viewport
-  // with information about the current viewport.
+  // Frees snapshot s; its tiles are freed when no other snapshot
+  // shares them.
 
-  viewport->left = vp.left;
-  viewport->top = vp.top;
-  viewport->right = vp.right;
-  viewport->bottom = vp.bottom;
-  viewport->clip = vp.clip;
+  struct bgi_snapshot
+    **p,
+    *older;
 
-} // getviewsettings ()
+  if (NULL == s)
+    return;
+
+  SDL_AtomicLock (&bgi_snap_lock);
+  for (p = &bgi_snapshots; *p; p = &(*p)->next)
+    if (s == *p) {
+      *p = s->next;
+      break;
+    }
+
+  // the map goes to the previous snapshot of the target, with the
+  // tiles that differ between the two
+  if (s->dirty) {
+    for (older = s->next; older; older = older->next)
+      if (older->target == s->target &&
+          older->width == s->width && older->height == s->height)
+        break;
+    if (older) {
+      for (int i = 0; i < s->tiles_x * s->tiles_y; i++)
+        if (s->tile[i] != older->tile[i])
+          s->dirty[i] = 1;
+      older->dirty = s->dirty;
+    }
+    else
+      free (s->dirty);
+    bgi_snap_gen++;
+  }
+  SDL_AtomicUnlock (&bgi_snap_lock);
+
+  for (int i = 0; i < s->tiles_x * s->tiles_y; i++)
+    snap_tile_drop (s->tile[i]);
+  free (s->tile);
+  free (s);
+
+} // freesnapshot ()
 
 // -----
 
-int getvisualpage (void)
+// Layers are contexts with their own buffer, the size of a window,
+// shown over its visual page: each window keeps its visible layers
+// in a list sorted by z, and updaterect () blends them over the
+// page inside the updated rectangle only. Drawing on a layer
+// updates the window as drawing on the default context does.
+
+static int on_screen (const struct bgi_context *c)
 {
-  // Returns the visual page number.
+  // Returns YEAH if drawing on c changes the current window: c is
+  // the default context, a visible layer, or a canvas shown there.
 
-  return (bgi_vp);
+  return (&bgi_default_ctx == c ||
+          (c->layer_name && YEAH == c->layer_visible &&
+           current_window == c->layer_window) ||
+          (c->canvas_bytes && current_window == c->canvas_window));
 
-} // getvisualpage ()
+} // on_screen ()
 
 // -----
 
-int getx (void)
+static void layer_link (struct bgi_context *c)
 {
-  // Returns the current viewport's x coordinate.
+  // Inserts layer c in the list of its window, above the layers
+  // with the same z.
 
-  return bgi_cp_x;
+  struct bgi_context
+    **p = &bgi_layers[c->layer_window];
 
-} // getx ()
+  while (*p && (*p)->layer_z <= c->layer_z)
+    p = &(*p)->next_layer;
+  c->next_layer = *p;
+  *p = c;
+
+} // layer_link ()
 
 // -----
 
-int gety (void)
+static void layer_unlink (struct bgi_context *c)
 {
-  // Returns the current viewport's y coordinate.
+  // Removes layer c from the list of its window.
 
-  return bgi_cp_y;
+  struct bgi_context
+    **p = &bgi_layers[c->layer_window];
 
-} // gety ()
+  while (*p && *p != c)
+    p = &(*p)->next_layer;
+  if (*p)
+    *p = c->next_layer;
+  c->next_layer = NULL;
+
+} // layer_unlink ()
 
 // -----
 
-char *grapherrormsg (int errorcode)
+static void layer_update (struct bgi_context *c)
 {
-  // Returns a pointer to the error message string associated with
-  // errorcode, returned by graphresult(). Actually, it does nothing.
+  // Shows a change in the settings of layer c.
 
-  return NULL;
+  if (current_window == c->layer_window)
+    CTX_CALL (&bgi_default_ctx, update ());
 
-} // grapherrormsg ()
+} // layer_update ()
 
 // -----
 
-void graphdefaults (void)
+static void blend_row (Uint32 *dst, const Uint32 *src, int n,
+                       int mode, int opacity, Uint32 key)
 {
-  // Resets all graphics settings to their defaults.
+  // Blends n pixels of a layer or sprite over dst. LAYER_OVER
+  // weighs each pixel by its alpha and 'opacity' (0..255);
+  // LAYER_KEY skips pixels of colour 'key' and weighs the others
+  // by 'opacity'.
 
-  int i;
+  int
+    i = 0,
+    op = opacity + (opacity >> 7), // 0..256
+    w;
+
+  key &= 0x00ffffff;
+
+#if defined (BGI_HAVE_SSE2)
+  __m128i
+    zero = _mm_setzero_si128 (),
+    half = _mm_set1_epi16 (128),
+    full = _mm_set1_epi16 (256),
+    rgb = _mm_set1_epi32 (0x00ffffff),
+    vkey = _mm_set1_epi32 (key),
+    vop16 = _mm_set1_epi16 (op),
+    vop32 = _mm_set1_epi32 (op),
+    s, d, w16, wlo, whi, lo, hi;
+
+  for (; i + 4 <= n; i += 4) {
+    s = _mm_loadu_si128 ((const __m128i *) (src + i));
+    d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+
+    // one weight (0..256) per pixel in the low four 16-bit lanes
+    if (LAYER_OVER == mode) {
+      w16 = _mm_srli_epi32 (s, 24);
+      w16 = _mm_packs_epi32 (w16, w16);
+      w16 = _mm_srli_epi16 (_mm_mullo_epi16 (w16, vop16), 8);
+      w16 = _mm_add_epi16 (w16, _mm_srli_epi16 (w16, 7));
+    }
+    else {
+      w16 = _mm_cmpeq_epi32 (_mm_and_si128 (s, rgb), vkey);
+      w16 = _mm_andnot_si128 (w16, vop32);
+      w16 = _mm_packs_epi32 (w16, w16);
+    }
 
-  initpalette ();
+    // four copies of each weight, for the channels of 2 pixels
+    w16 = _mm_unpacklo_epi16 (w16, w16);
+    wlo = _mm_unpacklo_epi32 (w16, w16);
+    whi = _mm_unpackhi_epi32 (w16, w16);
+
+    lo = _mm_add_epi16
+      (_mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero),
+                        _mm_sub_epi16 (full, wlo)),
+       _mm_mullo_epi16 (_mm_unpacklo_epi8 (s, zero), wlo));
+    hi = _mm_add_epi16
+      (_mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero),
+                        _mm_sub_epi16 (full, whi)),
+       _mm_mullo_epi16 (_mm_unpackhi_epi8 (s, zero), whi));
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, half), 8);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, half), 8);
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+  }
+#endif
 
-  // initialise the graphics writing mode
-  bgi_writemode = COPY_PUT;
+  // same rounding as the SSE2 code
+  for (; i < n; i++) {
+    if (LAYER_OVER == mode) {
+      w = ((src[i] >> 24) * op) >> 8;
+      w += w >> 7;
+    }
+    else
+      w = ((src[i] & 0x00ffffff) == key) ? 0 : op;
+    dst[i] = lerp_pixel (dst[i], src[i], w);
+  }
 
-  // initialise the viewport
-  vp.left = 0;
-  vp.top = 0;
+} // blend_row ()
 
-  vp.right = bgi_maxx;
-  vp.bottom = bgi_maxy;
-  vp.clip = NOPE;
+// -----
 
-  // initialise the CP
-  bgi_cp_x = 0;
-  bgi_cp_y = 0;
+static Uint32 *compose_rect (int x1, int y1, int x2, int y2)
+{
+  // Returns rectangle (x1, y1, x2, y2) of the current window as it
+  // is shown: the visual page, with a ring viewport in order, or
+  // the view of a canvas, and the visible layers and sprites over
+  // it. The page is put in order if tiled. Returns NULL if the page
+  // is stored in rows and no canvas, layer or sprite shows there, or
+  // if there is no memory; the caller frees the result.
 
-  // initialise the text settings
-  bgi_txt_style.font = DEFAULT_FONT;
-  bgi_txt_style.direction = HORIZ_DIR;
-  bgi_txt_style.charsize = 1;
-  bgi_txt_style.horiz = LEFT_TEXT;
-  bgi_txt_style.vert = TOP_TEXT;
+  int
+    w = x2 - x1 + 1,
+    x, y, width,
+    sx1, sy1, sx2, sy2,
+    *map = NULL;
+  Uint32
+    *rect,
+    *row,
+    *line = NULL;
+  struct bgi_context
+    *c,
+    *canvas = bgi_canvas[current_window];
+  Sprite
+    *s;
+
+  for (c = bgi_layers[current_window]; c; c = c->next_layer)
+    if (YEAH == c->layer_visible && c->layer_opacity > 0)
+      break;
+  for (s = bgi_sprite_list[current_window]; NULL == c && s; s = s->next)
+    if (YEAH == s->visible &&
+        s->x <= x2 && s->x + s->w > x1 && s->y <= y2 && s->y + s->h > y1)
+      break;
+  if (NULL == c && NULL == s && NULL == canvas &&
+      LAYOUT_ROWS == bgi_win_layout[current_window])
+    return NULL;
+
+  rect = malloc (w * (y2 - y1 + 1) * sizeof (Uint32));
+  if (canvas && rect) {
+    // canvas column shown by each window column
+    map = malloc (w * sizeof (int));
+    for (x = x1; map && x <= x2; x++)
+      map[x - x1] = canvas->canvas_x +
+        (int) ((x + 0.5) / canvas->canvas_zoom);
+  }
+  // layers with a ring are put in order here first
+  if (rect && bgi_layers[current_window])
+    line = malloc (w * sizeof (Uint32));
+  if (NULL == rect || (canvas && NULL == map) ||
+      (bgi_layers[current_window] && NULL == line)) {
+    free (rect);
+    free (map);
+    return NULL;
+  }
 
-  // initialise the fill settings
-  bgi_fill_style.pattern =  SOLID_FILL;
-  bgi_fill_style.color = WHITE;
+  for (y = y1; y <= y2; y++) {
+    row = rect + (y - y1) * w;
+    if (canvas)
+      canvas_row (canvas, row, map, w, y);
+    else
+      load_row (&bgi_default_ctx, bgi_visualpage[current_window], row,
+                x1, x2, y);
+    for (c = bgi_layers[current_window]; c; c = c->next_layer) {
+      // the window may have grown since the layer was made
+      if (NOPE == c->layer_visible || 0 == c->layer_opacity ||
+          y > c->maxy || x1 > c->maxx)
+        continue;
+      width = (x2 > c->maxx) ? c->maxx - x1 + 1 : w;
+      load_row (c, c->pixels, line, x1, x1 + width - 1, y);
+      blend_row (row, line, width,
+                 c->layer_mode, c->layer_opacity, c->layer_key);
+    }
+  }
 
-  // initialise the line settings
-  bgi_line_style.linestyle = SOLID_LINE;
-  bgi_line_style.upattern = SOLID_FILL;
-  bgi_line_style.thickness = NORM_WIDTH;
+  // sprites go on top, only where they are
+  for (s = bgi_sprite_list[current_window]; s; s = s->next) {
+    sx1 = (s->x > x1) ? s->x : x1;
+    sy1 = (s->y > y1) ? s->y : y1;
+    sx2 = (s->x + s->w - 1 < x2) ? s->x + s->w - 1 : x2;
+    sy2 = (s->y + s->h - 1 < y2) ? s->y + s->h - 1 : y2;
+    if (NOPE == s->visible || sx1 > sx2 || sy1 > sy2)
+      continue;
+    for (y = sy1; y <= sy2; y++)
+      blend_row (rect + (y - y1) * w + sx1 - x1,
+                 s->pixels + (y - s->y) * s->w + sx1 - s->x,
+                 sx2 - sx1 + 1, s->mode, 255, s->key);
+  }
 
-  // initialise the palette
-  pal.size = 1 + MAXCOLORS;
-  for (i = 0; i < MAXCOLORS + 1; i++)
-    pal.colors[i] = i;
+  free (map);
+  free (line);
 
-} // graphdefaults ()
+  return rect;
+
+} // compose_rect ()
 
 // -----
 
-int graphresult (void)
+bgi_context *createlayer (const char *name, int z)
 {
-  // Returns the error code for the last unsuccessful graphics
-  // operation and resets the error level to grOk. Actually,
-  // it does nothing.
+  // Creates a layer of the current window: a context the size of
+  // the window, shown over its visual page in 'z' order. A layer
+  // starts transparent, and its BLACK is transparent too, so that
+  // cleardevice () and clearviewport () make it transparent again.
 
-  return grOk;
+  struct bgi_context
+    *c;
 
-} // graphresult ()
+  if (current_window < 0 || NOPE == active_windows[current_window]) {
+    fprintf (stderr, "createlayer(): no window to draw on.\n");
+    return NULL;
+  }
+
+  c = createcontext (bgi_win_maxx[current_window] + 1,
+                     bgi_win_maxy[current_window] + 1);
+  if (NULL == c)
+    return NULL;
+
+  c->layer_name = strdup (name ? name : "");
+  if (NULL == c->layer_name) {
+    fprintf (stderr, "createlayer(): out of memory.\n");
+    freecontext (c);
+    return NULL;
+  }
+
+  c->palette[BLACK] &= 0x00ffffff;
+  for (int i = 0; i < (c->maxx + 1) * (c->maxy + 1); i++)
+    c->buffer[i] = c->palette[BLACK];
+
+  c->layer_window = current_window;
+  c->layer_z = z;
+  c->layer_visible = YEAH;
+  c->layer_opacity = 255;
+  c->layer_mode = LAYER_OVER;
+  if (update_mutex)
+    lock_update ();
+  layer_link (c);
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  // page 0 can't be the window surface, which has no layers
+  alias_window_surface ();
+  bind_default_context ();
+
+  return c;
+
+} // createlayer ()
 
 // -----
 
-unsigned imagesize (int left, int top, int right, int bottom)
+bgi_context *getlayer (const char *name)
 {
-  // Returns the size in bytes of the memory area required to store
-  // a bit image.
+  // Returns the layer of the current window called 'name', or
+  // NULL.
 
-  return 2 * sizeof(Uint32) + // witdth, height
-    (right - left + 1) * (bottom - top + 1) * sizeof (Uint32);
+  struct bgi_context
+    *c;
 
-} // imagesize ()
+  if (current_window < 0 || NULL == name)
+    return NULL;
+
+  for (c = bgi_layers[current_window]; c; c = c->next_layer)
+    if (0 == strcmp (c->layer_name, name))
+      return c;
+
+  return NULL;
+
+} // getlayer ()
 
 // -----
 
-void initgraph (int *graphdriver, int *graphmode, char *pathtodriver)
+void setlayermode (bgi_context *c, int mode, int color)
 {
-  // Initializes the graphics system.
+  // Sets how layer c is blended: LAYER_OVER uses the alpha of its
+  // pixels, LAYER_KEY hides the pixels of colour 'color' (which
+  // may be COLOR (r, g, b)) and shows the others.
 
-  bgi_fast_mode = NOPE;   // BGI compatibility
+  if (NULL == c || NULL == c->layer_name)
+    return;
 
-  // the graphics driver parameter is ignored and is always
-  // set to SDL; graphics modes may vary; the path parameter is
-  // also ignored.
+  c->layer_mode = (LAYER_KEY == mode) ? LAYER_KEY : LAYER_OVER;
+  c->layer_key = (-1 == color) ? bgi_tmp_color_argb : c->palette[color];
+  layer_update (c);
 
-  if (NULL != graphmode)
-    bgi_gm = *graphmode;
-  else
-    bgi_gm = SDL_800x600; // default
+} // setlayermode ()
 
-  switch (bgi_gm) {
+// -----
 
-  case SDL_320x200:
-    initwindow (320, 200);
-    break;
+void setlayeropacity (bgi_context *c, int opacity)
+{
+  // Sets the opacity of layer c, 0 (invisible) to 255.
 
-  case SDL_640x200:
-    initwindow (640, 200);
-    break;
+  if (NULL == c || NULL == c->layer_name)
+    return;
 
-  case SDL_640x350:
-    initwindow (640, 350);
-    break;
+  c->layer_opacity = (opacity < 0) ? 0 : (opacity > 255) ? 255 : opacity;
+  layer_update (c);
 
-  case SDL_640x480:
-    initwindow (640, 480);
-    break;
+} // setlayeropacity ()
 
-  case SDL_720x348:
-    initwindow (720, 348);
-    break;
+// -----
 
-  case SDL_720x350:
-    initwindow (720, 350);
-    break;
+void setlayerz (bgi_context *c, int z)
+{
+  // Moves layer c to position 'z' in the stack of layers of its
+  // window; higher values are on top.
 
-  case SDL_1024x768:
-    initwindow (1024, 768);
-    break;
+  if (NULL == c || NULL == c->layer_name || c->layer_window < 0)
+    return;
 
-  case SDL_1152x900:
-    initwindow (1152, 900);
-    break;
+  if (update_mutex)
+    lock_update ();
+  layer_unlink (c);
+  c->layer_z = z;
+  layer_link (c);
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-  case SDL_1280x1024:
-    initwindow (1280, 1024);
-    break;
+  layer_update (c);
 
-  case SDL_1366x768:
-    initwindow (1366, 768);
-    break;
+} // setlayerz ()
 
-  case SDL_FULLSCREEN:
-    initwindow (0, 0);
-    break;
+// -----
 
-  default:
-  case SDL_800x600:
-    initwindow (800, 600);
-    break;
+void showlayer (bgi_context *c, int visible)
+{
+  // Shows (visible = YEAH) or hides (NOPE) layer c.
 
-  } // switch
+  if (NULL == c || NULL == c->layer_name)
+    return;
 
-  // old programs take it for granted
+  c->layer_visible = visible ? YEAH : NOPE;
+  layer_update (c);
 
-  cleardevice ();
-  refresh_window ();
+} // showlayer ()
 
-} // initgraph ()
+// -----
+
+// Sprites are kept out of the pages: compose_rect () blends them
+// over the layers at present time, and moving one updates the
+// union of its old and new rectangles only.
+
+static Sprite *sprite_get (int id)
+{
+  // Returns sprite 'id', or NULL if there is none.
+
+  if (id < 0 || id >= bgi_nsprites || NULL == bgi_sprites[id]) {
+    fprintf (stderr, "Sprite %d does not exist\n", id);
+    return NULL;
+  }
+
+  return bgi_sprites[id];
+
+} // sprite_get ()
 
 // -----
 
-void initpalette (void)
+static void sprite_link (Sprite *s)
 {
-  int i;
+  // Inserts sprite s in the list of its window, above the sprites
+  // with the same z.
 
-  for (i = BLACK; i < WHITE + 1; i++)
-    palette[i] = bgi_palette[i];
+  Sprite
+    **p = &bgi_sprite_list[s->window];
 
-} // initpalette ()
+  while (*p && (*p)->z <= s->z)
+    p = &(*p)->next;
+  s->next = *p;
+  *p = s;
+
+} // sprite_link ()
 
 // -----
 
-void initwindow (int width, int height)
+static void sprite_unlink (Sprite *s)
 {
-  // Initializes the graphics system, opening a width x height window.
+  // Removes sprite s from the list of its window.
+
+  Sprite
+    **p = &bgi_sprite_list[s->window];
+
+  while (*p && *p != s)
+    p = &(*p)->next;
+  if (*p)
+    *p = s->next;
+  s->next = NULL;
+
+} // sprite_unlink ()
+
+// -----
+
+static void sprite_update (const Sprite *s, int x, int y)
+{
+  // Updates the union of the rectangle of sprite s and the one it
+  // had at (x, y).
 
   int
-    display_count = 0,
-    page;
+    x1 = (x < s->x) ? x : s->x,
+    y1 = (y < s->y) ? y : s->y,
+    x2 = ((x > s->x) ? x : s->x) + s->w - 1,
+    y2 = ((y > s->y) ? y : s->y) + s->h - 1;
 
-  static int
-    first_run = YEAH,    // first run of initwindow()
-    fullscreen = -1;     // fullscreen window already created?
+  if (current_window != s->window)
+    return;
 
-  // the mutex is used by update()
-  if (!update_mutex)
-    update_mutex = SDL_CreateMutex ();
-  if (!update_mutex) {
-    SDL_Log ("SDL_CreateMutex() failed: %s", SDL_GetError ());
-    showerrorbox ("SDL_CreateMutex() failed");
-    fprintf (stderr, "Automatic refresh not available.\n");
-    // don't exit - slow and fast modes are still available
-  }
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 > bgi_win_maxx[current_window])
+    x2 = bgi_win_maxx[current_window];
+  if (y2 > bgi_win_maxy[current_window])
+    y2 = bgi_win_maxy[current_window];
 
-  if (0 != SDL_LockMutex (update_mutex)) {
-    SDL_Log ("SDL_LockMutex() failed: %s", SDL_GetError ());
-    showerrorbox ("SDL_LockMutex() failed");
-  }
+  if (x1 <= x2 && y1 <= y2)
+    CTX_CALL (&bgi_default_ctx, update_area (x1, y1, x2, y2));
 
-  SDL_DisplayMode mode =
-  { SDL_PIXELFORMAT_UNKNOWN, 0, 0, 0, 0 };
+} // sprite_update ()
 
-  if (YEAH == first_run) {
-    first_run = NOPE;
-     // initialise SDL2
-    if (SDL_Init (SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
-      SDL_Log ("SDL_Init() failed: %s", SDL_GetError ());
-      showerrorbox ("SDL_Init() failed");
-      exit (1);
-    }
-    // initialise active_windows[]
-    for (int i = 0; i < NUM_BGI_WIN; i++)
-      active_windows[i] = NOPE;
-  }
+// -----
 
-  // any display available?
-  if ((display_count = SDL_GetNumVideoDisplays ()) < 1) {
-    SDL_Log ("SDL_GetNumVideoDisplays() returned: %i\n", display_count);
-    showerrorbox ("SDL_GetNumVideoDisplays() failed");
-    exit (1);
-  }
+static int sprite_new (int width, int height)
+{
+  // Adds a hidden width x height sprite to the current window, and
+  // returns its id, or -1.
 
-  // get display mode
-  if (SDL_GetDisplayMode (0, 0, &mode) != 0) {
-    SDL_Log ("SDL_GetDisplayMode() failed: %s", SDL_GetError ());
-    showerrorbox ("SDL_GetDisplayMode() failed");
-    exit (1);
+  Sprite
+    *s,
+    **tmp;
+  int
+    id;
+
+  if (current_window < 0 || NOPE == active_windows[current_window]) {
+    fprintf (stderr, "No window to show sprites on.\n");
+    return -1;
   }
 
-  // find a free ID for the window
-  do {
-    current_window++;
-    if (NOPE == active_windows[current_window])
+  for (id = 0; id < bgi_nsprites; id++)
+    if (NULL == bgi_sprites[id])
       break;
-  } while (current_window < NUM_BGI_WIN);
+  if (id == bgi_nsprites) {
+    tmp = realloc (bgi_sprites, 2 * (id + 8) * sizeof (Sprite *));
+    if (NULL == tmp)
+      return -1;
+    bgi_sprites = tmp;
+    bgi_nsprites = 2 * (id + 8);
+    for (int i = id; i < bgi_nsprites; i++)
+      bgi_sprites[i] = NULL;
+  }
 
-  if (current_window < NUM_BGI_WIN) {
-    active_windows[current_window] = YEAH;
-    num_windows++;
-  }
-  else {
-    fprintf (stderr, "Cannot create new window.\n");
-    return;
+  s = calloc (1, sizeof (Sprite));
+  if (s)
+    s->pixels = malloc (width * height * sizeof (Uint32));
+  if (NULL == s || NULL == s->pixels) {
+    fprintf (stderr, "Can't allocate memory for a sprite.\n");
+    free (s);
+    return -1;
   }
 
-  // check if a fullscreen window is already open
-  if (YEAH == fullscreen) {
-    fprintf (stderr, "Fullscreen window already open.\n");
-    return;
-  }
+  s->w = width;
+  s->h = height;
+  s->window = current_window;
+  s->mode = LAYER_OVER;
 
-  // take note of window size
-  bgi_maxx = width - 1;
-  bgi_maxy = height - 1;
+  if (update_mutex)
+    lock_update ();
+  sprite_link (s);
+  bgi_sprites[id] = s;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-  if (NOPE == bgi_fast_mode) {  // called by initgraph ()
-    if (!width || !height) {    // fullscreen
-      bgi_maxx = mode.w - 1;
-      bgi_maxy = mode.h - 1;
-      window_flags = window_flags | SDL_WINDOW_FULLSCREEN_DESKTOP;
-      fullscreen = YEAH;
-    }
-    else {
-      bgi_maxx = width - 1;
-      bgi_maxy = height - 1;
-      fullscreen = NOPE;
-    }
-  } // if (NOPE == bgi_fast_mode)
-  else { // initwindow () called directly
-    if (width > mode.w || height > mode.h) {
-      // window too large - force fullscreen
-      width = 0;
-      height = 0;
-    }
-    if ( (0 != width) && (0 != height) ) {
-      bgi_maxx = width - 1;
-      bgi_maxy = height - 1;
-      fullscreen = NOPE;
-    }
-    else { // 0, 0: fullscreen
-      bgi_maxx = mode.w - 1;
-      bgi_maxy = mode.h - 1;
-      window_flags = window_flags | SDL_WINDOW_FULLSCREEN_DESKTOP;
-      fullscreen = YEAH;
-    }
-  }
+  // page 0 can't be the window surface, which has no sprites
+  alias_window_surface ();
+  bind_default_context ();
 
-  bgi_win[current_window] =
-    SDL_CreateWindow (bgi_win_title,
-                      window_x,
-                      window_y,
-                      bgi_maxx + 1,
-                      bgi_maxy + 1,
-                      window_flags);
-  // is the window OK?
-  if (NULL == bgi_win[current_window]) {
-    SDL_Log ("Could not create window: %s\n", SDL_GetError ());
-    return;
-  }
+  return id;
 
-  // window ok; create renderer
-  bgi_rnd[current_window] =
-    SDL_CreateRenderer (bgi_win[current_window], -1,
-			// slow but guaranteed to exist
-                        SDL_RENDERER_SOFTWARE);
+} // sprite_new ()
 
-  if (NULL == bgi_rnd[current_window]) {
-    SDL_Log ("Could not create renderer: %s\n", SDL_GetError ());
-    return;
-  }
+// -----
+
+int createsprite (void *bitmap)
+{
+  // Creates a hidden sprite from a bitmap saved by getimage (),
+  // and returns its id, or -1.
+
+  Uint32
+    width, height;
+  int
+    id;
+
+  memcpy (&width, bitmap, sizeof (Uint32));
+  memcpy (&height, (Uint32 *) bitmap + 1, sizeof (Uint32));
+
+  id = sprite_new (width, height);
+  if (-1 != id)
+    memcpy (bgi_sprites[id]->pixels, (Uint32 *) bitmap + 2,
+            width * height * sizeof (Uint32));
+
+  return id;
+
+} // createsprite ()
 
-  // finally, create the texture
-  bgi_txt[current_window] =
-    SDL_CreateTexture (bgi_rnd[current_window],
-                       SDL_PIXELFORMAT_ARGB8888,
-		       SDL_TEXTUREACCESS_STREAMING,
-                       // SDL_TEXTUREACCESS_TARGET,
-                       bgi_maxx + 1,
-                       bgi_maxy + 1);
-  if (NULL == bgi_txt[current_window]) {
-    SDL_Log ("Could not create texture: %s\n", SDL_GetError ());
+// -----
+
+void freesprite (int id)
+{
+  // Removes sprite 'id' from the screen, and frees it.
+
+  Sprite
+    *s = sprite_get (id);
+
+  if (NULL == s)
     return;
+
+  if (s->window >= 0) {
+    if (update_mutex)
+      lock_update ();
+    sprite_unlink (s);
+    if (update_mutex)
+      SDL_UnlockMutex (update_mutex);
+    if (YEAH == s->visible)
+      sprite_update (s, s->x, s->y);
+    if (current_window == s->window)
+      alias_window_surface ();
+    bind_default_context ();
   }
 
-  // visual pages
-  for (page = 0; page < VPAGES; page++) {
-    bgi_vpage[page] =
-      SDL_CreateRGBSurface (0, mode.w, mode.h, 32, 0, 0, 0, 0);
-    if (NULL == bgi_vpage[page]) {
-      SDL_Log ("Could not create surface for visual page %d.", page);
-      showerrorbox ("Could not create surface for visual page");
-      break;
-    }
-    else
-      bgi_np++;
+  bgi_sprites[id] = NULL;
+  free (s->pixels);
+  free (s);
+
+} // freesprite ()
+
+// -----
+
+int loadsprite (char *filename)
+{
+  // Creates a hidden sprite from an image file, and returns its
+  // id, or -1.
+
+  ImageEntry
+    *image;
+  SDL_Surface
+    *surface;
+  int
+    id;
+
+  image = image_get (filename);
+  if (NULL == image) {
+    SDL_Log ("SDL_LoadBMP() error: %s\n", SDL_GetError ());
+    return -1;
   }
+  surface = image->surface;
 
-  bgi_window = bgi_win[current_window];
-  bgi_renderer = bgi_rnd[current_window];
-  bgi_texture = bgi_txt[current_window];
+  id = sprite_new (surface->w, surface->h);
+  if (-1 != id)
+    for (int y = 0; y < surface->h; y++)
+      memcpy (bgi_sprites[id]->pixels + y * surface->w,
+              (Uint8 *) surface->pixels + y * surface->pitch,
+              surface->w * sizeof (Uint32));
 
-  bgi_activepage[current_window] =
-    bgi_visualpage[current_window] =
-    bgi_vpage[0]->pixels;
-  bgi_ap = bgi_vp = 0;
+  image_release (image);
 
-  graphdefaults ();
+  return id;
 
-  // check the environment variable 'SDL_BGI_RATE'
-  // and act accordingly
+} // loadsprite ()
 
-  char *speed = getenv ("SDL_BGI_RATE");
+// -----
 
-  if (NULL == speed) // variable does not exist
-    speed = "compatible";
-  else {
+void movesprite (int id, int x, int y)
+{
+  // Moves sprite 'id' so that its top left corner is at (x, y) of
+  // the window.
 
-    if (0 == strcmp ("auto", speed))
-      sdlbgiauto ();
+  Sprite
+    *s = sprite_get (id);
+  int
+    old_x, old_y;
 
-    refresh_rate = atoi (speed);
-    if (0 != refresh_rate) // implies auto mode
-      sdlbgiauto ();
-  }
+  if (NULL == s || (x == s->x && y == s->y))
+    return;
 
-  // any other value of SDL_BGI_RATE triggers
-  // "compatible" mode by default
+  if (update_mutex)
+    lock_update ();
+  old_x = s->x;
+  old_y = s->y;
+  s->x = x;
+  s->y = y;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-  SDL_UnlockMutex (update_mutex);
+  if (YEAH == s->visible)
+    sprite_update (s, old_x, old_y);
 
-} // initwindow ()
+} // movesprite ()
 
 // -----
 
-int IS_BGI_COLOR (int color)
+void setspritemode (int id, int mode, int color)
 {
-  // Returns 1 if the current color is a standard BGI color
-  // (not ARGB); the color argument is redundant
+  // Sets how sprite 'id' is blended: LAYER_OVER uses the alpha of
+  // its pixels, LAYER_KEY hides the pixels of colour 'color' (which
+  // may be COLOR (r, g, b)).
 
-  return ! bgi_argb_mode;
+  Sprite
+    *s = sprite_get (id);
 
-} // IS_BGI_COLOR ()
+  if (NULL == s)
+    return;
+
+  s->mode = (LAYER_KEY == mode) ? LAYER_KEY : LAYER_OVER;
+  s->key = (-1 == color) ? bgi_tmp_color_argb : bgi_ctx->palette[color];
+  if (YEAH == s->visible)
+    sprite_update (s, s->x, s->y);
+
+} // setspritemode ()
 
 // -----
 
-int IS_RGB_COLOR (int color)
+void setspritez (int id, int z)
 {
-  // Returns 1 if the current color is a standard BGI color
-  // (not ARGB); the color argument is redundant
+  // Moves sprite 'id' to position 'z' in the stack of sprites of
+  // its window; higher values are on top.
 
-  return bgi_argb_mode;
+  Sprite
+    *s = sprite_get (id);
 
-} // IS_RGB_COLOR ()
+  if (NULL == s || s->window < 0)
+    return;
+
+  if (update_mutex)
+    lock_update ();
+  sprite_unlink (s);
+  s->z = z;
+  sprite_link (s);
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  if (YEAH == s->visible)
+    sprite_update (s, s->x, s->y);
+
+} // setspritez ()
 
 // -----
 
-int kbhit (void)
+void showsprite (int id, int visible)
 {
-  // Returns 1 when a key is pressed, or QUIT
-  // if the user asked to close the window
+  // Shows (visible = YEAH) or hides (NOPE) sprite 'id'.
 
-  SDL_Event event;
-  SDL_Keycode key;
+  Sprite
+    *s = sprite_get (id);
 
-  update ();
+  if (NULL == s)
+    return;
 
-  if (YEAH == key_pressed) { // a key was pressed during delay()
-    key_pressed = NOPE;
-    return YEAH;
+  s->visible = visible ? YEAH : NOPE;
+  sprite_update (s, s->x, s->y);
+
+} // showsprite ()
+
+// -----
+
+// A canvas is a context far larger than a window, shown through a
+// view that can be panned and zoomed at present time: moving the
+// view composes the window again from the canvas, and nothing is
+// drawn again. The canvas is stored in tiles of PAGE_TILE x
+// PAGE_TILE pixels, as a tiled page is; where mmap () is available,
+// it is mapped without reserving memory, so each tile is a memory
+// page that the system only allocates when it is drawn on, and an
+// untouched tile reads as transparent black. Elsewhere, the canvas
+// is allocated whole.
+
+bgi_context *createcanvas (int width, int height)
+{
+  // Creates a width x height canvas: a context that starts
+  // transparent black and uses memory only where it is drawn on.
+  // Its size is only limited by the address space.
+
+  struct bgi_context
+    *c;
+  Uint32
+    *pixels;
+  size_t
+    bytes;
+
+  if (width < 1 || height < 1 ||
+      (Uint64) width * height > SIZE_MAX / sizeof (Uint32)) {
+    fprintf (stderr, "createcanvas(): invalid size %d x %d.\n",
+             width, height);
+    return NULL;
+  }
+  bytes = (size_t) width * height * sizeof (Uint32);
+
+#if defined (BGI_HAVE_MMAP)
+  pixels = mmap (NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS
+#if defined (MAP_NORESERVE)
+                 | MAP_NORESERVE
+#endif
+                 , -1, 0);
+  if (MAP_FAILED == pixels)
+    pixels = NULL;
+#else
+  pixels = calloc (1, bytes);
+#endif
+  if (NULL == pixels) {
+    fprintf (stderr, "createcanvas(): out of memory.\n");
+    return NULL;
   }
 
-  if (SDL_PollEvent (&event)) {
-    if (SDL_KEYDOWN == event.type) {
-      key = event.key.keysym.sym;
-      if (key != SDLK_LCTRL &&
-          key != SDLK_RCTRL &&
-          key != SDLK_LSHIFT &&
-          key != SDLK_RSHIFT &&
-          key != SDLK_LGUI &&
-          key != SDLK_RGUI &&
-          key != SDLK_LALT &&
-          key != SDLK_RALT &&
-          key != SDLK_PAGEUP &&
-          key != SDLK_PAGEDOWN &&
-          key != SDLK_CAPSLOCK &&
-          key != SDLK_MENU &&
-          key != SDLK_APPLICATION)
-        return YEAH;
-      else
-        return NOPE;
-    } // if (SDL_KEYDOWN == event.type)
-    else
-      if (SDL_WINDOWEVENT == event.type) {
-        if (SDL_WINDOWEVENT_CLOSE == event.window.event)
-          return QUIT;
-      }
-    else
-      SDL_PushEvent (&event); // don't disrupt the mouse
+  c = new_context ("createcanvas", width, height, 0, pixels);
+  if (NULL == c) {
+#if defined (BGI_HAVE_MMAP)
+    munmap (pixels, bytes);
+#else
+    free (pixels);
+#endif
+    return NULL;
   }
 
-  return NOPE;
+  // untouched pixels are 0, so BLACK is transparent, as on layers
+  c->palette[BLACK] &= 0x00ffffff;
+  c->layout = LAYOUT_TILES;
+  c->canvas_bytes = bytes;
+  c->canvas_window = -1;
+  c->canvas_zoom = 1.0;
 
-} // kbhit ()
+  return c;
 
-// -----
+} // createcanvas ()
 
-// Bresenham's line algorithm routines that implement logical
-// operations: copy, xor, and, or, not.
+// -----
 
-void line_copy (int x1, int y1, int x2, int y2)
+static int canvas_release (void)
 {
-  int
-    counter = 0, // # of pixel plotted
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+  // Clears the current context, if it is a canvas and the
+  // background is BLACK, by giving its memory back. Returns YEAH
+  // if it did.
 
-  for (;;) {
+  struct bgi_context
+    *c = bgi_ctx;
 
-    // plot the pixel only if the corresponding bit
-    // in the current pattern is set to 1
+  if (0 == c->canvas_bytes || 0 != c->palette[c->bg_color])
+    return NOPE;
 
-    if (SOLID_LINE == bgi_line_style.linestyle)
-      putpixel_copy (x1, y1, palette[bgi_fg_color]);
-    else
-      if ((line_patterns[bgi_line_style.linestyle] >> counter % 16) & 1)
-        putpixel_copy (x1, y1, palette[bgi_fg_color]);
+  snap_touch (c, 0, 0, c->maxx, c->maxy);
 
-    counter++;
+#if defined (BGI_HAVE_MMAP)
+  // fresh pages read as 0
+  if (MAP_FAILED == mmap (c->pixels, c->canvas_bytes,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED
+#if defined (MAP_NORESERVE)
+                          | MAP_NORESERVE
+#endif
+                          , -1, 0))
+    return NOPE;
+#else
+  memset (c->pixels, 0, c->canvas_bytes);
+#endif
 
-    if (x1 == x2 && y1 == y2)
-      break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
-    if (e2 < dy) {
-      err += dx;
-      y1 += sy;
-    }
-  } // for
+  update ();
 
-} // line_copy ()
+  return YEAH;
+
+} // canvas_release ()
 
 // -----
 
-void line_xor (int x1, int y1, int x2, int y2)
+static int canvas_to_window (const struct bgi_context *c,
+                             int *x1, int *y1, int *x2, int *y2)
 {
-  int
-    counter = 0, // # of pixel plotted
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+  // Turns a rectangle of canvas c into the rectangle of the
+  // current window that shows it, with a pixel to spare for
+  // rounding. Returns NOPE if it is out of view.
 
-  for (;;) {
+  double
+    zoom = c->canvas_zoom;
 
-    if (SOLID_LINE == bgi_line_style.linestyle)
-      putpixel_xor (x1, y1, palette[bgi_fg_color]);
-    else
-      if ((line_patterns[bgi_line_style.linestyle] >> counter % 16) & 1)
-        putpixel_xor (x1, y1, palette[bgi_fg_color]);
+  *x1 = (int) floor ((*x1 - c->canvas_x) * zoom) - 1;
+  *y1 = (int) floor ((*y1 - c->canvas_y) * zoom) - 1;
+  *x2 = (int) ceil ((*x2 + 1 - c->canvas_x) * zoom);
+  *y2 = (int) ceil ((*y2 + 1 - c->canvas_y) * zoom);
 
-    counter++;
+  if (*x1 < 0)
+    *x1 = 0;
+  if (*y1 < 0)
+    *y1 = 0;
+  if (*x2 > bgi_win_maxx[current_window])
+    *x2 = bgi_win_maxx[current_window];
+  if (*y2 > bgi_win_maxy[current_window])
+    *y2 = bgi_win_maxy[current_window];
 
-    if (x1 == x2 && y1 == y2)
-      break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
-    if (e2 < dy) {
-      err += dx;
-      y1 += sy;
-    }
-  } // for
+  return (*x1 <= *x2 && *y1 <= *y2);
 
-} // line_xor ()
+} // canvas_to_window ()
 
 // -----
 
-void line_and (int x1, int y1, int x2, int y2)
+static void canvas_row (const struct bgi_context *c, Uint32 *row,
+                        const int *map, int n, int y)
 {
+  // Fills the n pixels of row with row y of the window, as shown
+  // by the view of canvas c; map[i] is the canvas column of pixel
+  // i. Pixels out of the canvas are transparent black.
+
   int
-    counter = 0, // # of pixel plotted
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+    i = 0,
+    len,
+    sy = c->canvas_y + (int) ((y + 0.5) / c->canvas_zoom);
 
-  for (;;) {
+  if (sy < 0 || sy > c->maxy) {
+    memset (row, 0, n * sizeof (Uint32));
+    return;
+  }
 
-    if (SOLID_LINE == bgi_line_style.linestyle)
-      putpixel_and (x1, y1, palette[bgi_fg_color]);
-    else
-      if ((line_patterns[bgi_line_style.linestyle] >> counter % 16) & 1)
-        putpixel_and (x1, y1, palette[bgi_fg_color]);
+  // not zoomed: the row is copied tile by tile
+  if (1.0 == c->canvas_zoom) {
+    for (; i < n && map[i] < 0; i++)
+      row[i] = 0;
+    if (i < n && map[i] <= c->maxx) {
+      len = n - i;
+      if (map[i] + len - 1 > c->maxx)
+        len = c->maxx - map[i] + 1;
+      load_row (c, c->pixels, row + i, map[i], map[i] + len - 1, sy);
+      i += len;
+    }
+  }
 
-    counter++;
+  for (; i < n; i++)
+    row[i] = (map[i] < 0 || map[i] > c->maxx) ? 0 :
+      c->pixels[ring_offset (c, map[i], sy)];
 
-    if (x1 == x2 && y1 == y2)
-      break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
+} // canvas_row ()
+
+// -----
+
+void setcanvasview (bgi_context *c, int x, int y, float zoom)
+{
+  // Shows canvas c from canvas pixel (x, y), at the top left
+  // corner of the window, magnified by 'zoom' (1.0: one window
+  // pixel per canvas pixel).
+
+  if (NULL == c || 0 == c->canvas_bytes)
+    return;
+
+  if (zoom < 1.0 / 256)
+    zoom = 1.0 / 256;
+  if (zoom > 256)
+    zoom = 256;
+
+  c->canvas_x = x;
+  c->canvas_y = y;
+  c->canvas_zoom = zoom;
+
+  if (c->canvas_window >= 0 && current_window == c->canvas_window)
+    CTX_CALL (&bgi_default_ctx, update ());
+
+} // setcanvasview ()
+
+// -----
+
+void showcanvas (bgi_context *c)
+{
+  // Shows canvas c in the current window, instead of its visual
+  // page; NULL shows the visual page again.
+
+  if (current_window < 0 || NOPE == active_windows[current_window])
+    return;
+
+  if (c && 0 == c->canvas_bytes) {
+    fprintf (stderr, "showcanvas(): not a canvas.\n");
+    return;
+  }
+
+  if (update_mutex)
+    lock_update ();
+  if (bgi_canvas[current_window])
+    bgi_canvas[current_window]->canvas_window = -1;
+  if (c) {
+    if (c->canvas_window >= 0)
+      bgi_canvas[c->canvas_window] = NULL;
+    c->canvas_window = current_window;
+  }
+  bgi_canvas[current_window] = c;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  // page 0 can't be the window surface under a canvas
+  alias_window_surface ();
+  bind_default_context ();
+  CTX_CALL (&bgi_default_ctx, update ());
+
+} // showcanvas ()
+
+// -----
+
+void delay (int msec)
+{
+  // Waits for msec milliseconds. Implemented as a loop,
+  // because apparently SDL_Delay() ignores pending events.
+
+  Uint32
+    stop;
+
+  update ();
+
+  stop = SDL_GetTicks () + msec;
+
+  do {
+
+    if (kbhit ()) // take care of keypresses
+      key_pressed = YEAH;
+    if (xkbhit ())
+      xkey_pressed = YEAH;
+
+  } while (SDL_GetTicks () < stop);
+
+} // delay ()
+
+// -----
+
+void detectgraph (int *graphdriver, int *graphmode)
+{
+  // Detects the graphics driver and graphics mode to use.
+
+  *graphdriver = SDL;
+  *graphmode = SDL_FULLSCREEN;
+
+} // detectgraph ()
+
+// -----
+
+void drawpoly (int numpoints, int *polypoints)
+{
+  // Draws a polygon of numpoints vertices.
+
+  int n;
+
+  RECORD (drawpoly (numpoints, polypoints), REC_DRAWPOLY, numpoints,
+          polypoints, 2 * numpoints * (int) sizeof (int));
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    stroke_begin ();
+    stroke_ipolyline (numpoints, polypoints, YEAH);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  // the vertices must be blended once
+  if (ALPHA_PUT == bgi_ctx->writemode) {
+    stroke_begin ();
+    stroke_thin_polyline (numpoints, polypoints);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  for (n = 0; n < numpoints - 1; n++)
+    line_fast (polypoints[2*n], polypoints[2*n + 1],
+               polypoints[2*n + 2], polypoints[2*n + 3]);
+  // close the polygon
+  line_fast (polypoints[2*n], polypoints[2*n + 1],
+             polypoints[0], polypoints[1]);
+
+  update ();
+
+} // drawpoly ()
+
+// -----
+
+static void swap_if_greater (int *x1, int *x2)
+{
+  int tmp;
+
+  if (*x1 > *x2) {
+    tmp = *x1;
+    *x1 = *x2;
+    *x2 = tmp;
+  }
+
+} // swap_if_greater ()
+
+// -----
+
+static void _ellipse (int, int, int, int);
+
+void ellipse (int x, int y, int stangle, int endangle,
+              int xradius, int yradius)
+{
+  // Draws an elliptical arc centered at (x, y), with axes given by
+  // xradius and yradius, traveling from stangle to endangle.
+
+  // Bresenham-based if complete
+  int angle;
+
+  RECORD (ellipse (x, y, stangle, endangle, xradius, yradius),
+          REC_ELLIPSE, x, y, stangle, endangle, xradius, yradius);
+
+  if (0 == xradius && 0 == yradius)
+    return;
+
+  if (endangle < stangle)
+    endangle += 360;
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    bgi_ctx->last_arc.x = x;
+    bgi_ctx->last_arc.y = y;
+    stroke_begin ();
+    stroke_arc (x + bgi_ctx->vp.left, y + bgi_ctx->vp.top, stangle, endangle,
+                xradius, yradius);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  // draw complete ellipse
+  if (0 == stangle && 360 == endangle) {
+    _ellipse (x, y, xradius, yradius);
+    return;
+  }
+
+  // really needed?
+  bgi_ctx->last_arc.x = x;
+  bgi_ctx->last_arc.y = y;
+
+  for (angle = stangle; angle < endangle; angle++)
+    line_fast (x + (xradius * cos (angle * PI_CONV)),
+               y - (yradius * sin (angle * PI_CONV)),
+               x + (xradius * cos ((angle + 1) * PI_CONV)),
+               y - (yradius * sin ((angle + 1) * PI_CONV)));
+
+  update ();
+
+} // ellipse ()
+
+// -----
+
+int event (void)
+{
+  // Returns YEAH if an event has occurred.
+
+  SDL_Event event;
+
+  if (poll_event (&event)) {
+    if ( (SDL_KEYDOWN == event.type)         ||
+         (SDL_MOUSEBUTTONDOWN == event.type) ||
+         (SDL_MOUSEWHEEL == event.type)      ||
+         (SDL_QUIT == event.type) ) {
+      SDL_PushEvent (&event); // don't disrupt the event
+      bgi_last_event = event.type;
+      return YEAH;
+    }
+  }
+  return NOPE;
+
+} // event ()
+
+// -----
+
+int eventtype (void)
+{
+  // Returns the type of event occurred
+
+  return (bgi_last_event);
+
+} // eventtype ()
+
+// -----
+
+static void ellipse_point (int *rows, int yradius, Sint64 x, Sint64 y)
+{
+  // records point (x, y) of the first quadrant in rows []
+
+  if (x < 0 || y < 0 || y > yradius)
+    return;
+  if (x < rows[2*y])
+    rows[2*y] = x;
+  if (x > rows[2*y + 1])
+    rows[2*y + 1] = x;
+
+} // ellipse_point ()
+
+// -----
+
+static int *ellipse_rows (int xradius, int yradius)
+{
+  // Runs the ellipse algorithm in the first quadrant and returns,
+  // for each row y = 0..yradius from the centre, the innermost and
+  // outermost x of the outline in rows[2*y] and rows[2*y + 1].
+  // The error terms are 64-bit; plain ints overflow for radii
+  // above 1000 pixels or so. The caller frees the array.
+
+  // from "A Fast Bresenham Type Algorithm For Drawing Ellipses"
+  // by John Kennedy
+
+  Sint64
+    x, y,
+    xchange, ychange,
+    ellipseerror,
+    TwoASquare, TwoBSquare,
+    StoppingX, StoppingY;
+  int
+    *rows, i;
+
+  rows = malloc (2 * (yradius + 1) * sizeof (int));
+  if (NULL == rows) {
+    fprintf (stderr, "Can't allocate ellipse rows.\n");
+    return NULL;
+  }
+
+  for (i = 0; i <= yradius; i++) {
+    rows[2*i] = xradius + 1;
+    rows[2*i + 1] = -1;
+  }
+
+  TwoASquare = 2*(Sint64) xradius*xradius;
+  TwoBSquare = 2*(Sint64) yradius*yradius;
+  x = xradius;
+  y = 0;
+  xchange = (Sint64) yradius*yradius*(1 - 2*(Sint64) xradius);
+  ychange = (Sint64) xradius*xradius;
+  ellipseerror = 0;
+  StoppingX = TwoBSquare*xradius;
+  StoppingY = 0;
+
+  while (StoppingX >= StoppingY) {
+
+    // 1st set of points, y' > -1
+
+    ellipse_point (rows, yradius, x, y);
+    y++;
+    StoppingY += TwoASquare;
+    ellipseerror += ychange;
+    ychange += TwoASquare;
+
+    if ((2*ellipseerror + xchange) > 0 ) {
+      x--;
+      StoppingX -= TwoBSquare;
+      ellipseerror += xchange;
+      xchange += TwoBSquare;
+    }
+  } // while
+
+  // 1st point set is done; start the 2nd set of points
+
+  x = 0;
+  y = yradius;
+  xchange = (Sint64) yradius*yradius;
+  ychange = (Sint64) xradius*xradius*(1 - 2*(Sint64) yradius);
+  ellipseerror = 0;
+  StoppingX = 0;
+  StoppingY = TwoASquare*yradius;
+
+  while (StoppingX <= StoppingY ) {
+
+    // 2nd set of points, y' < -1
+
+    ellipse_point (rows, yradius, x, y);
+    x++;
+    StoppingX += TwoBSquare;
+    ellipseerror += xchange;
+    xchange += TwoBSquare;
+    if ((2*ellipseerror + ychange) > 0) {
+      y--;
+      StoppingY -= TwoASquare;
+      ellipseerror += ychange;
+      ychange += TwoASquare;
+    }
+  }
+
+  // very thin ellipses leave rows between the two point sets
+  // empty; join them with a vertical run
+
+  for (i = 1; i <= yradius; i++)
+    if (rows[2*i + 1] < 0)
+      rows[2*i] = rows[2*i + 1] = rows[2*i - 2];
+
+  return rows;
+
+} // ellipse_rows ()
+
+// -----
+
+static void ellipse_spans (int cx, int cy, int yradius,
+                           const int *rows, int fill)
+{
+  // Draws the ellipse described by rows [], centred at the
+  // absolute point (cx, cy). Each scanline gets at most one
+  // interior span and two outline spans, so no pixel is drawn
+  // twice and XOR_PUT works as expected.
+
+  int
+    y, row, side, xin, xout;
+  Uint32
+    pixel = bgi_ctx->palette[bgi_ctx->fg_color];
+
+  for (y = 0; y <= yradius; y++) {
+
+    xin = rows[2*y];
+    xout = rows[2*y + 1];
+
+    // row 0 has no mirror image
+    for (side = 0; side < (y ? 2 : 1); side++) {
+      row = side ? cy + y : cy - y;
+      if (fill && xin > 0)
+        fill_span (cx - xin + 1, cx + xin - 1, row);
+      if (0 == xin)
+        draw_span (cx - xout, cx + xout, row, pixel);
+      else {
+        draw_span (cx - xout, cx - xin, row, pixel);
+        draw_span (cx + xin, cx + xout, row, pixel);
+      }
+    }
+  }
+
+} // ellipse_spans ()
+
+// -----
+
+void _ellipse (int cx, int cy, int xradius, int yradius)
+{
+  // Draws a complete ellipse outline, using the current writing
+  // mode.
+
+  int
+    *rows;
+
+  if (0 == xradius && 0 == yradius)
+    return;
+
+  xradius = abs (xradius);
+  yradius = abs (yradius);
+
+  rows = ellipse_rows (xradius, yradius);
+  if (NULL == rows)
+    return;
+
+  ellipse_spans (cx + bgi_ctx->vp.left, cy + bgi_ctx->vp.top,
+                 yradius, rows, NOPE);
+  free (rows);
+
+  update ();
+
+} // _ellipse ()
+
+// -----
+
+void fillellipse (int cx, int cy, int xradius, int yradius)
+{
+  // Draws an ellipse centered at (x, y), with axes given by
+  // xradius and yradius, and fills it using the current fill color
+  // and fill pattern.
+
+  // The interior is one span per scanline, handed to the fill
+  // kernel; the outline spans are drawn next to it, not over it.
+
+  int
+    *rows;
+
+  RECORD (fillellipse (cx, cy, xradius, yradius),
+          REC_FILLELLIPSE, cx, cy, xradius, yradius);
+
+  if (0 == xradius && 0 == yradius)
+    return;
+
+  xradius = abs (xradius);
+  yradius = abs (yradius);
+
+  rows = ellipse_rows (xradius, yradius);
+  if (NULL == rows)
+    return;
+
+  ellipse_spans (cx + bgi_ctx->vp.left, cy + bgi_ctx->vp.top,
+                 yradius, rows, YEAH);
+  free (rows);
+
+  update ();
+
+} // fillellipse ()
+
+// -----
+
+static int intcmp (const void *n1, const void *n2)
+{
+  // helper function for fillpoly ()
+
+  return (*(const int *) n1) - (*(const int *) n2);
+
+} // intcmp ()
+
+// -----
+
+// the following function was adapted from the public domain
+// code by Darel Rex Finley,
+// http://alienryderflex.com/polygon_fill/
+
+void fillpoly (int numpoints, int *polypoints)
+{
+  // Draws a polygon of numpoints vertices and fills it using the
+  // current fill color.
+
+  int
+    nodes,      // number of nodes
+    *nodeX,     // array of nodes
+    ymin, ymax,
+    pixelY,
+    i, j,
+    tmp, tmpcolor;
+
+  RECORD (fillpoly (numpoints, polypoints), REC_FILLPOLY, numpoints,
+          polypoints, 2 * numpoints * (int) sizeof (int));
+
+  if (NULL == (nodeX = calloc (sizeof (int), numpoints))) {
+    fprintf (stderr, "Can't allocate memory for fillpoly()\n");
+    return;
+  }
+
+  TRACE_BEGIN ("fillpoly");
+
+  tmp = bgi_ctx->fg_color;
+  if (EMPTY_FILL == bgi_ctx->fill_style.pattern)
+    tmpcolor = bgi_ctx->bg_color;
+  else // all other styles
+    tmpcolor = bgi_ctx->fill_style.color;
+
+  setcolor (tmpcolor);
+
+  // find Y maxima
+
+  ymin = ymax = polypoints[1];
+
+  for (i = 0; i < 2 * numpoints; i += 2) {
+    if (polypoints[i + 1] < ymin)
+      ymin = polypoints[i + 1];
+    if (polypoints[i + 1] > ymax)
+      ymax = polypoints[i + 1];
+  }
+
+  //  Loop through the rows of the image.
+  for (pixelY = ymin; pixelY < ymax; pixelY++) {
+
+    //  Build a list of nodes.
+    nodes = 0;
+    j = 2 * numpoints - 2;
+
+    for (i = 0; i < 2 * numpoints; i += 2) {
+
+      if (
+          ((float) polypoints[i + 1] < (float)  pixelY &&
+           (float) polypoints[j + 1] >= (float) pixelY) ||
+          ((float) polypoints[j + 1] < (float)  pixelY &&
+           (float) polypoints[i + 1] >= (float) pixelY))
+        nodeX[nodes++] =
+        (int) (polypoints[i] + (pixelY - (float) polypoints[i + 1]) /
+               ((float) polypoints[j + 1] - (float) polypoints[i + 1]) *
+               (polypoints[j] - polypoints[i]));
+      j = i;
+    }
+
+    // sort the nodes
+    qsort (nodeX, nodes, sizeof (int), intcmp);
+
+    // fill the pixels between node pairs.
+    for (i = 0; i < nodes; i += 2) {
+      if (SOLID_FILL == bgi_ctx->fill_style.pattern)
+        line_fast (nodeX[i], pixelY, nodeX[i + 1], pixelY);
+      else
+        line_fill (nodeX[i], pixelY, nodeX[i + 1], pixelY);
+    }
+
+  } //   for pixelY
+
+  setcolor (tmp);
+  drawpoly (numpoints, polypoints);
+
+  update ();
+
+  TRACE_END ("fillpoly");
+
+} // fillpoly ()
+
+
+// -----
+
+static void ff_putpixel (int x, int y)
+{
+  // similar to putpixel (), but uses fill patterns
+
+  x += bgi_ctx->vp.left;
+  y += bgi_ctx->vp.top;
+
+  // if the corresponding bit in the pattern is 1
+  if ( (bgi_ctx->fill_patterns[bgi_ctx->fill_style.pattern][y % 8]
+        >> x % 8) & 1)
+    putpixel_copy (x, y, bgi_ctx->palette[bgi_ctx->fill_style.color]);
+  else
+    putpixel_copy (x, y, bgi_ctx->palette[bgi_ctx->bg_color]);
+
+} // ff_putpixel ()
+
+// -----
+
+// the following code is adapted from "A Seed Fill Algorithm"
+// by Paul Heckbert, "Graphics Gems", Academic Press, 1990
+
+// the segment stack lives in the current context
+
+// the following functions were implemented as unreadable macros
+
+static inline void ff_push (int y, int xl, int xr, int dy)
+{
+  // push new segment on stack
+  if (bgi_ctx->sp < bgi_ctx->stack + STACKSIZE && y + dy >= 0 &&
+      y + dy <= bgi_ctx->vp.bottom - bgi_ctx->vp.top ) {
+    bgi_ctx->sp->y = y;
+    bgi_ctx->sp->xl = xl;
+    bgi_ctx->sp->xr = xr;
+    bgi_ctx->sp->dy = dy;
+    bgi_ctx->sp++;
+  }
+}
+
+// -----
+
+static inline void ff_pop (int *y, int *xl, int *xr, int *dy)
+{
+  // pop segment off stack
+  bgi_ctx->sp--;
+  *dy = bgi_ctx->sp->dy;
+  *y = bgi_ctx->sp->y + *dy;
+  *xl = bgi_ctx->sp->xl;
+  *xr = bgi_ctx->sp->xr;
+}
+
+// -----
+
+// non-recursive implementation; adapted from Paul Heckbert'
+// Seed Fill algorithm, in "Graphics Gems", Academic Press, 1990
+
+// fill: set the pixel at (x,y) and all of its 4-connected neighbors
+// with the same pixel value to the new pixel value nv.
+// A 4-connected neighbor is a pixel above, below, left, or right
+// of a pixel.
+
+void _floodfill (int x, int y, int border)
+{
+  // Fills an enclosed area, containing the x and y points bounded by
+  // the border color. The area is filled using the current fill color.
+
+  int
+    start,
+    x1, x2,
+    dy = 0;
+  unsigned int
+    oldcol;
+
+  oldcol = getpixel (x, y);
+  ff_push (y, x, x, 1);           // needed in some cases
+  ff_push (y + 1, x, x, -1);      // seed segment (popped 1st)
+
+  while (bgi_ctx->sp > bgi_ctx->stack) {
+
+    // pop segment off stack and fill a neighboring scan line
+
+    ff_pop (&y, &x1, &x2, &dy);
+
+     // segment of scan line y-dy for x1<=x<=x2 was previously filled,
+     // now explore adjacent pixels in scan line y
+
+    for (x = x1; x >= 0 && getpixel (x, y) == oldcol; x--)
+      ff_putpixel (x, y);
+
+    if (x >= x1) {
+      for (x++; x <= x2 && getpixel (x, y) == border; x++)
+        ;
+      start = x;
+      if (x > x2)
+        continue;
+    }
+    else {
+      start = x + 1;
+      if (start < x1)
+        ff_push (y, start, x1 - 1, -dy);    // leak on left?
+      x = x1 + 1;
+    }
+    do {
+      for (x1 = x; x <= bgi_ctx->vp.right && getpixel (x, y) != border; x++)
+        ff_putpixel (x, y);
+      ff_push (y, start, x - 1, dy);
+      if (x > x2 + 1)
+        ff_push (y, x2 + 1, x - 1, -dy);    // leak on right?
+      for (x++; x <= x2 && getpixel (x, y) == border; x++)
+        ;
+      start = x;
+    } while (x <= x2);
+
+  } // while
+
+} // _floodfill ()
+
+// -----
+
+void floodfill (int x, int y, int border)
+{
+  unsigned int
+    oldcol;
+  int
+    found,
+    tmp_pattern,
+    tmp_color;
+
+  RECORD (floodfill (x, y, border), REC_FLOODFILL, x, y, border);
+
+  oldcol = getpixel (x, y);
+
+  // the way the above implementation of floodfill works,
+  // the fill colour must be different than the border colour
+  // and the current shape's background color.
+
+  if (oldcol == border || oldcol == bgi_ctx->fill_style.color ||
+      // out of viewport/window?
+      x < 0 || x > bgi_ctx->vp.right - bgi_ctx->vp.left ||
+      y < 0 || y > bgi_ctx->vp.bottom - bgi_ctx->vp.top)
+    return;
+
+  TRACE_BEGIN ("floodfill");
+
+  // special case for fill patterns. The background colour can't be
+  // the same in the area to be filled and in the fill pattern.
+
+  if (SOLID_FILL == bgi_ctx->fill_style.pattern) {
+    _floodfill (x, y, border);
+    TRACE_END ("floodfill");
+    return;
+  }
+  else { // fill patterns
+    if (bgi_ctx->bg_color == oldcol) {
+      // solid fill first...
+      tmp_pattern = bgi_ctx->fill_style.pattern;
+      bgi_ctx->fill_style.pattern = SOLID_FILL;
+      tmp_color = bgi_ctx->fill_style.color;
+      // find a suitable temporary fill colour; it must be different
+      // than the border, the background and the pattern colour
+      found = NOPE;
+      while (!found) {
+        bgi_ctx->fill_style.color = BLUE + random (WHITE);
+        if (oldcol != bgi_ctx->fill_style.color &&
+            border != bgi_ctx->fill_style.color &&
+            tmp_color != bgi_ctx->fill_style.color)
+          found = YEAH;
+      }
+      _floodfill (x, y, border);
+      // ...then pattern fill
+      bgi_ctx->fill_style.pattern = tmp_pattern;
+      bgi_ctx->fill_style.color = tmp_color;
+      _floodfill (x, y, border);
+    }
+    else
+      _floodfill (x, y, border);
+  }
+
+  update ();
+
+  TRACE_END ("floodfill");
+
+} // floodfill ()
+
+// -----
+
+int getactivepage (void)
+{
+  // Returns the active page number.
+
+  return (bgi_ap);
+
+} // getactivepage ()
+
+// -----
+
+void getarccoords (struct arccoordstype *arccoords)
+{
+  // Gets the coordinates of the last call to arc(), filling the
+  // arccoords structure.
+
+  arccoords->x = bgi_ctx->last_arc.x;
+  arccoords->y = bgi_ctx->last_arc.y;
+  arccoords->xstart = bgi_ctx->last_arc.xstart;
+  arccoords->ystart = bgi_ctx->last_arc.ystart;
+  arccoords->xend = bgi_ctx->last_arc.xend;
+  arccoords->yend = bgi_ctx->last_arc.yend;
+
+} // getarccoords ()
+
+// -----
+
+void getaspectratio (int *xasp, int *yasp)
+{
+  // Retrieves the current graphics mode's aspect ratio.
+  // Irrelevant on modern hardware.
+
+  *xasp = 10000;
+  *yasp = 10000;
+
+} // getaspectratio ()
+
+// -----
+
+int getbkcolor (void)
+{
+  // Returns the current background color.
+
+  return bgi_ctx->bg_color;
+
+} // getbkcolor ()
+
+// -----
+
+// this function should be simply named "getch", but this name
+// causes a bug in MSYS2.
+// "getch" is defined as a macro in SDL_bgi.h
+
+int bgi_getch (void)
+{
+  // Waits for a key and returns its ASCII value or code,
+  // or QUIT if the user asked to close the window
+
+  int
+    key, type;
+
+  if (window_is_hidden)
+    return (getchar ());
+
+  do {
+    key = getevent ();
+    type = eventtype ();
+
+    if (QUIT == type)
+      return QUIT;
+
+    if (SDL_KEYDOWN == type &&
+        key != KEY_LEFT_CTRL &&
+        key != KEY_RIGHT_CTRL &&
+        key != KEY_LEFT_SHIFT &&
+        key != KEY_RIGHT_SHIFT &&
+        key != KEY_LEFT_ALT &&
+        key != KEY_RIGHT_ALT &&
+        key != KEY_CAPSLOCK &&
+        key != KEY_LGUI &&
+        key != KEY_RGUI &&
+        key != KEY_MENU &&
+        key != KEY_ALT_GR) // can't catch AltGr!
+      return (int) key;
+  } while (1);
+
+  // we should never get here...
+  return 0;
+
+} // bgi_getch ()
+
+// -----
+
+int getcolor (void)
+{
+  // Returns the current drawing (foreground) color.
+
+  return bgi_ctx->fg_color;
+
+} // getcolor ()
+
+// -----
+
+int getcurrentwindow (void)
+{
+  // Returns the ID of current window
+
+  return current_window;
+
+} // getcurrentwindow ()
+
+// -----
+
+struct palettetype *getdefaultpalette (void)
+{
+  // Returns the default palette
+
+  return &bgi_ctx->pal;
+
+} // getdefaultpalette ()
+
+// -----
+
+char *getdrivername (void)
+{
+  // Returns a pointer to a string containing the name
+  //  of the current graphics driver.
+
+  return ("SDL_bgi");
+
+} // getdrivername ()
+
+// -----
+
+int getevent (void)
+{
+  // Waits for a keypress or mouse click, and returns the code of
+  // the mouse button or key that was pressed.
+
+  SDL_Event event;
+
+  // wait for an event
+  while (1) {
+
+    // while (poll_event (&event))
+    while (wait_event (&event))
+
+      switch (event.type) {
+
+      case SDL_WINDOWEVENT:
+
+        switch (event.window.event) {
+
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_EXPOSED:
+          refresh_window ();
+          break;
+
+        case SDL_WINDOWEVENT_CLOSE:
+          bgi_last_event = QUIT;
+          return QUIT;
+          break;
+
+        default:
+          ;
+
+        } // switch (event.window.event)
+
+        break;
+
+      case SDL_KEYDOWN:
+        bgi_last_event = SDL_KEYDOWN;
+        bgi_mouse_x = bgi_mouse_y = -1;
+        return event.key.keysym.sym;
+        break;
+
+      case SDL_MOUSEBUTTONDOWN:
+        bgi_last_event = SDL_MOUSEBUTTONDOWN;
+        bgi_mouse_x = event.button.x;
+        bgi_mouse_y = event.button.y;
+        return event.button.button;
+        break;
+
+      case SDL_MOUSEWHEEL:
+        bgi_last_event = SDL_MOUSEWHEEL;
+        SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y);
+        if (1 == event.wheel.y) // up
+          return (WM_WHEELUP);
+        else
+          return (WM_WHEELDOWN);
+        break;
+
+      default:
+        ;
+
+      } // switch (event.type)
+
+  } // while (1)
+
+} // getevent ()
+
+// -----
+
+void getfillpattern (char *pattern)
+{
+  // Copies the user-defined fill pattern, as set by setfillpattern,
+  // into the 8-byte area pointed to by pattern.
+
+  int i;
+
+  for (i = 0; i < 8; i++)
+    pattern[i] = (char) bgi_ctx->fill_patterns[USER_FILL][i];
+
+} // getfillpattern ()
+
+// -----
+
+void getfillsettings (struct fillsettingstype *fillinfo)
+{
+  // Fills the fillsettingstype structure pointed to by fillinfo
+  // with information about the current fill pattern and fill color.
+
+  fillinfo->pattern = bgi_ctx->fill_style.pattern;
+  fillinfo->color = bgi_ctx->fill_color;
+
+} // getfillsettings ()
+
+// -----
+
+int getgraphmode (void)
+{
+  // Returns the current graphics mode.
+
+  return bgi_gm;
+
+} // getgraphmode ()
+
+// -----
+
+void getimage (int left, int top, int right, int bottom, void *bitmap)
+{
+  // Copies a bit image of the specified region into the memory
+  // pointed by bitmap. Pixels outside the target are 0.
+
+  Uint32 bitmap_w, bitmap_h, *tmp, *row;
+  int x, y, x1, x2, n;
+  size_t offset;
+
+  // bitmap has already been malloc()'ed by the user.
+  tmp = bitmap;
+  bitmap_w = right - left + 1;
+  bitmap_h = bottom - top + 1;
+
+  // copy width and height to the beginning of bitmap
+  memcpy (tmp, &bitmap_w, sizeof (Uint32));
+  memcpy (tmp + 1, &bitmap_h, sizeof (Uint32));
+
+  left += bgi_ctx->vp.left;
+  top += bgi_ctx->vp.top;
+  right += bgi_ctx->vp.left;
+  x1 = (left < 0) ? 0 : left;
+  x2 = (right > bgi_ctx->maxx) ? bgi_ctx->maxx : right;
+
+  // copy image to bitmap, one row at a time
+  for (y = 0; y < bitmap_h; y++) {
+    row = tmp + 2 + y * bitmap_w;
+    if (top + y < 0 || top + y > bgi_ctx->maxy || x1 > x2) {
+      memset (row, 0, bitmap_w * sizeof (Uint32));
+      continue;
+    }
+    memset (row, 0, (x1 - left) * sizeof (Uint32));
+    memset (row + x2 - left + 1, 0, (right - x2) * sizeof (Uint32));
+    for (x = x1; x <= x2; x += n) {
+      n = ring_run (bgi_ctx, x, x2, top + y, &offset);
+      memcpy (row + x - left, bgi_ctx->pixels + offset,
+              n * sizeof (Uint32));
+    }
+  }
+
+} // getimage ()
+
+// -----
+
+void getlinesettings (struct linesettingstype *lineinfo)
+{
+  // Fills the linesettingstype structure pointed by lineinfo with
+  // information about the current line style, pattern, and thickness.
+
+  lineinfo->linestyle = bgi_ctx->line_style.linestyle;
+  lineinfo->upattern = bgi_ctx->line_style.upattern;
+  lineinfo->thickness = bgi_ctx->line_style.thickness;
+
+} // getlinesettings ();
+
+// -----
+
+int getmaxcolor (void)
+{
+  // Returns the maximum color value available (MAXCOLORS).
+
+  if (! bgi_ctx->argb_mode)
+    return MAXCOLORS;
+  else
+    return PALETTE_SIZE;
+
+} // getmaxcolor ()
+
+// -----
+
+int getmaxmode (void)
+{
+  // Returns the maximum mode number for the current driver.
+
+  return SDL_FULLSCREEN;
+
+} // getmaxmode ()
+
+// -----
+
+int getmaxx ()
+{
+  // Returns the maximum x screen coordinate.
+
+  return bgi_ctx->maxx;
+
+} // getmaxx ()
+
+// -----
+
+int getmaxy ()
+{
+  // Returns the maximum y screen coordinate.
+
+  return bgi_ctx->maxy;
+
+} // getmaxy ()
+
+// -----
+
+char *getmodename (int mode_number)
+{
+  // Returns a pointer to a string containing
+  // the name of the specified graphics mode.
+
+  switch (mode_number) {
+
+  case SDL_CGALO:
+    return "SDL_CGALO";
+    break;
+
+  case SDL_CGAHI:
+    return "SDL_CGAHI";
+    break;
+
+  case SDL_EGA:
+    return "SDL_EGA";
+    break;
+
+  case SDL_VGA:
+    return "SDL_VGA";
+    break;
+
+  case SDL_HERC:
+    return "SDL_HERC";
+    break;
+
+  case SDL_PC3270:
+    return "SDL_PC3270";
+    break;
+
+  case SDL_1024x768:
+    return "SDL_1024x768";
+    break;
+
+  case SDL_1152x900:
+    return "SDL_1152x900";
+    break;
+
+  case SDL_1280x1024:
+    return "SDL_1280x1024";
+    break;
+
+  case SDL_1366x768:
+    return "SDL_1366x768";
+    break;
+
+  case SDL_USER:
+    return "SDL_USER";
+    break;
+
+  case SDL_FULLSCREEN:
+    return "SDL_FULLSCREEN";
+    break;
+
+  default:
+  case SDL_800x600:
+    return "SDL_800x600";
+    break;
+
+  } // switch
+
+} // getmodename ()
+
+// -----
+
+void getmoderange (int graphdriver, int *lomode, int *himode)
+{
+  // Gets the range of valid graphics modes.
+
+  // return dummy values
+  *lomode = 0;
+  *himode = 0;
+
+} // getmoderange ()
+
+// -----
+
+void getpalette (struct palettetype *palette)
+{
+  // Fills the palettetype structure pointed by palette with
+  // information about the current palette's size and colors.
+
+  int i;
+
+  for (i = 0; i <= MAXCOLORS; i++)
+    palette->colors[i] = bgi_ctx->pal.colors[i];
+
+} // getpalette ()
+
+// -----
+
+int getpalettesize (struct palettetype *palette)
+{
+  // Returns the size of the palette.
+
+  // !!! BUG - don't ignore the parameter
+  return BGI_COLORS + TMP_COLORS + PALETTE_SIZE;
+
+} // getpalettesize ()
+
+// -----
+
+static Uint32 getpixel_raw (int x, int y)
+{
+  // Returns a pixel as Uint32 value
+
+  return bgi_ctx->pixels[ring_offset (bgi_ctx, x, y)];
+
+} // getpixel_raw ()
+
+// -----
+
+static int is_in_range (int x, int x1, int x2)
+{
+  // Utility function for getpixel ()
+
+  return (x >= x1 && x <= x2);
+
+} // is_in_range ()
+
+// -----
+
+unsigned int getpixel (int x, int y)
+{
+  // Returns the color of the pixel located at (x, y).
+
+  int col;
+  Uint32 tmp;
+
+  x += bgi_ctx->vp.left;
+  y += bgi_ctx->vp.top;
+
+  // out of screen?
+  if (! is_in_range (x, 0, bgi_ctx->maxx) ||
+      ! is_in_range (y, 0, bgi_ctx->maxy))
+    return bgi_ctx->bg_color;
+
+  tmp = getpixel_raw (x, y);
+
+  // now find the colour
+
+  for (col = BLACK; col < WHITE + 1; col++)
+    if (tmp == bgi_ctx->palette[col])
+      return col;
+
+  // if it's not a BGI color, just return the 0xAARRGGBB value
+  return tmp;
+
+} // getpixel ()
+
+// -----
+
+void getpixels (int n, const int *x, const int *y, Uint32 *colors)
+{
+  // Reads n pixels at once. Unlike getpixel (), the colors are
+  // always returned as 0xAARRGGBB values; pixels out of the screen
+  // read as the background color.
+
+  int
+    xx, yy;
+
+  for (int i = 0; i < n; i++) {
+    xx = x[i] + bgi_ctx->vp.left;
+    yy = y[i] + bgi_ctx->vp.top;
+    if (xx < 0 || xx > bgi_ctx->maxx || yy < 0 || yy > bgi_ctx->maxy)
+      colors[i] = bgi_ctx->palette[bgi_ctx->bg_color];
+    else
+      colors[i] = getpixel_raw (xx, yy);
+  }
+
+} // getpixels ()
+
+// -----
+
+void gettextsettings (struct textsettingstype *texttypeinfo)
+{
+  // Fills the textsettingstype structure pointed to by texttypeinfo
+  // with information about the current text font, direction, size,
+  // and justification.
+
+  texttypeinfo->font = bgi_ctx->txt_style.font;
+  texttypeinfo->direction = bgi_ctx->txt_style.direction;
+  texttypeinfo->charsize = bgi_ctx->txt_style.charsize;
+  texttypeinfo->horiz = bgi_ctx->txt_style.horiz;
+  texttypeinfo->vert = bgi_ctx->txt_style.vert;
+
+} // gettextsettings ()
+
+// -----
+
+void getviewsettings (struct viewporttype *viewport)
+{
+  // Fills the viewporttype structure pointed to by viewport
+  // with information about the current viewport.
+
+  viewport->left = bgi_ctx->vp.left;
+  viewport->top = bgi_ctx->vp.top;
+  viewport->right = bgi_ctx->vp.right;
+  viewport->bottom = bgi_ctx->vp.bottom;
+  viewport->clip = bgi_ctx->vp.clip;
+
+} // getviewsettings ()
+
+// -----
+
+int getvisualpage (void)
+{
+  // Returns the visual page number.
+
+  return (bgi_vp);
+
+} // getvisualpage ()
+
+// -----
+
+int getx (void)
+{
+  // Returns the current viewport's x coordinate.
+
+  return bgi_ctx->cp_x;
+
+} // getx ()
+
+// -----
+
+int gety (void)
+{
+  // Returns the current viewport's y coordinate.
+
+  return bgi_ctx->cp_y;
+
+} // gety ()
+
+// -----
+
+char *grapherrormsg (int errorcode)
+{
+  // Returns a pointer to the error message string associated with
+  // errorcode, returned by graphresult(). Actually, it does nothing.
+
+  return NULL;
+
+} // grapherrormsg ()
+
+// -----
+
+void graphdefaults (void)
+{
+  // Resets all graphics settings to their defaults.
+
+  int i;
+
+  RECORD (graphdefaults (), REC_GRAPHDEFAULTS);
+
+  initpalette ();
+
+  // initialise the graphics writing mode
+  bgi_ctx->writemode = COPY_PUT;
+  bgi_ctx->image_filter = NEAREST_FILTER;
+
+  // initialise the viewport
+  bgi_ctx->vp.left = 0;
+  bgi_ctx->vp.top = 0;
+
+  bgi_ctx->vp.right = bgi_ctx->maxx;
+  bgi_ctx->vp.bottom = bgi_ctx->maxy;
+  bgi_ctx->vp.clip = NOPE;
+
+  // initialise the CP
+  bgi_ctx->cp_x = 0;
+  bgi_ctx->cp_y = 0;
+
+  // initialise the text settings
+  bgi_ctx->txt_style.font = DEFAULT_FONT;
+  bgi_ctx->txt_style.direction = HORIZ_DIR;
+  bgi_ctx->txt_style.charsize = 1;
+  bgi_ctx->txt_style.horiz = LEFT_TEXT;
+  bgi_ctx->txt_style.vert = TOP_TEXT;
+
+  // initialise the fill settings
+  bgi_ctx->fill_style.pattern =  SOLID_FILL;
+  bgi_ctx->fill_style.color = WHITE;
+
+  // initialise the line settings
+  bgi_ctx->line_style.linestyle = SOLID_LINE;
+  bgi_ctx->line_style.upattern = SOLID_FILL;
+  bgi_ctx->line_style.thickness = NORM_WIDTH;
+
+  // initialise the palette
+  bgi_ctx->pal.size = 1 + MAXCOLORS;
+  for (i = 0; i < MAXCOLORS + 1; i++)
+    bgi_ctx->pal.colors[i] = i;
+
+} // graphdefaults ()
+
+// -----
+
+int graphresult (void)
+{
+  // Returns the error code for the last unsuccessful graphics
+  // operation and resets the error level to grOk. Actually,
+  // it does nothing.
+
+  return grOk;
+
+} // graphresult ()
+
+// -----
+
+unsigned imagesize (int left, int top, int right, int bottom)
+{
+  // Returns the size in bytes of the memory area required to store
+  // a bit image.
+
+  return 2 * sizeof(Uint32) + // witdth, height
+    (right - left + 1) * (bottom - top + 1) * sizeof (Uint32);
+
+} // imagesize ()
+
+// -----
+
+void initgraph (int *graphdriver, int *graphmode, char *pathtodriver)
+{
+  // Initializes the graphics system.
+
+  bgi_fast_mode = NOPE;   // BGI compatibility
+
+  // the graphics driver parameter is ignored and is always
+  // set to SDL; graphics modes may vary; the path parameter is
+  // also ignored.
+
+  if (NULL != graphmode)
+    bgi_gm = *graphmode;
+  else
+    bgi_gm = SDL_800x600; // default
+
+  switch (bgi_gm) {
+
+  case SDL_320x200:
+    initwindow (320, 200);
+    break;
+
+  case SDL_640x200:
+    initwindow (640, 200);
+    break;
+
+  case SDL_640x350:
+    initwindow (640, 350);
+    break;
+
+  case SDL_640x480:
+    initwindow (640, 480);
+    break;
+
+  case SDL_720x348:
+    initwindow (720, 348);
+    break;
+
+  case SDL_720x350:
+    initwindow (720, 350);
+    break;
+
+  case SDL_1024x768:
+    initwindow (1024, 768);
+    break;
+
+  case SDL_1152x900:
+    initwindow (1152, 900);
+    break;
+
+  case SDL_1280x1024:
+    initwindow (1280, 1024);
+    break;
+
+  case SDL_1366x768:
+    initwindow (1366, 768);
+    break;
+
+  case SDL_FULLSCREEN:
+    initwindow (0, 0);
+    break;
+
+  default:
+  case SDL_800x600:
+    initwindow (800, 600);
+    break;
+
+  } // switch
+
+  // old programs take it for granted
+
+  cleardevice ();
+  refresh_window ();
+
+} // initgraph ()
+
+// -----
+
+void initpalette (void)
+{
+  int i;
+
+  for (i = BLACK; i < WHITE + 1; i++)
+    bgi_ctx->palette[i] = bgi_palette[i];
+
+} // initpalette ()
+
+// -----
+
+void initwindow (int width, int height)
+{
+  // Initializes the graphics system, opening a width x height window.
+
+  int
+    display_count = 0,
+    page;
+
+  static int
+    first_run = YEAH,    // first run of initwindow()
+    fullscreen = -1;     // fullscreen window already created?
+
+  // check the environment variables 'SDL_BGI_TRACE' and
+  // 'SDL_BGI_RECORD'
+  trace_start (getenv ("SDL_BGI_TRACE"));
+  if (NOPE == bgi_rec_busy)
+    record_start (getenv ("SDL_BGI_RECORD"));
+
+  // the mutex is used by update()
+  if (!update_mutex)
+    update_mutex = SDL_CreateMutex ();
+  if (!update_mutex) {
+    SDL_Log ("SDL_CreateMutex() failed: %s", SDL_GetError ());
+    showerrorbox ("SDL_CreateMutex() failed");
+    fprintf (stderr, "Automatic refresh not available.\n");
+    // don't exit - slow and fast modes are still available
+  }
+
+  if (0 != lock_update ()) {
+    SDL_Log ("SDL_LockMutex() failed: %s", SDL_GetError ());
+    showerrorbox ("SDL_LockMutex() failed");
+  }
+
+  SDL_DisplayMode mode =
+  { SDL_PIXELFORMAT_UNKNOWN, 0, 0, 0, 0 };
+
+  if (YEAH == first_run) {
+    first_run = NOPE;
+     // initialise SDL2
+    if (SDL_Init (SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
+      SDL_Log ("SDL_Init() failed: %s", SDL_GetError ());
+      showerrorbox ("SDL_Init() failed");
+      exit (1);
+    }
+    // initialise active_windows[]
+    for (int i = 0; i < NUM_BGI_WIN; i++)
+      active_windows[i] = NOPE;
+    context_init (&bgi_default_ctx);
+  }
+
+  // any display available?
+  if ((display_count = SDL_GetNumVideoDisplays ()) < 1) {
+    SDL_Log ("SDL_GetNumVideoDisplays() returned: %i\n", display_count);
+    showerrorbox ("SDL_GetNumVideoDisplays() failed");
+    exit (1);
+  }
+
+  // get display mode
+  if (SDL_GetDisplayMode (0, 0, &mode) != 0) {
+    SDL_Log ("SDL_GetDisplayMode() failed: %s", SDL_GetError ());
+    showerrorbox ("SDL_GetDisplayMode() failed");
+    exit (1);
+  }
+
+  // pending damage belongs to the previous window
+  if (current_window > -1)
+    flush_damage ();
+
+  // find a free ID for the window
+  do {
+    current_window++;
+    if (NOPE == active_windows[current_window])
+      break;
+  } while (current_window < NUM_BGI_WIN);
+
+  if (current_window < NUM_BGI_WIN) {
+    active_windows[current_window] = YEAH;
+    num_windows++;
+  }
+  else {
+    fprintf (stderr, "Cannot create new window.\n");
+    return;
+  }
+
+  // check if a fullscreen window is already open
+  if (YEAH == fullscreen) {
+    fprintf (stderr, "Fullscreen window already open.\n");
+    return;
+  }
+
+  // take note of window size
+  bgi_win_maxx[current_window] = width - 1;
+  bgi_win_maxy[current_window] = height - 1;
+
+  if (NOPE == bgi_fast_mode) {  // called by initgraph ()
+    if (!width || !height) {    // fullscreen
+      bgi_win_maxx[current_window] = mode.w - 1;
+      bgi_win_maxy[current_window] = mode.h - 1;
+      window_flags = window_flags | SDL_WINDOW_FULLSCREEN_DESKTOP;
+      fullscreen = YEAH;
+    }
+    else {
+      bgi_win_maxx[current_window] = width - 1;
+      bgi_win_maxy[current_window] = height - 1;
+      fullscreen = NOPE;
+    }
+  } // if (NOPE == bgi_fast_mode)
+  else { // initwindow () called directly
+    if (width > mode.w || height > mode.h) {
+      // window too large - force fullscreen
+      width = 0;
+      height = 0;
+    }
+    if ( (0 != width) && (0 != height) ) {
+      bgi_win_maxx[current_window] = width - 1;
+      bgi_win_maxy[current_window] = height - 1;
+      fullscreen = NOPE;
+    }
+    else { // 0, 0: fullscreen
+      bgi_win_maxx[current_window] = mode.w - 1;
+      bgi_win_maxy[current_window] = mode.h - 1;
+      window_flags = window_flags | SDL_WINDOW_FULLSCREEN_DESKTOP;
+      fullscreen = YEAH;
+    }
+  }
+
+  bgi_win[current_window] =
+    SDL_CreateWindow (bgi_win_title,
+                      window_x,
+                      window_y,
+                      bgi_win_maxx[current_window] + 1,
+                      bgi_win_maxy[current_window] + 1,
+                      window_flags);
+  // is the window OK?
+  if (NULL == bgi_win[current_window]) {
+    SDL_Log ("Could not create window: %s\n", SDL_GetError ());
+    return;
+  }
+
+  // check the environment variable 'SDL_BGI_BACKEND',
+  // which overrides setbackend ()
+
+  char *backend = getenv ("SDL_BGI_BACKEND");
+
+  if (NULL != backend) {
+    if (0 == strcmp ("surface", backend))
+      bgi_backend = SURFACE_BACKEND;
+    else
+      if (0 == strcmp ("renderer", backend))
+        bgi_backend = RENDERER_BACKEND;
+  }
+
+  // check the environment variable 'SDL_BGI_IMAGE_CACHE',
+  // which overrides setimagecache ()
+
+  char *cache = getenv ("SDL_BGI_IMAGE_CACHE");
+
+  if (NULL != cache && *cache >= '0' && *cache <= '9')
+    setimagecache (atoi (cache));
+
+  bgi_win_backend[current_window] = bgi_backend;
+  bgi_win_alias[current_window] = NULL;
+  bgi_win_layout[current_window] = LAYOUT_ROWS;
+  bgi_rnd[current_window] = NULL;
+  bgi_txt[current_window] = NULL;
+
+  // a window can't have both a surface and a renderer
+  if (SURFACE_BACKEND == bgi_backend &&
+      NULL == SDL_GetWindowSurface (bgi_win[current_window])) {
+    SDL_Log ("Could not get window surface: %s\n", SDL_GetError ());
+    fprintf (stderr, "Falling back to the renderer backend.\n");
+    bgi_win_backend[current_window] = RENDERER_BACKEND;
+  }
+
+  if (RENDERER_BACKEND == bgi_win_backend[current_window]) {
+
+    // window ok; create renderer
+    bgi_rnd[current_window] =
+      SDL_CreateRenderer (bgi_win[current_window], -1,
+                          // slow but guaranteed to exist
+                          SDL_RENDERER_SOFTWARE |
+                          (bgi_vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+
+    if (NULL == bgi_rnd[current_window]) {
+      SDL_Log ("Could not create renderer: %s\n", SDL_GetError ());
+      return;
+    }
+
+    // finally, create the texture
+    bgi_txt[current_window] =
+      SDL_CreateTexture (bgi_rnd[current_window],
+                         SDL_PIXELFORMAT_ARGB8888,
+                         SDL_TEXTUREACCESS_STREAMING,
+                         // SDL_TEXTUREACCESS_TARGET,
+                         bgi_win_maxx[current_window] + 1,
+                         bgi_win_maxy[current_window] + 1);
+    if (NULL == bgi_txt[current_window]) {
+      SDL_Log ("Could not create texture: %s\n", SDL_GetError ());
+      return;
+    }
+
+  } // if (RENDERER_BACKEND...)
+
+  // check the environment variable 'SDL_BGI_SHM',
+  // which overrides setsharedpages ()
+
+  char *shm = getenv ("SDL_BGI_SHM");
+
+  if (NULL != shm && NULL == bgi_shm)
+    setsharedpages (shm);
+
+  // visual pages; only one window can share them
+  if ('\0' != bgi_shm_name[0] && NULL == bgi_shm &&
+      YEAH == shm_pages_create (bgi_win_maxx[current_window] + 1,
+                                bgi_win_maxy[current_window] + 1))
+    bgi_np += VPAGES;
+  else
+    for (page = 0; page < VPAGES; page++) {
+      bgi_vpage[page] =
+        SDL_CreateRGBSurface (0, mode.w, mode.h, 32, 0, 0, 0, 0);
+      if (NULL == bgi_vpage[page]) {
+        SDL_Log ("Could not create surface for visual page %d.", page);
+        showerrorbox ("Could not create surface for visual page");
+        break;
+      }
+      else
+        bgi_np++;
+    }
+
+  bgi_window = bgi_win[current_window];
+  bgi_renderer = bgi_rnd[current_window];
+  bgi_texture = bgi_txt[current_window];
+
+  bgi_activepage[current_window] =
+    bgi_visualpage[current_window] =
+    bgi_vpage[0]->pixels;
+  bgi_ap = bgi_vp = 0;
+
+  alias_window_surface ();
+  bind_default_context ();
+  CTX_CALL (&bgi_default_ctx, graphdefaults ());
+
+  if (bgi_rec_file && NOPE == bgi_rec_busy)
+    record_call (REC_INITWINDOW, bgi_win_maxx[current_window] + 1,
+                 bgi_win_maxy[current_window] + 1, bgi_fast_mode);
+
+  // check the environment variable 'SDL_BGI_SERVE'
+
+  char *serve = getenv ("SDL_BGI_SERVE");
+
+  if (NULL != serve && NOPE == bgi_serve_running)
+    startframeserver (serve);
+
+  // check the environment variable 'SDL_BGI_RATE'
+  // and act accordingly
+
+  char *speed = getenv ("SDL_BGI_RATE");
+
+  if (NULL == speed) // variable does not exist
+    speed = "compatible";
+  else {
+
+    if (0 == strcmp ("auto", speed))
+      sdlbgiauto ();
+
+    if (0 == strcmp ("limit", speed))
+      sdlbgilimit ();
+
+    refresh_rate = atoi (speed);
+    if (0 != refresh_rate) // implies auto mode
+      sdlbgiauto ();
+  }
+
+  // any other value of SDL_BGI_RATE triggers
+  // "compatible" mode by default
+
+  SDL_UnlockMutex (update_mutex);
+
+} // initwindow ()
+
+// -----
+
+int IS_BGI_COLOR (int color)
+{
+  // Returns 1 if the current color is a standard BGI color
+  // (not ARGB); the color argument is redundant
+
+  return ! bgi_ctx->argb_mode;
+
+} // IS_BGI_COLOR ()
+
+// -----
+
+int IS_RGB_COLOR (int color)
+{
+  // Returns 1 if the current color is a standard BGI color
+  // (not ARGB); the color argument is redundant
+
+  return bgi_ctx->argb_mode;
+
+} // IS_RGB_COLOR ()
+
+// -----
+
+int kbhit (void)
+{
+  // Returns 1 when a key is pressed, or QUIT
+  // if the user asked to close the window
+
+  SDL_Event event;
+  SDL_Keycode key;
+
+  update ();
+
+  if (YEAH == key_pressed) { // a key was pressed during delay()
+    key_pressed = NOPE;
+    return YEAH;
+  }
+
+  if (poll_event (&event)) {
+    if (SDL_KEYDOWN == event.type) {
+      key = event.key.keysym.sym;
+      if (key != SDLK_LCTRL &&
+          key != SDLK_RCTRL &&
+          key != SDLK_LSHIFT &&
+          key != SDLK_RSHIFT &&
+          key != SDLK_LGUI &&
+          key != SDLK_RGUI &&
+          key != SDLK_LALT &&
+          key != SDLK_RALT &&
+          key != SDLK_PAGEUP &&
+          key != SDLK_PAGEDOWN &&
+          key != SDLK_CAPSLOCK &&
+          key != SDLK_MENU &&
+          key != SDLK_APPLICATION)
+        return YEAH;
+      else
+        return NOPE;
+    } // if (SDL_KEYDOWN == event.type)
+    else
+      if (SDL_WINDOWEVENT == event.type) {
+        if (SDL_WINDOWEVENT_CLOSE == event.window.event)
+          return QUIT;
+      }
+    else
+      SDL_PushEvent (&event); // don't disrupt the mouse
+  }
+
+  return NOPE;
+
+} // kbhit ()
+
+// -----
+
+// Bresenham's line algorithm routines that implement logical
+// operations: copy, xor, and, or, not.
+
+void line_copy (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    // plot the pixel only if the corresponding bit
+    // in the current pattern is set to 1
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_copy (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_copy (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_copy ()
+
+// -----
+
+void line_xor (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_xor (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_xor (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_xor ()
+
+// -----
+
+void line_and (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_and (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_and (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_and ()
+
+// -----
+
+void line_or (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_or (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_or (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_or ()
+
+// -----
+
+void line_not (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_not (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_not (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_not ()
+
+// -----
+
+void line_alpha (int x1, int y1, int x2, int y2)
+{
+  int
+    counter = 0, // # of pixel plotted
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  for (;;) {
+
+    if (SOLID_LINE == bgi_ctx->line_style.linestyle)
+      putpixel_alpha (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      if ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+           >> counter % 16) & 1)
+        putpixel_alpha (x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+    counter++;
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
+    if (e2 < dy) {
+      err += dx;
+      y1 += sy;
+    }
+  } // for
+
+} // line_alpha ()
+
+// -----
+
+void line_fill (int x1, int y1, int x2, int y2)
+{
+  // line function used for filling
+
+  int
+    dx = abs (x2 - x1),
+    sx = x1 < x2 ? 1 : -1,
+    dy = abs (y2 - y1),
+    sy = y1 < y2 ? 1 : -1,
+    err = (dx > dy ? dx : -dy) / 2,
+    e2;
+
+  // horizontal lines, as drawn by bar () and fillpoly (), are spans
+  if (y1 == y2) {
+    fill_span ((x1 < x2 ? x1 : x2) + bgi_ctx->vp.left,
+               (x1 < x2 ? x2 : x1) + bgi_ctx->vp.left,
+               y1 + bgi_ctx->vp.top);
+    return;
+  }
+
+  for (;;) {
+
+    ff_putpixel (x1, y1);
+
+    if (x1 == x2 && y1 == y2)
+      break;
+    e2 = err;
+    if (e2 >-dx) {
+      err -= dy;
+      x1 += sx;
+    }
     if (e2 < dy) {
       err += dx;
       y1 += sy;
     }
-  } // for
+  } // for
+
+} // line_fill ()
+
+// -----
+
+// Thick line stroking engine. Lines, polylines, and arcs wider
+// than one pixel are decomposed into convex pieces (segment bodies,
+// joins, caps), and each piece is scan converted to horizontal spans.
+// Spans are collected, sorted, and merged before being plotted, so
+// every pixel is written exactly once; this is essential for XOR_PUT,
+// and much faster than drawing overlapping lines.
+
+// Pixel centres lie on integer coordinates; a pixel belongs to a
+// piece if its centre lies in [min, max) along each scanline, so
+// that a line of thickness t is exactly t pixels wide. Line end
+// points are inclusive, as in Bresenham lines.
+
+// spans are collected in the current context
+
+#define STROKE_EPS   1e-7 // rounding tolerance
+#define MITER_LIMIT  4.0  // longer miters are bevelled
+
+// -----
+
+static void stroke_begin (void)
+{
+  // Starts a new stroke.
+
+  bgi_ctx->stroke_nspans = 0;
+
+} // stroke_begin ()
+
+// -----
+
+static void stroke_add_span (int y, int x1, int x2)
+{
+  // Adds a span to the current stroke.
+
+  Span
+    *tmp;
+
+  if (x1 > x2)
+    return;
+
+  if (bgi_ctx->stroke_nspans == bgi_ctx->stroke_maxspans) {
+    tmp = realloc (bgi_ctx->stroke_span,
+                   (bgi_ctx->stroke_maxspans + 1024) * sizeof (Span));
+    if (NULL == tmp) {
+      fprintf (stderr, "Can't allocate memory for thick lines\n");
+      return;
+    }
+    bgi_ctx->stroke_span = tmp;
+    bgi_ctx->stroke_maxspans += 1024;
+  }
+
+  bgi_ctx->stroke_span[bgi_ctx->stroke_nspans].y = y;
+  bgi_ctx->stroke_span[bgi_ctx->stroke_nspans].x1 = x1;
+  bgi_ctx->stroke_span[bgi_ctx->stroke_nspans].x2 = x2;
+  bgi_ctx->stroke_nspans++;
+
+} // stroke_add_span ()
+
+// -----
+
+static void stroke_convex (const double *px, const double *py, int n)
+{
+  // Scan converts a convex polygon of n vertices.
+
+  int
+    i, j, y, found;
+  double
+    ymin, ymax, xmin, xmax, x;
+
+  ymin = ymax = py[0];
+  for (i = 1; i < n; i++) {
+    if (py[i] < ymin)
+      ymin = py[i];
+    if (py[i] > ymax)
+      ymax = py[i];
+  }
+
+  for (y = ceil (ymin - STROKE_EPS); y < ceil (ymax - STROKE_EPS); y++) {
+
+    found = NOPE;
+    xmin = xmax = 0.0;
+
+    // intersect scanline y with all edges
+    for (i = 0, j = n - 1; i < n; j = i++) {
+      if ( (py[j] <= y && y < py[i]) || (py[i] <= y && y < py[j]) ) {
+        x = px[j] + (y - py[j]) * (px[i] - px[j]) / (py[i] - py[j]);
+        if (NOPE == found || x < xmin)
+          xmin = x;
+        if (NOPE == found || x > xmax)
+          xmax = x;
+        found = YEAH;
+      }
+    }
+
+    if (found)
+      stroke_add_span (y, ceil (xmin - STROKE_EPS),
+                       ceil (xmax - STROKE_EPS) - 1);
+  }
+
+} // stroke_convex ()
+
+// -----
+
+static void stroke_segment (double x1, double y1, double x2, double y2,
+                            double hw, double ext1, double ext2)
+{
+  // Adds the body of a segment of half width hw, extended by ext1
+  // and ext2 beyond its end points.
+
+  double
+    dx = x2 - x1,
+    dy = y2 - y1,
+    len = sqrt (dx*dx + dy*dy),
+    px[4], py[4];
+
+  if (len < STROKE_EPS) { // a dot: make it square
+    dx = 1.0;
+    dy = 0.0;
+    ext1 = ext2 = hw;
+  }
+  else {
+    dx /= len;
+    dy /= len;
+  }
+
+  x1 -= dx * ext1;
+  y1 -= dy * ext1;
+  x2 += dx * ext2;
+  y2 += dy * ext2;
+
+  // the normal is (-dy, dx)
+  px[0] = x1 - dy * hw; py[0] = y1 + dx * hw;
+  px[1] = x2 - dy * hw; py[1] = y2 + dx * hw;
+  px[2] = x2 + dy * hw; py[2] = y2 - dx * hw;
+  px[3] = x1 + dy * hw; py[3] = y1 - dx * hw;
+
+  stroke_convex (px, py, 4);
+
+} // stroke_segment ()
+
+// -----
+
+static void stroke_join (double x, double y,
+                         double dx1, double dy1,
+                         double dx2, double dy2, double hw)
+{
+  // Fills the gap on the outer side of the join at (x, y) between
+  // two segments of directions (dx1, dy1) and (dx2, dy2), both
+  // normalised. Miter joins are used, unless they're too long.
+
+  double
+    cross = dx1 * dy2 - dy1 * dx2,
+    side, cosine,
+    ox1, oy1, ox2, oy2,
+    px[4], py[4];
+
+  if (fabs (cross) < STROKE_EPS) // collinear or reversed: no gap
+    return;
+
+  // outer normals
+  side = (cross > 0) ? -1.0 : 1.0;
+  ox1 = -dy1 * side;
+  oy1 = dx1 * side;
+  ox2 = -dy2 * side;
+  oy2 = dx2 * side;
+
+  cosine = ox1 * ox2 + oy1 * oy2;
+
+  px[0] = x;
+  py[0] = y;
+  px[1] = x + ox1 * hw;
+  py[1] = y + oy1 * hw;
+
+  if (1.0 + cosine > 2.0 / (MITER_LIMIT * MITER_LIMIT)) { // miter
+    px[2] = x + (ox1 + ox2) * hw / (1.0 + cosine);
+    py[2] = y + (oy1 + oy2) * hw / (1.0 + cosine);
+    px[3] = x + ox2 * hw;
+    py[3] = y + oy2 * hw;
+    stroke_convex (px, py, 4);
+  }
+  else { // bevel
+    px[2] = x + ox2 * hw;
+    py[2] = y + oy2 * hw;
+    stroke_convex (px, py, 3);
+  }
+
+} // stroke_join ()
+
+// -----
+
+static void stroke_dashes (double x1, double y1, double x2, double y2,
+                           double hw)
+{
+  // Adds a segment drawn with the current line pattern. As in
+  // Bresenham lines, the pattern advances by one bit per pixel
+  // along the major axis.
+
+  int
+    k, start,
+    steps = fmax (fabs (x2 - x1), fabs (y2 - y1)) + 0.5;
+  Uint16
+    pattern = bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle];
+
+  if (0 == steps) {
+    if (pattern & 1)
+      stroke_segment (x1, y1, x1, y1, hw, 0.0, 0.0);
+    return;
+  }
+
+  for (k = 0; k <= steps; k++) {
+    if (! ((pattern >> k % 16) & 1))
+      continue;
+    // find the end of this dash
+    for (start = k; k < steps && ((pattern >> (k + 1) % 16) & 1); k++)
+      ;
+    stroke_segment (x1 + (x2 - x1) * (start - 0.5) / steps,
+                    y1 + (y2 - y1) * (start - 0.5) / steps,
+                    x1 + (x2 - x1) * (k + 0.5) / steps,
+                    y1 + (y2 - y1) * (k + 0.5) / steps,
+                    hw, 0.0, 0.0);
+  }
+
+} // stroke_dashes ()
+
+// -----
+
+static void stroke_polyline (int numpoints, const double *pts, int closed)
+{
+  // Adds a polyline of numpoints (x, y) vertices, using the current
+  // line thickness and style. Closed polylines get a join at the
+  // first vertex too; open polylines get butt caps, i.e. the end
+  // points are included.
+
+  int
+    i, n, prev, next;
+  double
+    hw = bgi_ctx->line_style.thickness / 2.0,
+    *xs, *ys, dx1, dy1, dx2, dy2, len;
+
+  if (numpoints < 1)
+    return;
+
+  if (NULL == (xs = malloc (2 * (numpoints + 1) * sizeof (double)))) {
+    fprintf (stderr, "Can't allocate memory for thick lines\n");
+    return;
+  }
+  ys = xs + numpoints + 1;
+
+  // drop repeated vertices
+  for (i = n = 0; i < numpoints; i++)
+    if (0 == n || pts[2*i] != xs[n - 1] || pts[2*i + 1] != ys[n - 1]) {
+      xs[n] = pts[2*i];
+      ys[n] = pts[2*i + 1];
+      n++;
+    }
+  if (closed && n > 2 && xs[0] == xs[n - 1] && ys[0] == ys[n - 1])
+    n--;
+  if (n < 3)
+    closed = NOPE;
+
+  if (1 == n) {
+    stroke_segment (xs[0], ys[0], xs[0], ys[0], hw, 0.0, 0.0);
+    free (xs);
+    return;
+  }
+
+  if (SOLID_LINE != bgi_ctx->line_style.linestyle) {
+    // dashed lines have no joins
+    for (i = 0; i < n - 1; i++)
+      stroke_dashes (xs[i], ys[i], xs[i + 1], ys[i + 1], hw);
+    if (closed)
+      stroke_dashes (xs[n - 1], ys[n - 1], xs[0], ys[0], hw);
+    free (xs);
+    return;
+  }
+
+  // segment bodies
+  for (i = 0; i < (closed ? n : n - 1); i++) {
+    next = (i + 1) % n;
+    stroke_segment (xs[i], ys[i], xs[next], ys[next], hw,
+                    (closed || i > 0) ? 0.0 : 0.5,
+                    (closed || next < n - 1) ? 0.0 : 0.5);
+  }
+
+  // joins
+  for (i = closed ? 0 : 1; i < (closed ? n : n - 1); i++) {
+    prev = (i + n - 1) % n;
+    next = (i + 1) % n;
+    dx1 = xs[i] - xs[prev];
+    dy1 = ys[i] - ys[prev];
+    len = sqrt (dx1*dx1 + dy1*dy1);
+    dx1 /= len;
+    dy1 /= len;
+    dx2 = xs[next] - xs[i];
+    dy2 = ys[next] - ys[i];
+    len = sqrt (dx2*dx2 + dy2*dy2);
+    dx2 /= len;
+    dy2 /= len;
+    stroke_join (xs[i], ys[i], dx1, dy1, dx2, dy2, hw);
+  }
+
+  free (xs);
+
+} // stroke_polyline ()
+
+// -----
+
+static void stroke_arc (double x, double y,
+                        double stangle, double endangle,
+                        double xradius, double yradius)
+{
+  // Adds an elliptical arc, approximated by a polyline whose
+  // vertices are close enough to look smooth at any radius.
+  // A complete ellipse is closed.
+
+  int
+    i, n,
+    closed = (endangle - stangle >= 360);
+  double
+    *pts,
+    r = fmax (xradius, yradius) + bgi_ctx->line_style.thickness / 2.0,
+    step;
+
+  // the chord must not deviate by more than 1/4 pixel from the arc
+  step = (r > 0.25) ? 2.0 * acos (1.0 - 0.25 / r) / PI_CONV : 45.0;
+  if (step > 5.0)
+    step = 5.0;
+  n = ceil ((endangle - stangle) / step);
+  if (n < 1)
+    n = 1;
+
+  if (NULL == (pts = malloc (2 * (n + 1) * sizeof (double)))) {
+    fprintf (stderr, "Can't allocate memory for thick lines\n");
+    return;
+  }
+
+  for (i = 0; i <= n; i++) {
+    step = (stangle + (endangle - stangle) * i / n) * PI_CONV;
+    pts[2*i] = x + xradius * cos (step);
+    pts[2*i + 1] = y - yradius * sin (step);
+  }
+
+  stroke_polyline (closed ? n : n + 1, pts, closed);
+  free (pts);
+
+} // stroke_arc ()
+
+// -----
+
+static void stroke_annulus (int x, int y, int radius)
+{
+  // Adds a full circle, as the ring between two concentric circles.
+  // The spans are computed exactly, scanline by scanline.
+
+  int
+    dy, xo, xi;
+  double
+    hw = bgi_ctx->line_style.thickness / 2.0,
+    ro = radius + hw, // outer and inner radii
+    ri = radius - hw;
+
+  for (dy = -floor (ro); dy <= floor (ro); dy++) {
+    xo = floor (sqrt (ro*ro - (double) dy*dy) + STROKE_EPS);
+    if (ri > 0 && ri*ri - (double) dy*dy > 0) {
+      xi = floor (sqrt (ri*ri - (double) dy*dy) + STROKE_EPS);
+      stroke_add_span (y + dy, x - xo, x - xi - 1);
+      stroke_add_span (y + dy, x + xi + 1, x + xo);
+    }
+    else
+      stroke_add_span (y + dy, x - xo, x + xo);
+  }
+
+} // stroke_annulus ()
+
+// -----
+
+static int spancmp (const void *s1, const void *s2)
+{
+  // helper function for stroke_end ()
+
+  const Span
+    *a = s1,
+    *b = s2;
+
+  if (a->y != b->y)
+    return a->y - b->y;
+  return a->x1 - b->x1;
+
+} // spancmp ()
+
+// -----
+
+static int clip_span (int *x1, int *x2, int y)
+{
+  // Clips the span *x1..*x2 at row y to the screen and, if
+  // clipping is on, to the viewport. Returns NOPE if nothing
+  // is left to draw.
+
+  if (y < 0 || y > bgi_ctx->maxy)
+    return NOPE;
+  if (*x1 < 0)
+    *x1 = 0;
+  if (*x2 > bgi_ctx->maxx)
+    *x2 = bgi_ctx->maxx;
+
+  if (YEAH == bgi_ctx->vp.clip) {
+    if (y < bgi_ctx->vp.top || y > bgi_ctx->vp.bottom)
+      return NOPE;
+    if (*x1 < bgi_ctx->vp.left)
+      *x1 = bgi_ctx->vp.left;
+    if (*x2 > bgi_ctx->vp.right)
+      *x2 = bgi_ctx->vp.right;
+  }
+
+  return *x1 <= *x2;
+
+} // clip_span ()
+
+// -----
+
+static void draw_span (int x1, int x2, int y, Uint32 pixel)
+{
+  // Plots the horizontal span x1..x2 at row y using the current
+  // writing mode. Coordinates are absolute, not viewport-relative.
+
+  Uint32
+    *p;
+  int
+    n;
+  size_t
+    offset;
+
+  if (! clip_span (&x1, &x2, y))
+    return;
+  snap_touch (bgi_ctx, x1, y, x2, y);
+
+  // one run, unless the span crosses the edge of a ring
+  while (x1 <= x2) {
+    n = ring_run (bgi_ctx, x1, x2, y, &offset);
+    p = bgi_ctx->pixels + offset;
+    x1 += n;
+
+    switch (bgi_ctx->writemode) {
+
+    case XOR_PUT:
+      while (n--)
+        *p++ ^= (pixel & 0x00ffffff);
+      break;
+
+    case AND_PUT:
+      while (n--)
+        *p++ &= pixel;
+      break;
+
+    case OR_PUT:
+      while (n--)
+        *p++ |= (pixel & 0x00ffffff);
+      break;
+
+    case NOT_PUT:
+      while (n--)
+        *p++ = ~(pixel & 0x00ffffff);
+      break;
+
+    case ALPHA_PUT:
+      alpha_span (p, pixel, n);
+      break;
+
+    default:
+    case COPY_PUT:
+      while (n--)
+        *p++ = pixel;
+
+    } // switch
+
+  } // while
+
+} // draw_span ()
+
+// -----
+
+static void fill_span (int x1, int x2, int y)
+{
+  // Fills the span x1..x2 at row y with the current fill colour
+  // and pattern, as ff_putpixel () does one pixel at a time;
+  // ALPHA_PUT composites them instead.
+  // Coordinates are absolute, not viewport-relative.
+
+  Uint32
+    *p, fill, bg;
+  Uint8
+    bits;
+  int
+    x, n;
+  size_t
+    offset;
+
+  if (! clip_span (&x1, &x2, y))
+    return;
+  snap_touch (bgi_ctx, x1, y, x2, y);
+
+  fill = bgi_ctx->palette[bgi_ctx->fill_style.color];
+  bg = bgi_ctx->palette[bgi_ctx->bg_color];
+  bits = bgi_ctx->fill_patterns[bgi_ctx->fill_style.pattern][y % 8];
+  if (0x00 == bits)
+    fill = bg;
+
+  // the pattern follows x, not where pixels are stored
+  while (x1 <= x2) {
+    n = ring_run (bgi_ctx, x1, x2, y, &offset);
+    p = bgi_ctx->pixels + offset;
+    // solid rows need no pattern lookup
+    if (ALPHA_PUT == bgi_ctx->writemode) {
+      if (0xff == bits || 0x00 == bits)
+        alpha_span (p, fill, n);
+      else
+        for (x = x1; x < x1 + n; x++, p++)
+          *p = alpha_pixel (*p, ((bits >> x % 8) & 1) ? fill : bg);
+    }
+    else if (0xff == bits || 0x00 == bits)
+      for (x = x1; x < x1 + n; x++)
+        *p++ = fill;
+    else
+      for (x = x1; x < x1 + n; x++)
+        *p++ = ((bits >> x % 8) & 1) ? fill : bg;
+    x1 += n;
+  }
+
+} // fill_span ()
+
+// -----
+
+static void stroke_end (void)
+{
+  // Merges overlapping spans of the current stroke and plots them
+  // with the current colour and writing mode.
+
+  int
+    i, y, x1, x2;
+
+  if (0 == bgi_ctx->stroke_nspans)
+    return;
+
+  qsort (bgi_ctx->stroke_span, bgi_ctx->stroke_nspans, sizeof (Span), spancmp);
+
+  y = bgi_ctx->stroke_span[0].y;
+  x1 = bgi_ctx->stroke_span[0].x1;
+  x2 = bgi_ctx->stroke_span[0].x2;
+
+  for (i = 1; i < bgi_ctx->stroke_nspans; i++) {
+    if (bgi_ctx->stroke_span[i].y == y &&
+        bgi_ctx->stroke_span[i].x1 <= x2 + 1) {
+      if (bgi_ctx->stroke_span[i].x2 > x2)
+        x2 = bgi_ctx->stroke_span[i].x2;
+    }
+    else {
+      draw_span (x1, x2, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+      y = bgi_ctx->stroke_span[i].y;
+      x1 = bgi_ctx->stroke_span[i].x1;
+      x2 = bgi_ctx->stroke_span[i].x2;
+    }
+  }
+  draw_span (x1, x2, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+  bgi_ctx->stroke_nspans = 0;
+
+} // stroke_end ()
+
+// -----
+
+static void stroke_ipolyline (int numpoints, const int *polypoints,
+                              int closed)
+{
+  // Adds a polyline given in integer viewport coordinates.
+
+  double
+    *pts;
+  int
+    i;
+
+  if (NULL == (pts = malloc (2 * numpoints * sizeof (double)))) {
+    fprintf (stderr, "Can't allocate memory for thick lines\n");
+    return;
+  }
+
+  for (i = 0; i < numpoints; i++) {
+    pts[2*i] = polypoints[2*i] + bgi_ctx->vp.left;
+    pts[2*i + 1] = polypoints[2*i + 1] + bgi_ctx->vp.top;
+  }
+
+  stroke_polyline (numpoints, pts, closed);
+  free (pts);
+
+} // stroke_ipolyline ()
+
+// -----
+
+static void stroke_thin_polyline (int numpoints, const int *polypoints)
+{
+  // Adds a closed polyline one pixel wide, given in integer
+  // viewport coordinates, with the pixels and line style of
+  // line_fast (). Pixels shared by two segments are added twice,
+  // but plotted once; runs along a row are added as one span.
+
+  int
+    i, x1, y1, x2, y2,
+    dx, sx, dy, sy, err, e2,
+    counter,
+    run_y = 0, run_x1 = 0, run_x2 = -1;
+
+  for (i = 0; i < numpoints; i++) {
+    x1 = polypoints[2*i] + bgi_ctx->vp.left;
+    y1 = polypoints[2*i + 1] + bgi_ctx->vp.top;
+    x2 = polypoints[(2*i + 2) % (2 * numpoints)] + bgi_ctx->vp.left;
+    y2 = polypoints[(2*i + 3) % (2 * numpoints)] + bgi_ctx->vp.top;
+    dx = abs (x2 - x1);
+    sx = x1 < x2 ? 1 : -1;
+    dy = abs (y2 - y1);
+    sy = y1 < y2 ? 1 : -1;
+    err = (dx > dy ? dx : -dy) / 2;
+    counter = 0;
+
+    for (;;) {
+      if (SOLID_LINE == bgi_ctx->line_style.linestyle ||
+          ((bgi_ctx->line_patterns[bgi_ctx->line_style.linestyle]
+            >> counter % 16) & 1)) {
+        if (y1 == run_y && run_x1 <= run_x2 &&
+            (x1 == run_x2 + 1 || x1 == run_x1 - 1)) {
+          if (x1 > run_x2)
+            run_x2 = x1;
+          else
+            run_x1 = x1;
+        }
+        else {
+          stroke_add_span (run_y, run_x1, run_x2);
+          run_y = y1;
+          run_x1 = run_x2 = x1;
+        }
+      }
+      counter++;
+
+      if (x1 == x2 && y1 == y2)
+        break;
+      e2 = err;
+      if (e2 >-dx) {
+        err -= dy;
+        x1 += sx;
+      }
+      if (e2 < dy) {
+        err += dx;
+        y1 += sy;
+      }
+    } // for
+  }
+  stroke_add_span (run_y, run_x1, run_x2);
+
+} // stroke_thin_polyline ()
+
+// -----
+
+void line (int x1, int y1, int x2, int y2)
+{
+  // Draws a line between two specified points.
+
+  RECORD (line (x1, y1, x2, y2), REC_LINE, x1, y1, x2, y2);
+
+  line_fast (x1, y1, x2, y2);
+  update ();
+
+} // line ()
+
+// -----
+
+void line_fast (int x1, int y1, int x2, int y2)
+{
+  // Draws a line without updating the screen.
+
+  double pts[4];
+
+  // viewport
+  x1 += bgi_ctx->vp.left;
+  y1 += bgi_ctx->vp.top;
+  x2 += bgi_ctx->vp.left;
+  y2 += bgi_ctx->vp.top;
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    pts[0] = x1;
+    pts[1] = y1;
+    pts[2] = x2;
+    pts[3] = y2;
+    stroke_begin ();
+    stroke_polyline (2, pts, NOPE);
+    stroke_end ();
+    return;
+  }
+
+  // solid horizontal lines, as drawn by bar () and fillpoly (),
+  // are spans
+  if (y1 == y2 && SOLID_LINE == bgi_ctx->line_style.linestyle) {
+    if (x1 < x2)
+      draw_span (x1, x2, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    else
+      draw_span (x2, x1, y1, bgi_ctx->palette[bgi_ctx->fg_color]);
+    return;
+  }
+
+  switch (bgi_ctx->writemode) {
+
+  case COPY_PUT:
+    line_copy (x1, y1, x2, y2);
+    break;
+
+  case AND_PUT:
+    line_and (x1, y1, x2, y2);
+    break;
+
+  case XOR_PUT:
+    line_xor (x1, y1, x2, y2);
+    break;
+
+  case OR_PUT:
+    line_or (x1, y1, x2, y2);
+    break;
+
+  case NOT_PUT:
+    line_not (x1, y1, x2, y2);
+    break;
+
+  case ALPHA_PUT:
+    line_alpha (x1, y1, x2, y2);
+    break;
+
+  } // switch
+
+} // line_fast ()
+
+// -----
+
+void linerel (int dx, int dy)
+{
+  // Draws a line from the CP to a point that is (dx,dy)
+  // pixels from the CP.
+
+  RECORD (linerel (dx, dy), REC_LINEREL, dx, dy);
+
+  line (bgi_ctx->cp_x, bgi_ctx->cp_y, bgi_ctx->cp_x + dx, bgi_ctx->cp_y + dy);
+  bgi_ctx->cp_x += dx;
+  bgi_ctx->cp_y += dy;
+
+} // linerel ()
+
+// -----
+
+void lineto (int x, int y)
+{
+  // Draws a line from the CP to (x, y), then moves the CP to (dx, dy).
+
+  RECORD (lineto (x, y), REC_LINETO, x, y);
+
+  line (bgi_ctx->cp_x, bgi_ctx->cp_y, x, y);
+  bgi_ctx->cp_x = x;
+  bgi_ctx->cp_y = y;
+
+} // lineto ()
+
+// -----
+
+Uint32 *lockframebuffer (int *stride)
+{
+  // Returns the pixels being drawn on (the active page, unless a
+  // rendering context is current) for direct 0xAARRGGBB access;
+  // 'stride' receives the number of pixels per row. The screen is
+  // not refreshed until unlockframebuffer () is called. A tiled
+  // page or one with a ring is lent as a copy in rows, which
+  // unlockframebuffer () writes back.
+
+  int
+    width = bgi_ctx->maxx + 1;
+
+  if (NULL != stride)
+    *stride = width;
+
+  if (&bgi_default_ctx == bgi_ctx && update_mutex)
+    lock_update ();
+
+  // any pixel may be written
+  snap_touch (bgi_ctx, 0, 0, bgi_ctx->maxx, bgi_ctx->maxy);
+
+  if (LAYOUT_ROWS == bgi_ctx->layout && RING_OFF == bgi_ctx->ring_mode)
+    return bgi_ctx->pixels;
+
+  free (bgi_ctx->staging);
+  bgi_ctx->staging = malloc ((size_t) width * (bgi_ctx->maxy + 1) *
+                             sizeof (Uint32));
+  if (NULL == bgi_ctx->staging) {
+    fprintf (stderr, "Can't allocate memory in lockframebuffer().\n");
+    if (&bgi_default_ctx == bgi_ctx && update_mutex)
+      SDL_UnlockMutex (update_mutex);
+    return NULL;
+  }
+  for (int y = 0; y <= bgi_ctx->maxy; y++)
+    load_row (bgi_ctx, bgi_ctx->pixels,
+              bgi_ctx->staging + (size_t) y * width, 0, bgi_ctx->maxx, y);
+
+  return bgi_ctx->staging;
+
+} // lockframebuffer ()
+
+// -----
+
+void makecolorramp (Uint32 *lut, int lutsize,
+                    const Uint32 *stops, int nstops)
+{
+  // Fills lut with lutsize colours that blend evenly from
+  // stops[0] to stops[nstops - 1], e.g. for putcolormap ().
+
+  int
+    i, k;
+  Sint64
+    f;
+
+  if (NULL == lut || lutsize <= 0 || NULL == stops || nstops <= 0)
+    return;
+
+  if (1 == nstops || 1 == lutsize) {
+    for (i = 0; i < lutsize; i++)
+      lut[i] = stops[0];
+    return;
+  }
+
+  for (i = 0; i < lutsize; i++) {
+    // position in the stops, 24.8 fixed point
+    f = (Sint64) i * (nstops - 1) * 256 / (lutsize - 1);
+    k = f >> 8;
+    if (k >= nstops - 1)
+      lut[i] = stops[nstops - 1];
+    else
+      lut[i] = lerp_pixel (stops[k], stops[k + 1], f & 0xff);
+  }
+
+} // makecolorramp ()
+
+// -----
+
+int mouseclick (void)
+{
+  // Returns the code of the mouse button that was clicked,
+  // or 0 if none was clicked.
+
+  SDL_Event event;
+
+  while (1) {
+
+    if (poll_event (&event)) {
+
+      if (SDL_MOUSEBUTTONDOWN == event.type) {
+        bgi_mouse_x = event.button.x;
+        bgi_mouse_y = event.button.y;
+        return (event.button.button);
+      }
+      else
+        if (SDL_MOUSEMOTION == event.type) {
+          bgi_mouse_x = event.motion.x;
+          bgi_mouse_y = event.motion.y;
+          return (WM_MOUSEMOVE);
+        }
+      else {
+        SDL_PushEvent (&event); // don't disrupt the keyboard
+        return NOPE;
+      }
+      return NOPE;
+
+    } // if
+    else
+      return NOPE;
+
+  } // while
+
+} // mouseclick ()
+
+// -----
+
+int ismouseclick (int btn)
+{
+  // Returns 1 if the 'btn' mouse button was clicked.
+
+  TRACE_BEGIN ("SDL_PumpEvents");
+  SDL_PumpEvents ();
+  TRACE_END ("SDL_PumpEvents");
+
+  switch (btn) {
+
+  case SDL_BUTTON_LEFT:
+    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(1));
+    break;
+
+  case SDL_BUTTON_MIDDLE:
+    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(2));
+    break;
+
+  case SDL_BUTTON_RIGHT:
+    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(3));
+    break;
+
+  }
+
+  return NOPE;
+
+} // ismouseclick ()
+
+// -----
+
+void getmouseclick (int kind, int *x, int *y)
+{
+  // Sets the x,y coordinates of the last kind button click
+  // expected by ismouseclick().
+
+  *x = bgi_mouse_x;
+  *y = bgi_mouse_y;
+
+} // getmouseclick ()
+
+// -----
+
+int mousex (void)
+{
+  // Returns the X coordinate of the last mouse click.
+
+  return bgi_mouse_x - bgi_ctx->vp.left;
+
+} // mousex ()
+
+// -----
+
+int mousey (void)
+{
+  // Returns the Y coordinate of the last mouse click.
+
+  return bgi_mouse_y - bgi_ctx->vp.top;
+
+} // mousey ()
+
+// -----
+
+void moverel (int dx, int dy)
+{
+  // Moves the CP by (dx, dy) pixels.
+
+  RECORD (moverel (dx, dy), REC_MOVEREL, dx, dy);
+
+  bgi_ctx->cp_x += dx;
+  bgi_ctx->cp_y += dy;
+
+} // moverel ()
+
+// -----
+
+void moveto (int x, int y)
+{
+  // Moves the CP to the position (x, y), relative to the viewport.
+
+  RECORD (moveto (x, y), REC_MOVETO, x, y);
+
+  bgi_ctx->cp_x = x;
+  bgi_ctx->cp_y = y;
+
+} // moveto ()
+
+// -----
+
+static void _bar (int left, int top, int right, int bottom)
+{
+  // Used by drawchar
+
+  int tmp, y;
+
+  // like bar (), but uses bgi_fg_color
+
+  tmp = bgi_ctx->fg_color;
+  // setcolor (bgi_fg_color);
+  for (y = top; y <= bottom; y++)
+    line_fast (left, y, right, y);
+
+  setcolor (tmp);
+
+} // _bar ()
+
+// -----
+
+static void drawchar (unsigned char ch)
+{
+  // used by outtextxy ()
+
+  unsigned char i, j, k;
+  int x, y, tmp;
+
+  tmp = bgi_ctx->bg_color;
+  bgi_ctx->bg_color = bgi_ctx->fg_color; // for bar ()
+  setcolor (bgi_ctx->bg_color);
+
+  // for each of the 8 bytes that make up the font
+
+  for (i = 0; i < 8; i++) {
+
+    k = fontptr[8*ch + i];
+
+    // scan horizontal line
+
+    for (j = 0; j < 8; j++)
+
+      if ( (k << j) & 0x80) { // bit set to 1
+        if (HORIZ_DIR == bgi_ctx->txt_style.direction) {
+          x = bgi_ctx->cp_x + j * bgi_ctx->font_mag_x;
+          y = bgi_ctx->cp_y + i * bgi_ctx->font_mag_y;
+          // putpixel (x, y, bgi_fg_color);
+          _bar (x, y, x + bgi_ctx->font_mag_x - 1,
+                y + bgi_ctx->font_mag_y - 1);
+        }
+        else {
+          x = bgi_ctx->cp_x + i * bgi_ctx->font_mag_y;
+          y = bgi_ctx->cp_y - j * bgi_ctx->font_mag_x;
+          // putpixel (bgi_cp_x + i, bgi_cp_y - j, bgi_fg_color);
+          _bar (x, y, x + bgi_ctx->font_mag_x - 1,
+                y + bgi_ctx->font_mag_y - 1);
+        }
+      }
+  }
+
+  if (HORIZ_DIR == bgi_ctx->txt_style.direction)
+    bgi_ctx->cp_x += 8*bgi_ctx->font_mag_x;
+  else
+    bgi_ctx->cp_y -= 8*bgi_ctx->font_mag_y;
+
+  bgi_ctx->bg_color = tmp;
+
+} // drawchar ()
+
+// -----
+
+void outtext (char *textstring)
+{
+  // Outputs textstring at the CP.
+
+  RECORD (outtext (textstring), REC_OUTTEXT, textstring);
+
+  outtextxy (bgi_ctx->cp_x, bgi_ctx->cp_y, textstring);
+  if ( (HORIZ_DIR == bgi_ctx->txt_style.direction) &&
+       (LEFT_TEXT == bgi_ctx->txt_style.horiz))
+    bgi_ctx->cp_x += textwidth (textstring);
+
+} // outtext ()
+
+// -----
+
+void outtextxy (int x, int y, char *textstring)
+{
+  // Outputs textstring at (x, y).
+
+  int
+    tmp,
+    i,
+    x1 = 0,
+    y1 = 0,
+    tw,
+    th;
+
+  RECORD (outtextxy (x, y, textstring), REC_OUTTEXTXY, x, y, textstring);
+
+  tw = textwidth (textstring);
+  if (0 == tw)
+    return;
+
+  TRACE_BEGIN ("outtextxy");
+
+  th = textheight (textstring);
+
+  if (HORIZ_DIR == bgi_ctx->txt_style.direction) {
+
+    if (LEFT_TEXT == bgi_ctx->txt_style.horiz)
+      x1 = x;
+
+    if (CENTER_TEXT == bgi_ctx->txt_style.horiz)
+      x1 = x - tw / 2;
+
+    if (RIGHT_TEXT == bgi_ctx->txt_style.horiz)
+      x1 = x - tw;
+
+    if (CENTER_TEXT == bgi_ctx->txt_style.vert)
+      y1 = y - th / 2;
+
+    if (TOP_TEXT == bgi_ctx->txt_style.vert)
+      y1 = y;
+
+    if (BOTTOM_TEXT == bgi_ctx->txt_style.vert)
+      y1 = y - th;
+
+  }
+  else { // VERT_DIR
+
+    if (LEFT_TEXT == bgi_ctx->txt_style.horiz)
+      y1 = y;
+
+    if (CENTER_TEXT == bgi_ctx->txt_style.horiz)
+      y1 = y + tw / 2;
+
+    if (RIGHT_TEXT == bgi_ctx->txt_style.horiz)
+      y1 = y + tw;
+
+    if (CENTER_TEXT == bgi_ctx->txt_style.vert)
+      x1 = x - th / 2;
+
+    if (TOP_TEXT == bgi_ctx->txt_style.vert)
+      x1 = x;
+
+    if (BOTTOM_TEXT == bgi_ctx->txt_style.vert)
+      x1 = x - th;
+
+  } // VERT_DIR
+
+  moveto (x1, y1);
+
+  // if THICK_WIDTH, fallback to NORM_WIDTH
+  tmp = bgi_ctx->line_style.thickness;
+  bgi_ctx->line_style.thickness = NORM_WIDTH;
+
+  for (i = 0; i < strlen (textstring); i++)
+    drawchar (textstring[i]);
+
+  bgi_ctx->line_style.thickness = tmp;
+
+  update ();
+
+  TRACE_END ("outtextxy");
+
+} // outtextxy ()
+
+// -----
+
+void pieslice (int x, int y, int stangle, int endangle, int radius)
+{
+  // Draws and fills a pie slice centered at (x, y), with a radius
+  // given by radius, traveling from stangle to endangle.
+
+  // quick and dirty for now, Bresenham-based later.
+  int angle;
+
+  RECORD (pieslice (x, y, stangle, endangle, radius),
+          REC_PIESLICE, x, y, stangle, endangle, radius);
+
+  if (0 == radius || stangle == endangle)
+    return;
+
+  if (endangle < stangle)
+    endangle += 360;
+
+  if (0 == radius)
+    return;
+
+  bgi_ctx->last_arc.x = x;
+  bgi_ctx->last_arc.y = y;
+  bgi_ctx->last_arc.xstart = x + (radius * cos (stangle * PI_CONV));
+  bgi_ctx->last_arc.ystart = y - (radius * sin (stangle * PI_CONV));
+  bgi_ctx->last_arc.xend = x + (radius * cos (endangle * PI_CONV));
+  bgi_ctx->last_arc.yend = y - (radius * sin (endangle * PI_CONV));
+
+  for (angle = stangle; angle < endangle; angle++)
+    line_fast (x + (radius * cos (angle * PI_CONV)),
+               y - (radius * sin (angle * PI_CONV)),
+               x + (radius * cos ((angle+1) * PI_CONV)),
+               y - (radius * sin ((angle+1) * PI_CONV)));
+  line_fast (x, y, bgi_ctx->last_arc.xstart, bgi_ctx->last_arc.ystart);
+  line_fast (x, y, bgi_ctx->last_arc.xend, bgi_ctx->last_arc.yend);
+
+  angle = (stangle + endangle) / 2;
+  floodfill (x + (radius * cos (angle * PI_CONV)) / 2,
+             y - (radius * sin (angle * PI_CONV)) / 2,
+             bgi_ctx->fg_color);
+
+  update ();
+
+} // pieslice ()
+
+// -----
+
+// Worker pool. putcolormap () and shadeviewport () split their work
+// into tasks that run on all cores; the calling thread works too.
+// Tasks must not use bgi_ctx, which is thread-local: they get all
+// they need through 'arg'. The pool is started on first use and
+// stopped by closegraph ().
+
+static void pool_start (void)
+{
+  // starts the worker threads, once
+
+  int
+    n;
+
+  SDL_AtomicLock (&bgi_pool_lock);
+
+  if (NULL == bgi_pool_mutex) {
+    bgi_pool_mutex = SDL_CreateMutex ();
+    bgi_pool_cond = SDL_CreateCond ();
+    bgi_pool_size = 0;
+    n = SDL_GetCPUCount () - 1;
+    if (n > MAX_WORKERS)
+      n = MAX_WORKERS;
+    if (NULL != bgi_pool_mutex && NULL != bgi_pool_cond)
+      while (bgi_pool_size < n) {
+        bgi_pool_thread[bgi_pool_size] =
+          SDL_CreateThread (pool_worker, "SDL_bgi worker", NULL);
+        if (NULL == bgi_pool_thread[bgi_pool_size])
+          break;
+        bgi_pool_size++;
+      }
+  }
+
+  SDL_AtomicUnlock (&bgi_pool_lock);
+
+} // pool_start ()
+
+// -----
+
+static void pool_stop (void)
+{
+  // stops the worker threads
+
+  if (NULL == bgi_pool_mutex)
+    return;
+
+  SDL_LockMutex (bgi_pool_mutex);
+  bgi_job.quit = YEAH;
+  SDL_CondBroadcast (bgi_pool_cond);
+  SDL_UnlockMutex (bgi_pool_mutex);
+
+  for (int i = 0; i < bgi_pool_size; i++)
+    SDL_WaitThread (bgi_pool_thread[i], NULL);
+
+  SDL_DestroyCond (bgi_pool_cond);
+  SDL_DestroyMutex (bgi_pool_mutex);
+  bgi_pool_mutex = NULL;
+  bgi_pool_cond = NULL;
+  bgi_pool_size = 0;
+  bgi_job.quit = NOPE;
+
+} // pool_stop ()
+
+// -----
+
+static int pool_worker (void *unused)
+{
+  // runs tasks until pool_stop () is called
+
+  bgi_task
+    fn;
+  void
+    *arg;
+  int
+    task;
+
+  SDL_LockMutex (bgi_pool_mutex);
+
+  for (;;) {
+    while (! bgi_job.quit &&
+           (NULL == bgi_job.fn || bgi_job.next >= bgi_job.ntasks))
+      SDL_CondWait (bgi_pool_cond, bgi_pool_mutex);
+    if (bgi_job.quit)
+      break;
+    fn = bgi_job.fn;
+    arg = bgi_job.arg;
+    task = bgi_job.next++;
+    SDL_UnlockMutex (bgi_pool_mutex);
+    fn (arg, task);
+    SDL_LockMutex (bgi_pool_mutex);
+    if (0 == --bgi_job.running)
+      SDL_CondBroadcast (bgi_pool_cond);
+  }
+
+  SDL_UnlockMutex (bgi_pool_mutex);
+  return 0;
+
+} // pool_worker ()
+
+// -----
+
+static void run_tasks (bgi_task fn, void *arg, int ntasks,
+                       bgi_progress progress)
+{
+  // Runs fn (arg, 0) ... fn (arg, ntasks - 1) on the worker pool
+  // and returns when all of them are done. If not NULL, progress
+  // (arg) is called on this thread after each task it runs, and
+  // every PROGRESS_MS milliseconds while it waits for the others.
+
+  int
+    task;
+
+  pool_start ();
+
+  if (0 == bgi_pool_size) {
+    for (task = 0; task < ntasks; task++) {
+      fn (arg, task);
+      if (progress)
+        progress (arg);
+    }
+    return;
+  }
+
+  SDL_LockMutex (bgi_pool_mutex);
+
+  // one job at a time
+  while (NULL != bgi_job.fn)
+    SDL_CondWait (bgi_pool_cond, bgi_pool_mutex);
+
+  bgi_job.fn = fn;
+  bgi_job.arg = arg;
+  bgi_job.ntasks = ntasks;
+  bgi_job.next = 0;
+  bgi_job.running = ntasks;
+  SDL_CondBroadcast (bgi_pool_cond);
+
+  while (bgi_job.next < ntasks) {
+    task = bgi_job.next++;
+    SDL_UnlockMutex (bgi_pool_mutex);
+    fn (arg, task);
+    if (progress)
+      progress (arg);
+    SDL_LockMutex (bgi_pool_mutex);
+    bgi_job.running--;
+  }
+
+  while (bgi_job.running > 0)
+    if (progress) {
+      SDL_CondWaitTimeout (bgi_pool_cond, bgi_pool_mutex, PROGRESS_MS);
+      SDL_UnlockMutex (bgi_pool_mutex);
+      progress (arg);
+      SDL_LockMutex (bgi_pool_mutex);
+    }
+    else
+      SDL_CondWait (bgi_pool_cond, bgi_pool_mutex);
+
+  bgi_job.fn = NULL;
+  SDL_CondBroadcast (bgi_pool_cond);
+  SDL_UnlockMutex (bgi_pool_mutex);
+
+} // run_tasks ()
+
+// -----
+
+// putcolormap () and putcolormapint (): each task converts a band
+// of COLORMAP_ROWS rows
+
+#define COLORMAP_ROWS 16
+
+typedef struct {
+  const struct bgi_context *ctx; // destination
+  int left, top;            // first destination pixel, absolute
+  int width, height;        // visible part of the field
+  const float *fvalues;     // first visible value, or NULL
+  const int *ivalues;       // first visible value, or NULL
+  int pitch;                // values per row
+  float vmin, scale;        // float index = (v - vmin) * scale
+  const Uint32 *lut;
+  int lutsize;
+} ColormapJob;
+
+// -----
+
+static void colormap_row (Uint32 *dst, const ColormapJob *job,
+                          const float *fv, const int *iv, int n)
+{
+  // converts n values to colours
+
+  int
+    x = 0,
+    i,
+    last = job->lutsize - 1;
+  float
+    f;
+
+#if defined (BGI_HAVE_SSE2)
+  int
+    idx[4];
+  __m128i
+    vi,
+    ilo = _mm_setzero_si128 (),
+    ihi = _mm_set1_epi32 (last),
+    mask;
+  __m128
+    vmin = _mm_set1_ps (job->vmin),
+    scale = _mm_set1_ps (job->scale),
+    half = _mm_set1_ps (0.5f),
+    flo = _mm_setzero_ps (),
+    fhi = _mm_set1_ps ((float) last);
+
+  for (; x + 4 <= n; x += 4) {
+    if (fv) {
+      // NaN becomes 0: MAXPS returns the second operand
+      __m128 v = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (fv + x), vmin),
+                             scale);
+      v = _mm_min_ps (_mm_max_ps (v, flo), fhi);
+      vi = _mm_cvttps_epi32 (_mm_add_ps (v, half));
+    }
+    else {
+      vi = _mm_loadu_si128 ((const __m128i *) (iv + x));
+      mask = _mm_cmplt_epi32 (vi, ilo);
+      vi = _mm_andnot_si128 (mask, vi);
+      mask = _mm_cmpgt_epi32 (vi, ihi);
+      vi = _mm_or_si128 (_mm_andnot_si128 (mask, vi),
+                         _mm_and_si128 (mask, ihi));
+    }
+    _mm_storeu_si128 ((__m128i *) idx, vi);
+    dst[x]     = job->lut[idx[0]];
+    dst[x + 1] = job->lut[idx[1]];
+    dst[x + 2] = job->lut[idx[2]];
+    dst[x + 3] = job->lut[idx[3]];
+  }
+#endif
+
+  for (; x < n; x++) {
+    if (fv) {
+      f = (fv[x] - job->vmin) * job->scale;
+      // clamp first: a float too large for an int can't be converted
+      if (f > (float) last)
+        f = (float) last;
+      i = (f > 0.0f) ? (int) (f + 0.5f) : 0; // NaN too
+    }
+    else
+      i = iv[x];
+    if (i < 0)
+      i = 0;
+    if (i > last)
+      i = last;
+    dst[x] = job->lut[i];
+  }
+
+} // colormap_row ()
+
+// -----
+
+static void colormap_task (void *arg, int task)
+{
+  // converts rows task * COLORMAP_ROWS and following
+
+  ColormapJob
+    *job = arg;
+  int
+    y, n,
+    x2 = job->left + job->width - 1,
+    y1 = (task + 1) * COLORMAP_ROWS;
+  size_t
+    offset;
+  const float
+    *fv;
+  const int
+    *iv;
+
+  if (y1 > job->height)
+    y1 = job->height;
+
+  // each row is converted in the runs it is stored in
+  for (y = task * COLORMAP_ROWS; y < y1; y++) {
+    fv = job->fvalues ? job->fvalues + y * job->pitch : NULL;
+    iv = job->ivalues ? job->ivalues + y * job->pitch : NULL;
+    for (int x = 0; x < job->width; x += n) {
+      n = ring_run (job->ctx, job->left + x, x2, job->top + y, &offset);
+      colormap_row (job->ctx->pixels + offset, job,
+                    fv ? fv + x : NULL, iv ? iv + x : NULL, n);
+    }
+  }
+
+} // colormap_task ()
+
+// -----
+
+static void colormap (int left, int top, int width, int height,
+                      const float *fvalues, const int *ivalues,
+                      float vmin, float vmax,
+                      const Uint32 *lut, int lutsize)
+{
+  // common code of putcolormap () and putcolormapint ()
+
+  ColormapJob
+    job;
+  int
+    x0, y0, x1, y1,
+    cleft, ctop, cright, cbottom;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  // no table: use the colours set by setrgbpalette ()
+  if (NULL == lut) {
+    lut = bgi_ctx->palette + BGI_COLORS + TMP_COLORS;
+    if (lutsize > PALETTE_SIZE)
+      lutsize = PALETTE_SIZE;
+  }
+  if (lutsize <= 0)
+    return;
+
+  // clip
+  left += bgi_ctx->vp.left;
+  top += bgi_ctx->vp.top;
+  clip_bounds (&cleft, &ctop, &cright, &cbottom);
+  x0 = (left < cleft) ? cleft - left : 0;
+  y0 = (top < ctop) ? ctop - top : 0;
+  x1 = (left + width - 1 > cright) ? cright - left : width - 1;
+  y1 = (top + height - 1 > cbottom) ? cbottom - top : height - 1;
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  snap_touch (bgi_ctx, left + x0, top + y0, left + x1, top + y1);
+
+  job.ctx = bgi_ctx;
+  job.left = left + x0;
+  job.top = top + y0;
+  job.width = x1 - x0 + 1;
+  job.height = y1 - y0 + 1;
+  job.pitch = width;
+  job.fvalues = fvalues ? fvalues + y0 * width + x0 : NULL;
+  job.ivalues = ivalues ? ivalues + y0 * width + x0 : NULL;
+  job.vmin = vmin;
+  job.scale = (vmax != vmin) ? (lutsize - 1) / (vmax - vmin) : 0.0f;
+  job.lut = lut;
+  job.lutsize = lutsize;
+
+  run_tasks (colormap_task, &job,
+             (job.height + COLORMAP_ROWS - 1) / COLORMAP_ROWS, NULL);
+
+  update_area (left + x0, top + y0, left + x1, top + y1);
+
+} // colormap ()
+
+// -----
+
+void putcolormap (int left, int top, int width, int height,
+                  const float *values, float vmin, float vmax,
+                  const Uint32 *lut, int lutsize)
+{
+  // Draws a width x height array of values at (left, top): vmin
+  // maps to lut[0], vmax to lut[lutsize - 1], values in between
+  // to the nearest entry. If lut is NULL, the colours set with
+  // setrgbpalette () are used.
+
+  RECORD (putcolormap (left, top, width, height, values, vmin, vmax,
+                       lut, lutsize),
+          REC_PUTCOLORMAP, left, top, width, height,
+          values, width * height * (int) sizeof (float),
+          (double) vmin, (double) vmax,
+          lut, lutsize * (int) sizeof (Uint32), lutsize);
+
+  colormap (left, top, width, height, values, NULL, vmin, vmax,
+            lut, lutsize);
+
+} // putcolormap ()
+
+// -----
+
+void putcolormapint (int left, int top, int width, int height,
+                     const int *values, const Uint32 *lut, int lutsize)
+{
+  // Like putcolormap (), but values are indices into lut;
+  // values out of range are clamped.
+
+  RECORD (putcolormapint (left, top, width, height, values,
+                          lut, lutsize),
+          REC_PUTCOLORMAPINT, left, top, width, height,
+          values, width * height * (int) sizeof (int),
+          lut, lutsize * (int) sizeof (Uint32), lutsize);
+
+  colormap (left, top, width, height, NULL, values, 0.0f, 0.0f,
+            lut, lutsize);
+
+} // putcolormapint ()
+
+// -----
+
+void putimage (int left, int top, void *bitmap, int op)
+{
+  // Puts the bit image pointed to by bitmap onto the screen.
+
+  Uint32
+    bitmap_w, bitmap_h, *tmp;
+  int
+    y, x1, y1, x2, y2;
+
+  RECORD (putimage (left, top, bitmap, op), REC_PUTIMAGE, left, top,
+          bitmap, bitmap_bytes (bitmap), op);
+
+  TRACE_BEGIN ("putimage");
+
+  tmp = bitmap;
+
+  // get width and height info from bitmap
+  memcpy (&bitmap_w, tmp, sizeof (Uint32));
+  memcpy (&bitmap_h, tmp + 1, sizeof (Uint32));
+
+  // clip the bitmap, then put it one row at a time
+  left += bgi_ctx->vp.left;
+  top += bgi_ctx->vp.top;
+  clip_bounds (&x1, &y1, &x2, &y2);
+  if (left > x1)
+    x1 = left;
+  if (top > y1)
+    y1 = top;
+  if (left + (int) bitmap_w - 1 < x2)
+    x2 = left + bitmap_w - 1;
+  if (top + (int) bitmap_h - 1 < y2)
+    y2 = top + bitmap_h - 1;
+
+  if (x1 <= x2 && y1 <= y2) {
+    for (y = y1; y <= y2; y++)
+      store_row (x1, x2, y,
+                 tmp + 2 + (y - top) * bitmap_w + x1 - left, op);
+    update_area (x1, y1, x2, y2);
+  }
+
+  TRACE_END ("putimage");
+
+} // putimage ()
+
+// -----
+
+// Scaled blits. Source pixels are mapped to destination pixels by
+// their centres. Bilinear filtering uses 8-bit weights and blends
+// two source rows first, then two columns; the box filter averages
+// every source pixel that falls in the destination pixel. Row
+// blending and summing are vectorised with SSE2 where available.
+
+static void clip_bounds (int *left, int *top, int *right, int *bottom)
+{
+  // returns the absolute rectangle that drawing is clipped to
+
+  *left = 0;
+  *top = 0;
+  *right = bgi_ctx->maxx;
+  *bottom = bgi_ctx->maxy;
+
+  if (YEAH == bgi_ctx->vp.clip) {
+    if (bgi_ctx->vp.left > *left)
+      *left = bgi_ctx->vp.left;
+    if (bgi_ctx->vp.top > *top)
+      *top = bgi_ctx->vp.top;
+    if (bgi_ctx->vp.right < *right)
+      *right = bgi_ctx->vp.right;
+    if (bgi_ctx->vp.bottom < *bottom)
+      *bottom = bgi_ctx->vp.bottom;
+  }
+
+} // clip_bounds ()
+
+// -----
+
+static void put_row (Uint32 *dst, const Uint32 *src, int n, int op)
+{
+  // writes n pixels to dst using op (COPY_PUT, XOR_PUT...)
+
+  switch (op) {
+
+  case COPY_PUT:
+    memcpy (dst, src, n * sizeof (Uint32));
+    break;
+
+  case AND_PUT:
+    while (n--)
+      *dst++ &= *src++;
+    break;
+
+  case XOR_PUT:
+    while (n--)
+      *dst++ ^= (*src++ & 0x00ffffff);
+    break;
+
+  case OR_PUT:
+    while (n--)
+      *dst++ |= (*src++ & 0x00ffffff);
+    break;
+
+  case NOT_PUT:
+    while (n--)
+      *dst++ = ~(*src++ & 0x00ffffff);
+    break;
+
+  case ALPHA_PUT:
+    alpha_row (dst, src, n);
+    break;
+
+  } // switch
+
+} // put_row ()
+
+// -----
+
+static inline Uint32 lerp_pixel (Uint32 a, Uint32 b, int w)
+{
+  // blends two ARGB pixels, rounding; w is the weight of b, 0..256
+
+  Uint32
+    rb, ag;
+
+  rb = ((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w +
+        0x00800080) >> 8;
+  ag = ((a >> 8) & 0x00ff00ff) * (256 - w) +
+    ((b >> 8) & 0x00ff00ff) * w + 0x00800080;
+
+  return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+
+} // lerp_pixel ()
+
+// -----
+
+// ALPHA_PUT composites pixels over the target by their alpha, as
+// SDL_BLENDMODE_BLEND does: each channel of the result, alpha
+// included, is source * a + target * (1 - a). This is the target
+// blended towards the opaque source, so the kernels share the
+// rounding of lerp_pixel (). alpha_span () premultiplies its
+// colour once, leaving one multiply per channel and pixel.
+
+static inline Uint32 alpha_pixel (Uint32 dst, Uint32 src)
+{
+  // composites src over dst
+
+  int
+    a = src >> 24;
+
+  return lerp_pixel (dst, src | 0xff000000, a + (a >> 7));
+
+} // alpha_pixel ()
+
+// -----
+
+static void alpha_span (Uint32 *dst, Uint32 color, int n)
+{
+  // composites 'color' over n pixels
+
+  int
+    i = 0,
+    a = color >> 24,
+    w = a + (a >> 7); // 0..256
+
+  if (0 == a)
+    return;
+
+  if (255 == a) {
+    while (n--)
+      *dst++ = color;
+    return;
+  }
+
+#if defined (BGI_HAVE_AVX2)
+  {
+    __m256i
+      zero = _mm256_setzero_si256 (),
+      inv = _mm256_set1_epi16 (256 - w),
+      src, d, lo, hi;
+
+    // premultiplied source, plus rounding
+    src = _mm256_unpacklo_epi8 (_mm256_set1_epi32 (color | 0xff000000),
+                                zero);
+    src = _mm256_add_epi16 (_mm256_mullo_epi16 (src,
+                                                _mm256_set1_epi16 (w)),
+                            _mm256_set1_epi16 (128));
+
+    for (; i + 8 <= n; i += 8) {
+      d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+      lo = _mm256_mullo_epi16 (_mm256_unpacklo_epi8 (d, zero), inv);
+      hi = _mm256_mullo_epi16 (_mm256_unpackhi_epi8 (d, zero), inv);
+      lo = _mm256_srli_epi16 (_mm256_add_epi16 (lo, src), 8);
+      hi = _mm256_srli_epi16 (_mm256_add_epi16 (hi, src), 8);
+      _mm256_storeu_si256 ((__m256i *) (dst + i),
+                           _mm256_packus_epi16 (lo, hi));
+    }
+  }
+#endif
+
+#if defined (BGI_HAVE_SSE2)
+  {
+    __m128i
+      zero = _mm_setzero_si128 (),
+      inv = _mm_set1_epi16 (256 - w),
+      src, d, lo, hi;
+
+    src = _mm_unpacklo_epi8 (_mm_set1_epi32 (color | 0xff000000), zero);
+    src = _mm_add_epi16 (_mm_mullo_epi16 (src, _mm_set1_epi16 (w)),
+                         _mm_set1_epi16 (128));
+
+    for (; i + 4 <= n; i += 4) {
+      d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+      lo = _mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero), inv);
+      hi = _mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero), inv);
+      lo = _mm_srli_epi16 (_mm_add_epi16 (lo, src), 8);
+      hi = _mm_srli_epi16 (_mm_add_epi16 (hi, src), 8);
+      _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+    }
+  }
+#endif
+
+  for (; i < n; i++)
+    dst[i] = alpha_pixel (dst[i], color);
+
+} // alpha_span ()
+
+// -----
+
+static void alpha_row (Uint32 *dst, const Uint32 *src, int n)
+{
+  // composites n pixels of src over dst, each by its own alpha
+
+  int
+    i = 0;
+
+#if defined (BGI_HAVE_AVX2)
+  {
+    __m256i
+      zero = _mm256_setzero_si256 (),
+      half = _mm256_set1_epi16 (128),
+      full = _mm256_set1_epi16 (256),
+      opaque = _mm256_set1_epi32 (0xff000000),
+      s, d, w, wlo, whi, lo, hi;
+
+    for (; i + 8 <= n; i += 8) {
+      s = _mm256_loadu_si256 ((const __m256i *) (src + i));
+      d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+
+      // weights as in alpha_pixel (), four copies each; unpacking
+      // works within 128-bit lanes, as for the pixels
+      w = _mm256_srli_epi32 (s, 24);
+      w = _mm256_add_epi32 (w, _mm256_srli_epi32 (w, 7));
+      w = _mm256_packs_epi32 (w, w);
+      w = _mm256_unpacklo_epi16 (w, w);
+      wlo = _mm256_unpacklo_epi32 (w, w);
+      whi = _mm256_unpackhi_epi32 (w, w);
+
+      s = _mm256_or_si256 (s, opaque);
+      lo = _mm256_add_epi16
+        (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (d, zero),
+                             _mm256_sub_epi16 (full, wlo)),
+         _mm256_mullo_epi16 (_mm256_unpacklo_epi8 (s, zero), wlo));
+      hi = _mm256_add_epi16
+        (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (d, zero),
+                             _mm256_sub_epi16 (full, whi)),
+         _mm256_mullo_epi16 (_mm256_unpackhi_epi8 (s, zero), whi));
+      lo = _mm256_srli_epi16 (_mm256_add_epi16 (lo, half), 8);
+      hi = _mm256_srli_epi16 (_mm256_add_epi16 (hi, half), 8);
+      _mm256_storeu_si256 ((__m256i *) (dst + i),
+                           _mm256_packus_epi16 (lo, hi));
+    }
+  }
+#endif
+
+#if defined (BGI_HAVE_SSE2)
+  {
+    __m128i
+      zero = _mm_setzero_si128 (),
+      half = _mm_set1_epi16 (128),
+      full = _mm_set1_epi16 (256),
+      opaque = _mm_set1_epi32 (0xff000000),
+      s, d, w, wlo, whi, lo, hi;
+
+    for (; i + 4 <= n; i += 4) {
+      s = _mm_loadu_si128 ((const __m128i *) (src + i));
+      d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+
+      w = _mm_srli_epi32 (s, 24);
+      w = _mm_add_epi32 (w, _mm_srli_epi32 (w, 7));
+      w = _mm_packs_epi32 (w, w);
+      w = _mm_unpacklo_epi16 (w, w);
+      wlo = _mm_unpacklo_epi32 (w, w);
+      whi = _mm_unpackhi_epi32 (w, w);
+
+      s = _mm_or_si128 (s, opaque);
+      lo = _mm_add_epi16
+        (_mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero),
+                          _mm_sub_epi16 (full, wlo)),
+         _mm_mullo_epi16 (_mm_unpacklo_epi8 (s, zero), wlo));
+      hi = _mm_add_epi16
+        (_mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero),
+                          _mm_sub_epi16 (full, whi)),
+         _mm_mullo_epi16 (_mm_unpackhi_epi8 (s, zero), whi));
+      lo = _mm_srli_epi16 (_mm_add_epi16 (lo, half), 8);
+      hi = _mm_srli_epi16 (_mm_add_epi16 (hi, half), 8);
+      _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+    }
+  }
+#endif
+
+  for (; i < n; i++)
+    dst[i] = alpha_pixel (dst[i], src[i]);
+
+} // alpha_row ()
+
+// -----
+
+static void lerp_rows (Uint32 *dst, const Uint32 *a, const Uint32 *b,
+                       int n, int w)
+{
+  // blends two rows of n pixels; w is the weight of b, 0..256
+
+  int
+    i = 0;
+
+#if defined (BGI_HAVE_SSE2)
+  __m128i
+    zero = _mm_setzero_si128 (),
+    wa = _mm_set1_epi16 (256 - w),
+    wb = _mm_set1_epi16 (w),
+    half = _mm_set1_epi16 (128),
+    pa, pb, lo, hi;
+
+  for (; i + 4 <= n; i += 4) {
+    pa = _mm_loadu_si128 ((const __m128i *) (a + i));
+    pb = _mm_loadu_si128 ((const __m128i *) (b + i));
+    lo = _mm_add_epi16
+      (_mm_mullo_epi16 (_mm_unpacklo_epi8 (pa, zero), wa),
+       _mm_mullo_epi16 (_mm_unpacklo_epi8 (pb, zero), wb));
+    hi = _mm_add_epi16
+      (_mm_mullo_epi16 (_mm_unpackhi_epi8 (pa, zero), wa),
+       _mm_mullo_epi16 (_mm_unpackhi_epi8 (pb, zero), wb));
+    lo = _mm_add_epi16 (lo, half);
+    hi = _mm_add_epi16 (hi, half);
+    _mm_storeu_si128 ((__m128i *) (dst + i),
+                      _mm_packus_epi16 (_mm_srli_epi16 (lo, 8),
+                                        _mm_srli_epi16 (hi, 8)));
+  }
+#endif
+
+  for (; i < n; i++)
+    dst[i] = lerp_pixel (a[i], b[i], w);
+
+} // lerp_rows ()
+
+// -----
+
+static void sum_row (Uint32 *acc, const Uint32 *src, int n)
+{
+  // adds the channels of n pixels to acc, 4 counters per pixel
+
+  int
+    i = 0;
+
+#if defined (BGI_HAVE_SSE2)
+  __m128i
+    zero = _mm_setzero_si128 (),
+    p, p16, *a;
+
+  for (; i + 2 <= n; i += 2) {
+    p = _mm_loadl_epi64 ((const __m128i *) (src + i));
+    p16 = _mm_unpacklo_epi8 (p, zero);
+    a = (__m128i *) (acc + 4*i);
+    _mm_storeu_si128 (a, _mm_add_epi32 (_mm_loadu_si128 (a),
+                      _mm_unpacklo_epi16 (p16, zero)));
+    _mm_storeu_si128 (a + 1, _mm_add_epi32 (_mm_loadu_si128 (a + 1),
+                      _mm_unpackhi_epi16 (p16, zero)));
+  }
+#endif
+
+  // same channel order as the SSE2 code: B, G, R, A
+  for (; i < n; i++) {
+    acc[4*i]     += src[i] & 0xff;
+    acc[4*i + 1] += (src[i] >> 8) & 0xff;
+    acc[4*i + 2] += (src[i] >> 16) & 0xff;
+    acc[4*i + 3] += src[i] >> 24;
+  }
+
+} // sum_row ()
+
+// -----
+
+static void scale_blit (const Uint32 *src, int sw, int sh, int spitch,
+                        int dx, int dy, int dw, int dh,
+                        int op, int filter)
+{
+  // Draws the sw x sh source image (spitch pixels per row) scaled
+  // to dw x dh at the absolute position (dx, dy) of the current
+  // context, clipped to the screen and the viewport.
+
+  int
+    left, top, right, bottom,
+    x0, x1, y0, y1, n, lo, hi,
+    x, y, i, c, sy, wy, sy1, area,
+    *map0 = NULL,
+    *map1 = NULL;
+  Sint64
+    f;
+  Uint32
+    *row = NULL,
+    *tmp = NULL,
+    sum[4];
+  const Uint32
+    *srow;
+
+  if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0)
+    return;
+
+  clip_bounds (&left, &top, &right, &bottom);
+  x0 = (dx < left) ? left - dx : 0;
+  y0 = (dy < top) ? top - dy : 0;
+  x1 = (dx + dw - 1 > right) ? right - dx : dw - 1;
+  y1 = (dy + dh - 1 > bottom) ? bottom - dy : dh - 1;
+  if (x0 > x1 || y0 > y1)
+    return;
+  n = x1 - x0 + 1;
+
+  // same size: no resampling needed
+
+  if (sw == dw && sh == dh) {
+    for (y = y0; y <= y1; y++)
+      store_row (dx + x0, dx + x1, dy + y, src + y * spitch + x0, op);
+    return;
+  }
+
+  // for each visible column, the source columns it depends on:
+  // nearest, the source column; bilinear, the left column and the
+  // weight of the right one; box, the first and last + 1 columns
+
+  map0 = malloc (n * sizeof (int));
+  map1 = malloc (n * sizeof (int));
+  row = malloc (n * sizeof (Uint32));
+  if (BILINEAR_FILTER == filter)
+    tmp = malloc (sw * sizeof (Uint32));
+  else if (BOX_FILTER == filter)
+    tmp = malloc (4 * sw * sizeof (Uint32));
+  else
+    filter = NEAREST_FILTER;
+  if (NULL == map0 || NULL == map1 || NULL == row ||
+      (NEAREST_FILTER != filter && NULL == tmp)) {
+    fprintf (stderr, "Can't allocate scaling buffers.\n");
+    free (map0);
+    free (map1);
+    free (row);
+    free (tmp);
+    return;
+  }
+
+  // lo..hi - 1: source columns used by the visible part
+  lo = sw;
+  hi = 0;
+
+  for (i = 0; i < n; i++) {
+    x = x0 + i;
+    switch (filter) {
+
+    case BILINEAR_FILTER:
+      // 16.16 source coordinate of the pixel centre
+      f = ((2 * (Sint64) x + 1) * sw << 16) / (2 * (Sint64) dw) - 32768;
+      if (f < 0)
+        f = 0;
+      map0[i] = f >> 16;
+      map1[i] = (f >> 8) & 0xff;
+      if (map0[i] >= sw - 1) {
+        map0[i] = sw - 1;
+        map1[i] = 0;
+      }
+      break;
+
+    case BOX_FILTER:
+      map0[i] = (Sint64) x * sw / dw;
+      map1[i] = (Sint64) (x + 1) * sw / dw;
+      if (map1[i] <= map0[i])
+        map1[i] = map0[i] + 1;
+      break;
+
+    default:
+    case NEAREST_FILTER:
+      map0[i] = (2 * (Sint64) x + 1) * sw / (2 * (Sint64) dw);
+
+    } // switch
+
+    if (map0[i] < lo)
+      lo = map0[i];
+    c = (BOX_FILTER == filter) ? map1[i] : map0[i] + 2;
+    if (c > hi)
+      hi = c;
+  }
+  if (hi > sw)
+    hi = sw;
+
+  for (y = y0; y <= y1; y++) {
+
+    switch (filter) {
+
+    case BILINEAR_FILTER:
+      f = ((2 * (Sint64) y + 1) * sh << 16) / (2 * (Sint64) dh) - 32768;
+      if (f < 0)
+        f = 0;
+      sy = f >> 16;
+      wy = (f >> 8) & 0xff;
+      if (sy >= sh - 1) {
+        sy = sh - 1;
+        wy = 0;
+      }
+      sy1 = (sy < sh - 1) ? sy + 1 : sy;
+      lerp_rows (tmp + lo, src + sy * spitch + lo,
+                 src + sy1 * spitch + lo, hi - lo, wy);
+      for (i = 0; i < n; i++)
+        row[i] = (map0[i] < sw - 1) ?
+          lerp_pixel (tmp[map0[i]], tmp[map0[i] + 1], map1[i]) :
+          tmp[map0[i]];
+      break;
+
+    case BOX_FILTER:
+      sy = (Sint64) y * sh / dh;
+      sy1 = (Sint64) (y + 1) * sh / dh;
+      if (sy1 <= sy)
+        sy1 = sy + 1;
+      memset (tmp + 4*lo, 0, 4 * (hi - lo) * sizeof (Uint32));
+      for (c = sy; c < sy1; c++)
+        sum_row (tmp + 4*lo, src + c * spitch + lo, hi - lo);
+      for (i = 0; i < n; i++) {
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+        for (x = map0[i]; x < map1[i]; x++)
+          for (c = 0; c < 4; c++)
+            sum[c] += tmp[4*x + c];
+        area = (map1[i] - map0[i]) * (sy1 - sy);
+        row[i] =
+          (sum[3] / area) << 24 | (sum[2] / area) << 16 |
+          (sum[1] / area) << 8 | (sum[0] / area);
+      }
+      break;
+
+    default:
+    case NEAREST_FILTER:
+      sy = (2 * (Sint64) y + 1) * sh / (2 * (Sint64) dh);
+      srow = src + sy * spitch;
+      for (i = 0; i < n; i++)
+        row[i] = srow[map0[i]];
+
+    } // switch
+
+    store_row (dx + x0, dx + x1, dy + y, row, op);
+
+  } // for y
+
+  free (map0);
+  free (map1);
+  free (row);
+  free (tmp);
+
+} // scale_blit ()
+
+// -----
+
+void putimagescaled (int left, int top, int right, int bottom,
+                     void *bitmap, int op, int filter)
+{
+  // Puts the bit image pointed to by bitmap onto the screen,
+  // scaled to fit the rectangle (left, top, right, bottom).
+  // 'filter' is NEAREST_FILTER, BILINEAR_FILTER, or BOX_FILTER.
+
+  Uint32
+    bitmap_w, bitmap_h, *tmp;
+
+  RECORD (putimagescaled (left, top, right, bottom, bitmap, op, filter),
+          REC_PUTIMAGESCALED, left, top, right, bottom,
+          bitmap, bitmap_bytes (bitmap), op, filter);
+
+  tmp = bitmap;
+
+  // get width and height info from bitmap
+  memcpy (&bitmap_w, tmp, sizeof (Uint32));
+  memcpy (&bitmap_h, tmp + 1, sizeof (Uint32));
+
+  scale_blit (tmp + 2, bitmap_w, bitmap_h, bitmap_w,
+              left + bgi_ctx->vp.left, top + bgi_ctx->vp.top,
+              right - left + 1, bottom - top + 1, op, filter);
+
+  update ();
+
+} // putimagescaled ()
+
+// -----
+
+void _putpixel (int x, int y)
+{
+  // like putpixel (), but not immediately displayed
+
+  RECORD (_putpixel (x, y), REC__PUTPIXEL, x, y);
+
+  // viewport range is taken care of by this function only,
+  // since all others use it to draw.
+
+  x += bgi_ctx->vp.left;
+  y += bgi_ctx->vp.top;
+
+  switch (bgi_ctx->writemode) {
+
+  case XOR_PUT:
+    putpixel_xor  (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+    break;
+
+  case AND_PUT:
+    putpixel_and  (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+    break;
+
+  case OR_PUT:
+    putpixel_or   (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+    break;
+
+  case NOT_PUT:
+    putpixel_not  (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+    break;
+
+  case ALPHA_PUT:
+    putpixel_alpha (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+    break;
+
+  default:
+  case COPY_PUT:
+    putpixel_copy (x, y, bgi_ctx->palette[bgi_ctx->fg_color]);
+
+  } // switch
+
+} // _putpixel ()
+
+// -----
+
+static Uint32 *pixel_address (int x, int y)
+{
+  // Returns the address of pixel (x, y) of the current context,
+  // or NULL if the pixel is out of range or clipped. The pixel is
+  // about to be written.
+
+  struct bgi_context
+    *c = bgi_ctx;
+
+  // out of range?
+  if (x < 0 || x > c->maxx || y < 0 || y > c->maxy)
+    return NULL;
+
+  if (YEAH == c->vp.clip)
+    if (x < c->vp.left || x > c->vp.right ||
+        y < c->vp.top || y > c->vp.bottom)
+      return NULL;
+
+  snap_touch (c, x, y, x, y);
+
+  return c->pixels + ring_offset (c, x, y);
+
+} // pixel_address ()
+
+// -----
+
+void putpixel_copy (int x, int y, Uint32 pixel)
+{
+  // plain putpixel - no logical operations
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p = pixel;
+
+  // we could use the native function:
+  // SDL_RenderDrawPoint (bgi_rnd, x, y);
+  // but strangely it's slower
+
+} // putpixel_copy ()
+
+// -----
+
+void putpixel_xor (int x, int y, Uint32 pixel)
+{
+  // XOR'ed putpixel
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p ^= (pixel & 0x00ffffff);
+
+} // putpixel_xor ()
+
+// -----
+
+void putpixel_and (int x, int y, Uint32 pixel)
+{
+  // AND-ed putpixel
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p &= pixel;
+
+} // putpixel_and ()
+
+// -----
+
+void putpixel_or (int x, int y, Uint32 pixel)
+{
+  // OR-ed putpixel
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p |= (pixel & 0x00ffffff);
+
+} // putpixel_or ()
+
+// -----
+
+void putpixel_not (int x, int y, Uint32 pixel)
+{
+  // NOT-ed putpixel
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p = ~(pixel & 0x00ffffff);
+
+} // putpixel_not ()
+
+// -----
+
+void putpixel_alpha (int x, int y, Uint32 pixel)
+{
+  // putpixel composited by alpha
+
+  Uint32 *p = pixel_address (x, y);
+
+  if (p)
+    *p = alpha_pixel (*p, pixel);
+
+} // putpixel_alpha ()
+
+// -----
+
+void putpixel (int x, int y, int color)
+{
+  // Plots a point at (x,y) in the color defined by 'color'.
+
+  int tmpcolor;
+
+  RECORD (putpixel (x, y, color), REC_PUTPIXEL, x, y, color);
+
+  x += bgi_ctx->vp.left;
+  y += bgi_ctx->vp.top;
+
+  // clip
+  if (YEAH == bgi_ctx->vp.clip)
+    if (x < bgi_ctx->vp.left || x > bgi_ctx->vp.right ||
+        y < bgi_ctx->vp.top || y > bgi_ctx->vp.bottom)
+      return;
+
+   // COLOR () set up the BGI_COLORS + 1 color
+  if (-1 == color) {
+    bgi_ctx->argb_mode = YEAH;
+    tmpcolor = TMP_FG_COL;
+    bgi_ctx->palette[tmpcolor] = bgi_tmp_color_argb;
+  }
+  else {
+    bgi_ctx->argb_mode = NOPE;
+    tmpcolor = color;
+  }
+
+  switch (bgi_ctx->writemode) {
+
+  case XOR_PUT:
+    putpixel_xor  (x, y, bgi_ctx->palette[tmpcolor]);
+    break;
+
+  case AND_PUT:
+    putpixel_and  (x, y, bgi_ctx->palette[tmpcolor]);
+    break;
+
+  case OR_PUT:
+    putpixel_or   (x, y, bgi_ctx->palette[tmpcolor]);
+    break;
+
+  case NOT_PUT:
+    putpixel_not  (x, y, bgi_ctx->palette[tmpcolor]);
+    break;
+
+  case ALPHA_PUT:
+    putpixel_alpha (x, y, bgi_ctx->palette[tmpcolor]);
+    break;
+
+  default:
+  case COPY_PUT:
+    putpixel_copy (x, y, bgi_ctx->palette[tmpcolor]);
+
+  } // switch
+
+  update_pixel (x, y);
+
+} // putpixel ()
+
+// -----
+
+void putpixels (int n, const int *x, const int *y,
+                const Uint32 *colors)
+{
+  // Plots n points at once, using the current writing mode and
+  // viewport. Colors are 0xAARRGGBB values; the screen is updated
+  // once, for the smallest rectangle that holds all points.
+
+  int
+    xx, yy,
+    x1 = bgi_ctx->maxx + 1, y1 = bgi_ctx->maxy + 1,
+    x2 = -1, y2 = -1;
+  Uint32
+    *p;
+
+  RECORD (putpixels (n, x, y, colors), REC_PUTPIXELS, n,
+          x, n * (int) sizeof (int), y, n * (int) sizeof (int),
+          colors, n * (int) sizeof (Uint32));
+
+  for (int i = 0; i < n; i++) {
+
+    xx = x[i] + bgi_ctx->vp.left;
+    yy = y[i] + bgi_ctx->vp.top;
+    p = pixel_address (xx, yy);
+    if (NULL == p)
+      continue;
+
+    switch (bgi_ctx->writemode) {
+
+    case XOR_PUT:
+      *p ^= (colors[i] & 0x00ffffff);
+      break;
+
+    case AND_PUT:
+      *p &= colors[i];
+      break;
+
+    case OR_PUT:
+      *p |= (colors[i] & 0x00ffffff);
+      break;
+
+    case NOT_PUT:
+      *p = ~(colors[i] & 0x00ffffff);
+      break;
+
+    case ALPHA_PUT:
+      *p = alpha_pixel (*p, colors[i]);
+      break;
+
+    default:
+    case COPY_PUT:
+      *p = colors[i];
+
+    } // switch
+
+    if (xx < x1)
+      x1 = xx;
+    if (xx > x2)
+      x2 = xx;
+    if (yy < y1)
+      y1 = yy;
+    if (yy > y2)
+      y2 = yy;
+  }
+
+  if (x2 >= 0)
+    update_area (x1, y1, x2, y2);
+
+} // putpixels ()
+
+// -----
+
+static void image_free (ImageEntry *e)
+{
+  // frees a cache entry and its bitmap
+
+  SDL_FreeSurface (e->surface);
+  free (e->path);
+  free (e);
+
+} // image_free ()
+
+// -----
+
+static void image_unlink (ImageEntry **link)
+{
+  // Removes *link from the cache; the lock must be held. The entry
+  // is freed now, or by image_release () if it is in use.
+
+  ImageEntry
+    *e = *link;
+
+  *link = e->next;
+  e->cached = NOPE;
+  bgi_image_bytes -= e->bytes;
+  if (0 == e->refs)
+    image_free (e);
+
+} // image_unlink ()
+
+// -----
+
+static void image_flush (size_t budget)
+{
+  // Evicts the least recently used entries until the cache fits
+  // in 'budget' bytes. Entries in use are unlinked, not freed.
+
+  ImageEntry
+    **link, **lru;
+
+  SDL_AtomicLock (&bgi_image_lock);
+
+  while (bgi_image_bytes > budget) {
+    lru = NULL;
+    for (link = &bgi_image_cache; *link; link = &(*link)->next)
+      if (NULL == lru || (*link)->stamp < (*lru)->stamp)
+        lru = link;
+    image_unlink (lru);
+  }
+
+  SDL_AtomicUnlock (&bgi_image_lock);
+
+} // image_flush ()
+
+// -----
+
+static SDL_Surface *image_load (const char *path, long size)
+{
+  // Decodes a .bmp file to an opaque ARGB8888 surface. Large files
+  // are memory-mapped and decoded in place, instead of being
+  // read through stdio buffers.
+
+  SDL_Surface
+    *bm_surface = NULL,
+    *surface;
+  Uint32
+    *p;
+
+#ifdef BGI_HAVE_MMAP
+  if (size >= IMAGE_MMAP_MIN) {
+    void
+      *map = MAP_FAILED;
+    int
+      fd = open (path, O_RDONLY);
+
+    if (fd >= 0) {
+      map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close (fd);
+    }
+    if (MAP_FAILED != map) {
+      bm_surface =
+        SDL_LoadBMP_RW (SDL_RWFromConstMem (map, size), 1);
+      munmap (map, size);
+      if (NULL == bm_surface)
+        return NULL;
+    }
+  }
+#endif
+
+  if (NULL == bm_surface)
+    bm_surface = SDL_LoadBMP (path);
+  if (NULL == bm_surface)
+    return NULL;
+
+  if (SDL_PIXELFORMAT_ARGB8888 == bm_surface->format->format)
+    surface = bm_surface;
+  else {
+    surface =
+      SDL_ConvertSurfaceFormat (bm_surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface (bm_surface);
+    if (NULL == surface)
+      return NULL;
+  }
+
+  // pages have no alpha channel
+  for (int y = 0; y < surface->h; y++) {
+    p = (Uint32 *) ((Uint8 *) surface->pixels + y * surface->pitch);
+    for (int x = 0; x < surface->w; x++)
+      *p++ |= 0xff000000;
+  }
+  SDL_SetSurfaceBlendMode (surface, SDL_BLENDMODE_NONE);
+
+  return surface;
+
+} // image_load ()
+
+// -----
+
+static ImageEntry *image_get (const char *path)
+{
+  // Returns the decoded bitmap of 'path', from the cache if the
+  // file has not changed since it was loaded. The caller must pass
+  // the entry to image_release () when done.
+
+  struct stat
+    st;
+  ImageEntry
+    *e,
+    **link;
+
+  if (0 != stat (path, &st)) {
+    SDL_SetError ("Couldn't stat %s", path);
+    return NULL;
+  }
+
+  SDL_AtomicLock (&bgi_image_lock);
+  for (e = bgi_image_cache; e; e = e->next)
+    if (e->mtime == st.st_mtime && e->size == (long) st.st_size &&
+        0 == strcmp (e->path, path)) {
+      e->refs++;
+      e->stamp = ++bgi_image_clock;
+      SDL_AtomicUnlock (&bgi_image_lock);
+      return e;
+    }
+  SDL_AtomicUnlock (&bgi_image_lock);
+
+  // not cached: decode it without holding the lock
+
+  e = calloc (1, sizeof (ImageEntry));
+  if (NULL == e) {
+    SDL_SetError ("Out of memory");
+    return NULL;
+  }
+  e->surface = image_load (path, st.st_size);
+  e->path = malloc (strlen (path) + 1);
+  if (NULL == e->surface || NULL == e->path) {
+    if (NULL != e->surface)
+      SDL_FreeSurface (e->surface);
+    free (e->path);
+    free (e);
+    return NULL;
+  }
+  strcpy (e->path, path);
+  e->mtime = st.st_mtime;
+  e->size = st.st_size;
+  e->bytes = (size_t) e->surface->h * e->surface->pitch;
+  e->refs = 1;
+
+  SDL_AtomicLock (&bgi_image_lock);
+  if (e->bytes <= bgi_image_budget) {
+    // drop older versions of the file, or a copy that another
+    // thread loaded meanwhile
+    link = &bgi_image_cache;
+    while (*link)
+      if (0 == strcmp ((*link)->path, path))
+        image_unlink (link);
+      else
+        link = &(*link)->next;
+    e->next = bgi_image_cache;
+    bgi_image_cache = e;
+    e->cached = YEAH;
+    e->stamp = ++bgi_image_clock;
+    bgi_image_bytes += e->bytes;
+  }
+  SDL_AtomicUnlock (&bgi_image_lock);
+
+  image_flush (bgi_image_budget);
+
+  return e;
+
+} // image_get ()
+
+// -----
+
+static void image_release (ImageEntry *e)
+{
+  // done drawing from e; frees it if it is no longer cached
+
+  SDL_AtomicLock (&bgi_image_lock);
+  if (0 == --e->refs && NOPE == e->cached)
+    image_free (e);
+  SDL_AtomicUnlock (&bgi_image_lock);
+
+} // image_release ()
+
+// -----
+
+void readimagefile (char *bitmapname, int x1, int y1, int x2, int y2)
+{
+  // Reads a .bmp file and displays it immediately at (x1, y1 ).
+
+  ImageEntry
+    *image;
+  SDL_Surface
+    *bm_surface;
+  SDL_Rect
+    src_rect,
+    dest_rect;
+
+  RECORD (readimagefile (bitmapname, x1, y1, x2, y2),
+          REC_READIMAGEFILE, bitmapname, x1, y1, x2, y2);
+
+  TRACE_BEGIN ("readimagefile");
+
+  // load bitmap, or get it from the cache
+  image = image_get (bitmapname);
+  if (NULL == image) {
+    SDL_Log ("SDL_LoadBMP() error: %s\n", SDL_GetError ());
+    showerrorbox ("SDL_LoadBMP() error");
+    TRACE_END ("readimagefile");
+    return;
+  }
+  bm_surface = image->surface;
+
+  // source rect, position and size
+  src_rect.x = 0;
+  src_rect.y = 0;
+  src_rect.w = bm_surface->w;
+  src_rect.h = bm_surface->h;
+
+  // destination rect, position
+  dest_rect.x = x1 + bgi_ctx->vp.left;
+  dest_rect.y = y1 + bgi_ctx->vp.top;
+
+  if (0 == x2 || 0 == y2) { // keep original size
+    dest_rect.w = src_rect.w;
+    dest_rect.h = src_rect.h;
+  }
+  else { // change size
+    dest_rect.w = x2 - x1 + 1;
+    dest_rect.h = y2 - y1 + 1;
+  }
+
+  // decode or scale straight into the current context
+  scale_blit (bm_surface->pixels, src_rect.w, src_rect.h,
+              bm_surface->pitch / sizeof (Uint32),
+              dest_rect.x, dest_rect.y, dest_rect.w, dest_rect.h,
+              COPY_PUT, bgi_ctx->image_filter);
+
+  image_release (image);
+
+  if (&bgi_default_ctx == bgi_ctx)
+    refresh_window ();
+
+  TRACE_END ("readimagefile");
+
+} // readimagefile ()
+
+// -----
+
+void rectangle (int x1, int y1, int x2, int y2)
+{
+  // Draws a rectangle delimited by (left,top) and (right,bottom).
 
-} // line_and ()
+  int
+    pts[8] = { x1, y1, x2, y1, x2, y2, x1, y2 };
+
+  RECORD (rectangle (x1, y1, x2, y2), REC_RECTANGLE, x1, y1, x2, y2);
+
+  if (bgi_ctx->line_style.thickness > NORM_WIDTH) {
+    stroke_begin ();
+    stroke_ipolyline (4, pts, YEAH);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  // the corners must be blended once
+  if (ALPHA_PUT == bgi_ctx->writemode) {
+    stroke_begin ();
+    stroke_thin_polyline (4, pts);
+    stroke_end ();
+    update ();
+    return;
+  }
+
+  line_fast (x1, y1, x2, y1);
+  line_fast (x2, y1, x2, y2);
+  line_fast (x2, y2, x1, y2);
+  line_fast (x1, y2, x1, y1);
+
+  update ();
+
+} // rectangle ()
 
 // -----
 
-void line_or (int x1, int y1, int x2, int y2)
+void refresh (void)
 {
-  int
-    counter = 0, // # of pixel plotted
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+  // Updates the screen.
 
-  for (;;) {
+  RECORD (refresh (), REC_REFRESH);
 
-    if (SOLID_LINE == bgi_line_style.linestyle)
-      putpixel_or (x1, y1, palette[bgi_fg_color]);
-    else
-      if ((line_patterns[bgi_line_style.linestyle] >> counter % 16) & 1)
-        putpixel_or (x1, y1, palette[bgi_fg_color]);
+  if (update_mutex)
+    lock_update ();
 
-    counter++;
+  refresh_window ();
 
-    if (x1 == x2 && y1 == y2)
-      break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
-    if (e2 < dy) {
-      err += dx;
-      y1 += sy;
-    }
-  } // for
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-} // line_or ()
+} // refresh ()
 
 // -----
 
-void line_not (int x1, int y1, int x2, int y2)
+void refresh_window (void)
 {
-  int
-    counter = 0, // # of pixel plotted
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+  // Updates the screen.
 
-  for (;;) {
+  TRACE_BEGIN ("refresh_window");
 
-    if (SOLID_LINE == bgi_line_style.linestyle)
-      putpixel_not (x1, y1, palette[bgi_fg_color]);
-    else
-      if ((line_patterns[bgi_line_style.linestyle] >> counter % 16) & 1)
-        putpixel_not (x1, y1, palette[bgi_fg_color]);
+  // the whole window supersedes any pending damage
+  bgi_damage_x2 = bgi_damage_y2 = -1;
+  bgi_last_present = SDL_GetTicks ();
 
-    counter++;
+  updaterect (0, 0,
+              bgi_win_maxx[current_window], bgi_win_maxy[current_window]);
 
-    if (x1 == x2 && y1 == y2)
-      break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
-    if (e2 < dy) {
-      err += dx;
-      y1 += sy;
-    }
-  } // for
+  TRACE_END ("refresh_window");
 
-} // line_not ()
+} // refresh_window ()
 
 // -----
 
-void line_fill (int x1, int y1, int x2, int y2)
+// arguments of a recorded call, see replayfile ()
+
+typedef union {
+  int i;
+  double d;
+  void *p;                      // blob, aligned copy
+} ReplayArg;
+
+static int replay_varint (const Uint8 **pos, const Uint8 *end,
+                          Uint64 *n)
 {
-  // line function used for filling
+  // Reads a varint written by record_varint ().
 
   int
-    dx = abs (x2 - x1),
-    sx = x1 < x2 ? 1 : -1,
-    dy = abs (y2 - y1),
-    sy = y1 < y2 ? 1 : -1,
-    err = (dx > dy ? dx : -dy) / 2,
-    e2;
+    shift = 0;
+  Uint8
+    byte;
 
-  for (;;) {
+  *n = 0;
 
-    ff_putpixel (x1, y1);
+  while (*pos < end && shift < 64) {
+    byte = *(*pos)++;
+    *n |= (Uint64) (byte & 0x7f) << shift;
+    if (0 == (byte & 0x80))
+      return YEAH;
+    shift += 7;
+  }
 
-    if (x1 == x2 && y1 == y2)
+  return NOPE;
+
+} // replay_varint ()
+
+// -----
+
+static int replay_args (int op, const Uint8 **pos, const Uint8 *end,
+                        ReplayArg *arg, int *len)
+{
+  // Decodes the arguments of 'op'; blobs are copied to 'arg'
+  // and their sizes stored in 'len'. Returns NOPE if the record
+  // is damaged.
+
+  const char
+    *sig;
+  Uint64
+    n;
+  int
+    k;
+
+  for (sig = bgi_rec_sig[op], k = 0; *sig; sig++, k++)
+    switch (*sig) {
+
+    case 'i':
+      if (NOPE == replay_varint (pos, end, &n))
+        return NOPE;
+      arg[k].i = (int) ((Uint32) (n >> 1) ^ (0 - (Uint32) (n & 1)));
       break;
-    e2 = err;
-    if (e2 >-dx) {
-      err -= dy;
-      x1 += sx;
-    }
-    if (e2 < dy) {
-      err += dx;
-      y1 += sy;
-    }
-  } // for
 
-} // line_fill ()
+    case 'd':
+      if (end - *pos < (long) sizeof (double))
+        return NOPE;
+      memcpy (&arg[k].d, *pos, sizeof (double));
+      *pos += sizeof (double);
+      break;
+
+    case 's':
+    case 'b':
+      if (NOPE == replay_varint (pos, end, &n) ||
+          n > (Uint64) (end - *pos) || n > SDL_MAX_SINT32)
+        return NOPE;
+      len[k] = (int) n;
+      if (n) {
+        if (NULL == (arg[k].p = malloc (n)))
+          return NOPE;
+        memcpy (arg[k].p, *pos, n);
+        *pos += n;
+      }
+      // strings keep their '\0'
+      if ('s' == *sig && n && '\0' != ((char *) arg[k].p)[n - 1])
+        return NOPE;
+      break;
+
+    } // switch
+
+  return YEAH;
+
+} // replay_args ()
 
 // -----
 
-static int octant (int x, int y)
+static void replay_free (int op, ReplayArg *arg)
 {
-  // Returns the octant where x, y lies; used by line().
+  // Frees the blobs decoded by replay_args ().
+
+  const char
+    *sig;
+  int
+    k;
 
-  if (x >= 0) { // octants 1, 2, 7, 8
+  for (sig = bgi_rec_sig[op], k = 0; *sig; sig++, k++)
+    if ('b' == *sig || 's' == *sig)
+      free (arg[k].p);
 
-    if (y >= 0)
-      return (x > y) ? 1 : 2;
-    else
-      return (x > -y) ? 8 : 7;
+} // replay_free ()
 
-  } // if (x > 0)
+// -----
 
-  else { // x < 0; 3, 4, 5, 6
+static void replay_blit (int x, int y, int w, int h, const Uint32 *src)
+{
+  // Copies recorded pixels to the active page.
 
-    if (y >= 0)
-      return (-x > y) ? 4 : 3;
-    else
-      return (-x > -y) ? 5 : 6;
+  int
+    stride,
+    row;
 
-  } // else
+  lockframebuffer (&stride);
 
-} // octant()
+  if (x >= 0 && y >= 0 && x + w <= stride &&
+      y + h <= bgi_default_ctx.maxy + 1)
+    for (row = 0; row < h; row++)
+      store_row (x, x + w - 1, y + row, src + row * w, COPY_PUT);
+
+  unlockframebuffer (x, y, x + w - 1, y + h - 1);
+
+} // replay_blit ()
 
 // -----
 
-void line (int x1, int y1, int x2, int y2)
+static int replay_call (int op, ReplayArg *a, int *len)
 {
-  // Draws a line between two specified points.
+  // Executes a decoded call. Returns NOPE if a blob does not
+  // have the size its call expects.
 
-  int oct;
+  int
+    ok = YEAH;
 
-  // viewport
-  x1 += vp.left;
-  y1 += vp.top;
-  x2 += vp.left;
-  y2 += vp.top;
+// blob k must hold 'bytes' bytes; an empty one is NULL
+#define BLOB_IS(k, bytes) \
+  (len[k] == ((bytes) > 0 ? (bytes) : 0))
 
-  switch (bgi_writemode) {
+  switch (op) {
 
-  case COPY_PUT:
-    line_copy (x1, y1, x2, y2);
+  case REC_INITWINDOW:
+    bgi_fast_mode = a[2].i;
+    initwindow (a[0].i, a[1].i);
+    break;
+
+  case REC_TMPCOLOR:
+    bgi_tmp_color_argb = (Uint32) a[0].i;
+    break;
+
+  case REC_BLIT:
+    if ((ok = a[2].i > 0 && a[3].i > 0 &&
+         BLOB_IS (4, a[2].i * a[3].i * (int) sizeof (Uint32))))
+      replay_blit (a[0].i, a[1].i, a[2].i, a[3].i, a[4].p);
+    break;
+
+  case REC_ARC:
+    arc (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i);
+    break;
+
+  case REC_BAR:
+    bar (a[0].i, a[1].i, a[2].i, a[3].i);
+    break;
+
+  case REC_BAR3D:
+    bar3d (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i);
+    break;
+
+  case REC_CIRCLE:
+    circle (a[0].i, a[1].i, a[2].i);
+    break;
+
+  case REC_CLEARDEVICE:
+    cleardevice ();
+    break;
+
+  case REC_CLEARVIEWPORT:
+    clearviewport ();
+    break;
+
+  case REC_DRAWPOLY:
+    if ((ok = BLOB_IS (1, 2 * a[0].i * (int) sizeof (int))))
+      drawpoly (a[0].i, a[1].p);
+    break;
+
+  case REC_ELLIPSE:
+    ellipse (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i);
+    break;
+
+  case REC_FILLELLIPSE:
+    fillellipse (a[0].i, a[1].i, a[2].i, a[3].i);
+    break;
+
+  case REC_FILLPOLY:
+    if ((ok = BLOB_IS (1, 2 * a[0].i * (int) sizeof (int))))
+      fillpoly (a[0].i, a[1].p);
+    break;
+
+  case REC_FLOODFILL:
+    floodfill (a[0].i, a[1].i, a[2].i);
+    break;
+
+  case REC_GRAPHDEFAULTS:
+    graphdefaults ();
+    break;
+
+  case REC_LINE:
+    line (a[0].i, a[1].i, a[2].i, a[3].i);
+    break;
+
+  case REC_LINEREL:
+    linerel (a[0].i, a[1].i);
+    break;
+
+  case REC_LINETO:
+    lineto (a[0].i, a[1].i);
+    break;
+
+  case REC_MOVEREL:
+    moverel (a[0].i, a[1].i);
+    break;
+
+  case REC_MOVETO:
+    moveto (a[0].i, a[1].i);
+    break;
+
+  case REC_OUTTEXT:
+    if ((ok = NULL != a[0].p))
+      outtext (a[0].p);
+    break;
+
+  case REC_OUTTEXTXY:
+    if ((ok = NULL != a[2].p))
+      outtextxy (a[0].i, a[1].i, a[2].p);
+    break;
+
+  case REC_PIESLICE:
+    pieslice (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i);
+    break;
+
+  case REC_PUTIMAGE:
+    if ((ok = len[2] >= 2 * (int) sizeof (Uint32) &&
+         BLOB_IS (2, bitmap_bytes (a[2].p))))
+      putimage (a[0].i, a[1].i, a[2].p, a[3].i);
+    break;
+
+  case REC_PUTPIXEL:
+    putpixel (a[0].i, a[1].i, a[2].i);
+    break;
+
+  case REC_READIMAGEFILE:
+    if ((ok = NULL != a[0].p))
+      readimagefile (a[0].p, a[1].i, a[2].i, a[3].i, a[4].i);
+    break;
+
+  case REC_RECTANGLE:
+    rectangle (a[0].i, a[1].i, a[2].i, a[3].i);
+    break;
+
+  case REC_SECTOR:
+    sector (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i);
+    break;
+
+  case REC_SETACTIVEPAGE:
+    setactivepage (a[0].i);
+    break;
+
+  case REC_SETALLPALETTE:
+    if ((ok = BLOB_IS (0, (int) sizeof (struct palettetype))))
+      setallpalette (a[0].p);
+    break;
+
+  case REC_SETBKCOLOR:
+    setbkcolor (a[0].i);
+    break;
+
+  case REC_SETCOLOR:
+    setcolor (a[0].i);
+    break;
+
+  case REC_SETFILLPATTERN:
+    if ((ok = BLOB_IS (0, 8)))
+      setfillpattern (a[0].p, a[1].i);
+    break;
+
+  case REC_SETFILLSTYLE:
+    setfillstyle (a[0].i, a[1].i);
+    break;
+
+  case REC_SETLINESTYLE:
+    setlinestyle (a[0].i, (unsigned) a[1].i, a[2].i);
+    break;
+
+  case REC_SETPALETTE:
+    setpalette (a[0].i, a[1].i);
+    break;
+
+  case REC_SETTEXTJUSTIFY:
+    settextjustify (a[0].i, a[1].i);
+    break;
+
+  case REC_SETTEXTSTYLE:
+    settextstyle (a[0].i, a[1].i, a[2].i);
+    break;
+
+  case REC_SETUSERCHARSIZE:
+    setusercharsize (a[0].i, a[1].i, a[2].i, a[3].i);
+    break;
+
+  case REC_SETVIEWPORT:
+    setviewport (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i);
+    break;
+
+  case REC_SETVISUALPAGE:
+    setvisualpage (a[0].i);
+    break;
+
+  case REC_SETWRITEMODE:
+    setwritemode (a[0].i);
+    break;
+
+  case REC_COPYPAGE:
+    copypage (a[0].i, a[1].i);
+    break;
+
+  case REC_PUTCOLORMAP:
+    if ((ok = BLOB_IS (4, a[2].i * a[3].i * (int) sizeof (float)) &&
+         (0 == len[7] ||
+          BLOB_IS (7, a[8].i * (int) sizeof (Uint32)))))
+      putcolormap (a[0].i, a[1].i, a[2].i, a[3].i, a[4].p,
+                   (float) a[5].d, (float) a[6].d, a[7].p, a[8].i);
+    break;
+
+  case REC_PUTCOLORMAPINT:
+    if ((ok = BLOB_IS (4, a[2].i * a[3].i * (int) sizeof (int)) &&
+         (0 == len[5] ||
+          BLOB_IS (5, a[6].i * (int) sizeof (Uint32)))))
+      putcolormapint (a[0].i, a[1].i, a[2].i, a[3].i, a[4].p,
+                      a[5].p, a[6].i);
+    break;
+
+  case REC__PUTPIXEL:
+    _putpixel (a[0].i, a[1].i);
+    break;
+
+  case REC_PUTIMAGESCALED:
+    if ((ok = len[4] >= 2 * (int) sizeof (Uint32) &&
+         BLOB_IS (4, bitmap_bytes (a[4].p))))
+      putimagescaled (a[0].i, a[1].i, a[2].i, a[3].i, a[4].p,
+                      a[5].i, a[6].i);
+    break;
+
+  case REC_PUTPIXELS:
+    if ((ok = BLOB_IS (1, a[0].i * (int) sizeof (int)) &&
+         BLOB_IS (2, a[0].i * (int) sizeof (int)) &&
+         BLOB_IS (3, a[0].i * (int) sizeof (Uint32))))
+      putpixels (a[0].i, a[1].p, a[2].p, a[3].p);
+    break;
+
+  case REC_REFRESH:
+    refresh ();
+    break;
+
+  case REC_SDLBGIAUTO:
+    sdlbgiauto ();
+    break;
+
+  case REC_SDLBGIFAST:
+    sdlbgifast ();
+    break;
+
+  case REC_SDLBGILIMIT:
+    sdlbgilimit ();
+    break;
+
+  case REC_SDLBGISLOW:
+    sdlbgislow ();
+    break;
+
+  case REC_SETALPHA:
+    setalpha (a[0].i, (Uint8) a[1].i);
+    break;
+
+  case REC_SETBKRGBCOLOR:
+    setbkrgbcolor (a[0].i);
+    break;
+
+  case REC_SETBLENDMODE:
+    setblendmode (a[0].i);
+    break;
+
+  case REC_SETIMAGEFILTER:
+    setimagefilter (a[0].i);
     break;
 
-  case AND_PUT:
-    line_and (x1, y1, x2, y2);
+  case REC_SETRGBCOLOR:
+    setrgbcolor (a[0].i);
     break;
 
-  case XOR_PUT:
-    line_xor (x1, y1, x2, y2);
+  case REC_SETRGBPALETTE:
+    setrgbpalette (a[0].i, a[1].i, a[2].i, a[3].i);
     break;
 
-  case OR_PUT:
-    line_or (x1, y1, x2, y2);
+  case REC_SWAPBUFFERS:
+    swapbuffers ();
     break;
 
-  case NOT_PUT:
-    line_not (x1, y1, x2, y2);
+  case REC_SETCURRENTWINDOW:
+    setcurrentwindow (a[0].i);
     break;
 
-  } // switch
+  case REC_CLOSEWINDOW:
+    closewindow (a[0].i);
+    break;
 
-  if (THICK_WIDTH == bgi_line_style.thickness) {
+  case REC_COPYRECT:
+    copyrect (a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i, a[6].i);
+    break;
 
-    oct = octant (x2 - x1, y1 - y2);
+  case REC_SCROLLVIEWPORT:
+    scrollviewport (a[0].i, a[1].i, a[2].i);
+    break;
 
-    switch (oct) { // draw thick line
+  case REC_SCROLLRING:
+    scrollring (a[0].i, a[1].i);
+    break;
 
-    case 1:
-    case 4:
-    case 5:
-    case 8:
-      switch (bgi_writemode) {
-      case COPY_PUT:
-        line_copy (x1, y1 - 1, x2, y2 - 1);
-        line_copy (x1, y1 + 1, x2, y2 + 1);
-        break;
-      case AND_PUT:
-        line_and (x1, y1 - 1, x2, y2 - 1);
-        line_and (x1, y1 + 1, x2, y2 + 1);
-        break;
-      case XOR_PUT:
-        line_xor (x1, y1 - 1, x2, y2 - 1);
-        line_xor (x1, y1 + 1, x2, y2 + 1);
-        break;
-      case OR_PUT:
-        line_or (x1, y1 - 1, x2, y2 - 1);
-        line_or (x1, y1 + 1, x2, y2 + 1);
-        break;
-      case NOT_PUT:
-        line_not (x1, y1 - 1, x2, y2 - 1);
-        line_not (x1, y1 + 1, x2, y2 + 1);
-        break;
-      } // switch
-      break;
+  case REC_SETRINGVIEWPORT:
+    setringviewport (a[0].i);
+    break;
 
-    case 2:
-    case 3:
-    case 6:
-    case 7:
-      switch (bgi_writemode) {
-      case COPY_PUT:
-        line_copy (x1 - 1, y1, x2 - 1, y2);
-        line_copy (x1 + 1, y1, x2 + 1, y2);
-        break;
-      case AND_PUT:
-        line_and (x1 - 1, y1, x2 - 1, y2);
-        line_and (x1 + 1, y1, x2 + 1, y2);
-        break;
-      case XOR_PUT:
-        line_xor (x1 - 1, y1, x2 - 1, y2);
-        line_xor (x1 + 1, y1, x2 + 1, y2);
-        break;
-      case OR_PUT:
-        line_or (x1 - 1, y1, x2 - 1, y2);
-        line_or (x1 + 1, y1, x2 + 1, y2);
-        break;
-      case NOT_PUT:
-        line_not (x1 - 1, y1, x2 - 1, y2);
-        line_not (x1 + 1, y1, x2 + 1, y2);
-        break;
-      } // switch
-      break;
+  case REC_SETPAGELAYOUT:
+    setpagelayout (a[0].i);
+    break;
 
-    } // switch
+  } // switch
 
-  } // if (THICK_WIDTH...)
+#undef BLOB_IS
 
-  update ();
+  return ok;
 
-} // line ()
+} // replay_call ()
 
 // -----
 
-void line_fast (int x1, int y1, int x2, int y2)
+int replayfile (char *filename)
 {
-  // Draws a line in fast mode
+  // Executes the calls recorded in 'filename' (see SDL_BGI_RECORD)
+  // once more, as fast as possible. Returns the number of calls,
+  // or -1 on error.
 
+  FILE
+    *f;
+  Uint8
+    *data = NULL;
+  const Uint8
+    *pos,
+    *end;
+  Uint32
+    order;
+  long
+    size;
   int
-    fastmode = bgi_fast_mode;
+    op,
+    calls = 0,
+    damaged = NOPE,
+    busy = bgi_rec_busy,
+    len[REC_MAXARGS];
+  ReplayArg
+    arg[REC_MAXARGS];
+
+  f = fopen (filename, "rb");
+  if (NULL == f) {
+    fprintf (stderr, "Can't open record file %s.\n", filename);
+    return -1;
+  }
 
-  bgi_fast_mode = YEAH; // draw in fast mode
-  line (x1, y1, x2, y2);
-  bgi_fast_mode = fastmode;
+  fseek (f, 0, SEEK_END);
+  size = ftell (f);
+  fseek (f, 0, SEEK_SET);
+  if (size >= (long) (sizeof (REC_MAGIC) + sizeof (order)))
+    data = malloc (size);
+  if (NULL == data || size != (long) fread (data, 1, size, f) ||
+      0 != memcmp (data, REC_MAGIC, sizeof (REC_MAGIC))) {
+    fprintf (stderr, "%s is not a record file.\n", filename);
+    fclose (f);
+    free (data);
+    return -1;
+  }
+  fclose (f);
+
+  memcpy (&order, data + sizeof (REC_MAGIC), sizeof (order));
+  if (0x01020304 != order) {
+    fprintf (stderr, "%s was recorded on another architecture.\n",
+             filename);
+    free (data);
+    return -1;
+  }
 
-} // line_fast ()
+  pos = data + sizeof (REC_MAGIC) + sizeof (order);
+  end = data + size;
 
-// -----
+  // don't record the replay
+  bgi_rec_busy = YEAH;
 
-void linerel (int dx, int dy)
-{
-  // Draws a line from the CP to a point that is (dx,dy)
-  // pixels from the CP.
+  // the program may have ended without closegraph ()
+  while (pos < end && NOPE == damaged) {
+    op = *pos++;
+    if (REC_CLOSEGRAPH == op)
+      break;
+    if (op < 1 || op >= REC_LAST) {
+      damaged = YEAH;
+      break;
+    }
+    memset (arg, 0, sizeof (arg));
+    memset (len, 0, sizeof (len));
+    if (YEAH == replay_args (op, &pos, end, arg, len) &&
+        YEAH == replay_call (op, arg, len))
+      calls++;
+    else
+      damaged = YEAH;
+    replay_free (op, arg);
+  }
 
-  line (bgi_cp_x, bgi_cp_y, bgi_cp_x + dx, bgi_cp_y + dy);
-  bgi_cp_x += dx;
-  bgi_cp_y += dy;
+  bgi_rec_busy = busy;
+  free (data);
 
-} // linerel ()
+  if (YEAH == damaged) {
+    fprintf (stderr, "Damaged record in %s after %d calls.\n",
+             filename, calls);
+    return -1;
+  }
+
+  return calls;
+
+} // replayfile ()
 
 // -----
 
-void lineto (int x, int y)
+void restorecrtmode (void)
 {
-  // Draws a line from the CP to (x, y), then moves the CP to (dx, dy).
+  // Hides the graphics window.
 
-  line (bgi_cp_x, bgi_cp_y, x, y);
-  bgi_cp_x = x;
-  bgi_cp_y = y;
+  SDL_HideWindow (bgi_win[current_window]);
+  window_is_hidden = YEAH;
 
-} // lineto ()
+} // restorecrtmode ()
 
 // -----
 
-int mouseclick (void)
+// callback for sdlbgiauto ()
+
+static Uint32 updatecallback (Uint32 interval, void *param)
 {
-  // Returns the code of the mouse button that was clicked,
-  // or 0 if none was clicked.
+  TRACE_BEGIN ("updatecallback");
 
-  SDL_Event event;
+  if (update_mutex)
+    lock_update ();
 
-  while (1) {
+  if (refresh_needed)
+    refresh_window ();
 
-    if (SDL_PollEvent (&event)) {
+  refresh_needed = NOPE;
 
-      if (SDL_MOUSEBUTTONDOWN == event.type) {
-        bgi_mouse_x = event.button.x;
-        bgi_mouse_y = event.button.y;
-        return (event.button.button);
-      }
-      else
-        if (SDL_MOUSEMOTION == event.type) {
-          bgi_mouse_x = event.motion.x;
-          bgi_mouse_y = event.motion.y;
-          return (WM_MOUSEMOVE);
-        }
-      else {
-        SDL_PushEvent (&event); // don't disrupt the keyboard
-        return NOPE;
-      }
-      return NOPE;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-    } // if
-    else
-      return NOPE;
+  TRACE_END ("updatecallback");
 
-  } // while
+  return interval;
 
-} // mouseclick ()
+} // updatecallback ()
 
 // -----
 
-int ismouseclick (int btn)
+void update (void)
 {
-  // Returns 1 if the 'btn' mouse button was clicked.
-
-  SDL_PumpEvents ();
-
-  switch (btn) {
-
-  case SDL_BUTTON_LEFT:
-    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(1));
-    break;
+  // Conditionally refreshes the screen or schedule it
 
-  case SDL_BUTTON_MIDDLE:
-    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(2));
-    break;
+  // only the default context and layers are shown on screen
+  if (! on_screen (bgi_ctx))
+    return;
 
-  case SDL_BUTTON_RIGHT:
-    return (SDL_GetMouseState (&bgi_mouse_x, &bgi_mouse_y) & SDL_BUTTON(3));
-    break;
+  if (update_mutex)
+    lock_update ();
 
-  }
+  if (! bgi_fast_mode)
+    present_damage (0, 0, bgi_win_maxx[current_window],
+                    bgi_win_maxy[current_window]);
+  else
+    refresh_needed = YEAH;
 
-  return NOPE;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-} // ismouseclick ()
+} // update ()
 
 // -----
 
-void getmouseclick (int kind, int *x, int *y)
+void update_pixel (int x, int y)
 {
-  // Sets the x,y coordinates of the last kind button click
-  // expected by ismouseclick().
+  // Updates a single pixel
 
-  *x = bgi_mouse_x;
-  *y = bgi_mouse_y;
+  int
+    x2 = x,
+    y2 = y;
 
-} // getmouseclick ()
+  if (! on_screen (bgi_ctx))
+    return;
 
-// -----
+  if (bgi_ctx->canvas_bytes &&
+      ! canvas_to_window (bgi_ctx, &x, &y, &x2, &y2))
+    return;
 
-int mousex (void)
-{
-  // Returns the X coordinate of the last mouse click.
+  if (update_mutex)
+    lock_update ();
+
+  if (! bgi_fast_mode)
+    present_damage (x, y, x2, y2);
+  else
+    refresh_needed = YEAH;
 
-  return bgi_mouse_x - vp.left;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-} // mousex ()
+} // update_pixel ()
 
 // -----
 
-int mousey (void)
+static void update_area (int x1, int y1, int x2, int y2)
 {
-  // Returns the Y coordinate of the last mouse click.
+  // Updates a rectangle, absolute coordinates
 
-  return bgi_mouse_y - vp.top;
+  if (! on_screen (bgi_ctx))
+    return;
 
-} // mousey ()
+  if (bgi_ctx->canvas_bytes &&
+      ! canvas_to_window (bgi_ctx, &x1, &y1, &x2, &y2))
+    return;
 
-// -----
+  if (update_mutex)
+    lock_update ();
 
-void moverel (int dx, int dy)
-{
-  // Moves the CP by (dx, dy) pixels.
+  if (! bgi_fast_mode)
+    present_damage (x1, y1, x2, y2);
+  else
+    refresh_needed = YEAH;
 
-  bgi_cp_x += dx;
-  bgi_cp_y += dy;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-} // moverel ()
+} // update_area ()
 
 // -----
 
-void moveto (int x, int y)
+// callback for the present limiter; one-shot
+
+static Uint32 damagecallback (Uint32 interval, void *param)
 {
-  // Moves the CP to the position (x, y), relative to the viewport.
+  if (update_mutex)
+    lock_update ();
 
-  bgi_cp_x = x;
-  bgi_cp_y = y;
+  bgi_damage_timer = 0;
+  flush_damage ();
 
-} // moveto ()
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  return 0;
+
+} // damagecallback ()
 
 // -----
 
-static void _bar (int left, int top, int right, int bottom)
+static void present_damage (int x1, int y1, int x2, int y2)
 {
-  // Used by drawchar
+  // Shows a rectangle in slow mode. With the limiter on, the
+  // rectangle is merged into the pending damage, which is
+  // presented at most once per interval. Called with
+  // update_mutex held.
 
-  int tmp, y;
+  Uint32
+    elapsed;
 
-  // like bar (), but uses bgi_fg_color
+  if (NOPE == bgi_present_limit) {
+    updaterect (x1, y1, x2, y2);
+    return;
+  }
 
-  tmp = bgi_fg_color;
-  // setcolor (bgi_fg_color);
-  for (y = top; y <= bottom; y++)
-    line_fast (left, y, right, y);
+  swap_if_greater (&x1, &x2);
+  swap_if_greater (&y1, &y2);
 
-  setcolor (tmp);
+  if (bgi_damage_x2 < 0) {
+    bgi_damage_x1 = x1;
+    bgi_damage_y1 = y1;
+    bgi_damage_x2 = x2;
+    bgi_damage_y2 = y2;
+  }
+  else {
+    if (x1 < bgi_damage_x1)
+      bgi_damage_x1 = x1;
+    if (y1 < bgi_damage_y1)
+      bgi_damage_y1 = y1;
+    if (x2 > bgi_damage_x2)
+      bgi_damage_x2 = x2;
+    if (y2 > bgi_damage_y2)
+      bgi_damage_y2 = y2;
+  }
 
-} // _bar ()
+  elapsed = SDL_GetTicks () - bgi_last_present;
+
+  if (elapsed >= bgi_present_interval)
+    flush_damage ();
+  else
+    if (0 == bgi_damage_timer)
+      // make sure the last damage gets shown
+      bgi_damage_timer =
+        SDL_AddTimer (bgi_present_interval - elapsed,
+                      damagecallback, NULL);
+
+} // present_damage ()
 
 // -----
 
-static void drawchar (unsigned char ch)
+static void flush_damage (void)
 {
-  // used by outtextxy ()
+  // Presents the pending damage, if any. Called with
+  // update_mutex held.
 
-  unsigned char i, j, k;
-  int x, y, tmp;
+  int
+    x1 = bgi_damage_x1,
+    y1 = bgi_damage_y1,
+    x2 = bgi_damage_x2,
+    y2 = bgi_damage_y2;
 
-  tmp = bgi_bg_color;
-  bgi_bg_color = bgi_fg_color; // for bar ()
-  setcolor (bgi_bg_color);
+  if (x2 < 0)
+    return;
 
-  // for each of the 8 bytes that make up the font
+  bgi_damage_x2 = bgi_damage_y2 = -1;
+  bgi_last_present = SDL_GetTicks ();
 
-  for (i = 0; i < 8; i++) {
+  // the window may have shrunk in the meantime
+  if (x1 > bgi_win_maxx[current_window] ||
+      y1 > bgi_win_maxy[current_window])
+    return;
+  if (x2 > bgi_win_maxx[current_window])
+    x2 = bgi_win_maxx[current_window];
+  if (y2 > bgi_win_maxy[current_window])
+    y2 = bgi_win_maxy[current_window];
 
-    k = fontptr[8*ch + i];
+  updaterect (x1, y1, x2, y2);
 
-    // scan horizontal line
+} // flush_damage ()
 
-    for (j = 0; j < 8; j++)
+// -----
 
-      if ( (k << j) & 0x80) { // bit set to 1
-        if (HORIZ_DIR == bgi_txt_style.direction) {
-          x = bgi_cp_x + j * bgi_font_mag_x;
-          y = bgi_cp_y + i * bgi_font_mag_y;
-          // putpixel (x, y, bgi_fg_color);
-          _bar (x, y, x + bgi_font_mag_x - 1, y + bgi_font_mag_y - 1);
-        }
-        else {
-          x = bgi_cp_x + i * bgi_font_mag_y;
-          y = bgi_cp_y - j * bgi_font_mag_x;
-          // putpixel (bgi_cp_x + i, bgi_cp_y - j, bgi_fg_color);
-          _bar (x, y, x + bgi_font_mag_x - 1, y + bgi_font_mag_y - 1);
-        }
-      }
-  }
+static int display_refresh_rate (void)
+{
+  // Returns the display refresh rate in Hz.
 
-  if (HORIZ_DIR == bgi_txt_style.direction)
-    bgi_cp_x += 8*bgi_font_mag_x;
-  else
-    bgi_cp_y -= 8*bgi_font_mag_y;
+  int
+    rate;
+  SDL_DisplayMode
+    display_mode;
 
-  bgi_bg_color = tmp;
+  SDL_GetDisplayMode (0, 0, &display_mode);
+  rate = display_mode.refresh_rate;
 
-} // drawchar ()
+  // fallback to 30hz if everything else fails
+  if (rate <= 0)
+    rate = 30;
+
+  return rate;
+
+} // display_refresh_rate ()
 
 // -----
 
-void outtext (char *textstring)
+void sdlbgiauto ()
 {
-  // Outputs textstring at the CP.
+  // Triggers "auto refresh mode", i.e. refresh() is performed
+  // automatically on a separate thread.
 
-  outtextxy (bgi_cp_x, bgi_cp_y, textstring);
-  if ( (HORIZ_DIR == bgi_txt_style.direction) &&
-       (LEFT_TEXT == bgi_txt_style.horiz))
-    bgi_cp_x += textwidth (textstring);
+  Uint32
+    interval;
 
-} // outtext ()
+  RECORD (sdlbgiauto (), REC_SDLBGIAUTO);
 
-// -----
+  if (0 == refresh_rate)
+    // refresh rate not specified by the user;
+    // then, let's use the display refresh rate
+    refresh_rate = display_refresh_rate ();
 
-void outtextxy (int x, int y, char *textstring)
-{
-  // Outputs textstring at (x, y).
+  interval = (Uint32) 1000.0 / refresh_rate;
 
-  int
-    tmp,
-    i,
-    x1 = 0,
-    y1 = 0,
-    tw,
-    th;
+  // install a timer to periodically update the screen
+  SDL_AddTimer (interval, updatecallback, NULL);
+  bgi_fast_mode = YEAH;
 
-  tw = textwidth (textstring);
-  if (0 == tw)
-    return;
+} // sdlbgiauto ()
+
+// -----
+
+void sdlbgifast (void)
+{
+  // Triggers "fast mode", i.e. refresh() is needed to
+  // display graphics.
 
-  th = textheight (textstring);
+  RECORD (sdlbgifast (), REC_SDLBGIFAST);
 
-  if (HORIZ_DIR == bgi_txt_style.direction) {
+  bgi_fast_mode = YEAH;
 
-    if (LEFT_TEXT == bgi_txt_style.horiz)
-      x1 = x;
+} // sdlbgifast ()
 
-    if (CENTER_TEXT == bgi_txt_style.horiz)
-      x1 = x - tw / 2;
+// -----
 
-    if (RIGHT_TEXT == bgi_txt_style.horiz)
-      x1 = x - tw;
+void sdlbgilimit (void)
+{
+  // Triggers "slow mode" with a present limiter: graphics are
+  // still displayed without refresh(), but the screen is
+  // presented at most once per display refresh.
 
-    if (CENTER_TEXT == bgi_txt_style.vert)
-      y1 = y - th / 2;
+  RECORD (sdlbgilimit (), REC_SDLBGILIMIT);
 
-    if (TOP_TEXT == bgi_txt_style.vert)
-      y1 = y;
+  if (update_mutex)
+    lock_update ();
 
-    if (BOTTOM_TEXT == bgi_txt_style.vert)
-      y1 = y - th;
+  if (0 == refresh_rate)
+    refresh_rate = display_refresh_rate ();
 
-  }
-  else { // VERT_DIR
+  bgi_present_interval = 1000 / refresh_rate;
+  bgi_present_limit = YEAH;
+  bgi_fast_mode = NOPE;
 
-    if (LEFT_TEXT == bgi_txt_style.horiz)
-      y1 = y;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-    if (CENTER_TEXT == bgi_txt_style.horiz)
-      y1 = y + tw / 2;
+} // sdlbgilimit ()
 
-    if (RIGHT_TEXT == bgi_txt_style.horiz)
-      y1 = y + tw;
+// -----
 
-    if (CENTER_TEXT == bgi_txt_style.vert)
-      x1 = x - th / 2;
+void sdlbgislow (void)
+{
+  // Triggers "slow mode", i.e. refresh() is not needed to
+  // display graphics.
 
-    if (TOP_TEXT == bgi_txt_style.vert)
-      x1 = x;
+  RECORD (sdlbgislow (), REC_SDLBGISLOW);
 
-    if (BOTTOM_TEXT == bgi_txt_style.vert)
-      x1 = x - th;
+  if (update_mutex)
+    lock_update ();
 
-  } // VERT_DIR
+  // show what the limiter was holding back
+  bgi_present_limit = NOPE;
+  flush_damage ();
+  bgi_fast_mode = NOPE;
 
-  moveto (x1, y1);
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-  // if THICK_WIDTH, fallback to NORM_WIDTH
-  tmp = bgi_line_style.thickness;
-  bgi_line_style.thickness = NORM_WIDTH;
+} // sdlbgislow ()
 
-  for (i = 0; i < strlen (textstring); i++)
-    drawchar (textstring[i]);
+// -----
 
-  bgi_line_style.thickness = tmp;
+static void fill_rect (int x1, int y1, int x2, int y2, Uint32 color)
+{
+  // Fills an absolute rectangle of the current context; no clipping.
 
-  update ();
+  int
+    n;
+  size_t
+    offset;
+  Uint32
+    *row;
+
+  snap_touch (bgi_ctx, x1, y1, x2, y2);
+  for (int y = y1; y <= y2; y++)
+    for (int x = x1; x <= x2; x += n) {
+      n = ring_run (bgi_ctx, x, x2, y, &offset);
+      row = bgi_ctx->pixels + offset;
+      for (int i = 0; i < n; i++)
+        row[i] = color;
+    }
 
-} // outtextxy ()
+} // fill_rect ()
 
 // -----
 
-void pieslice (int x, int y, int stangle, int endangle, int radius)
+// A ring viewport scrolls by moving its origin instead of its
+// pixels: column (or row) x of the viewport is stored at column
+// (x + ring_origin) mod width. Pixel and span writers apply this
+// through ring_offset () and ring_run (); updaterect () undoes it
+// when the page is shown.
+//
+// Tiled pages go through the same two functions. The largest part
+// of the page made of whole tiles comes first, tile after tile,
+// each tile row after row; then the columns to its right, row after
+// row, then the rows below it, as usual. A tile is 4 kB, so nearby
+// rows share cache lines and memory pages. Canvases are tiled too:
+// each tile is a page of their mapping, allocated when it is first
+// written. Offsets are size_t, as a canvas may have more pixels
+// than an int can count.
+
+static size_t tile_offset (const struct bgi_context *c, int x, int y)
 {
-  // Draws and fills a pie slice centered at (x, y), with a radius
-  // given by radius, traveling from stangle to endangle.
+  // Returns the offset of pixel (x, y) in a tiled page of c.
 
-  // quick and dirty for now, Bresenham-based later.
-  int angle;
+  int
+    width = c->maxx + 1,
+    tiled_w = width & ~(PAGE_TILE - 1),
+    tiled_h = (c->maxy + 1) & ~(PAGE_TILE - 1);
 
-  if (0 == radius || stangle == endangle)
-    return;
+  if (y >= tiled_h)
+    return (size_t) y * width + x;
+  if (x >= tiled_w)
+    return (size_t) tiled_w * tiled_h +
+      (size_t) y * (width - tiled_w) + x - tiled_w;
 
-  if (endangle < stangle)
-    endangle += 360;
+  return (size_t) (y & ~(PAGE_TILE - 1)) * tiled_w +
+    (size_t) (x & ~(PAGE_TILE - 1)) * PAGE_TILE +
+    (y & (PAGE_TILE - 1)) * PAGE_TILE + (x & (PAGE_TILE - 1));
 
-  if (0 == radius)
-    return;
+} // tile_offset ()
 
-  bgi_last_arc.x = x;
-  bgi_last_arc.y = y;
-  bgi_last_arc.xstart = x + (radius * cos (stangle * PI_CONV));
-  bgi_last_arc.ystart = y - (radius * sin (stangle * PI_CONV));
-  bgi_last_arc.xend = x + (radius * cos (endangle * PI_CONV));
-  bgi_last_arc.yend = y - (radius * sin (endangle * PI_CONV));
+// -----
 
-  for (angle = stangle; angle < endangle; angle++)
-    line_fast (x + (radius * cos (angle * PI_CONV)),
-               y - (radius * sin (angle * PI_CONV)),
-               x + (radius * cos ((angle+1) * PI_CONV)),
-               y - (radius * sin ((angle+1) * PI_CONV)));
-  line_fast (x, y, bgi_last_arc.xstart, bgi_last_arc.ystart);
-  line_fast (x, y, bgi_last_arc.xend, bgi_last_arc.yend);
+static size_t ring_offset (const struct bgi_context *c, int x, int y)
+{
+  // Returns the offset of pixel (x, y) from the start of the pixels
+  // of context c, which may be in its ring or tiled.
 
-  angle = (stangle + endangle) / 2;
-  floodfill (x + (radius * cos (angle * PI_CONV)) / 2,
-             y - (radius * sin (angle * PI_CONV)) / 2,
-             bgi_fg_color);
+  int
+    size;
+
+  if (LAYOUT_TILES == c->layout)
+    return tile_offset (c, x, y);
+
+  if (RING_OFF != c->ring_mode &&
+      x >= c->ring.left && x <= c->ring.right &&
+      y >= c->ring.top && y <= c->ring.bottom) {
+    if (RING_COLUMNS == c->ring_mode) {
+      size = c->ring.right - c->ring.left + 1;
+      x += c->ring_origin;
+      if (x > c->ring.right)
+        x -= size;
+    }
+    else {
+      size = c->ring.bottom - c->ring.top + 1;
+      y += c->ring_origin;
+      if (y > c->ring.bottom)
+        y -= size;
+    }
+  }
 
-  update ();
+  return (size_t) y * (c->maxx + 1) + x;
 
-} // pieslice ()
+} // ring_offset ()
 
 // -----
 
-void putimage (int left, int top, void *bitmap, int op)
+static int ring_run (const struct bgi_context *c, int x, int x2, int y,
+                     size_t *offset)
 {
-  // Puts the bit image pointed to by bitmap onto the screen.
+  // Returns how many of pixels x..x2 of row y are stored one after
+  // the other, and sets *offset to where the first one is.
 
-  Uint32
-    bitmap_w, bitmap_h, *tmp;
   int
-    i = 2, x, y;
+    stored;
 
-  tmp = bitmap;
+  *offset = ring_offset (c, x, y);
 
-  // get width and height info from bitmap
-  memcpy (&bitmap_w, tmp, sizeof (Uint32));
-  memcpy (&bitmap_h, tmp + 1, sizeof (Uint32));
+  // a tile row ends at the next multiple of PAGE_TILE
+  if (LAYOUT_TILES == c->layout) {
+    if (x < ((c->maxx + 1) & ~(PAGE_TILE - 1)) &&
+        y < ((c->maxy + 1) & ~(PAGE_TILE - 1)) &&
+        x2 > (x | (PAGE_TILE - 1)))
+      x2 = x | (PAGE_TILE - 1);
+    return x2 - x + 1;
+  }
 
-  // put bitmap to the screen
-  for (int yy = 0; yy < bitmap_h; yy++)
-    for (int xx = 0; xx < bitmap_w; xx++) {
+  if (RING_COLUMNS != c->ring_mode ||
+      y < c->ring.top || y > c->ring.bottom ||
+      x2 < c->ring.left || x > c->ring.right)
+    return x2 - x + 1;
 
-      x = left + vp.left + xx;
-      y = top + vp.top + yy;
+  // stop where the ring begins...
+  if (x < c->ring.left)
+    return c->ring.left - x;
 
-      switch (op) {
+  // ...ends, or wraps around
+  stored = (int) (*offset - (size_t) y * (c->maxx + 1));
+  if (x2 > c->ring.right)
+    x2 = c->ring.right;
+  if (x2 - x > c->ring.right - stored)
+    x2 = x + c->ring.right - stored;
 
-      case COPY_PUT:
-        putpixel_copy (x, y, tmp[i++]);
-        break;
+  return x2 - x + 1;
 
-      case AND_PUT:
-        putpixel_and (x, y, tmp[i++]);
-        break;
+} // ring_run ()
 
-      case XOR_PUT:
-        putpixel_xor (x, y, tmp[i++]);
-        break;
+// -----
 
-      case OR_PUT:
-        putpixel_or (x, y, tmp[i++]);
-        break;
+static void load_row (const struct bgi_context *c, const Uint32 *pixels,
+                      Uint32 *dst, int x1, int x2, int y)
+{
+  // Copies pixels x1..x2 of row y to dst, in order; 'pixels' is a
+  // page stored as those of context c are.
 
-      case NOT_PUT:
-        putpixel_not (x, y, tmp[i++]);
-        break;
+  int
+    n;
+  size_t
+    offset;
 
-      } // switch
+  for (int x = x1; x <= x2; x += n) {
+    n = ring_run (c, x, x2, y, &offset);
+    memcpy (dst + x - x1, pixels + offset, n * sizeof (Uint32));
+  }
 
-    } // for x
+} // load_row ()
 
-  update ();
+// -----
 
-} // putimage ()
+static void save_row (const struct bgi_context *c, const Uint32 *src,
+                      int x1, int x2, int y)
+{
+  // Copies src to pixels x1..x2 of row y of context c, wherever
+  // they are stored; unlike store_row (), it does not depend on the
+  // current context, so worker threads can use it.
+
+  int
+    n;
+  size_t
+    offset;
+
+  for (int x = x1; x <= x2; x += n) {
+    n = ring_run (c, x, x2, y, &offset);
+    memcpy (c->pixels + offset, src + x - x1, n * sizeof (Uint32));
+  }
+
+} // save_row ()
 
 // -----
 
-void _putpixel (int x, int y)
+static void store_row (int x1, int x2, int y, const Uint32 *src, int op)
 {
-  // like putpixel (), but not immediately displayed
+  // Writes src to pixels x1..x2 of row y of the current context
+  // using op, wherever they are stored.
 
-  // viewport range is taken care of by this function only,
-  // since all others use it to draw.
-
-  x += vp.left;
-  y += vp.top;
+  int
+    n;
+  size_t
+    offset;
+
+  snap_touch (bgi_ctx, x1, y, x2, y);
+  for (int x = x1; x <= x2; x += n) {
+    n = ring_run (bgi_ctx, x, x2, y, &offset);
+    put_row (bgi_ctx->pixels + offset, src + x - x1, n, op);
+  }
 
-  switch (bgi_writemode) {
+} // store_row ()
 
-  case XOR_PUT:
-    putpixel_xor  (x, y, palette[bgi_fg_color]);
-    break;
+// -----
 
-  case AND_PUT:
-    putpixel_and  (x, y, palette[bgi_fg_color]);
-    break;
+static int ring_pieces (int x1, int y1, int x2, int y2,
+                        SDL_Rect *src, SDL_Rect *dest)
+{
+  // Splits the rectangle (x1, y1, x2, y2) of the window into at
+  // most 6 pieces that are stored as rectangles, as the ring of the
+  // default context is; 'dest' are the pieces as shown and 'src'
+  // where they are in the page. Returns the number of pieces.
 
-  case OR_PUT:
-    putpixel_or   (x, y, palette[bgi_fg_color]);
-    break;
+  const struct bgi_context
+    *c = &bgi_default_ctx;
+  int
+    n = 0,
+    ix1 = (x1 > c->ring.left) ? x1 : c->ring.left,
+    iy1 = (y1 > c->ring.top) ? y1 : c->ring.top,
+    ix2 = (x2 < c->ring.right) ? x2 : c->ring.right,
+    iy2 = (y2 < c->ring.bottom) ? y2 : c->ring.bottom,
+    start,
+    wrap;
+
+#define PIECE(px1, py1, px2, py2, sx, sy)       \
+  do {                                          \
+    dest[n].x = (px1);                          \
+    dest[n].y = (py1);                          \
+    dest[n].w = (px2) - (px1) + 1;              \
+    dest[n].h = (py2) - (py1) + 1;              \
+    src[n].x = (sx);                            \
+    src[n].y = (sy);                            \
+    src[n].w = dest[n].w;                       \
+    src[n].h = dest[n].h;                       \
+    n++;                                        \
+  } while (0)
+
+  if (RING_OFF == c->ring_mode || ix1 > ix2 || iy1 > iy2) {
+    PIECE (x1, y1, x2, y2, x1, y1);
+    return n;
+  }
 
-  case NOT_PUT:
-    putpixel_not  (x, y, palette[bgi_fg_color]);
-    break;
+  // outside the ring: above, below, left, right
+  if (y1 < iy1)
+    PIECE (x1, y1, x2, iy1 - 1, x1, y1);
+  if (y2 > iy2)
+    PIECE (x1, iy2 + 1, x2, y2, x1, iy2 + 1);
+  if (x1 < ix1)
+    PIECE (x1, iy1, ix1 - 1, iy2, x1, iy1);
+  if (x2 > ix2)
+    PIECE (ix2 + 1, iy1, x2, iy2, ix2 + 1, iy1);
+
+  // inside: one piece, or two if the ring wraps around in it
+  start = (int) ring_offset (c, ix1, iy1);
+  if (RING_COLUMNS == c->ring_mode) {
+    start %= c->maxx + 1;
+    wrap = ix1 + c->ring.right - start;
+    if (wrap >= ix2)
+      PIECE (ix1, iy1, ix2, iy2, start, iy1);
+    else {
+      PIECE (ix1, iy1, wrap, iy2, start, iy1);
+      PIECE (wrap + 1, iy1, ix2, iy2, c->ring.left, iy1);
+    }
+  }
+  else {
+    start /= c->maxx + 1;
+    wrap = iy1 + c->ring.bottom - start;
+    if (wrap >= iy2)
+      PIECE (ix1, iy1, ix2, iy2, ix1, start);
+    else {
+      PIECE (ix1, iy1, ix2, wrap, ix1, start);
+      PIECE (ix1, wrap + 1, ix2, iy2, ix1, c->ring.top);
+    }
+  }
 
-  default:
-  case COPY_PUT:
-    putpixel_copy (x, y, palette[bgi_fg_color]);
+#undef PIECE
 
-  } // switch
+  return n;
 
-} // _putpixel ()
+} // ring_pieces ()
 
 // -----
 
-void putpixel_copy (int x, int y, Uint32 pixel)
+static void ring_unroll (void)
 {
-  // plain putpixel - no logical operations
+  // Stores the ring of the current context in plain order again,
+  // with origin 0.
 
-  // out of range?
-  if (x < 0 || x > bgi_maxx || y < 0 || y > bgi_maxy)
+  struct bgi_context
+    *c = bgi_ctx;
+  int
+    w = c->ring.right - c->ring.left + 1,
+    h = c->ring.bottom - c->ring.top + 1,
+    x, n;
+  size_t
+    offset;
+  Uint32
+    *tmp;
+
+  if (RING_OFF == c->ring_mode || 0 == c->ring_origin)
     return;
 
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
+  tmp = malloc (w * h * sizeof (Uint32));
+  if (NULL == tmp) {
+    fprintf (stderr, "Can't allocate memory in setringviewport().\n");
+    return;
+  }
 
-  bgi_activepage[current_window][y * (bgi_maxx + 1) + x] =
-    pixel;
+  for (int y = 0; y < h; y++)
+    for (x = 0; x < w; x += n) {
+      n = ring_run (c, c->ring.left + x, c->ring.right,
+                    c->ring.top + y, &offset);
+      memcpy (tmp + y * w + x, c->pixels + offset, n * sizeof (Uint32));
+    }
+  for (int y = 0; y < h; y++)
+    memcpy (c->pixels + (c->ring.top + y) * (c->maxx + 1) + c->ring.left,
+            tmp + y * w, w * sizeof (Uint32));
 
-  // we could use the native function:
-  // SDL_RenderDrawPoint (bgi_rnd, x, y);
-  // but strangely it's slower
+  c->ring_origin = 0;
+  free (tmp);
 
-} // putpixel_copy ()
+} // ring_unroll ()
 
 // -----
 
-void putpixel_xor (int x, int y, Uint32 pixel)
+static void drop_page_ring (void)
 {
-  // XOR'ed putpixel
+  // The ring of the default context is kept by the page it was made
+  // on; before another page becomes active or visual, the ring is
+  // put back in order and turned off.
 
-  // out of range?
-  if (x < 0 || x > bgi_maxx || y < 0 || y > bgi_maxy)
+  if (RING_OFF == bgi_default_ctx.ring_mode)
     return;
 
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
-
-  bgi_activepage[current_window][y * (bgi_maxx + 1) + x] ^=
-    (pixel & 0x00ffffff);
+  if (update_mutex)
+    lock_update ();
+  CTX_CALL (&bgi_default_ctx, ring_unroll ());
+  bgi_default_ctx.ring_mode = RING_OFF;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
 
-} // putpixel_xor ()
+} // drop_page_ring ()
 
 // -----
 
-void putpixel_and (int x, int y, Uint32 pixel)
+void scrollring (int n, int color)
 {
-  // AND-ed putpixel
+  // Scrolls a ring viewport (see setringviewport ()) n columns to
+  // the left, or n rows up; negative values scroll the other way.
+  // Only the n columns (rows) that come in are written, and they
+  // are filled with 'color'.
 
-  // out of range?
-  if (x < 0 || x > bgi_maxx || y < 0 || y > bgi_maxy)
-    return;
+  struct bgi_context
+    *c = bgi_ctx;
+  int
+    size,
+    first, last,
+    stride = c->maxx + 1;
+  Uint32
+    fill,
+    *p;
 
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
+  RECORD (scrollring (n, color), REC_SCROLLRING, n, color);
 
-  bgi_activepage[current_window][y * (bgi_maxx + 1) + x] &=
-    pixel;
+  if (RING_OFF == c->ring_mode)
+    return;
 
-} // putpixel_and ()
+  size = (RING_COLUMNS == c->ring_mode) ?
+    c->ring.right - c->ring.left + 1 : c->ring.bottom - c->ring.top + 1;
+  if (n > size)
+    n = size;
+  if (n < -size)
+    n = -size;
 
-// -----
+  fill = (-1 == color) ?
+    bgi_tmp_color_argb : c->palette[color];
 
-void putpixel_or (int x, int y, Uint32 pixel)
-{
-  // OR-ed putpixel
+  c->ring_origin = (c->ring_origin + n + size) % size;
+  snap_touch (c, c->ring.left, c->ring.top, c->ring.right, c->ring.bottom);
 
-  // out of range?
-  if (x < 0 || x > bgi_maxx || y < 0 || y > bgi_maxy)
-    return;
+  // the columns (rows) that came in
+  first = (n > 0) ? size - n : 0;
+  last = (n > 0) ? size - 1 : -n - 1;
 
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
+  for (int i = first; i <= last; i++)
+    if (RING_COLUMNS == c->ring_mode) {
+      p = c->pixels + ring_offset (c, c->ring.left + i, c->ring.top);
+      for (int y = c->ring.top; y <= c->ring.bottom; y++, p += stride)
+        *p = fill;
+    }
+    else {
+      p = c->pixels + ring_offset (c, c->ring.left, c->ring.top + i);
+      for (int x = c->ring.left; x <= c->ring.right; x++)
+        *p++ = fill;
+    }
 
-  bgi_activepage[current_window][y * (bgi_maxx + 1) + x] |=
-    (pixel & 0x00ffffff);
+  update_area (c->ring.left, c->ring.top, c->ring.right, c->ring.bottom);
 
-} // putpixel_or ()
+} // scrollring ()
 
 // -----
 
-void putpixel_not (int x, int y, Uint32 pixel)
+void scrollviewport (int dx, int dy, int color)
 {
-  // NOT-ed putpixel
+  // Scrolls the contents of the viewport by dx pixels right and dy
+  // pixels down, regardless of clipping; the uncovered strips are
+  // filled with 'color', which may be COLOR (r, g, b).
 
-  // out of range?
-  if (x < 0 || x > bgi_maxx || y < 0 || y > bgi_maxy)
+  int
+    left = bgi_ctx->vp.left,
+    top = bgi_ctx->vp.top,
+    right = bgi_ctx->vp.right,
+    bottom = bgi_ctx->vp.bottom;
+  Uint32
+    fill;
+  SDL_Rect
+    moved;
+
+  RECORD (scrollviewport (dx, dy, color), REC_SCROLLVIEWPORT,
+          dx, dy, color);
+
+  // the viewport may extend past the page
+  if (right > bgi_ctx->maxx)
+    right = bgi_ctx->maxx;
+  if (bottom > bgi_ctx->maxy)
+    bottom = bgi_ctx->maxy;
+  if (left > right || top > bottom)
     return;
 
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
+  fill = (-1 == color) ?
+    bgi_tmp_color_argb : bgi_ctx->palette[color];
+
+  // the part that stays inside the viewport
+  moved.w = moved.h = 0;
+  if (abs (dx) <= right - left && abs (dy) <= bottom - top)
+    move_rect (bgi_ctx->pixels,
+               (dx < 0) ? left - dx : left, (dy < 0) ? top - dy : top,
+               (dx > 0) ? right - dx : right,
+               (dy > 0) ? bottom - dy : bottom,
+               (dx > 0) ? left + dx : left, (dy > 0) ? top + dy : top,
+               &moved);
+
+  // fill what was uncovered: rows first, then columns
+  if (0 == moved.w)
+    fill_rect (left, top, right, bottom, fill);
+  else {
+    if (moved.y > top)
+      fill_rect (left, top, right, moved.y - 1, fill);
+    if (moved.y + moved.h - 1 < bottom)
+      fill_rect (left, moved.y + moved.h, right, bottom, fill);
+    if (moved.x > left)
+      fill_rect (left, moved.y, moved.x - 1,
+                 moved.y + moved.h - 1, fill);
+    if (moved.x + moved.w - 1 < right)
+      fill_rect (moved.x + moved.w, moved.y, right,
+                 moved.y + moved.h - 1, fill);
+  }
 
-  bgi_activepage[current_window][y * (bgi_maxx + 1) + x] = ~
-    (pixel & 0x00ffffff);
+  update_area (left, top, right, bottom);
 
-} // putpixel_not ()
+} // scrollviewport ()
 
 // -----
 
-void putpixel (int x, int y, int color)
+void sector (int x, int y, int stangle, int endangle,
+             int xradius, int yradius)
 {
-  // Plots a point at (x,y) in the color defined by 'color'.
+  // Draws and fills an elliptical pie slice centered at (x, y),
+  // horizontal and vertical radii given by xradius and yradius,
+  // traveling from stangle to endangle.
 
-  int tmpcolor;
+  // quick and dirty for now, Bresenham-based later.
+  int angle, tmpcolor;
 
-  x += vp.left;
-  y += vp.top;
+  RECORD (sector (x, y, stangle, endangle, xradius, yradius),
+          REC_SECTOR, x, y, stangle, endangle, xradius, yradius);
 
-  // clip
-  if (YEAH == vp.clip)
-    if (x < vp.left || x > vp.right || y < vp.top || y > vp.bottom)
-      return;
+  if (0 == xradius && 0 == yradius)
+    return;
 
-   // COLOR () set up the BGI_COLORS + 1 color
-  if (-1 == color) {
-    bgi_argb_mode = YEAH;
-    tmpcolor = TMP_FG_COL;
-    palette[tmpcolor] = bgi_tmp_color_argb;
-  }
-  else {
-    bgi_argb_mode = NOPE;
-    tmpcolor = color;
-  }
+  if (endangle < stangle)
+    endangle += 360;
 
-  switch (bgi_writemode) {
+  // really needed?
+  bgi_ctx->last_arc.x = x;
+  bgi_ctx->last_arc.y = y;
+  bgi_ctx->last_arc.xstart = x + (xradius * cos (stangle * PI_CONV));
+  bgi_ctx->last_arc.ystart = y - (yradius * sin (stangle * PI_CONV));
+  bgi_ctx->last_arc.xend = x + (xradius * cos (endangle * PI_CONV));
+  bgi_ctx->last_arc.yend = y - (yradius * sin (endangle * PI_CONV));
 
-  case XOR_PUT:
-    putpixel_xor  (x, y, palette[tmpcolor]);
-    break;
+  for (angle = stangle; angle < endangle; angle++)
+    line_fast (x + (xradius * cos (angle * PI_CONV)),
+               y - (yradius * sin (angle * PI_CONV)),
+               x + (xradius * cos ((angle+1) * PI_CONV)),
+               y - (yradius * sin ((angle+1) * PI_CONV)));
+  line_fast (x, y, bgi_ctx->last_arc.xstart, bgi_ctx->last_arc.ystart);
+  line_fast (x, y, bgi_ctx->last_arc.xend, bgi_ctx->last_arc.yend);
 
-  case AND_PUT:
-    putpixel_and  (x, y, palette[tmpcolor]);
-    break;
+  tmpcolor = bgi_ctx->fg_color;
+  setcolor (bgi_ctx->fill_style.color);
+  angle = (stangle + endangle) / 2;
+  // find a point within the sector
+  floodfill (x + (xradius * cos (angle * PI_CONV)) / 2,
+             y - (yradius * sin (angle * PI_CONV)) / 2,
+             tmpcolor);
 
-  case OR_PUT:
-    putpixel_or   (x, y, palette[tmpcolor]);
-    break;
+  update ();
 
-  case NOT_PUT:
-    putpixel_not  (x, y, palette[tmpcolor]);
-    break;
+} // sector ()
 
-  default:
-  case COPY_PUT:
-    putpixel_copy (x, y, palette[tmpcolor]);
+// -----
 
-  } // switch
+static int shm_pages_create (int width, int height)
+{
+  // Creates the visual pages in the POSIX shared memory object
+  // named by setsharedpages (), so that other processes can map
+  // them. Returns NOPE if the object can't be created.
+
+#ifdef BGI_HAVE_MMAP
+  int
+    fd,
+    page;
+  size_t
+    page_bytes,
+    page_offset;
+  Uint8
+    *map;
+
+  // pages start on a boundary of 4 kB, so that a consumer can map
+  // a single page
+  page_offset = (sizeof (bgi_shm_header) + 4095) & ~(size_t) 4095;
+  page_bytes = ((size_t) width * height * sizeof (Uint32) + 4095) &
+    ~(size_t) 4095;
+  bgi_shm_size = page_offset + VPAGES * page_bytes;
+
+  fd = shm_open (bgi_shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    SDL_Log ("shm_open(%s) failed: %s", bgi_shm_name, strerror (errno));
+    return NOPE;
+  }
+  if (0 != ftruncate (fd, bgi_shm_size)) {
+    SDL_Log ("ftruncate(%s) failed: %s", bgi_shm_name, strerror (errno));
+    close (fd);
+    shm_unlink (bgi_shm_name);
+    return NOPE;
+  }
+  map = mmap (NULL, bgi_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+  close (fd);
+  if (MAP_FAILED == map) {
+    SDL_Log ("mmap(%s) failed: %s", bgi_shm_name, strerror (errno));
+    shm_unlink (bgi_shm_name);
+    return NOPE;
+  }
+
+  for (page = 0; page < VPAGES; page++) {
+    bgi_vpage[page] =
+      SDL_CreateRGBSurfaceFrom (map + page_offset + page * page_bytes,
+                                width, height, 32,
+                                width * sizeof (Uint32), 0, 0, 0, 0);
+    if (NULL == bgi_vpage[page]) {
+      SDL_Log ("Could not create surface for visual page %d.", page);
+      while (page--)
+        SDL_FreeSurface (bgi_vpage[page]);
+      munmap (map, bgi_shm_size);
+      shm_unlink (bgi_shm_name);
+      return NOPE;
+    }
+  }
 
-  update_pixel (x, y);
+  bgi_shm = (bgi_shm_header *) map;
+  bgi_shm->header_size = sizeof (bgi_shm_header);
+  bgi_shm->width = width;
+  bgi_shm->height = height;
+  bgi_shm->stride = width;
+  bgi_shm->pages = VPAGES;
+  bgi_shm->page_bytes = page_bytes;
+  bgi_shm->page_offset = page_offset;
+  bgi_shm->visual_page = 0;
+  bgi_shm->active_page = 0;
+  bgi_shm->sequence = 0;
+  // consumers may look at the header at any time
+  SDL_MemoryBarrierRelease ();
+  bgi_shm->magic = BGI_SHM_MAGIC;
+  bgi_shm_window = current_window;
+
+  return YEAH;
+#else
+  (void) width;
+  (void) height;
+  unimplemented ("setsharedpages");
+  return NOPE;
+#endif
 
-} // putpixel ()
+} // shm_pages_create ()
 
 // -----
 
-void readimagefile (char *bitmapname, int x1, int y1, int x2, int y2)
+static void shm_pages_present (void)
 {
-  // Reads a .bmp file and displays it immediately at (x1, y1 ).
-
-  Uint32
-    *pixels;
-  SDL_Surface
-    *bm_surface,
-    *tmp_surface;
-  SDL_Rect
-    src_rect,
-    dest_rect;
+  // Tells consumers of the shared pages that a frame was presented.
 
-  // load bitmap
-  bm_surface = SDL_LoadBMP (bitmapname);
-  if (NULL == bm_surface) {
-    SDL_Log ("SDL_LoadBMP() error: %s\n", SDL_GetError ());
-    showerrorbox ("SDL_LoadBMP() error");
+  if (NULL == bgi_shm || current_window != bgi_shm_window)
     return;
-  }
-
-  // source rect, position and size
-  src_rect.x = 0;
-  src_rect.y = 0;
-  src_rect.w = bm_surface->w;
-  src_rect.h = bm_surface->h;
-
-  // destination rect, position
-  dest_rect.x = x1 + vp.left;
-  dest_rect.y = y1 + vp.top;
-
-  if (0 == x2 || 0 == y2) { // keep original size
-    dest_rect.w = src_rect.w;
-    dest_rect.h = src_rect.h;
-  }
-  else { // change size
-    dest_rect.w = x2 - x1 + 1;
-    dest_rect.h = y2 - y1 + 1;
-  }
 
-  // clip it if necessary
-  if (x1 + vp.left + src_rect.w > vp.right && vp.clip)
-    dest_rect.w = vp.right - x1 - vp.left + 1;
-  if (y1 + vp.top + src_rect.h > vp.bottom && vp.clip)
-    dest_rect.h = vp.bottom - y1 - vp.top + 1;
+  bgi_shm->visual_page = bgi_vp;
+  bgi_shm->active_page = bgi_ap;
+  // pixels and page numbers must be visible before the counter
+  SDL_MemoryBarrierRelease ();
+  bgi_shm->sequence++;
 
-  // get SDL surface from current window
-  tmp_surface = SDL_GetWindowSurface (bgi_win[current_window]);
+} // shm_pages_present ()
 
-  // blit bitmap surface to current surface
-  SDL_BlitScaled (bm_surface,
-                  &src_rect,
-                  tmp_surface,
-                  &dest_rect);
+// -----
 
-  // copy pixel data from the new surface to the active page
-  pixels = tmp_surface->pixels;
+static void shm_pages_free (void)
+{
+  // Unmaps and removes the shared memory object. Consumers that
+  // have it mapped keep their mapping. As with the other pages, the
+  // surfaces are not freed.
 
-  for (int y = dest_rect.y; y < dest_rect.y + dest_rect.h; y++)
-    for (int x = dest_rect.x; x < dest_rect.x + dest_rect.w; x++)
-      bgi_activepage[current_window][y * (bgi_maxx + 1) + x] =
-    pixels[y * (bgi_maxx + 1) + x] | 0xff000000;
+#ifdef BGI_HAVE_MMAP
+  if (NULL == bgi_shm)
+    return;
 
-  refresh_window ();
-  SDL_FreeSurface (bm_surface);
+  munmap (bgi_shm, bgi_shm_size);
+  shm_unlink (bgi_shm_name);
+  bgi_shm = NULL;
+  bgi_shm_window = -1;
+#endif
 
-} // readimagefile ()
+} // shm_pages_free ()
 
 // -----
 
-void rectangle (int x1, int y1, int x2, int y2)
+// Frame server. A thread accepts clients on a local socket and
+// sends them the visual page of one window: a whole frame first,
+// then only the rectangles that updaterect () presented, encoded
+// against the frame the client already has. The rendering thread
+// copies a presented rectangle to the server's own frame, merges it
+// and writes to a pipe; the server thread waits in poll (), and
+// reads the frame under update_mutex only. While a client still has
+// data to read, its damage keeps growing and no new frame is
+// encoded, so slow clients get fewer, merged frames and never block
+// the program.
+
+static void serve_copy (int x1, int y1, int x2, int y2)
 {
-  // Draws a rectangle delimited by (left,top) and (right,bottom).
+  // Copies rectangle (x1, y1, x2, y2) of the current window, as it
+  // is shown, to the server's frame; update_mutex must be locked.
 
-  line_fast (x1, y1, x2, y1);
-  line_fast (x2, y1, x2, y2);
-  line_fast (x2, y2, x1, y2);
-  line_fast (x1, y2, x1, y1);
+#ifdef BGI_HAVE_SOCKETS
+  int
+    w = x2 - x1 + 1;
+  Uint32
+    *shown = compose_rect (x1, y1, x2, y2);
 
-  update ();
+  for (int y = y1; y <= y2; y++)
+    if (shown)
+      memcpy (bgi_serve_frame + y * bgi_serve_w + x1,
+              shown + (y - y1) * w, w * sizeof (Uint32));
+    else
+      load_row (&bgi_default_ctx, bgi_visualpage[current_window],
+                bgi_serve_frame + y * bgi_serve_w + x1, x1, x2, y);
+  free (shown);
+#else
+  (void) x1;
+  (void) y1;
+  (void) x2;
+  (void) y2;
+#endif
 
-} // rectangle ()
+} // serve_copy ()
 
 // -----
 
-void refresh (void)
+static void serve_damage (int x1, int y1, int x2, int y2)
 {
-  // Updates the screen.
+  // Adds a presented rectangle to the pending damage.
 
-  if (update_mutex)
-    SDL_LockMutex (update_mutex);
+#ifdef BGI_HAVE_SOCKETS
+  int
+    wake;
 
-  refresh_window ();
+  if (NOPE == bgi_serve_running || current_window != bgi_serve_window)
+    return;
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 > bgi_serve_w - 1)
+    x2 = bgi_serve_w - 1;
+  if (y2 > bgi_serve_h - 1)
+    y2 = bgi_serve_h - 1;
+  if (x1 > x2 || y1 > y2)
+    return;
 
+  if (update_mutex)
+    lock_update ();
+  serve_copy (x1, y1, x2, y2);
   if (update_mutex)
     SDL_UnlockMutex (update_mutex);
 
-} // refresh ()
+  SDL_AtomicLock (&bgi_serve_lock);
+  wake = (bgi_serve_x2 < 0);
+  if (wake) {
+    bgi_serve_x1 = x1;
+    bgi_serve_y1 = y1;
+    bgi_serve_x2 = x2;
+    bgi_serve_y2 = y2;
+  }
+  else {
+    bgi_serve_x1 = (x1 < bgi_serve_x1) ? x1 : bgi_serve_x1;
+    bgi_serve_y1 = (y1 < bgi_serve_y1) ? y1 : bgi_serve_y1;
+    bgi_serve_x2 = (x2 > bgi_serve_x2) ? x2 : bgi_serve_x2;
+    bgi_serve_y2 = (y2 > bgi_serve_y2) ? y2 : bgi_serve_y2;
+  }
+  SDL_AtomicUnlock (&bgi_serve_lock);
+
+  if (wake && write (bgi_serve_wake[1], "", 1) < 0) {
+    // the pipe is full, so the thread will wake up anyway
+  }
+#else
+  (void) x1;
+  (void) y1;
+  (void) x2;
+  (void) y2;
+#endif
+
+} // serve_damage ()
 
 // -----
 
-void refresh_window (void)
+#ifdef BGI_HAVE_SOCKETS
+
+static void serve_merge (ServeClient *c, int x1, int y1, int x2, int y2)
 {
-  // Updates the screen.
+  // Adds a rectangle to the damage of a client.
 
-  updaterect (0, 0, bgi_maxx, bgi_maxy);
+  if (c->x2 < 0) {
+    c->x1 = x1;
+    c->y1 = y1;
+    c->x2 = x2;
+    c->y2 = y2;
+    return;
+  }
+  c->x1 = (x1 < c->x1) ? x1 : c->x1;
+  c->y1 = (y1 < c->y1) ? y1 : c->y1;
+  c->x2 = (x2 > c->x2) ? x2 : c->x2;
+  c->y2 = (y2 > c->y2) ? y2 : c->y2;
 
-} // refresh_window ()
+} // serve_merge ()
 
 // -----
 
-void restorecrtmode (void)
+static void serve_put32 (Uint8 **p, Uint32 value)
 {
-  // Hides the graphics window.
+  // Appends a little-endian word.
 
-  SDL_HideWindow (bgi_win[current_window]);
-  window_is_hidden = YEAH;
+  value = SDL_SwapLE32 (value);
+  memcpy (*p, &value, sizeof (value));
+  *p += sizeof (value);
 
-} // restorecrtmode ()
+} // serve_put32 ()
 
 // -----
 
-// callback for sdlbgiauto ()
+static void serve_drop (ServeClient *c)
+{
+  // Disconnects a client.
 
-static Uint32 updatecallback (Uint32 interval, void *param)
+  close (c->fd);
+  free (c->shadow);
+  free (c->out);
+  memset (c, 0, sizeof (*c));
+  c->fd = -1;
+
+} // serve_drop ()
+
+// -----
+
+static int serve_reserve (ServeClient *c, size_t bytes)
 {
-  if (update_mutex)
-    SDL_LockMutex (update_mutex);
+  // Makes room for 'bytes' more bytes of output.
 
-  if (refresh_needed)
-    refresh_window ();
+  Uint8
+    *out;
 
-  refresh_needed = NOPE;
+  if (c->out_len + bytes <= c->out_size)
+    return YEAH;
 
-  if (update_mutex)
-    SDL_UnlockMutex (update_mutex);
+  out = realloc (c->out, c->out_len + bytes);
+  if (NULL == out)
+    return NOPE;
+  c->out = out;
+  c->out_size = c->out_len + bytes;
 
-  return interval;
+  return YEAH;
 
-} // updatecallback ()
+} // serve_reserve ()
 
 // -----
 
-void update (void)
+static void serve_encode (ServeClient *c)
 {
-  // Conditionally refreshes the screen or schedule it
+  // Encodes the damage of a client as a BGI_MSG_FRAME message,
+  // against the frame the client has, and updates that frame.
 
-  if (update_mutex)
-    SDL_LockMutex (update_mutex);
+  int
+    w = c->x2 - c->x1 + 1,
+    h = c->y2 - c->y1 + 1,
+    n = w * h,
+    i = 0,
+    k,
+    have_last = NOPE;
+  Uint32
+    last = 0,
+    *cur,
+    *old;
+  Uint8
+    *p,
+    *start,
+    *size;
 
-  if (! bgi_fast_mode)
-    refresh_window ();
-  else
-    refresh_needed = YEAH;
+  // all pixels as raw colours, plus one byte every 64 pixels
+  if (NOPE == serve_reserve (c, 8 * sizeof (Uint32) + 5 * n))
+    return;
 
+  // snapshot of the rectangle, and the client's copy of it
+  cur = malloc (2 * n * sizeof (Uint32));
+  if (NULL == cur)
+    return;
+  old = cur + n;
+  if (update_mutex)
+    SDL_LockMutex (update_mutex);
+  for (int y = 0; y < h; y++)
+    memcpy (cur + y * w,
+            bgi_serve_frame + (c->y1 + y) * bgi_serve_w + c->x1,
+            w * sizeof (Uint32));
   if (update_mutex)
     SDL_UnlockMutex (update_mutex);
+  for (int y = 0; y < h; y++)
+    memcpy (old + y * w, c->shadow + (c->y1 + y) * bgi_serve_w + c->x1,
+            w * sizeof (Uint32));
+
+  p = c->out + c->out_len;
+  serve_put32 (&p, BGI_MSG_FRAME);
+  serve_put32 (&p, bgi_serve_seq);
+  serve_put32 (&p, c->x1);
+  serve_put32 (&p, c->y1);
+  serve_put32 (&p, w);
+  serve_put32 (&p, h);
+  serve_put32 (&p, c->keyframe ? BGI_FRAME_KEY : 0);
+  size = p;
+  serve_put32 (&p, 0);
+  start = p;
+
+  while (i < n) {
+    // unchanged pixels
+    if (! c->keyframe && cur[i] == old[i]) {
+      for (k = 1; k < 64 && i + k < n && cur[i + k] == old[i + k]; k++)
+        ;
+      *p++ = BGI_OP_SKIP | (k - 1);
+      i += k;
+      continue;
+    }
+    // pixels of the same colour
+    for (k = 1; k < 64 && i + k < n && cur[i + k] == cur[i]; k++)
+      ;
+    if (k > 1) {
+      if (have_last && cur[i] == last)
+        *p++ = BGI_OP_REPEAT | (k - 1);
+      else {
+        *p++ = BGI_OP_RUN | (k - 1);
+        serve_put32 (&p, cur[i]);
+      }
+      last = cur[i];
+      have_last = YEAH;
+      i += k;
+      continue;
+    }
+    // anything else, up to the next run or unchanged pixel
+    for (k = 1; k < 64 && i + k < n; k++)
+      if ((! c->keyframe && cur[i + k] == old[i + k]) ||
+          (i + k + 1 < n && cur[i + k] == cur[i + k + 1]))
+        break;
+    *p++ = BGI_OP_RAW | (k - 1);
+    while (k--)
+      serve_put32 (&p, cur[i++]);
+    last = cur[i - 1];
+    have_last = YEAH;
+  }
 
-} // update ()
+  serve_put32 (&size, p - start);
+  c->out_len = p - c->out;
+
+  for (int y = 0; y < h; y++)
+    memcpy (c->shadow + (c->y1 + y) * bgi_serve_w + c->x1, cur + y * w,
+            w * sizeof (Uint32));
+  free (cur);
+
+  c->keyframe = NOPE;
+  c->x2 = c->y2 = -1;
+
+} // serve_encode ()
 
 // -----
 
-void update_pixel (int x, int y)
+static int serve_flush (ServeClient *c)
 {
-  // Updates a single pixel
+  // Sends as much pending output as the socket takes. Returns NOPE
+  // if the client is gone.
 
-  if (update_mutex)
-    SDL_LockMutex (update_mutex);
+  ssize_t
+    sent;
 
-  if (! bgi_fast_mode)
-    updaterect (x, y, x, y);
-  else
-    refresh_needed = YEAH;
+  while (c->out_pos < c->out_len) {
+#ifdef MSG_NOSIGNAL
+    sent = send (c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+                 MSG_NOSIGNAL);
+#else
+    sent = send (c->fd, c->out + c->out_pos, c->out_len - c->out_pos, 0);
+#endif
+    if (sent < 0)
+      return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno);
+    c->out_pos += sent;
+  }
+  c->out_pos = c->out_len = 0;
 
-  if (update_mutex)
-    SDL_UnlockMutex (update_mutex);
+  return YEAH;
 
-} // update_pixel ()
+} // serve_flush ()
 
 // -----
 
-void sdlbgiauto ()
+static int serve_input (ServeClient *c)
 {
-  // Triggers "auto refresh mode", i.e. refresh() is performed
-  // automatically on a separate thread.
+  // Reads messages from a client and turns them into SDL events.
+  // Returns NOPE if the client is gone.
 
+  ssize_t
+    got;
   Uint32
-    interval;
+    msg[4];
+  SDL_Event
+    event;
 
-  if (0 == refresh_rate) {
-    // refresh rate not specified by the user;
-    // then, let's use the display refresh rate
-    SDL_DisplayMode
-      display_mode;
-    SDL_GetDisplayMode (0, 0, &display_mode);
-    // milliseconds between screen refresh
-    refresh_rate = display_mode.refresh_rate;
+  while (1) {
+    got = recv (c->fd, c->in + c->in_len, sizeof (c->in) - c->in_len, 0);
+    if (0 == got)
+      return NOPE;
+    if (got < 0)
+      return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno);
+    c->in_len += got;
+    if (c->in_len < (int) sizeof (c->in))
+      continue;
+    c->in_len = 0;
+
+    memcpy (msg, c->in, sizeof (msg));
+    for (int i = 0; i < 4; i++)
+      msg[i] = SDL_SwapLE32 (msg[i]);
+
+    memset (&event, 0, sizeof (event));
+    switch (msg[0]) {
+
+    case BGI_MSG_MOTION:
+      event.type = SDL_MOUSEMOTION;
+      event.motion.windowID = bgi_serve_window_id;
+      event.motion.x = (Sint32) msg[1];
+      event.motion.y = (Sint32) msg[2];
+      break;
 
-    // fallback to 30hz if everything else fails
-    if (0 == refresh_rate)
-      refresh_rate = 30;
-  }
+    case BGI_MSG_BUTTONDOWN:
+    case BGI_MSG_BUTTONUP:
+      event.type = (BGI_MSG_BUTTONDOWN == msg[0]) ?
+        SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+      event.button.windowID = bgi_serve_window_id;
+      event.button.x = (Sint32) msg[1];
+      event.button.y = (Sint32) msg[2];
+      event.button.button = msg[3];
+      event.button.state = (BGI_MSG_BUTTONDOWN == msg[0]) ?
+        SDL_PRESSED : SDL_RELEASED;
+      event.button.clicks = 1;
+      break;
 
-  interval = (Uint32) 1000.0 / refresh_rate;
+    case BGI_MSG_KEYDOWN:
+    case BGI_MSG_KEYUP:
+      event.type = (BGI_MSG_KEYDOWN == msg[0]) ? SDL_KEYDOWN : SDL_KEYUP;
+      event.key.windowID = bgi_serve_window_id;
+      event.key.keysym.sym = (SDL_Keycode) msg[1];
+      event.key.state = (BGI_MSG_KEYDOWN == msg[0]) ?
+        SDL_PRESSED : SDL_RELEASED;
+      break;
 
-  // install a timer to periodically update the screen
-  SDL_AddTimer (interval, updatecallback, NULL);
-  bgi_fast_mode = YEAH;
+    default: // ignore unknown messages
+      continue;
+    }
 
-} // sdlbgiauto ()
+    // SDL_PushEvent () can be called from any thread
+    SDL_PushEvent (&event);
+  }
+
+} // serve_input ()
 
 // -----
 
-void sdlbgifast (void)
+static void serve_accept (void)
 {
-  // Triggers "fast mode", i.e. refresh() is needed to
-  // display graphics.
+  // Accepts new clients; they get the whole frame first.
 
-  bgi_fast_mode = YEAH;
+  int
+    fd,
+    slot;
+  Uint8
+    *p;
+  ServeClient
+    *c;
 
-} // sdlbgifast ()
+  while ((fd = accept (bgi_serve_fd, NULL, NULL)) >= 0) {
+    for (slot = 0; slot < SERVE_MAX_CLIENTS; slot++)
+      if (-1 == bgi_serve_clients[slot].fd)
+        break;
+    if (SERVE_MAX_CLIENTS == slot) {
+      close (fd);
+      continue;
+    }
+    c = &bgi_serve_clients[slot];
+    c->shadow = calloc (bgi_serve_w * bgi_serve_h, sizeof (Uint32));
+    if (NULL == c->shadow || NOPE == serve_reserve (c, 12)) {
+      free (c->shadow);
+      c->shadow = NULL;
+      close (fd);
+      continue;
+    }
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    setsockopt (fd, SOL_SOCKET, SO_NOSIGPIPE, &(int) {1}, sizeof (int));
+#endif
+    c->fd = fd;
+    c->keyframe = YEAH;
+    c->x1 = c->y1 = 0;
+    c->x2 = bgi_serve_w - 1;
+    c->y2 = bgi_serve_h - 1;
+    p = c->out;
+    serve_put32 (&p, BGI_MSG_HELLO);
+    serve_put32 (&p, bgi_serve_w);
+    serve_put32 (&p, bgi_serve_h);
+    c->out_len = p - c->out;
+  }
+
+} // serve_accept ()
 
 // -----
 
-void sdlbgislow (void)
+static int serve_thread (void *unused)
 {
-  // Triggers "slow mode", i.e. refresh() is not needed to
-  // display graphics.
+  // Body of the server thread.
 
-  bgi_fast_mode = NOPE;
+  struct pollfd
+    fds[2 + SERVE_MAX_CLIENTS];
+  int
+    nfds,
+    slot[2 + SERVE_MAX_CLIENTS],
+    x1, y1, x2, y2;
+  char
+    buf[64];
+  ServeClient
+    *c;
+
+  (void) unused;
+
+  while (YEAH == bgi_serve_running) {
+
+    fds[0].fd = bgi_serve_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = bgi_serve_wake[0];
+    fds[1].events = POLLIN;
+    nfds = 2;
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++)
+      if (-1 != bgi_serve_clients[i].fd) {
+        fds[nfds].fd = bgi_serve_clients[i].fd;
+        fds[nfds].events = POLLIN |
+          (bgi_serve_clients[i].out_len ? POLLOUT : 0);
+        slot[nfds++] = i;
+      }
 
-} // sdlbgislow ()
+    if (poll (fds, nfds, 100) < 0 && EINTR != errno)
+      break;
+
+    while (read (bgi_serve_wake[0], buf, sizeof (buf)) > 0)
+      ;
+
+    SDL_AtomicLock (&bgi_serve_lock);
+    x1 = bgi_serve_x1;
+    y1 = bgi_serve_y1;
+    x2 = bgi_serve_x2;
+    y2 = bgi_serve_y2;
+    bgi_serve_x2 = bgi_serve_y2 = -1;
+    SDL_AtomicUnlock (&bgi_serve_lock);
+    if (x2 >= 0) {
+      bgi_serve_seq++;
+      for (int i = 0; i < SERVE_MAX_CLIENTS; i++)
+        if (-1 != bgi_serve_clients[i].fd)
+          serve_merge (&bgi_serve_clients[i], x1, y1, x2, y2);
+    }
+
+    for (int i = 2; i < nfds; i++) {
+      c = &bgi_serve_clients[slot[i]];
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+          NOPE == serve_input (c))
+        serve_drop (c);
+    }
+
+    if (fds[0].revents & POLLIN)
+      serve_accept ();
+
+    for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+      c = &bgi_serve_clients[i];
+      if (-1 == c->fd)
+        continue;
+      // a client gets a new frame when it has read the last one
+      if (0 == c->out_len && c->x2 >= 0)
+        serve_encode (c);
+      if (NOPE == serve_flush (c))
+        serve_drop (c);
+    }
+  }
+
+  return 0;
+
+} // serve_thread ()
+
+#endif // BGI_HAVE_SOCKETS
 
 // -----
 
-void sector (int x, int y, int stangle, int endangle,
-             int xradius, int yradius)
+static void alias_window_surface (void)
 {
-  // Draws and fills an elliptical pie slice centered at (x, y),
-  // horizontal and vertical radii given by xradius and yradius,
-  // traveling from stangle to endangle.
+  // With the surface backend, page 0 lives in the window surface
+  // while it is both the active and the visual page, and the
+  // surface has the same pixel layout. Otherwise, page 0 is a
+  // separate buffer, as the other pages are copied to the window.
 
-  // quick and dirty for now, Bresenham-based later.
-  int angle, tmpcolor;
+  int
+    w = current_window,
+    size = (bgi_win_maxx[w] + 1) * (bgi_win_maxy[w] + 1) *
+    sizeof (Uint32),
+    width, height,
+    alias = NOPE;
+  SDL_Surface
+    *surface = NULL;
 
-  if (0 == xradius && 0 == yradius)
+  if (SURFACE_BACKEND != bgi_win_backend[w])
     return;
 
-  if (endangle < stangle)
-    endangle += 360;
-
-  // really needed?
-  bgi_last_arc.x = x;
-  bgi_last_arc.y = y;
-  bgi_last_arc.xstart = x + (xradius * cos (stangle * PI_CONV));
-  bgi_last_arc.ystart = y - (yradius * sin (stangle * PI_CONV));
-  bgi_last_arc.xend = x + (xradius * cos (endangle * PI_CONV));
-  bgi_last_arc.yend = y - (yradius * sin (endangle * PI_CONV));
-
-  for (angle = stangle; angle < endangle; angle++)
-    line_fast (x + (xradius * cos (angle * PI_CONV)),
-               y - (yradius * sin (angle * PI_CONV)),
-               x + (xradius * cos ((angle+1) * PI_CONV)),
-               y - (yradius * sin ((angle+1) * PI_CONV)));
-  line_fast (x, y, bgi_last_arc.xstart, bgi_last_arc.ystart);
-  line_fast (x, y, bgi_last_arc.xend, bgi_last_arc.yend);
+  // SDL makes a new window surface when the window is resized, and
+  // frees the old one in SDL_GetWindowSurface (): move page 0 out
+  // of it before that
+  if (bgi_win_alias[w]) {
+    SDL_GetWindowSize (bgi_win[w], &width, &height);
+    if (width != bgi_win_maxx[w] + 1 || height != bgi_win_maxy[w] + 1) {
+      memcpy (bgi_vpage[0]->pixels, bgi_win_alias[w], size);
+      snap_forget (bgi_vpage[0]->pixels);
+      bgi_win_alias[w] = NULL;
+    }
+  }
 
-  tmpcolor = bgi_fg_color;
-  setcolor (bgi_fill_style.color);
-  angle = (stangle + endangle) / 2;
-  // find a point within the sector
-  floodfill (x + (xradius * cos (angle * PI_CONV)) / 2,
-             y - (yradius * sin (angle * PI_CONV)) / 2,
-             tmpcolor);
+  // shared pages must stay where consumers can see them
+  if (0 == bgi_ap && 0 == bgi_vp && w != bgi_shm_window &&
+      RING_OFF == bgi_default_ctx.ring_mode &&
+      LAYOUT_ROWS == bgi_win_layout[w] && NULL == bgi_layers[w] &&
+      NULL == bgi_sprite_list[w] && NULL == bgi_canvas[w])
+    alias = YEAH;
+
+  if (alias || bgi_win_alias[w])
+    surface = SDL_GetWindowSurface (bgi_win[w]);
+
+  // a surface made again for another reason: the old pixels are
+  // already gone
+  if (bgi_win_alias[w] && surface && surface->pixels != bgi_win_alias[w])
+    bgi_win_alias[w] = NULL;
+
+  if (alias)
+    alias = (NULL != surface &&
+             surface_is_argb (surface) &&
+             ! SDL_MUSTLOCK (surface) &&
+             surface->pitch == (bgi_win_maxx[w] + 1) * sizeof (Uint32) &&
+             surface->h == bgi_win_maxy[w] + 1);
+
+  if (alias && NULL == bgi_win_alias[w]) {
+    // move page 0 into the window surface
+    memcpy (surface->pixels, bgi_vpage[0]->pixels, size);
+    snap_forget (surface->pixels);
+    bgi_win_alias[w] = surface->pixels;
+  }
+  else
+    if (! alias && NULL != bgi_win_alias[w]) {
+      // move page 0 back into its buffer
+      memcpy (bgi_vpage[0]->pixels, bgi_win_alias[w], size);
+      snap_forget (bgi_vpage[0]->pixels);
+      bgi_win_alias[w] = NULL;
+    }
 
-  update ();
+  bgi_activepage[w] = (0 == bgi_ap && bgi_win_alias[w]) ?
+    bgi_win_alias[w] : bgi_vpage[bgi_ap]->pixels;
+  bgi_visualpage[w] = (0 == bgi_vp && bgi_win_alias[w]) ?
+    bgi_win_alias[w] : bgi_vpage[bgi_vp]->pixels;
 
-} // sector ()
+} // alias_window_surface ()
 
 // -----
 
@@ -3699,12 +11219,18 @@ void setactivepage (int page)
 {
   // Makes 'page' the active page for all subsequent graphics output.
 
+  RECORD (setactivepage (page), REC_SETACTIVEPAGE, page);
+
   if (! bgi_fast_mode)
     bgi_blendmode = SDL_BLENDMODE_NONE; // like in Turbo C
 
   if (page > -1 && page < bgi_np + 1) {
+    if (page != bgi_ap)
+      drop_page_ring ();
     bgi_ap = page;
     bgi_activepage[current_window] = bgi_vpage[bgi_ap]->pixels;
+    alias_window_surface ();
+    bind_default_context ();
   }
 
 } // setactivepage ()
@@ -3717,6 +11243,9 @@ void setallpalette (struct palettetype *palette)
 
   int i;
 
+  RECORD (setallpalette (palette), REC_SETALLPALETTE,
+          palette, (int) sizeof (struct palettetype));
+
   for (i = 0; i <= MAXCOLORS; i++)
     if (palette->colors[i] != -1)
       setpalette (i, palette->colors[i]);
@@ -3731,18 +11260,20 @@ void setalpha (int col, Uint8 alpha)
 
   Uint32 tmp;
 
+  RECORD (setalpha (col, alpha), REC_SETALPHA, col, (int) alpha);
+
   // COLOR () set up the WHITE + 1 color
   if (-1 == col) {
-    bgi_argb_mode = YEAH;
-    bgi_fg_color = WHITE + 1;
+    bgi_ctx->argb_mode = YEAH;
+    bgi_ctx->fg_color = WHITE + 1;
   }
   else {
-    bgi_argb_mode = NOPE;
-    bgi_fg_color = col;
+    bgi_ctx->argb_mode = NOPE;
+    bgi_ctx->fg_color = col;
   }
-  tmp = palette[bgi_fg_color] << 8; // get rid of alpha
+  tmp = bgi_ctx->palette[bgi_ctx->fg_color] << 8; // get rid of alpha
   tmp = tmp >> 8;
-  palette[bgi_fg_color] = ((Uint32)alpha << 24) | tmp;
+  bgi_ctx->palette[bgi_ctx->fg_color] = ((Uint32)alpha << 24) | tmp;
 
 } // setalpha ()
 
@@ -3759,19 +11290,34 @@ void setaspectratio (int xasp, int yasp)
 
 // -----
 
+void setbackend (int backend)
+{
+  // Selects how windows created afterwards present their pages:
+  // RENDERER_BACKEND (the default) or SURFACE_BACKEND. The
+  // SDL_BGI_BACKEND environment variable takes precedence.
+
+  if (RENDERER_BACKEND == backend || SURFACE_BACKEND == backend)
+    bgi_backend = backend;
+
+} // setbackend ()
+
+// -----
+
 void setbkcolor (int col)
 {
   // Sets the current background color using the default palette.
 
+  RECORD (setbkcolor (col), REC_SETBKCOLOR, col);
+
   // COLOR () set up the BGI_COLORS + 2 color
   if (-1 == col) {
-    bgi_argb_mode = YEAH;
-    bgi_bg_color = BGI_COLORS + 2;
-    palette[bgi_bg_color] = bgi_tmp_color_argb;
+    bgi_ctx->argb_mode = YEAH;
+    bgi_ctx->bg_color = BGI_COLORS + 2;
+    bgi_ctx->palette[bgi_ctx->bg_color] = bgi_tmp_color_argb;
   }
   else {
-    bgi_argb_mode = NOPE;
-    bgi_bg_color = col;
+    bgi_ctx->argb_mode = NOPE;
+    bgi_ctx->bg_color = col;
   }
 
 } // setbkcolor ()
@@ -3783,7 +11329,9 @@ void setbkrgbcolor (int index)
   // Sets the current background color using using the
   // n-th color index in the ARGB palette.
 
-  bgi_bg_color = BGI_COLORS + TMP_COLORS + index;
+  RECORD (setbkrgbcolor (index), REC_SETBKRGBCOLOR, index);
+
+  bgi_ctx->bg_color = BGI_COLORS + TMP_COLORS + index;
 
 } // setbkrgbcolor ()
 
@@ -3793,6 +11341,8 @@ void setblendmode (int blendmode)
 {
   // Sets the blending mode; SDL_BLENDMODE_NONE or SDL_BLENDMODE_BLEND
 
+  RECORD (setblendmode (blendmode), REC_SETBLENDMODE, blendmode);
+
   bgi_blendmode = blendmode;
 
 } // setblendmode ()
@@ -3803,15 +11353,17 @@ void setcolor (int col)
 {
   // Sets the current drawing color using the default palette.
 
+  RECORD (setcolor (col), REC_SETCOLOR, col);
+
   // COLOR () set up the BGI_COLORS + 1 color
   if (-1 == col) {
-    bgi_argb_mode = YEAH;
-    bgi_fg_color = TMP_FG_COL;
-    palette[bgi_fg_color] = bgi_tmp_color_argb;
+    bgi_ctx->argb_mode = YEAH;
+    bgi_ctx->fg_color = TMP_FG_COL;
+    bgi_ctx->palette[bgi_ctx->fg_color] = bgi_tmp_color_argb;
   }
   else {
-    bgi_argb_mode = NOPE;
-    bgi_fg_color = col;
+    bgi_ctx->argb_mode = NOPE;
+    bgi_ctx->fg_color = col;
   }
 
 } // setcolor ()
@@ -3822,21 +11374,28 @@ void setcurrentwindow (int id)
 {
   // Sets the current window.
 
+  RECORD (setcurrentwindow (id), REC_SETCURRENTWINDOW, id);
+
   if (NOPE == active_windows[id]) {
     fprintf (stderr, "Window %d does not exist.\n", id);
     return;
   }
 
+  // pending damage, and the ring, belong to the old window
+  if (update_mutex)
+    lock_update ();
+  if (id != current_window)
+    drop_page_ring ();
+  flush_damage ();
   current_window = id;
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
   bgi_window = bgi_win[current_window];
   bgi_renderer = bgi_rnd[current_window];
   bgi_texture = bgi_txt[current_window];
 
-  // get current window size
-  SDL_GetWindowSize (bgi_window, &bgi_maxx, &bgi_maxy);
-
-  bgi_maxx--;
-  bgi_maxy--;
+  bind_default_context ();
 
 } // setcurrentwindow ()
 
@@ -3865,22 +11424,25 @@ void setfillpattern (char *upattern, int color)
 
   int i;
 
+  RECORD (setfillpattern (upattern, color), REC_SETFILLPATTERN,
+          upattern, 8, color);
+
   for (i = 0; i < 8; i++)
-    fill_patterns[USER_FILL][i] = mirror_bits ((Uint8) *upattern++);
+    bgi_ctx->fill_patterns[USER_FILL][i] = mirror_bits ((Uint8) *upattern++);
 
   // COLOR () set up the BGI_COLORS + 3 color
   if (-1 == color) {
-    bgi_argb_mode = YEAH;
-    bgi_fill_color = BGI_COLORS + 3;
-    palette[bgi_fill_color] = bgi_tmp_color_argb;
-    bgi_fill_style.color = bgi_fill_color;
+    bgi_ctx->argb_mode = YEAH;
+    bgi_ctx->fill_color = BGI_COLORS + 3;
+    bgi_ctx->palette[bgi_ctx->fill_color] = bgi_tmp_color_argb;
+    bgi_ctx->fill_style.color = bgi_ctx->fill_color;
   }
   else {
-    bgi_argb_mode = NOPE;
-    bgi_fill_style.color = color;
+    bgi_ctx->argb_mode = NOPE;
+    bgi_ctx->fill_style.color = color;
   }
 
-  bgi_fill_style.pattern = USER_FILL;
+  bgi_ctx->fill_style.pattern = USER_FILL;
 
 } // setfillpattern ()
 
@@ -3890,18 +11452,21 @@ void setfillstyle (int pattern, int color)
 {
   // Sets the fill pattern and fill color.
 
-  bgi_fill_style.pattern = pattern;
+  RECORD (setfillstyle (pattern, color), REC_SETFILLSTYLE,
+          pattern, color);
+
+  bgi_ctx->fill_style.pattern = pattern;
 
   // COLOR () set up the temporary fill colour
   if (-1 == color) {
-    bgi_argb_mode = YEAH;
-    bgi_fill_color = TMP_FILL_COL - 1;
-    palette[bgi_fill_color] = bgi_tmp_color_argb;
-    bgi_fill_style.color = bgi_fill_color;
+    bgi_ctx->argb_mode = YEAH;
+    bgi_ctx->fill_color = TMP_FILL_COL - 1;
+    bgi_ctx->palette[bgi_ctx->fill_color] = bgi_tmp_color_argb;
+    bgi_ctx->fill_style.color = bgi_ctx->fill_color;
   }
   else {
-    bgi_argb_mode = NOPE;
-    bgi_fill_style.color = color;
+    bgi_ctx->argb_mode = NOPE;
+    bgi_ctx->fill_style.color = color;
   }
 
 } // setfillstyle ()
@@ -3912,10 +11477,41 @@ void setgraphmode (int mode)
 {
   // Shows the window that was hidden by restorecrtmode ().
 
-  SDL_ShowWindow (bgi_win[current_window]);
-  window_is_hidden = NOPE;
+  SDL_ShowWindow (bgi_win[current_window]);
+  window_is_hidden = NOPE;
+
+} // setgraphmode ()
+
+// -----
+
+void setimagecache (int megabytes)
+{
+  // Sets the memory budget of the readimagefile () cache, in
+  // megabytes; 0 disables the cache. The SDL_BGI_IMAGE_CACHE
+  // environment variable takes precedence.
+
+  if (megabytes < 0)
+    return;
+
+  bgi_image_budget = (size_t) megabytes << 20;
+  image_flush (bgi_image_budget);
+
+} // setimagecache ()
+
+// -----
+
+void setimagefilter (int filter)
+{
+  // Sets the filter used by readimagefile () to resize bitmaps:
+  // NEAREST_FILTER (the default), BILINEAR_FILTER, or BOX_FILTER.
+
+  RECORD (setimagefilter (filter), REC_SETIMAGEFILTER, filter);
 
-} // setgraphmode ()
+  if (NEAREST_FILTER == filter || BILINEAR_FILTER == filter ||
+      BOX_FILTER == filter)
+    bgi_ctx->image_filter = filter;
+
+} // setimagefilter ()
 
 // -----
 
@@ -3924,19 +11520,118 @@ void setlinestyle (int linestyle, unsigned upattern, int thickness)
   // Sets the line width and style for all lines drawn by line(),
   // lineto(), rectangle(), drawpoly(), etc.
 
-  bgi_line_style.linestyle = linestyle;
-  line_patterns[USERBIT_LINE] = bgi_line_style.upattern = upattern;
-  bgi_line_style.thickness = thickness;
+  RECORD (setlinestyle (linestyle, upattern, thickness),
+          REC_SETLINESTYLE, linestyle, (int) upattern, thickness);
+
+  bgi_ctx->line_style.linestyle = linestyle;
+  bgi_ctx->line_patterns[USERBIT_LINE] =
+    bgi_ctx->line_style.upattern = upattern;
+  bgi_ctx->line_style.thickness = thickness;
 
 } // setlinestyle ()
 
 // -----
 
+void setpagelayout (int layout)
+{
+  // Stores the pages of the current window in rows (LAYOUT_ROWS),
+  // or in tiles of PAGE_TILE x PAGE_TILE pixels (LAYOUT_TILES), so
+  // that drawing that goes down the page touches fewer cache lines
+  // and memory pages. Drawing functions work as usual; tiled pages
+  // are put back in rows when shown.
+
+  int
+    w = current_window,
+    size, stride,
+    x, y, n;
+  size_t
+    offset;
+  Uint32
+    *pixels,
+    *tmp;
+
+  RECORD (setpagelayout (layout), REC_SETPAGELAYOUT, layout);
+
+  if (current_window < 0 || NOPE == active_windows[current_window])
+    return;
+
+  if (LAYOUT_ROWS != layout && LAYOUT_TILES != layout) {
+    fprintf (stderr, "Invalid layout in setpagelayout().\n");
+    return;
+  }
+  if (layout == bgi_win_layout[w])
+    return;
+
+  // bgi_vpage[] only holds the pages of the newest window
+  for (int i = 0; i < NUM_BGI_WIN; i++)
+    if (i != w && YEAH == active_windows[i]) {
+      fprintf (stderr, "setpagelayout(): more than one window "
+               "is open.\n");
+      return;
+    }
+
+  // consumers of shared pages, and rings, expect rows
+  if (w == bgi_shm_window || RING_OFF != bgi_default_ctx.ring_mode) {
+    fprintf (stderr, "setpagelayout(): the pages are shared, "
+             "or have a ring viewport.\n");
+    return;
+  }
+
+  stride = bgi_win_maxx[w] + 1;
+  size = stride * (bgi_win_maxy[w] + 1);
+  tmp = malloc (size * sizeof (Uint32));
+  if (NULL == tmp) {
+    fprintf (stderr, "Can't allocate memory in setpagelayout().\n");
+    return;
+  }
+
+  if (update_mutex)
+    lock_update ();
+
+  // page 0 leaves the window surface first; offsets are computed
+  // as in the tiled layout, both ways
+  bgi_win_layout[w] = LAYOUT_TILES;
+  alias_window_surface ();
+  bind_default_context ();
+
+  for (int page = 0; page < VPAGES; page++) {
+    if (NULL == bgi_vpage[page])
+      continue;
+    pixels = bgi_vpage[page]->pixels;
+    memcpy (tmp, pixels, size * sizeof (Uint32));
+    for (y = 0; y <= bgi_win_maxy[w]; y++)
+      for (x = 0; x < stride; x += n) {
+        n = ring_run (&bgi_default_ctx, x, stride - 1, y, &offset);
+        if (LAYOUT_TILES == layout)
+          memcpy (pixels + offset, tmp + y * stride + x,
+                  n * sizeof (Uint32));
+        else
+          memcpy (pixels + y * stride + x, tmp + offset,
+                  n * sizeof (Uint32));
+      }
+  }
+
+  bgi_win_layout[w] = layout;
+  alias_window_surface ();
+  bind_default_context ();
+
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  free (tmp);
+
+} // setpagelayout ()
+
+// -----
+
 void setpalette (int colornum, int color)
 {
   // Changes the standard palette colornum to color.
 
-  palette[colornum] = bgi_palette[color];
+  RECORD (setpalette (colornum, color), REC_SETPALETTE,
+          colornum, color);
+
+  bgi_ctx->palette[colornum] = bgi_palette[color];
 
 } // setpalette ()
 
@@ -3947,7 +11642,9 @@ void setrgbcolor (int index)
   // Sets the current drawing color using the n-th color index
   // in the ARGB palette.
 
-  bgi_fg_color = BGI_COLORS + TMP_COLORS + index;
+  RECORD (setrgbcolor (index), REC_SETRGBCOLOR, index);
+
+  bgi_ctx->fg_color = BGI_COLORS + TMP_COLORS + index;
 
 } // setrgbcolor ()
 
@@ -3958,19 +11655,111 @@ void setrgbpalette (int colornum, int red, int green, int blue)
   // Sets the n-th entry in the ARGB palette specifying the r, g,
   // and b components.
 
-  palette[BGI_COLORS + TMP_COLORS + colornum] =
+  RECORD (setrgbpalette (colornum, red, green, blue),
+          REC_SETRGBPALETTE, colornum, red, green, blue);
+
+  bgi_ctx->palette[BGI_COLORS + TMP_COLORS + colornum] =
     0xff000000 | red << 16 | green << 8 | blue;
 
 } // setrgbpalette ()
 
 // -----
 
+void setringviewport (int mode)
+{
+  // Makes the current viewport a ring of columns (RING_COLUMNS) or
+  // rows (RING_ROWS), to be scrolled by scrollring (); RING_OFF
+  // turns it back into plain pixels. Only one ring per context.
+
+  struct bgi_context
+    *c = bgi_ctx;
+
+  RECORD (setringviewport (mode), REC_SETRINGVIEWPORT, mode);
+
+  if (LAYOUT_TILES == c->layout && RING_OFF != mode) {
+    fprintf (stderr, "setringviewport(): the pages are tiled.\n");
+    return;
+  }
+
+  // putimage () and createsprite () read bitmaps in rows
+  if (RING_OFF != mode && c->buffer && c == bitmap_context (c->buffer)) {
+    fprintf (stderr, "setringviewport(): the target is a bitmap.\n");
+    return;
+  }
+
+  // the ring is shown on the visual page
+  if (&bgi_default_ctx == c && bgi_ap != bgi_vp && RING_OFF != mode) {
+    fprintf (stderr, "setringviewport(): the active page "
+             "is not visible.\n");
+    return;
+  }
+
+  // other processes read shared pages in rows
+  if (bgi_shm && RING_OFF != mode &&
+      (Uint8 *) c->pixels >= (Uint8 *) bgi_shm &&
+      (Uint8 *) c->pixels < (Uint8 *) bgi_shm + bgi_shm_size) {
+    fprintf (stderr, "setringviewport(): the pages are shared.\n");
+    return;
+  }
+
+  ring_unroll ();
+  c->ring_mode = RING_OFF;
+
+  if (RING_COLUMNS == mode || RING_ROWS == mode) {
+    c->ring = c->vp;
+    if (c->ring.right > c->maxx)
+      c->ring.right = c->maxx;
+    if (c->ring.bottom > c->maxy)
+      c->ring.bottom = c->maxy;
+    if (c->ring.left <= c->ring.right && c->ring.top <= c->ring.bottom)
+      c->ring_mode = mode;
+  }
+
+  // page 0 can't be the window surface, which has no ring
+  if (&bgi_default_ctx == c) {
+    alias_window_surface ();
+    bind_default_context ();
+  }
+
+} // setringviewport ()
+
+// -----
+
+void setsharedpages (const char *name)
+{
+  // Makes the next window create its pages in the POSIX shared
+  // memory object 'name' (e.g. "/sdlbgi"), which other processes
+  // can map; see bgi_shm_header. NULL or "" turn sharing off. The
+  // SDL_BGI_SHM environment variable takes precedence.
+
+  if (NULL == name)
+    name = "";
+
+  if (NULL != bgi_shm) {
+    fprintf (stderr, "Pages are already shared as %s.\n", bgi_shm_name);
+    return;
+  }
+
+  if (strlen (name) >= sizeof (bgi_shm_name)) {
+    fprintf (stderr, "Shared memory name too long.\n");
+    return;
+  }
+
+  strcpy (bgi_shm_name, name);
+
+} // setsharedpages ()
+
+// -----
+
 void settextjustify (int horiz, int vert)
 {
   // Sets text justification.
 
-  bgi_txt_style.horiz = horiz;
-  bgi_txt_style.vert = vert;
+  RECORD (settextjustify (horiz, vert), REC_SETTEXTJUSTIFY,
+          horiz, vert);
+
+  bgi_ctx->txt_style.horiz = horiz;
+  bgi_ctx->txt_style.vert = vert;
 
 } // settextjustify ()
 
@@ -3982,11 +11771,15 @@ void settextstyle (int font, int direction, int charsize)
   // the direction in which text is displayed (HORIZ DIR, VERT DIR),
   // and the size of the characters.
 
+  RECORD (settextstyle (font, direction, charsize),
+          REC_SETTEXTSTYLE, font, direction, charsize);
+
   if (VERT_DIR == direction)
-    bgi_txt_style.direction = VERT_DIR;
+    bgi_ctx->txt_style.direction = VERT_DIR;
   else
-    bgi_txt_style.direction = HORIZ_DIR;
-  bgi_txt_style.charsize = bgi_font_mag_x = bgi_font_mag_y = charsize;
+    bgi_ctx->txt_style.direction = HORIZ_DIR;
+  bgi_ctx->txt_style.charsize =
+    bgi_ctx->font_mag_x = bgi_ctx->font_mag_y = charsize;
 
 } // settextstyle ()
 
@@ -3996,8 +11789,11 @@ void setusercharsize (int multx, int divx, int multy, int divy)
 {
   // Lets the user change the character width and height.
 
-  bgi_font_mag_x = (float)multx / (float)divx;
-  bgi_font_mag_y = (float)multy / (float)divy;
+  RECORD (setusercharsize (multx, divx, multy, divy),
+          REC_SETUSERCHARSIZE, multx, divx, multy, divy);
+
+  bgi_ctx->font_mag_x = (float)multx / (float)divx;
+  bgi_ctx->font_mag_y = (float)multy / (float)divy;
 
 } // setusercharsize ()
 
@@ -4007,16 +11803,20 @@ void setviewport (int left, int top, int right, int bottom, int clip)
 {
   // Sets the current viewport for graphics output.
 
-  if (left < 0 || right > bgi_maxx || top < 0 || bottom > bgi_maxy)
+  RECORD (setviewport (left, top, right, bottom, clip),
+          REC_SETVIEWPORT, left, top, right, bottom, clip);
+
+  if (left < 0 || right > bgi_ctx->maxx ||
+      top < 0 || bottom > bgi_ctx->maxy)
     return;
 
-  vp.left = left;
-  vp.top = top;
-  vp.right = right;
-  vp.bottom = bottom;
-  vp.clip = clip;
-  bgi_cp_x = 0;
-  bgi_cp_y = 0;
+  bgi_ctx->vp.left = left;
+  bgi_ctx->vp.top = top;
+  bgi_ctx->vp.right = right;
+  bgi_ctx->vp.bottom = bottom;
+  bgi_ctx->vp.clip = clip;
+  bgi_ctx->cp_x = 0;
+  bgi_ctx->cp_y = 0;
 
 } // setviewport ()
 
@@ -4026,9 +11826,15 @@ void setvisualpage (int page)
 {
   // Sets the visual graphics page number.
 
+  RECORD (setvisualpage (page), REC_SETVISUALPAGE, page);
+
   if (page > -1 && page < bgi_np + 1) {
+    if (page != bgi_vp)
+      drop_page_ring ();
     bgi_vp = page;
     bgi_visualpage[current_window] = bgi_vpage[bgi_vp]->pixels;
+    alias_window_surface ();
+    bind_default_context ();
   }
 
   update ();
@@ -4037,6 +11843,22 @@ void setvisualpage (int page)
 
 // -----
 
+void setvsync (int on)
+{
+  // Makes swapbuffers() wait for the display refresh.
+
+  bgi_vsync = on ? YEAH : NOPE;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  for (int i = 0; i < NUM_BGI_WIN; i++)
+    if (YEAH == active_windows[i] && bgi_rnd[i])
+      SDL_RenderSetVSync (bgi_rnd[i], bgi_vsync);
+#endif
+
+} // setvsync ()
+
+// -----
+
 void setwinoptions (char *title, int x, int y, Uint32 flags)
 {
   if (strlen (title) > BGI_WINTITLE_LEN) {
@@ -4069,14 +11891,168 @@ void setwinoptions (char *title, int x, int y, Uint32 flags)
 void setwritemode (int mode)
 {
   // Sets the writing mode for line drawing. 'mode' can be COPY PUT,
-  // XOR PUT, OR PUT, AND PUT, and NOT PUT.
+  // XOR PUT, OR PUT, AND PUT, NOT PUT, and ALPHA PUT, which also
+  // applies to fills.
 
-  bgi_writemode = mode;
+  RECORD (setwritemode (mode), REC_SETWRITEMODE, mode);
+
+  bgi_ctx->writemode = mode;
 
 } // setwritemode ()
 
 // -----
 
+// shadeviewport () cuts the viewport into SHADE_TILE x SHADE_TILE
+// tiles, one task each. Tasks are started row by row; a row of
+// tiles is shown as soon as it and all rows above are finished, so
+// that nothing is read while being written.
+
+#define SHADE_TILE 64
+
+typedef struct {
+  bgi_shader shader;
+  void *userdata;
+  const struct bgi_context *ctx;
+  int left, top, width, height; // shaded area, absolute
+  int vpx, vpy;                 // viewport origin
+  int cols, rows;               // tiles per row and column
+  SDL_SpinLock lock;            // protects 'done'
+  int *done;                    // finished tiles in each row
+  int shown;                    // rows of tiles shown so far
+  Uint32 ticks;                 // time of the last refresh
+} ShadeJob;
+
+// -----
+
+static void shade_task (void *arg, int task)
+{
+  // runs the shader on one tile
+
+  ShadeJob
+    *job = arg;
+  const struct bgi_context
+    *c = job->ctx;
+  int
+    x = job->left + (task % job->cols) * SHADE_TILE,
+    y = job->top + (task / job->cols) * SHADE_TILE,
+    w = job->left + job->width - x,
+    h = job->top + job->height - y;
+  Uint32
+    tile[SHADE_TILE * SHADE_TILE];
+
+  if (w > SHADE_TILE)
+    w = SHADE_TILE;
+  if (h > SHADE_TILE)
+    h = SHADE_TILE;
+
+  if (LAYOUT_ROWS == c->layout && RING_OFF == c->ring_mode)
+    job->shader (c->pixels + y * (c->maxx + 1) + x, c->maxx + 1,
+                 x - job->vpx, y - job->vpy, w, h, job->userdata);
+  else {
+    // the shader gets the tile in rows, then it is stored back
+    for (int i = 0; i < h; i++)
+      load_row (c, c->pixels, tile + i * w, x, x + w - 1, y + i);
+    job->shader (tile, w, x - job->vpx, y - job->vpy, w, h,
+                 job->userdata);
+    for (int i = 0; i < h; i++)
+      save_row (c, tile + i * w, x, x + w - 1, y + i);
+  }
+
+  SDL_AtomicLock (&job->lock);
+  job->done[task / job->cols]++;
+  SDL_AtomicUnlock (&job->lock);
+
+} // shade_task ()
+
+// -----
+
+static void shade_progress (void *arg)
+{
+  // shows the rows of tiles finished so far, at most every
+  // PROGRESS_MS
+
+  ShadeJob
+    *job = arg;
+  int
+    first = job->shown,
+    y1, y2;
+
+  if (SDL_GetTicks () - job->ticks < PROGRESS_MS)
+    return;
+
+  SDL_AtomicLock (&job->lock);
+  while (job->shown < job->rows && job->cols == job->done[job->shown])
+    job->shown++;
+  SDL_AtomicUnlock (&job->lock);
+
+  if (job->shown > first) {
+    y1 = job->top + first * SHADE_TILE;
+    y2 = job->top + job->shown * SHADE_TILE - 1;
+    if (y2 > job->top + job->height - 1)
+      y2 = job->top + job->height - 1;
+    update_area (job->left, y1, job->left + job->width - 1, y2);
+  }
+  job->ticks = SDL_GetTicks ();
+
+} // shade_progress ()
+
+// -----
+
+void shadeviewport (bgi_shader shader, void *userdata)
+{
+  // Fills the viewport using all CPU cores. The viewport is cut
+  // into tiles, and shader (pixels, stride, x, y, width, height,
+  // userdata) is called once per tile: it must write the
+  // 0xAARRGGBB colours of the width x height tile whose top left
+  // corner is pixels[0], at viewport coordinates (x, y); rows are
+  // 'stride' pixels apart. Tiles are shaded by several threads at
+  // once, so the shader must not call drawing functions. In slow
+  // mode, finished tiles are shown while the others are shaded.
+
+  ShadeJob
+    job;
+
+  if (NULL == shader)
+    return;
+
+  job.shader = shader;
+  job.userdata = userdata;
+  job.ctx = bgi_ctx;
+  job.vpx = bgi_ctx->vp.left;
+  job.vpy = bgi_ctx->vp.top;
+  job.left = bgi_ctx->vp.left;
+  job.top = bgi_ctx->vp.top;
+  job.width = bgi_ctx->vp.right - bgi_ctx->vp.left + 1;
+  job.height = bgi_ctx->vp.bottom - bgi_ctx->vp.top + 1;
+  job.cols = (job.width + SHADE_TILE - 1) / SHADE_TILE;
+  job.rows = (job.height + SHADE_TILE - 1) / SHADE_TILE;
+  job.lock = 0;
+  job.shown = 0;
+  job.ticks = SDL_GetTicks ();
+  job.done = calloc (job.rows, sizeof (int));
+  if (NULL == job.done) {
+    fprintf (stderr, "Can't allocate tiles.\n");
+    return;
+  }
+  snap_touch (bgi_ctx, job.left, job.top,
+              bgi_ctx->vp.right, bgi_ctx->vp.bottom);
+
+  run_tasks (shade_task, &job, job.cols * job.rows,
+             (&bgi_default_ctx == bgi_ctx && ! bgi_fast_mode) ?
+             shade_progress : NULL);
+  free (job.done);
+
+  update_area (job.left, job.top,
+               bgi_ctx->vp.right, bgi_ctx->vp.bottom);
+
+  // the shader can't be recorded, its output can
+  record_blit (job.left, job.top,
+               bgi_ctx->vp.right, bgi_ctx->vp.bottom);
+
+} // shadeviewport ()
+
+// -----
+
 void showerrorbox (const char *message)
 {
   // Opens an error box
@@ -4088,14 +12064,191 @@ void showerrorbox (const char *message)
 
 // -----
 
+int startframeserver (const char *path)
+{
+  // Streams the current window to clients of the local socket
+  // 'path', or of the loopback TCP port n if 'path' is "tcp:n";
+  // see BGI_MSG_HELLO. Returns 0, or -1 on error.
+
+#ifdef BGI_HAVE_SOCKETS
+  struct sockaddr_un
+    addr_un;
+  struct sockaddr_in
+    addr_in;
+  struct sockaddr
+    *addr;
+  socklen_t
+    addr_len;
+  int
+    tcp = (0 == strncmp (path, "tcp:", 4));
+
+  if (YEAH == bgi_serve_running) {
+    fprintf (stderr, "The frame server is already running.\n");
+    return -1;
+  }
+  if (current_window < 0) {
+    fprintf (stderr, "startframeserver() needs a window.\n");
+    return -1;
+  }
+  if (strlen (path) >= sizeof (addr_un.sun_path)) {
+    fprintf (stderr, "Socket name too long.\n");
+    return -1;
+  }
+  strcpy (bgi_serve_path, path);
+
+  if (tcp) {
+    memset (&addr_in, 0, sizeof (addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_port = htons (atoi (path + 4));
+    addr_in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr = (struct sockaddr *) &addr_in;
+    addr_len = sizeof (addr_in);
+  }
+  else {
+    memset (&addr_un, 0, sizeof (addr_un));
+    addr_un.sun_family = AF_UNIX;
+    strcpy (addr_un.sun_path, path);
+    addr = (struct sockaddr *) &addr_un;
+    addr_len = sizeof (addr_un);
+    unlink (path); // left over by a previous run
+  }
+
+  bgi_serve_fd = socket (addr->sa_family, SOCK_STREAM, 0);
+  if (bgi_serve_fd >= 0 && tcp)
+    setsockopt (bgi_serve_fd, SOL_SOCKET, SO_REUSEADDR,
+                &(int) {1}, sizeof (int));
+  bgi_serve_w = bgi_win_maxx[current_window] + 1;
+  bgi_serve_h = bgi_win_maxy[current_window] + 1;
+  bgi_serve_frame = malloc (bgi_serve_w * bgi_serve_h * sizeof (Uint32));
+  if (bgi_serve_fd < 0 || NULL == bgi_serve_frame ||
+      bind (bgi_serve_fd, addr, addr_len) < 0 ||
+      listen (bgi_serve_fd, SERVE_MAX_CLIENTS) < 0 ||
+      pipe (bgi_serve_wake) < 0) {
+    SDL_Log ("Could not listen on %s: %s", path, strerror (errno));
+    if (bgi_serve_fd >= 0)
+      close (bgi_serve_fd);
+    bgi_serve_fd = -1;
+    free (bgi_serve_frame);
+    bgi_serve_frame = NULL;
+    return -1;
+  }
+
+  fcntl (bgi_serve_fd, F_SETFL, fcntl (bgi_serve_fd, F_GETFL) | O_NONBLOCK);
+  for (int i = 0; i < 2; i++)
+    fcntl (bgi_serve_wake[i], F_SETFL,
+           fcntl (bgi_serve_wake[i], F_GETFL) | O_NONBLOCK);
+
+  for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+    memset (&bgi_serve_clients[i], 0, sizeof (ServeClient));
+    bgi_serve_clients[i].fd = -1;
+  }
+  bgi_serve_window = current_window;
+  bgi_serve_window_id = SDL_GetWindowID (bgi_win[current_window]);
+  serve_copy (0, 0, bgi_serve_w - 1, bgi_serve_h - 1);
+  bgi_serve_x2 = bgi_serve_y2 = -1;
+  bgi_serve_running = YEAH;
+
+  bgi_serve_thread = SDL_CreateThread (serve_thread, "bgi_serve", NULL);
+  if (NULL == bgi_serve_thread) {
+    SDL_Log ("SDL_CreateThread() failed: %s", SDL_GetError ());
+    bgi_serve_running = NOPE;
+    stopframeserver ();
+    return -1;
+  }
+
+  return 0;
+#else
+  (void) path;
+  unimplemented ("startframeserver");
+  return -1;
+#endif
+
+} // startframeserver ()
+
+// -----
+
+void stopframeserver (void)
+{
+  // Disconnects all clients and closes the frame server socket.
+
+#ifdef BGI_HAVE_SOCKETS
+  if (-1 == bgi_serve_fd)
+    return;
+
+  bgi_serve_running = NOPE;
+  if (bgi_serve_thread) {
+    if (write (bgi_serve_wake[1], "", 1) < 0) {
+      // poll () times out anyway
+    }
+    SDL_WaitThread (bgi_serve_thread, NULL);
+    bgi_serve_thread = NULL;
+  }
+
+  for (int i = 0; i < SERVE_MAX_CLIENTS; i++)
+    if (-1 != bgi_serve_clients[i].fd)
+      serve_drop (&bgi_serve_clients[i]);
+  close (bgi_serve_wake[0]);
+  close (bgi_serve_wake[1]);
+  close (bgi_serve_fd);
+  bgi_serve_fd = -1;
+  if (0 != strncmp (bgi_serve_path, "tcp:", 4))
+    unlink (bgi_serve_path);
+  bgi_serve_window = -1;
+  free (bgi_serve_frame);
+  bgi_serve_frame = NULL;
+#endif
+
+} // stopframeserver ()
+
+// -----
+
 void swapbuffers (void)
 {
-  // Swaps current visual and active pages.
+  // Swaps current visual and active pages. Only the page pointers
+  // are exchanged; the new visual page is then presented once.
+
+  int
+    page;
+  Uint32
+    interval,
+    elapsed;
+
+  RECORD (swapbuffers (), REC_SWAPBUFFERS);
+
+  if (update_mutex)
+    lock_update ();
+
+  if (bgi_ap != bgi_vp)
+    drop_page_ring ();
+  page = bgi_vp;
+  bgi_vp = bgi_ap;
+  bgi_ap = page;
+  bgi_visualpage[current_window] = page_pixels (bgi_vp);
+  bgi_activepage[current_window] = page_pixels (bgi_ap);
+  alias_window_surface ();
+  bind_default_context ();
+
+  // a flip is shown at once, bypassing the present limiter
+  if (! bgi_fast_mode)
+    refresh_window ();
+  else
+    refresh_needed = YEAH;
+
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+  if (YEAH == bgi_vsync) {
+    // wait for the next display refresh; a renderer that honours
+    // SDL_RENDERER_PRESENTVSYNC has already waited
+    if (0 == refresh_rate)
+      refresh_rate = display_refresh_rate ();
+    interval = 1000 / refresh_rate;
+    elapsed = SDL_GetTicks () - bgi_last_flip;
+    if (elapsed < interval)
+      SDL_Delay (interval - elapsed);
+  }
 
-  int oldv = getvisualpage ();
-  int olda = getactivepage ();
-  setvisualpage (olda);
-  setactivepage (oldv);
+  bgi_last_flip = SDL_GetTicks ();
 
 } // swapbuffers ()
 
@@ -4105,7 +12258,7 @@ int textheight (char *textstring)
 {
   // Returns the height in pixels of a string.
 
-  return bgi_font_mag_y * bgi_font_height;
+  return bgi_ctx->font_mag_y * bgi_font_height;
 
 } // textheight ()
 
@@ -4115,29 +12268,83 @@ int textwidth (char *textstring)
 {
   // Returns the height in pixels of a string.
 
-  return (strlen (textstring) * bgi_font_width * bgi_font_mag_x);
+  return (strlen (textstring) * bgi_font_width * bgi_ctx->font_mag_x);
 
 } // textwidth ()
 
 // -----
 
+void unlockframebuffer (int left, int top, int right, int bottom)
+{
+  // Ends direct access started by lockframebuffer (). The screen
+  // is updated for the modified rectangle, in absolute coordinates.
+
+  if (left < 0)
+    left = 0;
+  if (top < 0)
+    top = 0;
+  if (right > bgi_ctx->maxx)
+    right = bgi_ctx->maxx;
+  if (bottom > bgi_ctx->maxy)
+    bottom = bgi_ctx->maxy;
+
+  snap_touch (bgi_ctx, 0, 0, bgi_ctx->maxx, bgi_ctx->maxy);
+
+  // a lent copy: only the modified rectangle goes back
+  if (bgi_ctx->staging) {
+    for (int y = top; left <= right && y <= bottom; y++)
+      save_row (bgi_ctx,
+                bgi_ctx->staging + (size_t) y * (bgi_ctx->maxx + 1) + left,
+                left, right, y);
+    free (bgi_ctx->staging);
+    bgi_ctx->staging = NULL;
+  }
+
+  if (&bgi_default_ctx != bgi_ctx)
+    return;
+
+  if (left <= right && top <= bottom) {
+    update_area (left, top, right, bottom);
+    record_blit (left, top, right, bottom);
+  }
+
+  if (update_mutex)
+    SDL_UnlockMutex (update_mutex);
+
+} // unlockframebuffer ()
+
+// -----
+
 void updaterect (int x1, int y1, int x2, int y2)
 {
   // Updates a rectangle on the screen. This version uses
   // texture streaming.
 
   int
-    x, y,
-    pitch = (bgi_maxx + 1) * sizeof (Uint32),
-    semipitch;
+    y, n,
+    stride = bgi_win_maxx[current_window] + 1,
+    pitch = stride * sizeof (Uint32);
   void
     *pixels;
+  Uint32
+    *shown;
   SDL_Rect
-    src_rect, dest_rect;
+    src_rect, dest_rect,
+    from[6], to[6];
 
   swap_if_greater (&x1, &x2);
   swap_if_greater (&y1, &y2);
 
+  TRACE_BEGIN ("updaterect");
+
+  if (SURFACE_BACKEND == bgi_win_backend[current_window]) {
+    updaterect_surface (x1, y1, x2, y2);
+    shm_pages_present ();
+    serve_damage (x1, y1, x2, y2);
+    TRACE_END ("updaterect");
+    return;
+  }
+
   src_rect.x = x1;
   src_rect.y = y1;
   src_rect.w = x2 - x1 + 1;
@@ -4156,17 +12363,23 @@ void updaterect (int x1, int y1, int x2, int y2)
 
   // whole texture:
   /* memcpy (pixels, bgi_visualpage[current_window], */
-  /* 	  pitch * (bgi_maxy + 1)); */
-
-  x = x1;
-  semipitch = x * sizeof (Uint32);
-
-  // copy pixel data from bgi_visualpage
-  for (y = y1; y < y2 + 1; y++)
-    memcpy (pixels + y * pitch + semipitch,
-	    (void *) bgi_visualpage[current_window] +
-	    pitch * y + semipitch,
-	    (x2 - x1 + 1) * sizeof (Uint32));
+  /* 	  pitch * (bgi_win_maxy[current_window] + 1)); */
+
+  // copy pixel data from bgi_visualpage, in pieces if a ring
+  // viewport is stored out of order, or blended with the layers
+  shown = compose_rect (x1, y1, x2, y2);
+  n = shown ? 0 : ring_pieces (x1, y1, x2, y2, from, to);
+  for (y = y1; shown && y < y2 + 1; y++)
+    memcpy ((Uint8 *) pixels + y * pitch + x1 * sizeof (Uint32),
+            shown + (y - y1) * src_rect.w, src_rect.w * sizeof (Uint32));
+  free (shown);
+  for (int i = 0; i < n; i++)
+    for (y = 0; y < to[i].h; y++)
+      memcpy ((Uint8 *) pixels + (to[i].y + y) * pitch +
+              to[i].x * sizeof (Uint32),
+              bgi_visualpage[current_window] +
+              (from[i].y + y) * stride + from[i].x,
+              to[i].w * sizeof (Uint32));
 
   SDL_UnlockTexture (bgi_txt[current_window]);
   if (0 != SDL_SetTextureBlendMode
@@ -4182,18 +12395,141 @@ void updaterect (int x1, int y1, int x2, int y2)
     showerrorbox ("SDL_RenderCopy() failed");
   }
   SDL_RenderPresent (bgi_rnd[current_window]);
+  shm_pages_present ();
+  serve_damage (x1, y1, x2, y2);
+
+  TRACE_END ("updaterect");
 
 } // updaterect()
 
 // -----
 
+static int surface_is_argb (SDL_Surface *surface)
+{
+  // Returns YEAH if surface pixels have the same layout as pages.
+
+  return (SDL_PIXELFORMAT_ARGB8888 == surface->format->format ||
+          SDL_PIXELFORMAT_RGB888 == surface->format->format);
+
+} // surface_is_argb ()
+
+// -----
+
+static void updaterect_surface (int x1, int y1, int x2, int y2)
+{
+  // Updates a rectangle on the screen. This version copies the
+  // visual page to the window surface, unless page 0 is aliased
+  // to it, and pushes the rectangle only.
+
+  int
+    y, n,
+    stride = bgi_win_maxx[current_window] + 1;
+  Uint32
+    *page,
+    *shown;
+  SDL_Surface
+    *surface,
+    *tmp;
+  SDL_Rect
+    rect,
+    from[6], to[6];
+
+  // SDL may have replaced the surface that page 0 lives in
+  if (bgi_win_alias[current_window]) {
+    alias_window_surface ();
+    bind_default_context ();
+  }
+  page = bgi_visualpage[current_window];
+
+  surface = SDL_GetWindowSurface (bgi_win[current_window]);
+  if (NULL == surface) {
+    SDL_Log ("SDL_GetWindowSurface() failed: %s", SDL_GetError ());
+    return;
+  }
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 > surface->w - 1)
+    x2 = surface->w - 1;
+  if (y2 > surface->h - 1)
+    y2 = surface->h - 1;
+  if (x1 > x2 || y1 > y2)
+    return;
+
+  rect.x = x1;
+  rect.y = y1;
+  rect.w = x2 - x1 + 1;
+  rect.h = y2 - y1 + 1;
+
+  // a ring viewport is copied in pieces; with layers, what is shown
+  // is composed first, and copied as a whole
+  shown = compose_rect (x1, y1, x2, y2);
+  if (shown) {
+    from[0] = to[0] = rect;
+    from[0].x = from[0].y = 0;
+    page = shown;
+    stride = rect.w;
+    n = 1;
+  }
+  else
+    n = ring_pieces (x1, y1, x2, y2, from, to);
+
+  if (page != surface->pixels) {
+    if (surface_is_argb (surface)) {
+      if (SDL_MUSTLOCK (surface))
+        SDL_LockSurface (surface);
+      for (int i = 0; i < n; i++)
+        for (y = 0; y < to[i].h; y++)
+          memcpy ((Uint8 *) surface->pixels +
+                  (to[i].y + y) * surface->pitch +
+                  to[i].x * sizeof (Uint32),
+                  page + (from[i].y + y) * stride + from[i].x,
+                  to[i].w * sizeof (Uint32));
+      if (SDL_MUSTLOCK (surface))
+        SDL_UnlockSurface (surface);
+    }
+    else { // let SDL convert the pixels
+      tmp = SDL_CreateRGBSurfaceFrom (page, stride,
+                                      shown ? rect.h :
+                                      bgi_win_maxy[current_window] + 1,
+                                      32, stride * sizeof (Uint32),
+                                      0x00ff0000, 0x0000ff00,
+                                      0x000000ff, 0);
+      if (NULL == tmp) {
+        SDL_Log ("SDL_CreateRGBSurfaceFrom() failed: %s",
+                 SDL_GetError ());
+        free (shown);
+        return;
+      }
+      for (int i = 0; i < n; i++)
+        SDL_BlitSurface (tmp, &from[i], surface, &to[i]);
+      SDL_FreeSurface (tmp);
+    }
+  }
+  free (shown);
+
+  if (0 != SDL_UpdateWindowSurfaceRects (bgi_win[current_window],
+                                         &rect, 1))
+    SDL_Log ("SDL_UpdateWindowSurfaceRects() failed: %s",
+             SDL_GetError ());
+
+} // updaterect_surface ()
+
+// -----
+
 void writeimagefile (char *filename,
                      int left, int top, int right, int bottom)
 {
   // Writes a .bmp file from the screen rectangle
   // defined by left, top, right, bottom.
 
+  Uint32
+    *pixels = bgi_ctx->pixels,
+    *shown = NULL;
   SDL_Surface
+    *src,
     *dest;
   SDL_Rect
     rect;
@@ -4204,30 +12540,89 @@ void writeimagefile (char *filename,
   rect.h = bottom - top + 1;
 
   // the user specified a range larger than the viewport
-  if (rect.w > (vp.right - vp.left + 1))
-    rect.w = vp.right - vp.left + 1;
-  if (rect.h > (vp.bottom - vp.top + 1))
-    rect.h = vp.bottom - vp.top + 1;
+  if (rect.w > (bgi_ctx->vp.right - bgi_ctx->vp.left + 1))
+    rect.w = bgi_ctx->vp.right - bgi_ctx->vp.left + 1;
+  if (rect.h > (bgi_ctx->vp.bottom - bgi_ctx->vp.top + 1))
+    rect.h = bgi_ctx->vp.bottom - bgi_ctx->vp.top + 1;
+
+  TRACE_BEGIN ("writeimagefile");
 
   dest = SDL_CreateRGBSurface (0, rect.w, rect.h, 32, 0, 0, 0, 0);
   if (NULL == dest) {
     SDL_Log ("SDL_CreateRGBSurface() failed: %s", SDL_GetError ());
     showerrorbox ("SDL_CreateRGBSurface() failed");
+    TRACE_END ("writeimagefile");
     return;
   }
 
-  SDL_RenderReadPixels (bgi_rnd[current_window],
-                        NULL,
-                        SDL_GetWindowPixelFormat (bgi_win[current_window]),
-                        bgi_vpage[bgi_vp]->pixels,
-                        bgi_vpage[bgi_vp]->pitch);
-  // blit and save
-  SDL_BlitSurface (bgi_vpage[bgi_vp], &rect, dest, NULL);
+  // the surface backend has no renderer to read from, but the
+  // visual page holds what is on screen
+  if (&bgi_default_ctx == bgi_ctx &&
+      SURFACE_BACKEND == bgi_win_backend[current_window])
+    pixels = bgi_visualpage[current_window];
+
+  // a tiled page, or a ring the renderer does not put in order,
+  // is saved as it is shown
+  if (LAYOUT_TILES == bgi_ctx->layout ||
+      (RING_OFF != bgi_ctx->ring_mode &&
+       (&bgi_default_ctx != bgi_ctx ||
+        SURFACE_BACKEND == bgi_win_backend[current_window]))) {
+    if (&bgi_default_ctx == bgi_ctx)
+      shown = compose_rect (0, 0, bgi_ctx->maxx, bgi_ctx->maxy);
+    if (NULL == shown) {
+      shown = malloc ((size_t) (bgi_ctx->maxx + 1) * (bgi_ctx->maxy + 1) *
+                      sizeof (Uint32));
+      for (int y = 0; shown && y <= bgi_ctx->maxy; y++)
+        load_row (bgi_ctx, pixels,
+                  shown + (size_t) y * (bgi_ctx->maxx + 1),
+                  0, bgi_ctx->maxx, y);
+    }
+    pixels = shown;
+    if (NULL == shown) {
+      fprintf (stderr, "Can't allocate memory in writeimagefile().\n");
+      SDL_FreeSurface (dest);
+      TRACE_END ("writeimagefile");
+      return;
+    }
+  }
+
+  if (&bgi_default_ctx != bgi_ctx || shown ||
+      SURFACE_BACKEND == bgi_win_backend[current_window]) {
+    // no renderer involved: save the pixels directly
+    src = SDL_CreateRGBSurfaceFrom (pixels,
+                                    bgi_ctx->maxx + 1, bgi_ctx->maxy + 1,
+                                    32,
+                                    (bgi_ctx->maxx + 1) * sizeof (Uint32),
+                                    0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+    if (NULL == src) {
+      SDL_Log ("SDL_CreateRGBSurfaceFrom() failed: %s", SDL_GetError ());
+      SDL_FreeSurface (dest);
+      free (shown);
+      TRACE_END ("writeimagefile");
+      return;
+    }
+    SDL_BlitSurface (src, &rect, dest, NULL);
+    SDL_FreeSurface (src);
+    free (shown);
+  }
+  else {
+    SDL_RenderReadPixels (bgi_rnd[current_window],
+                          NULL,
+                          SDL_GetWindowPixelFormat (bgi_win[current_window]),
+                          bgi_vpage[bgi_vp]->pixels,
+                          bgi_vpage[bgi_vp]->pitch);
+    // blit
+    SDL_BlitSurface (bgi_vpage[bgi_vp], &rect, dest, NULL);
+  }
+
+  // save
   SDL_SaveBMP (dest, filename);
 
   // free the stuff
   SDL_FreeSurface (dest);
 
+  TRACE_END ("writeimagefile");
+
 } // writeimagefile ()
 
 // -----
@@ -4246,7 +12641,7 @@ int xkbhit (void)
     return YEAH;
   }
 
-  if (SDL_PollEvent (&event)) {
+  if (poll_event (&event)) {
     if (SDL_KEYDOWN == event.type)
       return YEAH;
     else
@@ -54,6 +54,78 @@ extern SDL_Texture  *bgi_texture;
 
 #define VPAGES 4
 
+// present backends, see setbackend()
+
+enum { RENDERER_BACKEND, SURFACE_BACKEND };
+
+// image filters, see putimagescaled()
+
+enum { NEAREST_FILTER, BILINEAR_FILTER, BOX_FILTER };
+
+// ring viewports, see setringviewport()
+
+enum { RING_OFF, RING_COLUMNS, RING_ROWS };
+
+// page layouts, see setpagelayout()
+
+enum { LAYOUT_ROWS, LAYOUT_TILES };
+
+// layer blending, see createlayer()
+
+enum { LAYER_OVER, LAYER_KEY };
+
+// tile callback, see shadeviewport()
+
+typedef void (*bgi_shader) (Uint32 *, int, int, int, int, int, void *);
+
+// shared pages, see setsharedpages(). The shared memory object
+// starts with this header; page n starts at byte
+// page_offset + n * page_bytes, and holds ARGB8888 pixels.
+
+#define BGI_SHM_MAGIC 0x53494742 // "BGIS"
+
+typedef struct {
+  Uint32 magic;       // BGI_SHM_MAGIC, once the header is complete
+  Uint32 header_size; // sizeof (bgi_shm_header)
+  Uint32 width;       // page size in pixels
+  Uint32 height;
+  Uint32 stride;      // pixels from one row to the next
+  Uint32 pages;       // number of pages
+  Uint32 page_bytes;  // bytes from one page to the next
+  Uint32 page_offset; // byte offset of page 0
+  Uint32 visual_page; // page shown by the last present
+  Uint32 active_page; // page being drawn on
+  Uint64 sequence;    // incremented after each present
+} bgi_shm_header;
+
+// frame server, see startframeserver(). Messages are made of
+// little-endian 32-bit words; the first one is the message type.
+// Server to client: BGI_MSG_HELLO width height, then
+// BGI_MSG_FRAME sequence x y w h flags nbytes, followed by nbytes
+// of pixel operations for the w x h rectangle, row by row.
+
+enum {
+  BGI_MSG_HELLO = 1, BGI_MSG_FRAME,
+  // client to server: 4 words; unused words are 0
+  BGI_MSG_MOTION = 16,     // x y 0
+  BGI_MSG_BUTTONDOWN,      // x y button
+  BGI_MSG_BUTTONUP,        // x y button
+  BGI_MSG_KEYDOWN,         // keycode 0 0
+  BGI_MSG_KEYUP            // keycode 0 0
+};
+
+#define BGI_FRAME_KEY 1    // frame flag: no BGI_OP_SKIP inside
+
+// pixel operations: one byte, operation in the top 2 bits and
+// (count - 1) in the low 6 bits, then colours as 32-bit ARGB words
+
+enum {
+  BGI_OP_SKIP = 0x00,      // count pixels unchanged since last frame
+  BGI_OP_RUN = 0x40,       // count pixels of the colour that follows
+  BGI_OP_RAW = 0x80,       // count colours follow
+  BGI_OP_REPEAT = 0xc0     // count pixels of the last colour sent
+};
+
 // BGI fonts
 
 // only DEFAULT_FONT (8x8) is implemented
@@ -90,7 +162,7 @@ enum { NORM_WIDTH = 1, THICK_WIDTH = 3 };
 
 enum { SOLID_LINE, DOTTED_LINE, CENTER_LINE, DASHED_LINE, USERBIT_LINE };
 
-enum { COPY_PUT, XOR_PUT, OR_PUT, AND_PUT, NOT_PUT };
+enum { COPY_PUT, XOR_PUT, OR_PUT, AND_PUT, NOT_PUT, ALPHA_PUT };
 
 // fill styles
 
@@ -262,6 +334,14 @@ struct viewporttype {
   int clip;
 };
 
+// opaque rendering context; see createcontext()
+
+typedef struct bgi_context bgi_context;
+
+// opaque page snapshot; see snapshotpage()
+
+typedef struct bgi_snapshot bgi_snapshot;
+
 // prototypes - standard BGI
 // make them C++ compatible
 
@@ -364,37 +444,149 @@ int  ALPHA_VALUE (int);
 int  BLUE_VALUE (int);
 void closewindow (int);
 int  COLOR (int, int, int);
+void copypage (int, int);
+void copyrect (int, int, int, int, int, int, int);
+void *createbitmap (int, int);
+int  createsprite (void *);
 int  event (void);
 int eventtype (void);
+void freebitmap (void *);
 void freeimage (void *);
+void freesnapshot (bgi_snapshot *);
+void freesprite (int);
 int  getcurrentwindow (void);
 int  getevent (void);
+void getpixels (int, const int *, const int *, Uint32 *);
 void getmouseclick (int, int *, int *);
 int  GREEN_VALUE (int);
 void initwindow (int, int);
 int  IS_BGI_COLOR (int color);
 int  ismouseclick (int);
 int  IS_RGB_COLOR (int color);
+int  loadsprite (char *);
+Uint32 *lockframebuffer (int *);
+void makecolorramp (Uint32 *, int, const Uint32 *, int);
 int  mouseclick (void);
 int  mousex (void);
 int  mousey (void);
+void movesprite (int, int, int);
+void putcolormap (int, int, int, int, const float *, float, float,
+                  const Uint32 *, int);
+void putcolormapint (int, int, int, int, const int *,
+                     const Uint32 *, int);
 void _putpixel (int, int);
+void putimagescaled (int, int, int, int, void *, int, int);
+void putpixels (int, const int *, const int *, const Uint32 *);
 int  RED_VALUE (int );
 void refresh (void);
+int  replayfile (char *);
+void restorepage (bgi_snapshot *);
+void scrollring (int, int);
+void scrollviewport (int, int, int);
 void sdlbgiauto (void);
 void sdlbgifast (void);
+void sdlbgilimit (void);
 void sdlbgislow (void);
 void setalpha (int, Uint8);
+void setbackend (int);
 void setbkrgbcolor (int);
 void setblendmode (int);
 void setcurrentwindow (int);
+void setimagecache (int);
+void setimagefilter (int);
+void setpagelayout (int);
 void setrgbcolor (int);
 void setrgbpalette (int, int, int, int);
+void setringviewport (int);
+void setsharedpages (const char *);
+void setspritemode (int, int, int);
+void setspritez (int, int);
+void settarget (void *);
+void setvsync (int);
 void setwinoptions (char *, int, int, Uint32);
+void shadeviewport (bgi_shader, void *);
 void showerrorbox (const char *);
+void showsprite (int, int);
+bgi_snapshot *snapshotpage (void);
+int  startframeserver (const char *);
+void stopframeserver (void);
 void swapbuffers (void);
+void unlockframebuffer (int, int, int, int);
 int  xkbhit (void);
 
+// rendering contexts
+
+bgi_context *createcanvas (int, int);
+bgi_context *createcontext (int, int);
+bgi_context *createlayer (const char *, int);
+void ctx_arc (bgi_context *, int, int, int, int, int);
+void ctx_bar3d (bgi_context *, int, int, int, int, int, int);
+void ctx_bar (bgi_context *, int, int, int, int);
+void ctx_circle (bgi_context *, int, int, int);
+void ctx_cleardevice (bgi_context *);
+void ctx_clearviewport (bgi_context *);
+void ctx_copyrect (bgi_context *, int, int, int, int, int, int);
+void ctx_drawpoly (bgi_context *, int, int *);
+void ctx_ellipse (bgi_context *, int, int, int, int, int, int);
+void ctx_fillellipse (bgi_context *, int, int, int, int);
+void ctx_fillpoly (bgi_context *, int, int *);
+void ctx_floodfill (bgi_context *, int, int, int);
+void ctx_getimage (bgi_context *, int, int, int, int, void *);
+unsigned int ctx_getpixel (bgi_context *, int, int);
+void ctx_getpixels (bgi_context *, int, const int *, const int *,
+                    Uint32 *);
+void ctx_graphdefaults (bgi_context *);
+void ctx_line (bgi_context *, int, int, int, int);
+void ctx_linerel (bgi_context *, int, int);
+void ctx_lineto (bgi_context *, int, int);
+void ctx_moverel (bgi_context *, int, int);
+void ctx_moveto (bgi_context *, int, int);
+void ctx_outtext (bgi_context *, char *);
+void ctx_outtextxy (bgi_context *, int, int, char *);
+void ctx_pieslice (bgi_context *, int, int, int, int, int);
+void ctx_putcolormap (bgi_context *, int, int, int, int, const float *,
+                      float, float, const Uint32 *, int);
+void ctx_putcolormapint (bgi_context *, int, int, int, int, const int *,
+                         const Uint32 *, int);
+void ctx_putimage (bgi_context *, int, int, void *, int);
+void ctx_putimagescaled (bgi_context *, int, int, int, int, void *,
+                         int, int);
+void ctx_putpixel (bgi_context *, int, int, int);
+void ctx_putpixels (bgi_context *, int, const int *, const int *,
+                    const Uint32 *);
+void ctx_readimagefile (bgi_context *, char *, int, int, int, int);
+void ctx_rectangle (bgi_context *, int, int, int, int);
+void ctx_scrollring (bgi_context *, int, int);
+void ctx_scrollviewport (bgi_context *, int, int, int);
+void ctx_sector (bgi_context *, int, int, int, int, int, int);
+void ctx_setbkcolor (bgi_context *, int);
+void ctx_setbkrgbcolor (bgi_context *, int);
+void ctx_setcolor (bgi_context *, int);
+void ctx_setfillpattern (bgi_context *, char *, int);
+void ctx_setfillstyle (bgi_context *, int, int);
+void ctx_setlinestyle (bgi_context *, int, unsigned, int);
+void ctx_setrgbcolor (bgi_context *, int);
+void ctx_setrgbpalette (bgi_context *, int, int, int, int);
+void ctx_setringviewport (bgi_context *, int);
+void ctx_settextjustify (bgi_context *, int, int);
+void ctx_settextstyle (bgi_context *, int, int, int);
+void ctx_setusercharsize (bgi_context *, int, int, int, int);
+void ctx_setviewport (bgi_context *, int, int, int, int, int);
+void ctx_setwritemode (bgi_context *, int);
+void ctx_shadeviewport (bgi_context *, bgi_shader, void *);
+void ctx_writeimagefile (bgi_context *, char *, int, int, int, int);
+void freecontext (bgi_context *);
+Uint32 *getcontextpixels (bgi_context *, int *, int *);
+bgi_context *getcurrentcontext (void);
+bgi_context *getlayer (const char *);
+void setcanvasview (bgi_context *, int, int, float);
+void setcurrentcontext (bgi_context *);
+void setlayermode (bgi_context *, int, int);
+void setlayeropacity (bgi_context *, int);
+void setlayerz (bgi_context *, int);
+void showcanvas (bgi_context *);
+void showlayer (bgi_context *, int);
+
 #ifdef __cplusplus
 }
 #endif
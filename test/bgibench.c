@@ -0,0 +1,886 @@
+/* bgibench.c  -*- C -*-
+ *
+ * To compile:
+ * gcc -O2 -o bgibench bgibench.c -lSDL_bgi -lSDL2 -lm
+ *
+ * Non-interactive benchmark and pixel regression test. Runs fixed
+ * seed versions of the demo programs (fern, dla, life, kaleido,
+ * floodfilltest, sdlbgidemo), direct access to the page with
+ * lockframebuffer (), colour tables with putcolormapint (), tiles
+ * shaded in parallel with shadeviewport (), plus any session
+ * recorded with SDL_BGI_RECORD given on the command line, and prints
+ * for each: wall time, pixels per second and a CRC-32C of the final
+ * page.
+ *
+ * bgibench [-r runs] [-t factor] [-l] [-b file | -c file] [-s file]
+ *          [record ...]
+ *
+ * -r: run each workload 'runs' times and keep the best time (3)
+ * -l: run the built-in workloads again on tiled pages, as
+ *     "name+tiles"; their checksums must be the same
+ * -b: write the checksums to 'file' as the new baseline
+ * -c: compare the checksums with 'file', and fail if one differs.
+ *     If 'file' does not exist, it is written.
+ * -s: compare the times with 'file', and fail if a workload is
+ *     slower than 'factor' times the baseline (1.25). If 'file'
+ *     does not exist, or with -b, it is written.
+ *
+ * Checksums are the same on every machine, and bench.crc is kept
+ * with the sources; times are not, so bench.times stays local. Run
+ * it without a window as:
+ *
+ * SDL_VIDEODRIVER=dummy ./bgibench -c bench.crc -s bench.times
+ *
+ * "Pixels per second" counts the pixels that differ from the
+ * background (the top left pixel) in the final frame, times the
+ * number of frames drawn.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <graphics.h>
+
+// the CRC32 instruction of SSE 4.2 is used if the CPU has it,
+// whatever the compiler targets
+#if defined (__x86_64__) && (defined (__GNUC__) || defined (__clang__))
+#include <nmmintrin.h>
+#define CRC_SSE42
+#elif defined (__ARM_FEATURE_CRC32) && defined (__aarch64__)
+#include <arm_acle.h>
+#endif
+
+#define WIDTH  640
+#define HEIGHT 480
+#define MAXRESULTS 64
+
+typedef struct {
+  char   name[64];
+  Uint32 crc;
+  double ms;
+  double mpix;
+} Result;
+
+typedef struct {
+  char   name[64];
+  double value;              // checksum or time
+} Baseline;
+
+Uint32 crc_table[256];
+Uint32 seed;
+char   cells[2][WIDTH][HEIGHT];
+
+// -----
+
+void crc_init (void)
+{
+  // CRC-32C (Castagnoli), reflected polynomial
+
+  Uint32 crc;
+
+  for (int i = 0; i < 256; i++) {
+    crc = i;
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    crc_table[i] = crc;
+  }
+
+} // crc_init ()
+
+// -----
+
+#ifdef CRC_SSE42
+__attribute__ ((target ("sse4.2")))
+Uint32 crc32c_sse42 (const Uint8 *p, size_t len)
+{
+  // CRC-32C of the multiple of 8 bytes at the start of p
+
+  Uint64 c = 0xffffffff, v;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy (&v, p, 8);
+    c = _mm_crc32_u64 (c, v);
+  }
+
+  return (Uint32) c;
+
+} // crc32c_sse42 ()
+#endif
+
+// -----
+
+Uint32 crc32c (const void *data, size_t len)
+{
+  // uses the CRC32 instructions of SSE 4.2, if the CPU has them,
+  // or of ARMv8 when the compiler targets them; all versions give
+  // the same result
+
+  const Uint8 *p = data;
+  Uint32 crc = 0xffffffff;
+
+#if defined (CRC_SSE42)
+  if (__builtin_cpu_supports ("sse4.2")) {
+    crc = crc32c_sse42 (p, len);
+    p += len & ~(size_t) 7;
+    len &= 7;
+  }
+#elif defined (__ARM_FEATURE_CRC32) && defined (__aarch64__)
+  Uint64 v;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy (&v, p, 8);
+    crc = __crc32cd (crc, v);
+  }
+#endif
+
+  while (len--)
+    crc = (crc >> 8) ^ crc_table[(crc ^ *p++) & 0xff];
+
+  return crc ^ 0xffffffff;
+
+} // crc32c ()
+
+// -----
+
+int rnd (int n)
+{
+  // xorshift32: same sequence on every platform, unlike rand ().
+  // The order in which function arguments are evaluated is
+  // unspecified, so never call rnd () twice in one argument list.
+
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed % n;
+
+} // rnd ()
+
+// -----
+
+void random_values (int *v, int n)
+{
+  // fills v with n coordinates: even entries in [0, WIDTH),
+  // odd entries in [0, HEIGHT)
+
+  for (int i = 0; i < n; i++)
+    v[i] = rnd (i % 2 ? HEIGHT : WIDTH);
+
+} // random_values ()
+
+// -----
+
+int fern (void)
+{
+  // as fern.c, without the key check
+
+  float x = 0.0, y = 0.0, xx, yy;
+  int k, prob, scale = (WIDTH - 1) / 16;
+  float
+    a[4] = {0.0, 0.85, 0.2, -0.15},
+    b[4] = {0.0, 0.04, -0.26, 0.28},
+    c[4] = {0.0, 0.04, 0.23, 0.26},
+    d[4] = {0.16, 0.85, 0.22, 0.24},
+    f[4] = {0.0, 1.6, 1.6, 0.44};
+
+  for (int i = 0; i < 400000; i++) {
+    prob = rnd (100);
+    k = (prob < 1) ? 0 : (prob < 86) ? 1 : (prob < 93) ? 2 : 3;
+    xx = a[k] * x + b[k] * y;
+    yy = c[k] * x + d[k] * y + f[k];
+    x = xx;
+    y = yy;
+    putpixel (WIDTH / 2 + (int) (x * scale),
+              HEIGHT - 1 - (int) (y * scale * 0.45), GREEN);
+  }
+
+  return 1;
+
+} // fern ()
+
+// -----
+
+int dla (void)
+{
+  // diffusion-limited aggregation, as dla.c
+
+  int x, y, stuck;
+
+  putpixel (WIDTH / 2, HEIGHT / 2, WHITE);
+
+  for (int n = 0; n < 1500; n++) {
+    x = WIDTH / 2 - 40 + rnd (80);
+    y = HEIGHT / 2 - 40 + rnd (80);
+    stuck = NOPE;
+    for (int step = 0; step < 5000 && NOPE == stuck; step++) {
+      x += rnd (3) - 1;
+      y += rnd (3) - 1;
+      if (x < 1 || x >= WIDTH - 1 || y < 1 || y >= HEIGHT - 1)
+        break;
+      stuck =
+        getpixel (x - 1, y) || getpixel (x + 1, y) ||
+        getpixel (x, y - 1) || getpixel (x, y + 1);
+    }
+    if (YEAH == stuck)
+      putpixel (x, y, 1 + n % 15);
+  }
+
+  return 1;
+
+} // dla ()
+
+// -----
+
+int life (void)
+{
+  // Conway's game of life, one cell per pixel, as life.c
+
+  int gen, now = 0, n;
+
+  for (int x = 0; x < WIDTH; x++)
+    for (int y = 0; y < HEIGHT; y++)
+      cells[now][x][y] = (rnd (4) == 0);
+
+  for (gen = 0; gen < 40; gen++) {
+    for (int x = 1; x < WIDTH - 1; x++)
+      for (int y = 1; y < HEIGHT - 1; y++) {
+        n =
+          cells[now][x-1][y-1] + cells[now][x][y-1] +
+          cells[now][x+1][y-1] + cells[now][x-1][y] +
+          cells[now][x+1][y] + cells[now][x-1][y+1] +
+          cells[now][x][y+1] + cells[now][x+1][y+1];
+        cells[1 - now][x][y] = (3 == n || (2 == n && cells[now][x][y]));
+        putpixel (x, y, cells[1 - now][x][y] ? YELLOW : BLACK);
+      }
+    now = 1 - now;
+  }
+
+  return gen;
+
+} // life ()
+
+// -----
+
+int kaleido (void)
+{
+  // mirrored lines and filled ellipses, as kaleido.c
+
+  int frame, x1, y1, x2, y2, r1, r2;
+  int mx = WIDTH / 2, my = HEIGHT / 2;
+
+  for (frame = 0; frame < 100; frame++) {
+    cleardevice ();
+    for (int i = 0; i < 40; i++) {
+      x1 = rnd (mx);
+      y1 = rnd (my);
+      x2 = rnd (mx);
+      y2 = rnd (my);
+      setcolor (1 + rnd (15));
+      line (mx + x1, my + y1, mx + x2, my + y2);
+      line (mx - x1, my + y1, mx - x2, my + y2);
+      line (mx + x1, my - y1, mx + x2, my - y2);
+      line (mx - x1, my - y1, mx - x2, my - y2);
+      r1 = 1 + rnd (30);
+      r2 = 1 + rnd (30);
+      setfillstyle (SOLID_FILL, getcolor ());
+      fillellipse (mx + x2, my + y1, r1, r2);
+      fillellipse (mx - x2, my + y1, r1, r2);
+      fillellipse (mx + x2, my - y1, r1, r2);
+      fillellipse (mx - x2, my - y1, r1, r2);
+    }
+  }
+
+  return frame;
+
+} // kaleido ()
+
+// -----
+
+int floodfilltest (void)
+{
+  // random outlines filled with all patterns, as floodfilltest.c
+
+  int frame, v[4];
+
+  for (frame = 0; frame < 20; frame++) {
+    cleardevice ();
+    setcolor (WHITE);
+    for (int i = 0; i < 30; i++) {
+      random_values (v, 3);
+      circle (v[0], v[1], 10 + v[2] % 80);
+    }
+    for (int i = 0; i < 10; i++) {
+      random_values (v, 4);
+      rectangle (v[0], v[1], v[2], v[3]);
+    }
+    // pattern fills only work on areas of background colour
+    for (int i = 0; i < 20; i++) {
+      random_values (v, 4);
+      if (BLACK != getpixel (v[0], v[1]))
+        continue;
+      setfillstyle (1 + v[2] % (USER_FILL - 1), 1 + v[3] % 14);
+      floodfill (v[0], v[1], WHITE);
+    }
+  }
+
+  return frame;
+
+} // floodfilltest ()
+
+// -----
+
+int primitives (void)
+{
+  // a bit of everything, as sdlbgidemo.c
+
+  int frame, v[8];
+  char *msg = "SDL_bgi benchmark";
+
+  for (frame = 0; frame < 50; frame++) {
+    cleardevice ();
+    // pieslice () calls floodfill (), which needs a closed outline
+    // around plain background, and a fill colour that is not the
+    // outline colour
+    random_values (v, 8);
+    setcolor (1 + v[4] % 7);
+    setlinestyle (SOLID_LINE, 0, 1);
+    setfillstyle (1 + v[5] % (USER_FILL - 1), 8 + v[6] % 8);
+    pieslice (v[0], v[1], v[5] % 360, v[6] % 360, 20 + v[7] % 80);
+    for (int i = 0; i < 20; i++) {
+      random_values (v, 8);
+      setcolor (1 + v[4] % 15);
+      setlinestyle (v[5] % 4, 0, 1 + 2 * (v[6] % 2));
+      line (v[0], v[1], v[2], v[3]);
+      random_values (v, 8);
+      arc (v[0], v[1], v[4] % 360, v[5] % 360, v[6] % 100);
+      ellipse (v[2], v[3], 0, 360, v[6] % 100, v[7] % 100);
+      random_values (v, 8);
+      setfillstyle (v[5] % USER_FILL, 1 + v[6] % 15);
+      bar3d (v[0], v[1], v[2], v[3], v[4] % 20, 1);
+      random_values (v, 8);
+      fillpoly (4, v);
+      random_values (v, 8);
+      settextstyle (v[4] % (BOLD_FONT + 1), v[5] % 2, 1 + v[6] % 4);
+      outtextxy (v[0], v[1], msg);
+    }
+  }
+
+  setlinestyle (SOLID_LINE, 0, 1);
+  settextstyle (DEFAULT_FONT, HORIZ_DIR, 1);
+
+  return frame;
+
+} // primitives ()
+
+// -----
+
+int images (void)
+{
+  // getimage () and putimage () with all operators
+
+  int frame, size, v[3];
+  void *img;
+
+  setfillstyle (XHATCH_FILL, RED);
+  bar (0, 0, 63, 63);
+  setcolor (YELLOW);
+  circle (32, 32, 30);
+  size = imagesize (0, 0, 63, 63);
+  img = malloc (size);
+  getimage (0, 0, 63, 63, img);
+
+  for (frame = 0; frame < 50; frame++)
+    for (int i = 0; i < 200; i++) {
+      random_values (v, 3);
+      putimage (v[0] % (WIDTH - 64), v[1] % (HEIGHT - 64), img, v[2] % 5);
+    }
+
+  free (img);
+
+  return frame;
+
+} // images ()
+
+// -----
+
+int columns (void)
+{
+  // vertical lines and circles, which go down the page: the case
+  // tiled pages are for
+
+  int frame, v[3];
+
+  for (frame = 0; frame < 20; frame++) {
+    setcolor (1 + frame % 15);
+    for (int x = frame % 2; x < WIDTH; x += 2)
+      line (x, 0, x, HEIGHT - 1);
+    for (int i = 0; i < 50; i++) {
+      random_values (v, 3);
+      circle (v[0], v[1], v[2] % 200);
+    }
+  }
+
+  return frame;
+
+} // columns ()
+
+// -----
+
+int framebuffer (void)
+{
+  // a plasma written straight into the page, as psychedelia.c
+  // could; integer arithmetic keeps the checksum the same on
+  // every machine
+
+  int frame, stride, col;
+  Uint32 *pixels;
+
+  for (frame = 0; frame < 20; frame++) {
+    pixels = lockframebuffer (&stride);
+    for (int y = 0; y < HEIGHT; y++)
+      for (int x = 0; x < WIDTH; x++) {
+        col = (x * x / 64 + y * y / 32 + (x + y) * frame) & 0xff;
+        pixels[y * stride + x] = 0xff000000 | col << 16 |
+          (255 - col) << 8 | ((3 * col) & 0xff);
+      }
+    unlockframebuffer (0, 0, WIDTH - 1, HEIGHT - 1);
+  }
+
+  return frame;
+
+} // framebuffer ()
+
+// -----
+
+int colormap (void)
+{
+  // a field of values drawn through a colour table in one call,
+  // as plasma.c could
+
+  int frame, *values;
+  Uint32 lut[256];
+
+  for (int i = 0; i < 256; i++)
+    lut[i] = 0xff000000 | i << 16 | ((i * 7) & 0xff) << 8 | (255 - i);
+  values = malloc (WIDTH * HEIGHT * sizeof (int));
+
+  for (frame = 0; frame < 20; frame++) {
+    for (int y = 0; y < HEIGHT; y++)
+      for (int x = 0; x < WIDTH; x++)
+        values[y * WIDTH + x] = ((x ^ y) + x * y / 128 + frame * 9) & 0xff;
+    putcolormapint (0, 0, WIDTH, HEIGHT, values, lut, 256);
+  }
+
+  free (values);
+
+  return frame;
+
+} // colormap ()
+
+// -----
+
+void mandelbrot_tile (Uint32 *pixels, int stride, int left, int top,
+                      int width, int height, void *data)
+{
+  // a tile of the Mandelbrot set in 24-bit fixed point, so that the
+  // checksum does not depend on the floating point unit; called on
+  // several threads at once
+
+  int zoom = *(int *) data, n;
+  Sint64 a, b, aa, bb, x, y, d = (3LL << 24) / (WIDTH * zoom);
+
+  for (int j = 0; j < height; j++)
+    for (int i = 0; i < width; i++) {
+      // centred on -0.75 + 0.125i
+      x = -(3LL << 22) + (left + i - WIDTH / 2) * d;
+      y = (1LL << 21) + (top + j - HEIGHT / 2) * d;
+      a = b = aa = bb = 0;
+      for (n = 0; n < 64 && aa + bb <= (4LL << 24); n++) {
+        b = ((a * b) >> 23) + y;
+        a = aa - bb + x;
+        aa = (a * a) >> 24;
+        bb = (b * b) >> 24;
+      }
+      pixels[j * stride + i] = 0xff000000 | (n * 4) << 16 | (n * 3) << 8 |
+        (255 - n * 4);
+    }
+
+} // mandelbrot_tile ()
+
+// -----
+
+int shade (void)
+{
+  // a Mandelbrot set, closer on every frame, computed by
+  // shadeviewport () on all cores, as mandelbrot.c could
+
+  int frame, zoom;
+
+  for (frame = 0; frame < 10; frame++) {
+    zoom = 1 + frame;
+    shadeviewport (mandelbrot_tile, &zoom);
+  }
+
+  return frame;
+
+} // shade ()
+
+// -----
+
+void page_stats (Uint32 *crc, long *lit)
+{
+  // checksum of the active page, and number of pixels that differ
+  // from the background, taken from the top left corner
+
+  Uint32
+    *pixels,
+    bg;
+  int
+    stride,
+    rows;
+
+  pixels = lockframebuffer (&stride);
+  rows = getmaxy () + 1;
+  *crc = crc32c (pixels, sizeof (Uint32) * stride * rows);
+  bg = pixels[0] & 0xffffff;
+  *lit = 0;
+  for (int y = 0; y < rows; y++)
+    for (int x = 0; x <= getmaxx (); x++)
+      if ((pixels[y * stride + x] & 0xffffff) != bg)
+        (*lit)++;
+  unlockframebuffer (0, 0, -1, -1);
+
+} // page_stats ()
+
+// -----
+
+int load_baseline (char *filename, Baseline *base, int hex)
+{
+  // reads 'name value' lines; checksums are in hex
+
+  FILE *f;
+  int n = 0;
+  Uint32 crc;
+
+  f = fopen (filename, "r");
+  if (NULL == f)
+    return -1;
+  while (n < MAXRESULTS &&
+         (hex ? 2 == fscanf (f, "%63s %x", base[n].name, &crc) :
+          2 == fscanf (f, "%63s %lf", base[n].name, &base[n].value))) {
+    if (hex)
+      base[n].value = crc;
+    n++;
+  }
+  fclose (f);
+
+  return n;
+
+} // load_baseline ()
+
+// -----
+
+Baseline *find_baseline (Baseline *base, int n, char *name, size_t len)
+{
+  // looks for the first 'len' characters of name
+
+  for (int k = 0; k < n; k++)
+    if (strlen (base[k].name) == len &&
+        0 == strncmp (base[k].name, name, len))
+      return &base[k];
+
+  return NULL;
+
+} // find_baseline ()
+
+// -----
+
+int main (int argc, char *argv[])
+{
+  struct {
+    char *name;
+    int (*run) (void);
+  } workload[] = {
+    {"fern", fern},
+    {"dla", dla},
+    {"life", life},
+    {"kaleido", kaleido},
+    {"floodfill", floodfilltest},
+    {"primitives", primitives},
+    {"images", images},
+    {"columns", columns},
+    {"framebuffer", framebuffer},
+    {"colormap", colormap},
+    {"shade", shade}
+  };
+  int
+    nwork = sizeof (workload) / sizeof (workload[0]),
+    runs = 3,
+    nres = 0,
+    ncrc = 0,
+    ntime = 0,
+    frames = 0,
+    failed = 0,
+    layouts = 1,
+    w,
+    main_window,
+    second_window,
+    arg;
+  double
+    factor = 1.25,
+    elapsed,
+    ms;
+  char
+    *crcfile = NULL,
+    *timefile = NULL,
+    *status;
+  int
+    write_crc = NOPE,
+    write_time = NOPE;
+  Uint32
+    crc,
+    check_crc,
+    first_crc = 0;
+  Uint64
+    start;
+  long
+    lit;
+  Result
+    res[MAXRESULTS];
+  Baseline
+    crcbase[MAXRESULTS],
+    timebase[MAXRESULTS],
+    *b;
+  FILE
+    *f;
+
+  for (arg = 1; arg < argc && '-' == argv[arg][0]; arg++) {
+    if (0 == strcmp (argv[arg], "-l")) {
+      layouts = 2;
+      continue;
+    }
+    if (arg + 1 >= argc)
+      break;
+    if (0 == strcmp (argv[arg], "-r"))
+      runs = atoi (argv[++arg]);
+    else if (0 == strcmp (argv[arg], "-t"))
+      factor = atof (argv[++arg]);
+    else if (0 == strcmp (argv[arg], "-b")) {
+      crcfile = argv[++arg];
+      write_crc = write_time = YEAH;
+    }
+    else if (0 == strcmp (argv[arg], "-c"))
+      crcfile = argv[++arg];
+    else if (0 == strcmp (argv[arg], "-s"))
+      timefile = argv[++arg];
+    else
+      break;
+  }
+  if ((arg < argc && '-' == argv[arg][0]) || runs < 1 || factor <= 0) {
+    fprintf (stderr,
+             "Usage: %s [-r runs] [-t factor] [-l] [-b file | -c file] "
+             "[-s file] [record ...]\n", argv[0]);
+    return 2;
+  }
+  if (layouts * nwork + argc - arg > MAXRESULTS) {
+    fprintf (stderr, "Too many record files.\n");
+    return 2;
+  }
+
+  if (NULL != crcfile && NOPE == write_crc) {
+    ncrc = load_baseline (crcfile, crcbase, YEAH);
+    if (-1 == ncrc) {
+      printf ("No checksums in %s, writing them.\n", crcfile);
+      write_crc = YEAH;
+    }
+  }
+  if (NULL != timefile && NOPE == write_time) {
+    ntime = load_baseline (timefile, timebase, NOPE);
+    if (-1 == ntime) {
+      printf ("No times in %s, writing them.\n", timefile);
+      write_time = YEAH;
+    }
+  }
+
+  crc_init ();
+
+  // the built-in workloads, in one window; tiled pages are put
+  // back in rows, untimed, to be checked
+
+  initwindow (WIDTH, HEIGHT);
+  sdlbgifast ();
+  main_window = getcurrentwindow ();
+
+  for (int k = 0; k < layouts * nwork; k++) {
+    w = k % nwork;
+    ms = 0.0;
+    for (int r = 0; r < runs; r++) {
+      // floodfill () picks temporary colours with rand ()
+      seed = 2463534242u;
+      srand (1);
+      setpagelayout (k < nwork ? LAYOUT_ROWS : LAYOUT_TILES);
+      graphdefaults ();
+      setbkcolor (BLACK);
+      cleardevice ();
+      start = SDL_GetPerformanceCounter ();
+      frames = workload[w].run ();
+      refresh ();
+      elapsed = 1000.0 * (SDL_GetPerformanceCounter () - start) /
+        SDL_GetPerformanceFrequency ();
+      setpagelayout (LAYOUT_ROWS);
+      page_stats (&crc, &lit);
+      if (0 == r || elapsed < ms)
+        ms = elapsed;
+      if (0 == r)
+        first_crc = crc;
+      else if (crc != first_crc)
+        fprintf (stderr, "%s: run %d drew different pixels.\n",
+                 workload[w].name, r + 1);
+    }
+    snprintf (res[nres].name, sizeof (res[nres].name), "%s%s",
+              workload[w].name, k < nwork ? "" : "+tiles");
+    res[nres].crc = first_crc;
+    res[nres].ms = ms;
+    res[nres].mpix = ms > 0 ? (double) lit * frames / ms / 1000.0 : 0;
+    nres++;
+  }
+
+  // with two windows open, the layout can't change: neither
+  // window may lose its pixels
+
+  if (2 == layouts) {
+    page_stats (&first_crc, &lit);
+    initwindow (WIDTH / 2, HEIGHT / 2);
+    second_window = getcurrentwindow ();
+    setcolor (YELLOW);
+    circle (WIDTH / 4, HEIGHT / 4, HEIGHT / 5);
+    page_stats (&crc, &lit);
+    setpagelayout (LAYOUT_TILES);
+    setcurrentwindow (main_window);
+    setpagelayout (LAYOUT_TILES);
+    page_stats (&check_crc, &lit);
+    if (check_crc != first_crc) {
+      fprintf (stderr, "Changing the layout with two windows "
+               "open drew over the first window.\n");
+      failed++;
+    }
+    setcurrentwindow (second_window);
+    page_stats (&check_crc, &lit);
+    if (check_crc != crc) {
+      fprintf (stderr, "Changing the layout with two windows "
+               "open drew over the second window.\n");
+      failed++;
+    }
+    closewindow (second_window);
+    setcurrentwindow (main_window);
+  }
+
+  // recorded sessions open their own window, which is closed
+  // after each run; closegraph () can't be followed by initwindow ()
+
+  for (; arg < argc; arg++) {
+    ms = 0.0;
+    for (int r = 0; r < runs; r++) {
+      start = SDL_GetPerformanceCounter ();
+      if (replayfile (argv[arg]) < 0)
+        return 2;
+      elapsed = 1000.0 * (SDL_GetPerformanceCounter () - start) /
+        SDL_GetPerformanceFrequency ();
+      crc = 0;
+      lit = 0;
+      if (main_window != getcurrentwindow ()) {
+        page_stats (&crc, &lit);
+        closewindow (getcurrentwindow ());
+        setcurrentwindow (main_window);
+      }
+      if (0 == r || elapsed < ms)
+        ms = elapsed;
+      if (0 == r)
+        first_crc = crc;
+      else if (crc != first_crc)
+        fprintf (stderr, "%s: run %d drew different pixels.\n",
+                 argv[arg], r + 1);
+    }
+    snprintf (res[nres].name, sizeof (res[nres].name), "%s",
+              strrchr (argv[arg], '/') ? strrchr (argv[arg], '/') + 1 :
+              argv[arg]);
+    res[nres].crc = first_crc;
+    res[nres].ms = ms;
+    res[nres].mpix = ms > 0 ? (double) lit / ms / 1000.0 : 0;
+    nres++;
+  }
+
+  closegraph ();
+
+  // report and compare
+
+  for (int i = 0; i < nres; i++) {
+    status = "";
+    if (NULL != crcfile && NOPE == write_crc) {
+      // "name+tiles" must draw what "name" draws
+      b = find_baseline (crcbase, ncrc, res[i].name,
+                         strstr (res[i].name, "+tiles") ?
+                         (size_t) (strstr (res[i].name, "+tiles") -
+                                   res[i].name) :
+                         strlen (res[i].name));
+      status = (NULL == b) ? "new" :
+        (b->value != res[i].crc) ? "FAILED: checksum" : "ok";
+    }
+    if (NULL != timefile && NOPE == write_time &&
+        NULL == strstr (status, "FAILED")) {
+      b = find_baseline (timebase, ntime, res[i].name,
+                         strlen (res[i].name));
+      if (NULL != b && res[i].ms > factor * b->value)
+        status = "FAILED: slower";
+      else if ('\0' == status[0])
+        status = (NULL == b) ? "new" : "ok";
+    }
+    if (strstr (status, "FAILED"))
+      failed++;
+    printf ("%-16s %9.2f ms %9.3f Mpixel/s  %08x  %s\n",
+            res[i].name, res[i].ms, res[i].mpix, res[i].crc, status);
+  }
+
+  if (NULL != crcfile && YEAH == write_crc) {
+    f = fopen (crcfile, "w");
+    if (NULL == f) {
+      fprintf (stderr, "Can't write %s.\n", crcfile);
+      return 2;
+    }
+    for (int i = 0; i < nres; i++)
+      fprintf (f, "%s %08x\n", res[i].name, res[i].crc);
+    fclose (f);
+  }
+
+  if (NULL != timefile && YEAH == write_time) {
+    f = fopen (timefile, "w");
+    if (NULL == f) {
+      fprintf (stderr, "Can't write %s.\n", timefile);
+      return 2;
+    }
+    for (int i = 0; i < nres; i++)
+      fprintf (f, "%s %.3f\n", res[i].name, res[i].ms);
+    fclose (f);
+  }
+
+  if (failed)
+    printf ("%d of %d workloads failed.\n", failed, nres);
+
+  return failed ? 1 : 0;
+
+} // main ()
@@ -0,0 +1,122 @@
+/* bgipeek.c  -*- C -*-
+ *
+ * To compile:
+ * gcc -o bgipeek bgipeek.c -lSDL_bgi -lSDL2
+ *
+ * Reads the pages of a running SDL_bgi program from another process,
+ * without copies on the program's side. Start the program with
+ * shared pages, then look at them:
+ *
+ * SDL_BGI_SHM=/sdlbgi ./fern &
+ * ./bgipeek /sdlbgi 100 fern.bmp
+ *
+ * waits for 100 frames, printing their number and the visual page,
+ * then saves the last one to fern.bmp. POSIX systems only.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <graphics.h>
+
+// -----
+
+int main (int argc, char *argv[])
+{
+  int
+    fd,
+    frames = 1,
+    page;
+  struct stat
+    st;
+  const Uint8
+    *map;
+  const bgi_shm_header
+    *hdr;
+  Uint64
+    seq,
+    last;
+  Uint32
+    *frame;
+  SDL_Surface
+    *surface;
+
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s name [frames [file.bmp]]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 2)
+    frames = atoi (argv[2]);
+
+  fd = shm_open (argv[1], O_RDONLY, 0);
+  if (fd < 0 || 0 != fstat (fd, &st)) {
+    fprintf (stderr, "Can't open shared memory object %s.\n", argv[1]);
+    return 1;
+  }
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (MAP_FAILED == map) {
+    fprintf (stderr, "Can't map %s.\n", argv[1]);
+    return 1;
+  }
+
+  hdr = (const bgi_shm_header *) map;
+  while (BGI_SHM_MAGIC != hdr->magic)
+    SDL_Delay (1);
+  SDL_MemoryBarrierAcquire ();
+
+  printf ("%dx%d pixels, %d pages\n",
+          hdr->width, hdr->height, hdr->pages);
+
+  frame = malloc (hdr->height * hdr->stride * sizeof (Uint32));
+  last = hdr->sequence;
+
+  while (frames > 0) {
+    // wait for a present, then copy the page that was presented
+    seq = hdr->sequence;
+    if (seq == last) {
+      SDL_Delay (1);
+      continue;
+    }
+    SDL_MemoryBarrierAcquire ();
+    page = hdr->visual_page;
+    memcpy (frame, map + hdr->page_offset + page * hdr->page_bytes,
+            hdr->height * hdr->stride * sizeof (Uint32));
+    printf ("frame %llu, page %d\n", (unsigned long long) seq, page);
+    last = seq;
+    frames--;
+  }
+
+  if (argc > 3) {
+    surface = SDL_CreateRGBSurfaceFrom (frame, hdr->width, hdr->height,
+                                        32, hdr->stride * sizeof (Uint32),
+                                        0x00ff0000, 0x0000ff00,
+                                        0x000000ff, 0);
+    if (NULL == surface || 0 != SDL_SaveBMP (surface, argv[3]))
+      fprintf (stderr, "Can't save %s.\n", argv[3]);
+    SDL_FreeSurface (surface);
+  }
+
+  free (frame);
+  munmap ((void *) map, st.st_size);
+
+  return 0;
+
+} // main ()
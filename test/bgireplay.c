@@ -0,0 +1,116 @@
+/* bgireplay.c  -*- C -*-
+ *
+ * To compile:
+ * gcc -o bgireplay bgireplay.c -lSDL_bgi -lSDL2
+ *
+ * Replays a session recorded with SDL_BGI_RECORD as fast as
+ * possible, then prints the elapsed time and a CRC-32C checksum of
+ * each page. Record a session, then replay it:
+ *
+ * SDL_BGI_RECORD=session.bgi ./simple
+ * SDL_VIDEODRIVER=dummy ./bgireplay session.bgi
+ *
+ * Two library versions that print the same checksums for a session
+ * draw the same pixels.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <graphics.h>
+
+Uint32 crc_table[256];
+
+// -----
+
+void crc_init (void)
+{
+  // CRC-32C (Castagnoli), reflected polynomial
+
+  Uint32 crc;
+
+  for (int i = 0; i < 256; i++) {
+    crc = i;
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    crc_table[i] = crc;
+  }
+
+} // crc_init ()
+
+// -----
+
+Uint32 crc32c (const void *data, size_t len)
+{
+  const Uint8 *p = data;
+  Uint32 crc = 0xffffffff;
+
+  while (len--)
+    crc = (crc >> 8) ^ crc_table[(crc ^ *p++) & 0xff];
+
+  return crc ^ 0xffffffff;
+
+} // crc32c ()
+
+// -----
+
+int main (int argc, char *argv[])
+{
+  int
+    calls,
+    stride;
+  Uint32
+    *pixels;
+  Uint64
+    start;
+  double
+    ms;
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s record-file\n", argv[0]);
+    return 1;
+  }
+
+  crc_init ();
+
+  start = SDL_GetPerformanceCounter ();
+  calls = replayfile (argv[1]);
+  ms = 1000.0 * (SDL_GetPerformanceCounter () - start) /
+    SDL_GetPerformanceFrequency ();
+
+  if (calls < 0)
+    return 1;
+
+  printf ("%d calls in %.1f ms (%.0f calls/s)\n",
+          calls, ms, ms > 0 ? 1000.0 * calls / ms : 0.0);
+
+  // the recorded program may not have opened a window
+  if (-1 == getcurrentwindow ())
+    return 0;
+
+  for (int page = 0; page < VPAGES; page++) {
+    setactivepage (page);
+    pixels = lockframebuffer (&stride);
+    printf ("page %d: %08x\n", page,
+            crc32c (pixels, sizeof (Uint32) * stride * (getmaxy () + 1)));
+    unlockframebuffer (0, 0, -1, -1);
+  }
+
+  closegraph ();
+
+  return 0;
+
+} // main ()
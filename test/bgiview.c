@@ -0,0 +1,238 @@
+/* bgiview.c  -*- C -*-
+ *
+ * To compile:
+ * gcc -o bgiview bgiview.c -lSDL_bgi -lSDL2
+ *
+ * Shows the window of an SDL_bgi program running elsewhere on this
+ * machine, and sends it mouse and keyboard input. Start the program
+ * with a frame server, then connect:
+ *
+ * SDL_BGI_SERVE=/tmp/bgi.sock ./mousetest &
+ * ./bgiview /tmp/bgi.sock
+ *
+ * "tcp:port" instead of a socket name connects to 127.0.0.1:port.
+ * POSIX systems only.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <graphics.h>
+
+int server;
+
+// -----
+
+int read_all (void *buf, size_t len)
+{
+  // reads exactly len bytes; returns 0 if the server is gone
+
+  ssize_t got;
+
+  while (len > 0) {
+    got = read (server, buf, len);
+    if (got <= 0)
+      return 0;
+    buf = (char *) buf + got;
+    len -= got;
+  }
+
+  return 1;
+
+} // read_all ()
+
+// -----
+
+int read_words (Uint32 *words, int n)
+{
+  if (! read_all (words, n * sizeof (Uint32)))
+    return 0;
+  for (int i = 0; i < n; i++)
+    words[i] = SDL_SwapLE32 (words[i]);
+
+  return 1;
+
+} // read_words ()
+
+// -----
+
+void send_message (Uint32 type, Uint32 a, Uint32 b, Uint32 c)
+{
+  Uint32 msg[4];
+
+  msg[0] = SDL_SwapLE32 (type);
+  msg[1] = SDL_SwapLE32 (a);
+  msg[2] = SDL_SwapLE32 (b);
+  msg[3] = SDL_SwapLE32 (c);
+  if (write (server, msg, sizeof (msg)) < 0)
+    fprintf (stderr, "Can't send input.\n");
+
+} // send_message ()
+
+// -----
+
+int read_frame (void)
+{
+  // reads a BGI_MSG_FRAME message and draws it
+
+  Uint32
+    hdr[8],
+    last = 0,
+    *pixels,
+    *dest;
+  Uint8
+    *data,
+    *p;
+  int
+    stride,
+    op,
+    count;
+  long
+    i = 0;
+
+  if (! read_words (hdr, 8) || BGI_MSG_FRAME != hdr[0])
+    return 0;
+  // hdr: type sequence x y w h flags nbytes
+
+  data = malloc (hdr[7]);
+  if (NULL == data || ! read_all (data, hdr[7])) {
+    free (data);
+    return 0;
+  }
+
+  pixels = lockframebuffer (&stride);
+  for (p = data; p < data + hdr[7]; ) {
+    op = *p & 0xc0;
+    count = (*p++ & 0x3f) + 1;
+    while (count--) {
+      dest = pixels + (hdr[3] + i / hdr[4]) * stride + hdr[2] + i % hdr[4];
+      if (BGI_OP_RUN == op || BGI_OP_RAW == op) {
+        memcpy (&last, p, sizeof (last));
+        last = SDL_SwapLE32 (last);
+        if (BGI_OP_RAW == op)
+          p += sizeof (last);
+      }
+      if (BGI_OP_SKIP != op)
+        *dest = last;
+      i++;
+    }
+    if (BGI_OP_RUN == op)
+      p += sizeof (last);
+  }
+  unlockframebuffer (hdr[2], hdr[3],
+                     hdr[2] + hdr[4] - 1, hdr[3] + hdr[5] - 1);
+
+  free (data);
+
+  return 1;
+
+} // read_frame ()
+
+// -----
+
+int main (int argc, char *argv[])
+{
+  struct sockaddr_un addr_un;
+  struct sockaddr_in addr_in;
+  struct pollfd pfd;
+  Uint32 hello[3];
+  SDL_Event event;
+  int stop = 0;
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s socket | tcp:port\n", argv[0]);
+    return 1;
+  }
+
+  if (0 == strncmp (argv[1], "tcp:", 4)) {
+    memset (&addr_in, 0, sizeof (addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_port = htons (atoi (argv[1] + 4));
+    addr_in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    server = socket (AF_INET, SOCK_STREAM, 0);
+    if (connect (server, (struct sockaddr *) &addr_in,
+                 sizeof (addr_in)) < 0)
+      server = -1;
+  }
+  else {
+    memset (&addr_un, 0, sizeof (addr_un));
+    addr_un.sun_family = AF_UNIX;
+    strncpy (addr_un.sun_path, argv[1], sizeof (addr_un.sun_path) - 1);
+    server = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (connect (server, (struct sockaddr *) &addr_un,
+                 sizeof (addr_un)) < 0)
+      server = -1;
+  }
+  if (server < 0 || ! read_words (hello, 3) || BGI_MSG_HELLO != hello[0]) {
+    fprintf (stderr, "Can't connect to %s.\n", argv[1]);
+    return 1;
+  }
+
+  setwinoptions ("SDL_bgi viewer", -1, -1, -1);
+  initwindow (hello[1], hello[2]);
+  sdlbgifast ();
+
+  pfd.fd = server;
+  pfd.events = POLLIN;
+
+  while (! stop) {
+
+    if (poll (&pfd, 1, 10) > 0 && ! read_frame ())
+      break;
+
+    while (SDL_PollEvent (&event))
+      switch (event.type) {
+
+      case SDL_QUIT:
+        stop = 1;
+        break;
+
+      case SDL_MOUSEMOTION:
+        send_message (BGI_MSG_MOTION, event.motion.x, event.motion.y, 0);
+        break;
+
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP:
+        send_message (SDL_MOUSEBUTTONDOWN == event.type ?
+                      BGI_MSG_BUTTONDOWN : BGI_MSG_BUTTONUP,
+                      event.button.x, event.button.y,
+                      event.button.button);
+        break;
+
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+        send_message (SDL_KEYDOWN == event.type ?
+                      BGI_MSG_KEYDOWN : BGI_MSG_KEYUP,
+                      event.key.keysym.sym, 0, 0);
+        break;
+
+      default:
+        ;
+      }
+  }
+
+  close (server);
+  closegraph ();
+
+  return 0;
+
+} // main ()